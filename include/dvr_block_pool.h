@@ -0,0 +1,55 @@
+#ifndef _DVR_BLOCK_POOL_H_
+#define _DVR_BLOCK_POOL_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Block pool
+ * Data buffers of the record and playback threads are mapped outside of
+ * the heap, and freed blocks are cached for the next session instead of
+ * being unmapped. Blocks of 2MB or more are aligned for transparent huge
+ * pages. A session keeps its blocks in a DVR_BlockReserve_t, so they are
+ * reused when its thread is restarted.
+ */
+
+#define DVR_BLOCK_POOL_CACHE_PROP     "vendor.tv.libdvr.poolcache"   /**< Property of the maximum cached size in KB, read at the first free*/
+#define DVR_BLOCK_POOL_CACHE_DEFAULT  (4 * 1024)                     /**< Default maximum cached size in KB*/
+
+/**\brief Block reserved by a session*/
+typedef struct {
+  void           *block;        /**< The block, NULL if none*/
+  size_t          size;         /**< Usable size of the block*/
+} DVR_BlockReserve_t;
+
+/**\brief Get a block from the pool
+ * \param[in] size, Minimum size of the block
+ * \return The page aligned block, NULL on failure
+ */
+void *dvr_block_pool_alloc(size_t size);
+
+/**\brief Return a block to the pool
+ * \param[in] block, The block got from dvr_block_pool_alloc, may be NULL
+ */
+void dvr_block_pool_free(void *block);
+
+/**\brief Get the reserved block of a session, replace it if it is too small
+ * \param[in] res, The reservation
+ * \param[in] size, Minimum size of the block
+ * \return The block, NULL on failure
+ */
+void *dvr_block_pool_reserve(DVR_BlockReserve_t *res, size_t size);
+
+/**\brief Return the reserved block of a session to the pool
+ * \param[in] res, The reservation
+ */
+void dvr_block_pool_release(DVR_BlockReserve_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_DVR_BLOCK_POOL_H_*/
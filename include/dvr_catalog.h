@@ -0,0 +1,97 @@
+#ifndef _DVR_CATALOG_H_
+#define _DVR_CATALOG_H_
+
+#include "dvr_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Recording catalog
+ * Each directory holding recordings has one catalog file, with the totals,
+ * the segment list and the pids of all its recordings. Updates are appended
+ * as small binary records, and the file is rewritten without the outdated
+ * records when they outnumber the live ones. The catalog is parsed once and
+ * kept in memory, later lookups only parse what was appended since, so a
+ * library is listed without opening the files of each recording.
+ */
+
+#define DVR_CATALOG_FILE          ".dvr_catalog"                 /**< Name of the catalog file in a recording directory*/
+#define DVR_CATALOG_PROP          "vendor.tv.libdvr.catalog"     /**< Property, 0 disables the catalog*/
+
+#define DVR_CATALOG_HAS_STATS     (1 << 0)                       /**< The totals of the entry are set*/
+#define DVR_CATALOG_HAS_SEGMENTS  (1 << 1)                       /**< The segments and pids of the entry are set*/
+
+/**\brief Catalog entry of a recording*/
+typedef struct {
+  char              name[DVR_MAX_LOCATION_SIZE];                 /**< File name of the recording, without its directory*/
+  uint32_t          flags;                                       /**< DVR_CATALOG_HAS_xxx*/
+  uint64_t          size;                                        /**< Total size in bytes*/
+  time_t            time;                                        /**< Total duration in ms*/
+  uint32_t          pkts;                                        /**< Total number of packets*/
+  uint32_t          nb_segments;                                 /**< Number of segments*/
+  uint32_t          nb_pids;                                     /**< Number of pids*/
+  DVR_StreamPid_t   pids[DVR_MAX_RECORD_PIDS_COUNT];             /**< Pids of the last segment*/
+} DVR_CatalogEntry_t;
+
+/**\brief Set the totals of a recording
+ * \param[in] location The record file's location
+ * \param[in] size Total size in bytes
+ * \param[in] time Total duration in ms
+ * \param[in] pkts Total number of packets
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_catalog_set_stats(const char *location, uint64_t size, time_t time, uint32_t pkts);
+
+/**\brief Set the segment list and pids of a recording
+ * \param[in] location The record file's location
+ * \param[in] nb_segments Number of segments
+ * \param[in] p_segment_ids The segments index, oldest first
+ * \param[in] nb_pids Number of pids
+ * \param[in] p_pids The pids of the last segment
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_catalog_set_segments(const char *location, uint32_t nb_segments, const uint64_t *p_segment_ids,
+    uint32_t nb_pids, const DVR_StreamPid_t *p_pids);
+
+/**\brief Remove a recording from the catalog
+ * \param[in] location The record file's location
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_catalog_remove(const char *location);
+
+/**\brief Get the catalog entry of a recording
+ * \param[in] location The record file's location
+ * \param[out] p_entry Return the entry
+ * \return DVR_SUCCESS On success
+ * \return Error code if the recording is not in the catalog
+ */
+int dvr_catalog_get(const char *location, DVR_CatalogEntry_t *p_entry);
+
+/**\brief Get the segment list of a recording from the catalog
+ * \param[in] location The record file's location
+ * \param[out] p_segment_nb Return the segments number
+ * \param[out] pp_segment_ids Return the segments index, to be freed with free()
+ * \return DVR_SUCCESS On success
+ * \return Error code if the segments of the recording are not in the catalog
+ */
+int dvr_catalog_get_segments(const char *location, uint32_t *p_segment_nb, uint64_t **pp_segment_ids);
+
+/**\brief Get the entries of all the recordings of a directory
+ * \param[in] dir The directory
+ * \param[out] p_entry_nb Return the entries number
+ * \param[out] pp_entries Return the entries, to be freed with free()
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_catalog_list(const char *dir, uint32_t *p_entry_nb, DVR_CatalogEntry_t **pp_entries);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_DVR_CATALOG_H_*/
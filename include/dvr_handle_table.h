@@ -0,0 +1,102 @@
+#ifndef _DVR_HANDLE_TABLE_H_
+#define _DVR_HANDLE_TABLE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Handle table
+ * Maps session handles onto dynamically allocated contexts. A handle holds
+ * the slot index in its low bits and the generation of the slot in the
+ * others, so a handle is validated in O(1) and a handle kept after its
+ * session is closed is rejected even if the slot is reused.
+ * A context got from the table is referenced until it is put back, and
+ * removing it waits for these references, so a context is only freed once
+ * no other thread uses it.
+ */
+
+#define DVR_HANDLE_TABLE_INDEX_BITS   (10)                                    /**< Bits of the slot index in a handle*/
+#define DVR_HANDLE_TABLE_MAX          (1 << DVR_HANDLE_TABLE_INDEX_BITS)      /**< Maximum number of slots*/
+#define DVR_HANDLE_TABLE_DEFAULT      (16)                                    /**< Default number of slots*/
+#define DVR_HANDLE_TABLE_PROP         "vendor.tv.libdvr.sessions"             /**< Property overriding the default number of slots*/
+
+/**\brief Handle table*/
+typedef struct {
+  pthread_mutex_t lock;           /**< Protects the table*/
+  pthread_cond_t  cond;           /**< Signaled when the last reference of a slot is put*/
+  int             limit;          /**< Maximum number of slots, 0 until the table is used*/
+  int             size;           /**< Number of allocated slots*/
+  int             count;          /**< Number of used slots*/
+  void          **objs;           /**< Context of each slot, NULL if free*/
+  uint32_t       *gens;           /**< Generation of each slot*/
+  int            *refs;           /**< References of each slot, a slot is not reused while referenced*/
+} DVR_HandleTable_t;
+
+/**\brief Static initializer of a handle table*/
+#define DVR_HANDLE_TABLE_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL, NULL, NULL}
+
+/**\brief Set the maximum number of slots of a table
+ * Slots already in use above the new limit stay valid until removed.
+ * \param[in] table, The handle table
+ * \param[in] limit, Maximum number of slots, 1 to DVR_HANDLE_TABLE_MAX
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_handle_table_set_limit(DVR_HandleTable_t *table, int limit);
+
+/**\brief Add a context to a table
+ * \param[in] table, The handle table
+ * \param[in] obj, The context
+ * \param[out] p_handle, Return the handle of the context
+ * \param[out] p_index, Return the slot index of the context, may be NULL
+ * \return DVR_SUCCESS On success
+ * \return Error code if the table is full
+ */
+int dvr_handle_table_add(DVR_HandleTable_t *table, void *obj, void **p_handle, int *p_index);
+
+/**\brief Get and reference the context of a handle
+ * \param[in] table, The handle table
+ * \param[in] handle, The handle
+ * \return The context, to be put with dvr_handle_table_put, NULL if the handle is not valid
+ */
+void *dvr_handle_table_get(DVR_HandleTable_t *table, void *handle);
+
+/**\brief Put a context got with dvr_handle_table_get or dvr_handle_table_at
+ * \param[in] table, The handle table
+ * \param[in] handle, The handle of the context
+ */
+void dvr_handle_table_put(DVR_HandleTable_t *table, void *handle);
+
+/**\brief Remove a context from a table, its handle becomes invalid
+ * The context can not be got anymore, and the call returns once all its
+ * references are put. The caller must not hold a reference. Only one
+ * caller removes a handle, it is the one to free the context.
+ * \param[in] table, The handle table
+ * \param[in] handle, The handle
+ * \return DVR_SUCCESS On success
+ * \return Error code if the handle is not valid or already removed
+ */
+int dvr_handle_table_remove(DVR_HandleTable_t *table, void *handle);
+
+/**\brief Get and reference the context in a slot, to walk all the contexts of a table
+ * \param[in] table, The handle table
+ * \param[in] index, The slot index, 0 to dvr_handle_table_size - 1
+ * \return The context, to be put with dvr_handle_table_put, NULL if the slot is free or out of the table
+ */
+void *dvr_handle_table_at(DVR_HandleTable_t *table, int index);
+
+/**\brief Get the number of slots of a table, to walk all the contexts of a table
+ * \param[in] table, The handle table
+ * \return The number of allocated slots
+ */
+int dvr_handle_table_size(DVR_HandleTable_t *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_DVR_HANDLE_TABLE_H_*/
@@ -12,6 +12,7 @@
 #include "dvr_types.h"
 #include "dvr_crypto.h"
 #include "dvr_mutex.h"
+#include "dvr_block_pool.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -168,6 +169,39 @@ typedef struct
   DVR_PlaybackSegmentFlag_t flags; /**< playback played segment flag */
 } DVR_PlaybackStatus_t;
 
+/**\brief Number of log2 buckets of a playback histogram*/
+#define DVR_PLAYBACK_STATS_BUCKETS  (24)
+
+/**\brief Timed stages of the playback thread*/
+typedef enum
+{
+  DVR_PLAYBACK_STAGE_READ,        /**< Read data from the segment*/
+  DVR_PLAYBACK_STAGE_DECRYPT,     /**< Decrypt data, only with a decrypt callback or cryptor*/
+  DVR_PLAYBACK_STAGE_WRITE,       /**< Write data to the TS player*/
+  DVR_PLAYBACK_STAGE_MAX
+} DVR_PlaybackStage_t;
+
+/**\brief Playback histogram*/
+typedef struct
+{
+  uint32_t count;                                 /**< Number of samples*/
+  uint32_t max;                                   /**< Largest sample*/
+  uint64_t total;                                 /**< Sum of the samples*/
+  uint32_t buckets[DVR_PLAYBACK_STATS_BUCKETS];   /**< buckets[n] counts the samples in [2^(n-1), 2^n), the last bucket also counts the larger ones*/
+} DVR_PlaybackHistogram_t;
+
+/**\brief Playback statistics, since the playback was opened*/
+typedef struct
+{
+  DVR_PlaybackHistogram_t stages[DVR_PLAYBACK_STAGE_MAX]; /**< Duration of each stage in us*/
+  DVR_PlaybackHistogram_t cache;        /**< TS player cache depth in ms, sampled each time it is checked*/
+  uint32_t write_timeouts;              /**< Number of writes which timed out and were retried*/
+  uint32_t block_waits;                 /**< Number of waits for a whole block to be recorded*/
+  uint32_t end_waits;                   /**< Number of waits at the end of the data*/
+  uint32_t read_errors;                 /**< Number of segment read errors*/
+  uint64_t bytes;                       /**< Number of bytes written to the TS player*/
+} DVR_PlaybackStats_t;
+
 /**\brief DVR playback vendor*/
 typedef enum {
   DVR_PLAYBACK_VENDOR_DEF,                    /**< default, for Irdeto*/
@@ -390,6 +424,17 @@ typedef struct
 
   /**< 1: system clock, 0: libdvr can determine index time source based on actual situation*/
   DVR_Bool_t                 control_speed_enable;
+
+  DVR_Bool_t                 iframe_trick;     /**< FF/FB feeds the decoder with I-frames read through the I-frame index*/
+  Segment_IFrame_t           iframe_last;      /**< Last I-frame fed in I-frame trick play*/
+  uint64_t                   iframe_last_id;   /**< Segment id of iframe_last*/
+  DVR_BlockReserve_t         iframe_buf;       /**< I-frame trick play buffer, allocated on first use*/
+  DVR_BlockReserve_t         thread_buf;       /**< Playback thread read buffer*/
+  DVR_BlockReserve_t         dec_buf;          /**< Playback thread decrypt buffer*/
+
+  pthread_mutex_t            stats_lock;       /**< Protects stats*/
+  DVR_PlaybackStats_t        stats;            /**< Playback thread statistics*/
+  uint32_t                   segment_gen;      /**< Bumped with segment_lock held when segment_handle is closed, a mapped view of an older generation is gone*/
 } DVR_Playback_t;
 /**\endcond*/
 
@@ -555,6 +600,14 @@ int dvr_playback_set_speed(DVR_PlaybackHandle_t handle, DVR_PlaybackSpeed_t spee
  */
 int dvr_playback_get_status(DVR_PlaybackHandle_t handle, DVR_PlaybackStatus_t *p_status);
 
+/**\brief Get playback statistics
+ * \param[in] handle playback handle
+ * \param[out] p_stats playback statistics
+ * \retval DVR_SUCCESS On success
+ * \return Error code
+ */
+int dvr_playback_get_stats(DVR_PlaybackHandle_t handle, DVR_PlaybackStats_t *p_stats);
+
 /**\brief Get playback capabilities
  * \param[out] p_capability playback capability
  * \retval DVR_SUCCESS On success
@@ -0,0 +1,64 @@
+#ifndef _DVR_REACTOR_H_
+#define _DVR_REACTOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * I/O reactor
+ * One epoll instance, shared by the whole library, and a small pool of
+ * worker threads service many file descriptors. A source is armed one shot:
+ * when its fd is readable, one worker calls its function and then rearms it,
+ * so the function of a source never runs twice at the same time. The
+ * reactor is disabled unless DVR_REACTOR_PROP is set.
+ */
+
+#define DVR_REACTOR_PROP          "vendor.tv.libdvr.reactor"   /**< Property of the number of worker threads, 0 disables the reactor*/
+#define DVR_REACTOR_MAX_WORKERS   (8)                          /**< Maximum number of worker threads*/
+
+/**\brief Reactor source handle*/
+typedef void* DVR_ReactorHandle_t;
+
+/**\brief Function called by a worker when the source is readable or kicked
+ * \param[in] userdata, The userdata of the source
+ * \return DVR_SUCCESS to be called again, Error code to stop listening to the fd
+ */
+typedef int (*DVR_ReactorFunction_t)(void *userdata);
+
+/**\brief Get the number of worker threads, started on first use
+ * \return The number of workers, 0 if the reactor is disabled
+ */
+int dvr_reactor_get_workers(void);
+
+/**\brief Add a source to the reactor
+ * \param[in] fd, The fd to wait for, it must be non-blocking
+ * \param[in] fn, The function called when the fd is readable
+ * \param[in] userdata, The userdata of the function
+ * \param[out] p_handle, Return the handle of the source
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure, or if the reactor is disabled
+ */
+int dvr_reactor_add(int fd, DVR_ReactorFunction_t fn, void *userdata, DVR_ReactorHandle_t *p_handle);
+
+/**\brief Call the function of a source as soon as possible, even if its fd is not readable
+ * \param[in] handle, The source handle
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_reactor_kick(DVR_ReactorHandle_t handle);
+
+/**\brief Remove a source from the reactor
+ * Waits for its function to return if it is running, so it must not be
+ * called from the function itself.
+ * \param[in] handle, The source handle
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_reactor_remove(DVR_ReactorHandle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_DVR_REACTOR_H_*/
@@ -36,8 +36,9 @@ typedef enum
 /**\brief DVR record flag*/
 typedef enum {
   DVR_RECORD_FLAG_SCRAMBLED = (1 << 0),
-  DVR_RECORD_FLAG_ACCURATE  = (1 << 1),
+  DVR_RECORD_FLAG_ACCURATE  = (1 << 1),   /**< Build an I-frame index of each segment for frame accurate seeking and trick play*/
   DVR_RECORD_FLAG_DATAOUT   = (1 << 2),
+  DVR_RECORD_FLAG_DIRECTIO  = (1 << 3),   /**< Write TS files with O_DIRECT, bypassing the page cache*/
 } DVR_RecordFlag_t;
 
 /**\brief DVR crypto parity flag*/
@@ -97,6 +98,8 @@ typedef struct {
   int                         notification_time;  /**< DVR record notification time, record module would send a notification when the size of current segment is multiple of this value. Put 0 in this argument if you don't want to receive the notification*/
   DVR_Bool_t                  force_sysclock;     /**< If ture, force to use system clock as PVR index time source. If false, libdvr can determine index time source based on actual situation*/
   loff_t                      guarded_segment_size;   /**< Guarded segment size in bytes. Libdvr will be forcely stopped to write anymore if current segment reaches this size*/
+  loff_t                      segment_size;       /**< Expected segment size in bytes, used to preallocate segment files. Put 0 if unknown*/
+  loff_t                      ring_size;          /**< If > 0, store all segments in one preallocated ring file of this size. Used for timeshift*/
 } DVR_RecordOpenParams_t;
 
 /**\brief DVR record segment start parameters*/
@@ -120,12 +123,64 @@ typedef struct {
   DVR_RecordSegmentInfo_t info;                                   /**< DVR record segment information*/
 } DVR_RecordStatus_t;
 
+/**\brief dvr_record_ioctl command, get the record statistics. data: DVR_RecordStats_t*, size: sizeof(DVR_RecordStats_t)*/
+#define DVR_RECORD_CMD_GET_STATS    (0x2001)
+/**\brief dvr_record_ioctl command, clear the record statistics. data: NULL, size: 0*/
+#define DVR_RECORD_CMD_RESET_STATS  (0x2002)
+
+/**\brief Number of latency buckets. Bucket 0 counts latencies under 1us, bucket n counts [2^(n-1), 2^n) us, the last bucket also counts all longer ones*/
+#define DVR_RECORD_STATS_BUCKETS    (24)
+
+/**\brief DVR record loop stage*/
+typedef enum {
+  DVR_RECORD_STAGE_READ,                                          /**< Read a block from the device, including the wait for data*/
+  DVR_RECORD_STAGE_ENCRYPT,                                       /**< Encrypt the block, only counted for encrypted records*/
+  DVR_RECORD_STAGE_WRITE,                                         /**< Write the block to the segment*/
+  DVR_RECORD_STAGE_INDEX,                                         /**< PCR and I-frame indexing*/
+  DVR_RECORD_STAGE_STORE,                                         /**< Update and store the segment information*/
+  DVR_RECORD_STAGE_NOTIFY,                                        /**< Send the status event*/
+  DVR_RECORD_STAGE_MAX                                            /**< Number of stages*/
+} DVR_RecordStage_t;
+
+/**\brief DVR record stage latency histogram*/
+typedef struct {
+  uint32_t count;                                                 /**< Number of samples*/
+  uint32_t max_us;                                                /**< Max latency in us*/
+  uint64_t total_us;                                              /**< Sum of latencies in us*/
+  uint32_t buckets[DVR_RECORD_STATS_BUCKETS];                     /**< Log2 latency buckets*/
+} DVR_RecordStageStats_t;
+
+/**\brief DVR record segment write-behind statistics, see the property vendor.tv.libdvr.wbqueue*/
+typedef struct {
+  int      queue_size;                                            /**< Number of blocks of the queue, 0 if write-behind is off*/
+  int      high_water;                                            /**< Max number of queued blocks*/
+  uint32_t full_count;                                            /**< Times a write waited for a free block*/
+  uint32_t max_write_ms;                                          /**< Max write() latency in ms*/
+  int64_t  pending;                                               /**< Bytes queued, not written to the file yet*/
+} DVR_RecordWriteStats_t;
+
+/**\brief DVR record statistics, collected since the record is opened or the statistics are reset*/
+typedef struct {
+  DVR_RecordStageStats_t stages[DVR_RECORD_STAGE_MAX];            /**< Latency of each record loop stage*/
+  uint64_t bytes;                                                 /**< Bytes read from the device*/
+  DVR_RecordWriteStats_t write;                                   /**< Write-behind queue of the current segment, updated with the segment information*/
+} DVR_RecordStats_t;
+
 /**\brief DVR record start parameters*/
 typedef struct {
   char location[DVR_MAX_LOCATION_SIZE];                           /**< DVR record file location*/
   DVR_RecordSegmentStartParams_t segment;                         /**< DVR record segment start parameters*/
 } DVR_RecordStartParams_t;
 
+/**\brief Set the maximum number of recording sessions
+ * The default is 16, or the value of the property vendor.tv.libdvr.sessions.
+ * Sessions already open above the new limit are not affected.
+ * \param[in] count Maximum number of sessions, 1 to 1024
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int dvr_record_set_max_sessions(int count);
+
 /**\brief Open a recording session for a target giving some open parameters
  * \param[out] p_handle Return the handle of the newly created dvr session
  * \param[in] params Open parameters
@@ -250,6 +305,14 @@ int dvr_record_discard_coming_data(DVR_RecordHandle_t handle, DVR_Bool_t discard
  */
 int dvr_record_ioctl(DVR_RecordHandle_t handle, unsigned int cmd, void *data, size_t size);
 
+/**\brief Get the record loop statistics
+ * \param[in] handle, DVR recording session handle
+ * \param[out] p_stats, Return the statistics
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int dvr_record_get_stats(DVR_RecordHandle_t handle, DVR_RecordStats_t *p_stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -35,6 +35,27 @@ int dvr_segment_delete(const char *location, uint64_t segment_id);
  */
 int dvr_segment_get_list(const char *location, uint32_t *p_segment_nb, uint64_t **pp_segment_ids);
 
+#define DVR_SEGMENT_ENUM_SIZE   (1 << 0)  /**< dvr_segment_enum returns the size of the TS files*/
+
+/**\brief Segment entry returned by dvr_segment_enum*/
+typedef struct {
+  uint64_t          id;                                   /**< Segment id*/
+  uint64_t          size;                                 /**< TS file size in bytes, 0 if not asked or unknown*/
+} DVR_SegmentEntry_t;
+
+/**\brief Get the segments of a record file in one pass
+ * The ids are read from the list file in its order if it exists. Otherwise
+ * the directory is scanned for the TS files of the record, and their ids
+ * are sorted.
+ * \param[in] location The record file's location
+ * \param[in] flags DVR_SEGMENT_ENUM_SIZE to get the size of the TS files
+ * \param[out] p_segment_nb Return the segments number
+ * \param[out] pp_entries Return the segments, to be freed with free()
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int dvr_segment_enum(const char *location, int flags, uint32_t *p_segment_nb, DVR_SegmentEntry_t **pp_entries);
+
 /**\brief Del all info of segment whose location is "*location"
  * \param[in] location The record of need del file's location
  * \return DVR_SUCCESS On success
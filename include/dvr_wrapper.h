@@ -121,6 +121,17 @@ typedef struct {
   DVR_Bool_t              control_speed_enable;            /**< 1: system clock, 0: libdvr can determine index time source based on actual situation*/
 } DVR_WrapperPlaybackOpenParams_t;
 
+/**
+ * Set the maximum number of record and playback sessions.
+ * Call it before opening sessions, the default is 16, or the value of
+ * the property vendor.tv.libdvr.sessions. A timeshift uses one record and
+ * one playback session.
+ * \param count Maximum number of sessions of each kind, 1 to 1024.
+ * \retval DVR_SUCCESS On success.
+ * \return Error code.
+ */
+int dvr_wrapper_set_max_sessions (int count);
+
 /**
  * Open a new record wrapper.
  * \param[out] rec Return the new record handle.
@@ -304,6 +315,15 @@ int dvr_wrapper_seek_playback (DVR_WrapperPlayback_t playback, uint32_t time_off
  */
 int dvr_wrapper_get_playback_status (DVR_WrapperPlayback_t playback, DVR_WrapperPlaybackStatus_t *status);
 
+/**
+ * Get the playback thread statistics.
+ * \param playback The playback handle.
+ * \param stats The playback statistics returned.
+ * \retval DVR_SUCCESS On success.
+ * \return Error code.
+ */
+int dvr_wrapper_get_playback_stats (DVR_WrapperPlayback_t playback, DVR_PlaybackStats_t *stats);
+
 /**
  * Update playback.
  * \param playback The playback handle.
@@ -415,7 +435,7 @@ int dvr_wrapper_property_get(const char* prop_name, char* prop_value, int length
 /**
  * Control the internal recording logic
  * \param rec The record handle.
- * \param cmd control command
+ * \param cmd control command, DVR_RECORD_CMD_XXX or a segment command
  * \param data control data
  * \param size size of the control data
  * \retval DVR_SUCCESS On success.
@@ -16,6 +16,43 @@ typedef struct Record_DeviceOpenParams_t_s {
   uint32_t    ringbuf_size;     /**< dvr record ring buffer size*/
 } Record_DeviceOpenParams_t;
 
+/**
+ * Record device backend
+ * A backend feeds the record pipeline from another source than the demux
+ * device, so recording runs without the hardware. The device keeps its
+ * handle and state, and forwards the calls to the backend. The secure
+ * demux is not supported by backends, and a NULL splice makes the record
+ * fall back to read.
+ */
+typedef struct Record_DeviceBackend_s {
+  const char *name;                                                         /**< Backend name*/
+  int (*open)(void **p_priv, Record_DeviceOpenParams_t *params);            /**< Open the source, return its context in p_priv*/
+  int (*close)(void *priv);                                                 /**< Close the source*/
+  int (*add_pid)(void *priv, int pid);                                      /**< Add a pid to the output*/
+  int (*remove_pid)(void *priv, int pid);                                   /**< Remove a pid from the output*/
+  int (*start)(void *priv);                                                 /**< Start the source*/
+  int (*stop)(void *priv);                                                  /**< Stop the source, wake up a waiting read*/
+  int (*read)(void *priv, void *buf, size_t len, int timeout);              /**< Read TS packets of the added pids, DVR_FAILURE if none*/
+  int (*splice)(void *priv, int pipe_fd, size_t len, int timeout);          /**< Move data into a pipe, may be NULL*/
+} Record_DeviceBackend_t;
+
+#define RECORD_DEVICE_SECURE_BATCH_PROP "vendor.tv.libdvr.secbatch"      /**< Property, 1 batches the secure demux processing of the recordings sharing a sid*/
+#define RECORD_DEVICE_REPLAY_PROP       "vendor.tv.libdvr.replay"        /**< Property of the TS file or pipe replayed instead of the demux*/
+#define RECORD_DEVICE_REPLAY_PACE_PROP  "vendor.tv.libdvr.replay.pace"   /**< Property, 1 replays at the PCR bitrate (default), 0 as fast as possible*/
+#define RECORD_DEVICE_REPLAY_LOOP_PROP  "vendor.tv.libdvr.replay.loop"   /**< Property, 1 rewinds the file at its end*/
+
+/**\brief Backend replaying a TS file or pipe, see RECORD_DEVICE_REPLAY_PROP*/
+extern const Record_DeviceBackend_t record_device_replay_backend;
+
+/**\brief Set the backend of the record devices opened next
+ * If no backend is set, the replay backend is used when RECORD_DEVICE_REPLAY_PROP
+ * is set, and the demux device otherwise.
+ * \param[in] backend, The backend, NULL for the default
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int record_device_set_backend(const Record_DeviceBackend_t *backend);
+
 /**\brief Open a DVR record device
  * \param[out] p_handle, DVR device handle
  * \param[in] params, DVR device open parameters
@@ -62,6 +99,9 @@ int record_device_start(Record_DeviceHandle_t handle);
 int record_device_stop(Record_DeviceHandle_t handle);
 
 /**\brief Read data from the DVR record device
+ * The device is not locked while reading, so pids can be changed and the
+ * device stopped meanwhile. Stop wakes up a waiting read. The device must
+ * not be closed until the read returns.
  * \param[in] handle, DVR device handle
  * \param[out] buf, the data buffer
  * \param[in] len, the data length
@@ -71,6 +111,23 @@ int record_device_stop(Record_DeviceHandle_t handle);
  */
 int record_device_read(Record_DeviceHandle_t handle, void *buf, size_t len, int timeout);
 
+/**\brief Move data from the DVR record device into a pipe without copying it
+ * \param[in] handle, DVR device handle
+ * \param[in] pipe_fd, Write end of the pipe
+ * \param[in] len, the data length
+ * \param[in] timeout, unit on ms
+ * \return The actual length on Success
+ * \return Error code On failure, errno is EINVAL if the driver can not splice
+ */
+int record_device_splice(Record_DeviceHandle_t handle, int pipe_fd, size_t len, int timeout);
+
+/**\brief Get the fd to wait for before reading the DVR record device
+ * The fd is non-blocking and does not change until the device is closed.
+ * \param[in] handle, DVR device handle
+ * \return The fd, -1 if the device has no pollable fd, e.g. with a backend
+ */
+int record_device_get_fd(Record_DeviceHandle_t handle);
+
 /**\brief Configure secure buffer for the given record device
  * \param[in] handle, DVR device handle
  * \param[out] sec_buf, secure buffer address
@@ -80,6 +137,13 @@ int record_device_read(Record_DeviceHandle_t handle, void *buf, size_t len, int
  */
 int record_device_set_secure_buffer(Record_DeviceHandle_t handle, uint8_t *sec_buf, uint32_t len);
 
+/**\brief Set the maximum number of opened record devices
+ * \param[in] count, Maximum number of devices
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int record_device_set_max_count(int count);
+
 #ifdef __cplusplus
 }
 #endif
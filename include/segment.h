@@ -37,6 +37,27 @@ int segment_close(Segment_Handle_t handle);
  */
 ssize_t segment_read(Segment_Handle_t handle, void *buf, size_t count);
 
+/**\brief Get a view of the next data of the giving segment without copying it.
+ * The view is a mapping of the TS file and stays valid until the next call or segment_close.
+ * Only available in read mode when vendor.tv.libdvr.mmap is set.
+ * \param[in] handle, Segment handle
+ * \param[out] p_buf, Return the start of the data
+ * \param[in] count, The max data count
+ * \return The number of bytes in the view on success, 0 at end of file
+ * \return error code on failure or if mmap read is not enabled, use segment_read then
+ */
+ssize_t segment_read_view(Segment_Handle_t handle, void **p_buf, size_t count);
+
+/**\brief Read data at an offset of the giving segment, the read position is not changed
+ * \param[in] handle, Segment handle
+ * \param[out] buf, The buffer of data
+ * \param[in] count, The data count
+ * \param[in] offset, Offset in the segment
+ * \return The number of bytes read on success
+ * \return error code on failure
+ */
+ssize_t segment_pread(Segment_Handle_t handle, void *buf, size_t count, loff_t offset);
+
 /**\brief Write data from the giving segment
  * \param[in] buf, The buffer of data
  * \param[in] handle, Segment handle
@@ -46,6 +67,15 @@ ssize_t segment_read(Segment_Handle_t handle, void *buf, size_t count);
  */
 ssize_t segment_write(Segment_Handle_t handle, void *buf, size_t count);
 
+/**\brief Move data from a pipe to the giving segment without copying it
+ * \param[in] handle, Segment handle
+ * \param[in] pipe_fd, Read end of the pipe holding the data
+ * \param[in] count, The data count
+ * \return The number of bytes moved on success
+ * \return error code on failure, errno is ENOTSUP if the segment can not splice
+ */
+ssize_t segment_splice(Segment_Handle_t handle, int pipe_fd, size_t count);
+
 /**\brief force Update the pts and offset when record
  * \param[in] handle, Segment handle
  * \param[in] pts, Current pts
@@ -65,6 +95,26 @@ int segment_update_pts_force(Segment_Handle_t handle, uint64_t pts, loff_t offse
  */
 int segment_update_pts(Segment_Handle_t handle, uint64_t pts, loff_t offset);
 
+/**\brief Add an I-frame to the I-frame index when record
+ * \param[in] handle, Segment handle
+ * \param[in] pts, PTS of the frame, 90KHz
+ * \param[in] offset, Segment offset of the frame
+ * \param[in] size, Size of the frame's data in bytes, 0 if unknown
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int segment_update_iframe(Segment_Handle_t handle, uint64_t pts, loff_t offset, uint32_t size);
+
+/**\brief Find an I-frame next to an offset in the I-frame index
+ * \param[in] handle, Segment handle
+ * \param[in] offset, Segment offset
+ * \param[in] dir, >= 0 to find the first I-frame at or after offset, < 0 to find the last I-frame before offset
+ * \param[out] p_frame, Return the I-frame
+ * \return DVR_SUCCESS on success
+ * \return error code if there is no such I-frame or no I-frame index
+ */
+int segment_find_iframe(Segment_Handle_t handle, loff_t offset, int dir, Segment_IFrame_t *p_frame);
+
 /**\brief Seek the segment to the correct position which match the giving time
  * \param[in] handle, Segment handle
  * \param[in] time, The time offset
@@ -160,6 +210,15 @@ off_t segment_get_cur_segment_size(Segment_Handle_t handle);
  */
 uint64_t segment_get_cur_segment_id(Segment_Handle_t handle);
 
+/**\brief Get the write-behind queue statistics
+ * The queue is off unless vendor.tv.libdvr.wbqueue is set to its number of blocks.
+ * \param[in] handle, The segment handle
+ * \param[out] p_stats, Return the statistics
+ * \return DVR_SUCCESS On success
+ * \return Error code On failure
+ */
+int segment_get_write_stats(Segment_Handle_t handle, Segment_WriteStats_t *p_stats);
+
 
 #ifdef __cplusplus
 }
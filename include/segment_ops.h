@@ -28,8 +28,29 @@ typedef struct Segment_OpenParams_s {
   uint64_t              segment_id;                             /**< Segment index*/
   Segment_OpenMode_t    mode;                                   /**< Segment open mode*/
   DVR_Bool_t            force_sysclock;                         /**< If ture, force to use system clock as PVR index time source. If false, libdvr can determine index time source based on actual situation*/
+  loff_t                size_hint;                              /**< Expected segment file size in bytes, used to preallocate the file in write mode. 0 means unknown*/
+  DVR_Bool_t            direct_io;                              /**< If true, write the TS file with O_DIRECT in write mode*/
+  loff_t                ring_size;                              /**< If > 0, store the TS data in the location's ring file of this size instead of one TS file per segment*/
+  DVR_Bool_t            zero_copy;                              /**< If true, data is written through segment_splice, so no user space write buffering is used*/
 } Segment_OpenParams_t;
 
+/**\brief I-frame index entry*/
+typedef struct Segment_IFrame_s {
+  uint64_t              pts;                                    /**< PTS of the frame, 90KHz. ULLONG_MAX if the PES has no PTS*/
+  loff_t                offset;                                 /**< Offset of the TS packet starting the frame's PES in the segment*/
+  uint32_t              size;                                   /**< Bytes from offset to the start of the next video PES, 0 if unknown*/
+  uint32_t              reserved;
+} Segment_IFrame_t;
+
+/**\brief Write-behind queue statistics, collected since the segment is opened*/
+typedef struct Segment_WriteStats_s {
+  int                   queue_size;                             /**< Number of blocks of the queue, 0 if write-behind is off*/
+  int                   high_water;                             /**< Max number of queued blocks*/
+  uint32_t              full_count;                             /**< Times segment_write waited for a free block*/
+  uint32_t              max_write_ms;                           /**< Max write() latency in ms*/
+  loff_t                pending;                                /**< Bytes queued, not written to the TS file yet*/
+} Segment_WriteStats_t;
+
 typedef struct Segment_Ops_s {
 
   /**\brief Open a segment for a target giving some open parameters
@@ -188,6 +209,43 @@ typedef struct Segment_Ops_s {
    * \return segment id
    */
   uint64_t (*segment_get_cur_segment_id)(Segment_Handle_t handle);
+
+  /**\brief Move data from a pipe to the giving segment without copying it
+   * \param[in] handle, Segment handle
+   * \param[in] pipe_fd, Read end of the pipe holding the data
+   * \param[in] count, The data count
+   * \return The number of bytes moved on success
+   * \return error code on failure, errno is ENOTSUP if the segment can not splice
+   */
+  ssize_t (*segment_splice)(Segment_Handle_t handle, int pipe_fd, size_t count);
+
+  /**\brief Add an I-frame to the I-frame index when record
+   * \param[in] handle, Segment handle
+   * \param[in] pts, PTS of the frame, 90KHz
+   * \param[in] offset, Segment offset of the frame
+   * \param[in] size, Size of the frame's data in bytes, 0 if unknown
+   * \return DVR_SUCCESS on success
+   * \return error code on failure
+   */
+  int (*segment_update_iframe)(Segment_Handle_t handle, uint64_t pts, loff_t offset, uint32_t size);
+
+  /**\brief Find an I-frame next to an offset in the I-frame index
+   * \param[in] handle, Segment handle
+   * \param[in] offset, Segment offset
+   * \param[in] dir, >= 0 to find the first I-frame at or after offset, < 0 to find the last I-frame before offset
+   * \param[out] p_frame, Return the I-frame
+   * \return DVR_SUCCESS on success
+   * \return error code if there is no such I-frame or no I-frame index
+   */
+  int (*segment_find_iframe)(Segment_Handle_t handle, loff_t offset, int dir, Segment_IFrame_t *p_frame);
+
+  /**\brief Get the write-behind queue statistics
+   * \param[in] handle, The segment handle
+   * \param[out] p_stats, Return the statistics
+   * \return DVR_SUCCESS On success
+   * \return Error code On failure
+   */
+  int (*segment_get_write_stats)(Segment_Handle_t handle, Segment_WriteStats_t *p_stats);
 } Segment_Ops_t;
 
 #ifdef __cplusplus
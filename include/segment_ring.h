@@ -0,0 +1,100 @@
+#ifndef _SEGMENT_RING_H_
+#define _SEGMENT_RING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "dvr_types.h"
+
+/**
+ * Segment ring file storage
+ * All segments of a location share one preallocated file "<location>.ring".
+ * The write pointer wraps at the end of the file, and a slot table in the
+ * file header maps segment ids onto logical ranges of the ring.
+ * Used by segment.c instead of one TS file per segment.
+ */
+
+/**\brief Ring file handle*/
+typedef struct Segment_Ring_s Segment_Ring_t;
+
+/**\brief Attach to the ring file of a location
+ * \param[in] location, The record file's location
+ * \param[in] capacity, Ring data size in bytes, used to create the file. 0 to only open an existing ring
+ * \param[out] p_ring, Return the ring handle
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int segment_ring_attach(const char *location, loff_t capacity, Segment_Ring_t **p_ring);
+
+/**\brief Detach from a ring file
+ * \param[in] ring, Ring handle
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int segment_ring_detach(Segment_Ring_t *ring);
+
+/**\brief Start a new segment at the write pointer of the ring
+ * \param[in] ring, Ring handle
+ * \param[in] segment_id, Segment id
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int segment_ring_begin(Segment_Ring_t *ring, uint64_t segment_id);
+
+/**\brief Finish a segment started by segment_ring_begin
+ * \param[in] ring, Ring handle
+ * \param[in] segment_id, Segment id
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int segment_ring_end(Segment_Ring_t *ring, uint64_t segment_id);
+
+/**\brief Append data to a segment
+ * \param[in] ring, Ring handle
+ * \param[in] segment_id, Segment id, must be the last begun segment
+ * \param[in] buf, The buffer of data
+ * \param[in] count, The data count
+ * \return The number of bytes written on success
+ * \return error code on failure
+ */
+ssize_t segment_ring_append(Segment_Ring_t *ring, uint64_t segment_id, const void *buf, size_t count);
+
+/**\brief Read data of a segment
+ * \param[in] ring, Ring handle
+ * \param[in] segment_id, Segment id
+ * \param[out] buf, The buffer of data
+ * \param[in] count, The data count
+ * \param[in] pos, Position in the segment
+ * \return The number of bytes read on success, 0 at the end of the segment
+ * \return error code on failure or if the data was already overwritten
+ */
+ssize_t segment_ring_read(Segment_Ring_t *ring, uint64_t segment_id, void *buf, size_t count, loff_t pos);
+
+/**\brief Get the size of a segment
+ * \param[in] ring, Ring handle
+ * \param[in] segment_id, Segment id
+ * \return The segment size on success
+ * \return error code if the segment is not in the ring
+ */
+loff_t segment_ring_size(Segment_Ring_t *ring, uint64_t segment_id);
+
+/**\brief Release a segment from the ring of a location
+ * \param[in] location, The record file's location
+ * \param[in] segment_id, Segment id
+ * \return DVR_SUCCESS on success
+ * \return error code on failure
+ */
+int segment_ring_remove(const char *location, uint64_t segment_id);
+
+/**\brief Check if a location stores its segments in a ring file
+ * \param[in] location, The record file's location
+ * \return DVR_TRUE if the ring file exists
+ */
+DVR_Bool_t segment_ring_exists(const char *location);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
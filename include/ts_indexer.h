@@ -7,6 +7,7 @@
 #define _TS_INDEXER_H_
 
 #include <inttypes.h>
+#include "ts_pid_set.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -88,6 +89,7 @@ typedef struct {
 struct TS_Indexer_s {
   TSParser               video_parser;  /**< The video parser.*/
   TSParser               audio_parser;  /**< The audio parser.*/
+  TS_PidSet_t            pid_set;       /**< The video and audio PIDs, the slot selects the parser.*/
   uint64_t                      offset; /**< The current offset.*/
   TS_Indexer_EventCallback_t callback;  /**< The event callback function.*/
 };
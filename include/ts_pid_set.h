@@ -0,0 +1,101 @@
+#ifndef _TS_PID_SET_H_
+#define _TS_PID_SET_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * TS PID set
+ * A bitmap of the PIDs in the set, plus one slot byte per PID which maps
+ * the PID onto the caller's stream table. Membership and dispatch are
+ * O(1), so per-packet filtering does not scan the stream lists.
+ */
+
+#define TS_PID_COUNT       (8192)      /**< Number of 13-bit PIDs*/
+#define TS_PID_NULL        (0x1fff)    /**< Null packet PID*/
+#define TS_PID_ALL         (0x2000)    /**< Pseudo PID requesting the whole TS, never in a set*/
+#define TS_PID_SLOT_NONE   (0xff)      /**< The PID is not in the set*/
+
+/**\brief Get the PID of a TS packet*/
+#define TS_PKT_PID(_p)     ((((_p)[1] & 0x1f) << 8) | (_p)[2])
+
+/**\brief TS PID set*/
+typedef struct {
+  uint32_t        bitmap[TS_PID_COUNT / 32];  /**< Bit set for each PID in the set*/
+  uint8_t         slot[TS_PID_COUNT];         /**< Slot of each PID, TS_PID_SLOT_NONE if not in the set*/
+  int             count;                      /**< Number of PIDs in the set*/
+} TS_PidSet_t;
+
+/**\brief Empty a PID set
+ * \param[in] set, The PID set
+ */
+static inline void ts_pid_set_init(TS_PidSet_t *set)
+{
+  memset(set->bitmap, 0, sizeof(set->bitmap));
+  memset(set->slot, TS_PID_SLOT_NONE, sizeof(set->slot));
+  set->count = 0;
+}
+
+/**\brief Check if a PID is in the set
+ * \param[in] set, The PID set
+ * \param[in] pid, The PID
+ * \return 1 if the PID is in the set, 0 if not
+ */
+static inline int ts_pid_set_has(const TS_PidSet_t *set, int pid)
+{
+  if (pid < 0 || pid >= TS_PID_COUNT)
+    return 0;
+  return (set->bitmap[pid >> 5] >> (pid & 31)) & 1;
+}
+
+/**\brief Get the slot of a PID
+ * \param[in] set, The PID set
+ * \param[in] pid, The PID
+ * \return The slot given to ts_pid_set_add, -1 if the PID is not in the set
+ */
+static inline int ts_pid_set_slot(const TS_PidSet_t *set, int pid)
+{
+  if (!ts_pid_set_has(set, pid))
+    return -1;
+  return set->slot[pid];
+}
+
+/**\brief Add a PID to the set, or change its slot
+ * \param[in] set, The PID set
+ * \param[in] pid, The PID, the null packet PID is not accepted
+ * \param[in] slot, The slot of the PID, 0 to TS_PID_SLOT_NONE - 1
+ * \return 0 on success, -1 on invalid parameters
+ */
+static inline int ts_pid_set_add(TS_PidSet_t *set, int pid, int slot)
+{
+  if (pid < 0 || pid >= TS_PID_NULL || slot < 0 || slot >= TS_PID_SLOT_NONE)
+    return -1;
+  if (!ts_pid_set_has(set, pid))
+    set->count++;
+  set->bitmap[pid >> 5] |= 1U << (pid & 31);
+  set->slot[pid] = (uint8_t)slot;
+  return 0;
+}
+
+/**\brief Remove a PID from the set
+ * \param[in] set, The PID set
+ * \param[in] pid, The PID
+ */
+static inline void ts_pid_set_remove(TS_PidSet_t *set, int pid)
+{
+  if (!ts_pid_set_has(set, pid))
+    return;
+  set->bitmap[pid >> 5] &= ~(1U << (pid & 31));
+  set->slot[pid] = TS_PID_SLOT_NONE;
+  set->count--;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_TS_PID_SET_H_*/
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "list.h"
+#include "dvr_block_pool.h"
+
+#define BLOCK_POOL_HUGE_SIZE  (2 * 1024 * 1024)
+
+/**\brief Block descriptor, kept out of the block so the block stays page aligned*/
+typedef struct {
+  struct list_head  head;       /**< List node*/
+  void             *addr;       /**< Mapped address*/
+  size_t            size;       /**< Mapped size*/
+} DVR_Block_t;
+
+static LIST_HEAD(block_free_list);
+static LIST_HEAD(block_used_list);
+static size_t block_cached = 0;
+static ssize_t block_limit = -1;
+static pthread_mutex_t block_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t block_pool_round(size_t size)
+{
+  size_t align = (size >= BLOCK_POOL_HUGE_SIZE) ? BLOCK_POOL_HUGE_SIZE : (size_t)getpagesize();
+
+  return (size + align - 1) & ~(align - 1);
+}
+
+static void *block_pool_map(size_t size)
+{
+  size_t map_size = size;
+  uint8_t *addr, *aligned;
+
+  /* Map huge blocks 2MB larger, then trim them to a 2MB boundary, so the
+   * whole block can be backed by transparent huge pages */
+  if (size >= BLOCK_POOL_HUGE_SIZE)
+    map_size += BLOCK_POOL_HUGE_SIZE;
+  addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    DVR_ERROR("%s map %zu failed, reason:%s", __func__, map_size, strerror(errno));
+    return NULL;
+  }
+  if (map_size == size)
+    return addr;
+
+  aligned = (uint8_t *)(((uintptr_t)addr + BLOCK_POOL_HUGE_SIZE - 1) & ~((uintptr_t)BLOCK_POOL_HUGE_SIZE - 1));
+  if (aligned > addr)
+    munmap(addr, aligned - addr);
+  if (addr + map_size > aligned + size)
+    munmap(aligned + size, addr + map_size - (aligned + size));
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+  return aligned;
+}
+
+void *dvr_block_pool_alloc(size_t size)
+{
+  DVR_Block_t *blk, *best = NULL;
+  size_t rsize;
+
+  if (!size)
+    return NULL;
+  rsize = block_pool_round(size);
+
+  /* Take the smallest cached block which fits, but do not waste a block
+   * more than twice as large */
+  pthread_mutex_lock(&block_lock);
+  list_for_each_entry(blk, &block_free_list, head) {
+    if (blk->size >= rsize && blk->size <= rsize * 2 && (!best || blk->size < best->size))
+      best = blk;
+  }
+  if (best) {
+    list_del(&best->head);
+    list_add(&best->head, &block_used_list);
+    block_cached -= best->size;
+    pthread_mutex_unlock(&block_lock);
+    return best->addr;
+  }
+  pthread_mutex_unlock(&block_lock);
+
+  blk = (DVR_Block_t *)calloc(1, sizeof(DVR_Block_t));
+  if (!blk)
+    return NULL;
+  blk->addr = block_pool_map(rsize);
+  if (!blk->addr) {
+    free(blk);
+    return NULL;
+  }
+  blk->size = rsize;
+
+  pthread_mutex_lock(&block_lock);
+  list_add(&blk->head, &block_used_list);
+  pthread_mutex_unlock(&block_lock);
+  return blk->addr;
+}
+
+void dvr_block_pool_free(void *block)
+{
+  DVR_Block_t *blk, *found = NULL, *tmp;
+  size_t limit;
+  LIST_HEAD(unmap_list);
+
+  if (!block)
+    return;
+
+  pthread_mutex_lock(&block_lock);
+  if (block_limit < 0) {
+    int kb = dvr_prop_read_int(DVR_BLOCK_POOL_CACHE_PROP, DVR_BLOCK_POOL_CACHE_DEFAULT);
+
+    block_limit = (kb > 0) ? (ssize_t)kb * 1024 : 0;
+  }
+  limit = (size_t)block_limit;
+  list_for_each_entry(blk, &block_used_list, head) {
+    if (blk->addr == block) {
+      found = blk;
+      break;
+    }
+  }
+  if (!found) {
+    pthread_mutex_unlock(&block_lock);
+    DVR_ERROR("%s %p is not a pool block", __func__, block);
+    return;
+  }
+  list_del(&found->head);
+  list_add(&found->head, &block_free_list);
+  block_cached += found->size;
+
+  /* Unmap the least recently freed blocks above the cache limit */
+  list_for_each_entry_safe_reverse(blk, tmp, &block_free_list, head) {
+    if (block_cached <= limit)
+      break;
+    list_del(&blk->head);
+    list_add(&blk->head, &unmap_list);
+    block_cached -= blk->size;
+  }
+  pthread_mutex_unlock(&block_lock);
+
+  list_for_each_entry_safe(blk, tmp, &unmap_list, head) {
+    list_del(&blk->head);
+    munmap(blk->addr, blk->size);
+    free(blk);
+  }
+}
+
+void *dvr_block_pool_reserve(DVR_BlockReserve_t *res, size_t size)
+{
+  if (!res)
+    return NULL;
+
+  if (res->block && res->size >= size)
+    return res->block;
+
+  dvr_block_pool_release(res);
+  res->block = dvr_block_pool_alloc(size);
+  if (res->block)
+    res->size = size;
+  return res->block;
+}
+
+void dvr_block_pool_release(DVR_BlockReserve_t *res)
+{
+  if (!res)
+    return;
+
+  dvr_block_pool_free(res->block);
+  res->block = NULL;
+  res->size = 0;
+}
@@ -0,0 +1,773 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "list.h"
+#include "dvr_catalog.h"
+
+#define CATALOG_MAGIC             "DVRCAT01"
+#define CATALOG_MAGIC_SIZE        (8)
+#define CATALOG_REC_STATS         (1)
+#define CATALOG_REC_SEGMENTS      (2)
+#define CATALOG_REC_REMOVE        (3)
+#define CATALOG_REC_MAX           (1024*1024)  /**< Larger records are treated as garbage*/
+#define CATALOG_COMPACT_MIN       (256)        /**< Extra outdated records tolerated before compacting*/
+#define CATALOG_CACHE_MAX         (8)          /**< Catalogs kept in memory*/
+
+/**\brief Header of a record, followed by the name and the payload*/
+typedef struct {
+  uint16_t          type;         /**< CATALOG_REC_xxx*/
+  uint16_t          name_len;     /**< Length of the name, without the terminating 0*/
+  uint32_t          len;          /**< Length of the payload*/
+} Catalog_RecordHeader_t;
+
+/**\brief Payload of a CATALOG_REC_STATS record*/
+typedef struct {
+  uint64_t          size;         /**< Total size in bytes*/
+  int64_t           time;         /**< Total duration in ms*/
+  uint32_t          pkts;         /**< Total number of packets*/
+  uint32_t          reserved;
+} Catalog_Stats_t;
+
+/**\brief Payload of a CATALOG_REC_SEGMENTS record, followed by the pids and the segments index*/
+typedef struct {
+  uint32_t          nb_pids;      /**< Number of Catalog_Pid_t*/
+  uint32_t          nb_segments;  /**< Number of uint64_t segments index*/
+} Catalog_Segments_t;
+
+typedef struct {
+  uint32_t          pid;
+  uint32_t          type;
+} Catalog_Pid_t;
+
+typedef struct {
+  DVR_CatalogEntry_t  entry;
+  uint64_t           *segment_ids;  /**< Segments index, oldest first*/
+} Catalog_Entry_t;
+
+/**\brief In memory copy of a catalog file*/
+typedef struct {
+  struct list_head  head;
+  char              path[DVR_MAX_LOCATION_SIZE + 32]; /**< Path of the catalog file*/
+  dev_t             dev;          /**< Device of the parsed file*/
+  ino_t             ino;          /**< Inode of the parsed file, changed by compaction*/
+  int               fd;           /**< Held open on the parsed file, so no new file gets its inode*/
+  DVR_Bool_t        foreign;      /**< The file is not a catalog, it is neither parsed nor written*/
+  off_t             offset;       /**< Parsed length of the file*/
+  uint32_t          records;      /**< Number of records in the file*/
+  Catalog_Entry_t  *entries;      /**< Live entries*/
+  uint32_t          nb_entries;
+  uint32_t          cap_entries;
+} Catalog_t;
+
+static pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(catalog_list);
+static int catalog_enabled = -1;
+
+static DVR_Bool_t catalog_is_enabled(void)
+{
+  DVR_Bool_t enabled;
+
+  pthread_mutex_lock(&catalog_lock);
+  if (catalog_enabled < 0)
+    catalog_enabled = dvr_prop_read_int(DVR_CATALOG_PROP, 1) ? 1 : 0;
+  enabled = catalog_enabled ? DVR_TRUE : DVR_FALSE;
+  pthread_mutex_unlock(&catalog_lock);
+  return enabled;
+}
+
+/* Split a location into the catalog path of its directory and its file name */
+static int catalog_split(const char *location, char *path, size_t path_size, const char **p_name)
+{
+  const char *name = strrchr(location, '/');
+
+  if (name)
+    name++;
+  else
+    name = location;
+  if (!*name || strlen(name) >= DVR_MAX_LOCATION_SIZE)
+    return DVR_FAILURE;
+
+  if (name == location)
+    snprintf(path, path_size, "%s", DVR_CATALOG_FILE);
+  else
+    snprintf(path, path_size, "%.*s%s", (int)(name - location), location, DVR_CATALOG_FILE);
+  *p_name = name;
+  return DVR_SUCCESS;
+}
+
+static void catalog_reset(Catalog_t *cat)
+{
+  uint32_t i;
+
+  for (i = 0; i < cat->nb_entries; i++)
+    free(cat->entries[i].segment_ids);
+  cat->nb_entries = 0;
+  cat->offset = 0;
+  cat->records = 0;
+  cat->dev = 0;
+  cat->ino = 0;
+  cat->foreign = DVR_FALSE;
+}
+
+static void catalog_free(Catalog_t *cat)
+{
+  catalog_reset(cat);
+  if (cat->fd != -1)
+    close(cat->fd);
+  free(cat->entries);
+  free(cat);
+}
+
+/* Get the catalog of a path, most recently used first. Must be called with catalog_lock held */
+static Catalog_t *catalog_get(const char *path)
+{
+  Catalog_t *cat, *last = NULL;
+  int n = 0;
+
+  list_for_each_entry(cat, &catalog_list, head) {
+    if (!strcmp(cat->path, path)) {
+      list_del(&cat->head);
+      list_add(&cat->head, &catalog_list);
+      return cat;
+    }
+    last = cat;
+    n++;
+  }
+
+  if (n >= CATALOG_CACHE_MAX && last) {
+    list_del(&last->head);
+    catalog_free(last);
+  }
+
+  cat = (Catalog_t *)calloc(1, sizeof(Catalog_t));
+  if (!cat)
+    return NULL;
+  snprintf(cat->path, sizeof(cat->path), "%s", path);
+  cat->fd = -1;
+  list_add(&cat->head, &catalog_list);
+  return cat;
+}
+
+static Catalog_Entry_t *catalog_find(Catalog_t *cat, const char *name, DVR_Bool_t create)
+{
+  Catalog_Entry_t *entries;
+  uint32_t i, cap;
+
+  for (i = 0; i < cat->nb_entries; i++) {
+    if (!strcmp(cat->entries[i].entry.name, name))
+      return &cat->entries[i];
+  }
+  if (!create)
+    return NULL;
+
+  if (cat->nb_entries == cat->cap_entries) {
+    cap = cat->cap_entries ? cat->cap_entries * 2 : 64;
+    entries = (Catalog_Entry_t *)realloc(cat->entries, cap * sizeof(Catalog_Entry_t));
+    if (!entries)
+      return NULL;
+    cat->entries = entries;
+    cat->cap_entries = cap;
+  }
+  memset(&cat->entries[cat->nb_entries], 0, sizeof(Catalog_Entry_t));
+  snprintf(cat->entries[cat->nb_entries].entry.name, DVR_MAX_LOCATION_SIZE, "%s", name);
+  return &cat->entries[cat->nb_entries++];
+}
+
+/* Apply one record to the in memory catalog */
+static int catalog_apply(Catalog_t *cat, int type, const char *name, const uint8_t *payload, uint32_t len)
+{
+  Catalog_Entry_t *p_ent;
+  Catalog_Stats_t stats;
+  Catalog_Segments_t segs;
+  Catalog_Pid_t pid;
+  uint64_t *ids = NULL;
+  uint32_t i;
+
+  switch (type) {
+    case CATALOG_REC_STATS:
+      if (len < sizeof(stats))
+        return DVR_FAILURE;
+      memcpy(&stats, payload, sizeof(stats));
+      p_ent = catalog_find(cat, name, DVR_TRUE);
+      if (!p_ent)
+        return DVR_FAILURE;
+      p_ent->entry.size = stats.size;
+      p_ent->entry.time = (time_t)stats.time;
+      p_ent->entry.pkts = stats.pkts;
+      p_ent->entry.flags |= DVR_CATALOG_HAS_STATS;
+      break;
+    case CATALOG_REC_SEGMENTS:
+      if (len < sizeof(segs))
+        return DVR_FAILURE;
+      memcpy(&segs, payload, sizeof(segs));
+      if (segs.nb_pids > DVR_MAX_RECORD_PIDS_COUNT ||
+          len != sizeof(segs) + segs.nb_pids * sizeof(Catalog_Pid_t) +
+            (uint64_t)segs.nb_segments * sizeof(uint64_t))
+        return DVR_FAILURE;
+      if (segs.nb_segments) {
+        ids = (uint64_t *)malloc(segs.nb_segments * sizeof(uint64_t));
+        if (!ids)
+          return DVR_FAILURE;
+        memcpy(ids, payload + sizeof(segs) + segs.nb_pids * sizeof(Catalog_Pid_t),
+            segs.nb_segments * sizeof(uint64_t));
+      }
+      p_ent = catalog_find(cat, name, DVR_TRUE);
+      if (!p_ent) {
+        free(ids);
+        return DVR_FAILURE;
+      }
+      for (i = 0; i < segs.nb_pids; i++) {
+        memcpy(&pid, payload + sizeof(segs) + i * sizeof(Catalog_Pid_t), sizeof(pid));
+        p_ent->entry.pids[i].pid = pid.pid;
+        p_ent->entry.pids[i].type = pid.type;
+      }
+      p_ent->entry.nb_pids = segs.nb_pids;
+      p_ent->entry.nb_segments = segs.nb_segments;
+      p_ent->entry.flags |= DVR_CATALOG_HAS_SEGMENTS;
+      free(p_ent->segment_ids);
+      p_ent->segment_ids = ids;
+      break;
+    case CATALOG_REC_REMOVE:
+      p_ent = catalog_find(cat, name, DVR_FALSE);
+      if (p_ent) {
+        free(p_ent->segment_ids);
+        *p_ent = cat->entries[--cat->nb_entries];
+      }
+      break;
+    default:
+      /*Unknown records are skipped*/
+      break;
+  }
+  return DVR_SUCCESS;
+}
+
+/* Parse the records appended to the file since the last call. A record
+ * still being written is left for the next call. Must be called with
+ * catalog_lock held */
+static int catalog_sync(Catalog_t *cat, int fd)
+{
+  Catalog_RecordHeader_t hdr;
+  char name[DVR_MAX_LOCATION_SIZE];
+  struct stat st;
+  uint8_t *buf;
+  size_t len, pos;
+  ssize_t ret;
+  int own_fd = -1, err;
+  DVR_Bool_t held;
+
+  if (fd == -1) {
+    if (stat(cat->path, &st) == -1)
+      goto missing;
+    if (cat->fd != -1 && st.st_dev == cat->dev && st.st_ino == cat->ino) {
+      fd = cat->fd;
+    } else {
+      own_fd = open(cat->path, O_RDONLY | O_CLOEXEC);
+      if (own_fd == -1)
+        goto missing;
+      fd = own_fd;
+      if (fstat(fd, &st) == -1)
+        goto error;
+    }
+  } else if (fstat(fd, &st) == -1) {
+    goto error;
+  }
+
+  /*While cat->fd is open, the parsed file's inode can not be freed and
+   *reused by a new file, so matching dev and inode means the same file*/
+  held = (cat->fd != -1 && st.st_dev == cat->dev && st.st_ino == cat->ino) ? DVR_TRUE : DVR_FALSE;
+  if (!held || st.st_size < cat->offset) {
+    catalog_reset(cat);
+    cat->dev = st.st_dev;
+    cat->ino = st.st_ino;
+  }
+  if (!held) {
+    if (cat->fd != -1)
+      close(cat->fd);
+    cat->fd = (own_fd != -1) ? own_fd : fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    own_fd = -1;
+  }
+  if (cat->foreign)
+    goto foreign;
+  if (st.st_size == cat->offset)
+    goto done;
+
+  len = st.st_size - cat->offset;
+  buf = (uint8_t *)malloc(len);
+  if (!buf)
+    goto error;
+  ret = pread(fd, buf, len, cat->offset);
+  if (ret < 0) {
+    free(buf);
+    goto error;
+  }
+  len = ret;
+
+  pos = 0;
+  if (cat->offset == 0) {
+    /*Never overwrite a file of someone else, a partial magic is the
+     *start of a catalog left by a writer which died*/
+    if (memcmp(buf, CATALOG_MAGIC, (len < CATALOG_MAGIC_SIZE) ? len : CATALOG_MAGIC_SIZE)) {
+      DVR_ERROR("%s %s is not a catalog, catalog disabled in its directory", __func__, cat->path);
+      cat->foreign = DVR_TRUE;
+      free(buf);
+      goto foreign;
+    }
+    if (len < CATALOG_MAGIC_SIZE) {
+      free(buf);
+      goto done;
+    }
+    pos = CATALOG_MAGIC_SIZE;
+  }
+
+  while (pos + sizeof(hdr) <= len) {
+    memcpy(&hdr, buf + pos, sizeof(hdr));
+    if (hdr.name_len == 0 || hdr.name_len >= DVR_MAX_LOCATION_SIZE || hdr.len > CATALOG_REC_MAX) {
+      /*Skip the garbage, the next compaction drops it*/
+      DVR_WARN("%s %s corrupted at %lld", __func__, cat->path, (long long)(cat->offset + pos));
+      pos = len;
+      cat->records += CATALOG_COMPACT_MIN + 1;
+      break;
+    }
+    if (pos + sizeof(hdr) + hdr.name_len + hdr.len > len)
+      break;
+    memcpy(name, buf + pos + sizeof(hdr), hdr.name_len);
+    name[hdr.name_len] = 0;
+    catalog_apply(cat, hdr.type, name, buf + pos + sizeof(hdr) + hdr.name_len, hdr.len);
+    cat->records++;
+    pos += sizeof(hdr) + hdr.name_len + hdr.len;
+  }
+  cat->offset += pos;
+  free(buf);
+
+done:
+  if (own_fd != -1)
+    close(own_fd);
+  return DVR_SUCCESS;
+error:
+  DVR_ERROR("%s read %s failed, reason:%s", __func__, cat->path, strerror(errno));
+  if (own_fd != -1)
+    close(own_fd);
+  return DVR_FAILURE;
+foreign:
+  if (own_fd != -1)
+    close(own_fd);
+  return DVR_FAILURE;
+missing:
+  err = errno;
+  catalog_reset(cat);
+  if (cat->fd != -1) {
+    close(cat->fd);
+    cat->fd = -1;
+  }
+  return (err == ENOENT) ? DVR_SUCCESS : DVR_FAILURE;
+}
+
+/* Build a record, the caller frees it */
+static uint8_t *catalog_build(int type, const char *name, const void *payload, uint32_t len, size_t *p_size)
+{
+  Catalog_RecordHeader_t hdr;
+  uint8_t *rec;
+
+  hdr.type = type;
+  hdr.name_len = strlen(name);
+  hdr.len = len;
+  *p_size = sizeof(hdr) + hdr.name_len + len;
+  rec = (uint8_t *)malloc(*p_size);
+  if (!rec)
+    return NULL;
+  memcpy(rec, &hdr, sizeof(hdr));
+  memcpy(rec + sizeof(hdr), name, hdr.name_len);
+  if (len)
+    memcpy(rec + sizeof(hdr) + hdr.name_len, payload, len);
+  return rec;
+}
+
+static uint8_t *catalog_build_segments(const char *name, uint32_t nb_segments, const uint64_t *p_segment_ids,
+    uint32_t nb_pids, const DVR_StreamPid_t *p_pids, size_t *p_size)
+{
+  Catalog_Segments_t segs;
+  Catalog_Pid_t pid;
+  uint8_t *payload, *rec;
+  uint32_t i, len;
+
+  segs.nb_pids = nb_pids;
+  segs.nb_segments = nb_segments;
+  len = sizeof(segs) + nb_pids * sizeof(Catalog_Pid_t) + nb_segments * sizeof(uint64_t);
+  payload = (uint8_t *)malloc(len);
+  if (!payload)
+    return NULL;
+  memcpy(payload, &segs, sizeof(segs));
+  for (i = 0; i < nb_pids; i++) {
+    pid.pid = p_pids[i].pid;
+    pid.type = p_pids[i].type;
+    memcpy(payload + sizeof(segs) + i * sizeof(pid), &pid, sizeof(pid));
+  }
+  if (nb_segments)
+    memcpy(payload + sizeof(segs) + nb_pids * sizeof(Catalog_Pid_t), p_segment_ids,
+        nb_segments * sizeof(uint64_t));
+  rec = catalog_build(CATALOG_REC_SEGMENTS, name, payload, len, p_size);
+  free(payload);
+  return rec;
+}
+
+static uint8_t *catalog_build_stats(const char *name, uint64_t size, time_t time, uint32_t pkts, size_t *p_size)
+{
+  Catalog_Stats_t stats;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.size = size;
+  stats.time = time;
+  stats.pkts = pkts;
+  return catalog_build(CATALOG_REC_STATS, name, &stats, sizeof(stats), p_size);
+}
+
+static int catalog_write_rec(int fd, uint8_t *rec, size_t size)
+{
+  ssize_t ret;
+
+  if (!rec)
+    return DVR_FAILURE;
+  ret = write(fd, rec, size);
+  free(rec);
+  return (ret == (ssize_t)size) ? DVR_SUCCESS : DVR_FAILURE;
+}
+
+/* Rewrite the file with the live entries only. Must be called with the
+ * file locked, the in memory catalog synced */
+static int catalog_compact(Catalog_t *cat)
+{
+  char tmp[DVR_MAX_LOCATION_SIZE + 48];
+  Catalog_Entry_t *p_ent;
+  struct stat st;
+  uint8_t *rec;
+  size_t size;
+  uint32_t i, records = 0;
+  int fd;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", cat->path);
+  fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0664);
+  if (fd == -1) {
+    DVR_ERROR("%s open %s failed, reason:%s", __func__, tmp, strerror(errno));
+    return DVR_FAILURE;
+  }
+  if (write(fd, CATALOG_MAGIC, CATALOG_MAGIC_SIZE) != CATALOG_MAGIC_SIZE)
+    goto error;
+  for (i = 0; i < cat->nb_entries; i++) {
+    p_ent = &cat->entries[i];
+    if (p_ent->entry.flags & DVR_CATALOG_HAS_STATS) {
+      rec = catalog_build_stats(p_ent->entry.name, p_ent->entry.size, p_ent->entry.time,
+          p_ent->entry.pkts, &size);
+      if (catalog_write_rec(fd, rec, size) != DVR_SUCCESS)
+        goto error;
+      records++;
+    }
+    if (p_ent->entry.flags & DVR_CATALOG_HAS_SEGMENTS) {
+      rec = catalog_build_segments(p_ent->entry.name, p_ent->entry.nb_segments, p_ent->segment_ids,
+          p_ent->entry.nb_pids, p_ent->entry.pids, &size);
+      if (catalog_write_rec(fd, rec, size) != DVR_SUCCESS)
+        goto error;
+      records++;
+    }
+  }
+  if (fsync(fd) == -1 || fstat(fd, &st) == -1 || rename(tmp, cat->path) == -1)
+    goto error;
+  if (cat->fd != -1)
+    close(cat->fd);
+  cat->fd = fd;
+
+  DVR_INFO("%s %s records:%u->%u", __func__, cat->path, cat->records, records);
+  cat->dev = st.st_dev;
+  cat->ino = st.st_ino;
+  cat->offset = st.st_size;
+  cat->records = records;
+  return DVR_SUCCESS;
+
+error:
+  DVR_ERROR("%s write %s failed, reason:%s", __func__, tmp, strerror(errno));
+  close(fd);
+  unlink(tmp);
+  return DVR_FAILURE;
+}
+
+/* Open and lock the catalog file of a directory, creating it if needed.
+ * Return -1 on failure */
+static int catalog_open_locked(const char *path)
+{
+  struct stat st, st_path;
+  int fd;
+
+  /*Reopen if a compaction renamed a new file over the one we locked*/
+  for (;;) {
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0664);
+    if (fd == -1) {
+      DVR_ERROR("%s open %s failed, reason:%s", __func__, path, strerror(errno));
+      return -1;
+    }
+    if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1) {
+      close(fd);
+      return -1;
+    }
+    if (stat(path, &st_path) == 0 && st_path.st_dev == st.st_dev && st_path.st_ino == st.st_ino)
+      return fd;
+    close(fd);
+  }
+}
+
+/* Append a record to the catalog of its directory. The record is written
+ * with a single write on an append fd, and the file is locked so that the
+ * compaction of another process does not drop it. The file is synced
+ * before the write, so that the record is never parsed as part of a
+ * garbage or partial record left at the end of the file */
+static int catalog_append(const char *location, uint8_t *(*build)(const char *name, void *arg, size_t *p_size),
+    void *arg)
+{
+  char path[DVR_MAX_LOCATION_SIZE + 32];
+  const char *name;
+  Catalog_t *cat;
+  DVR_Bool_t compacted;
+  uint8_t *rec;
+  size_t size;
+  off_t end;
+  int fd, ret = DVR_FAILURE;
+
+  DVR_RETURN_IF_FALSE(location);
+  if (!catalog_is_enabled())
+    return DVR_SUCCESS;
+  DVR_RETURN_IF_FALSE(catalog_split(location, path, sizeof(path), &name) == DVR_SUCCESS);
+
+  for (;;) {
+    fd = catalog_open_locked(path);
+    if (fd == -1)
+      return DVR_FAILURE;
+
+    /*An entry has at most 2 live records (stats and segments), so compact
+     *once the file holds more than four times as many records as entries,
+     *i.e. the outdated records outnumber the live ones, plus some slack*/
+    compacted = DVR_FALSE;
+    pthread_mutex_lock(&catalog_lock);
+    cat = catalog_get(path);
+    if (!cat || catalog_sync(cat, fd) != DVR_SUCCESS) {
+      pthread_mutex_unlock(&catalog_lock);
+      goto done;
+    }
+    /*Records are written whole under the file lock, so a partial record
+     *at the end was left by a writer which died*/
+    end = lseek(fd, 0, SEEK_END);
+    if (end > cat->offset) {
+      DVR_WARN("%s %s drop %lld bytes at the end", __func__, path, (long long)(end - cat->offset));
+      if (ftruncate(fd, cat->offset) == -1)
+        DVR_ERROR("%s truncate %s failed, reason:%s", __func__, path, strerror(errno));
+    }
+    if (cat->records > cat->nb_entries * 4 + CATALOG_COMPACT_MIN)
+      compacted = (catalog_compact(cat) == DVR_SUCCESS) ? DVR_TRUE : DVR_FALSE;
+    pthread_mutex_unlock(&catalog_lock);
+    if (!compacted)
+      break;
+    /*Append to the compacted file*/
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+
+  if (lseek(fd, 0, SEEK_END) == 0 && write(fd, CATALOG_MAGIC, CATALOG_MAGIC_SIZE) != CATALOG_MAGIC_SIZE)
+    goto done;
+
+  rec = build(name, arg, &size);
+  if (catalog_write_rec(fd, rec, size) != DVR_SUCCESS) {
+    DVR_ERROR("%s write %s failed, reason:%s", __func__, path, strerror(errno));
+    goto done;
+  }
+  ret = DVR_SUCCESS;
+
+done:
+  flock(fd, LOCK_UN);
+  close(fd);
+  return ret;
+}
+
+typedef struct {
+  uint64_t                size;
+  time_t                  time;
+  uint32_t                pkts;
+  uint32_t                nb_segments;
+  const uint64_t         *p_segment_ids;
+  uint32_t                nb_pids;
+  const DVR_StreamPid_t  *p_pids;
+} Catalog_Update_t;
+
+static uint8_t *catalog_stats_cb(const char *name, void *arg, size_t *p_size)
+{
+  Catalog_Update_t *p = (Catalog_Update_t *)arg;
+
+  return catalog_build_stats(name, p->size, p->time, p->pkts, p_size);
+}
+
+static uint8_t *catalog_segments_cb(const char *name, void *arg, size_t *p_size)
+{
+  Catalog_Update_t *p = (Catalog_Update_t *)arg;
+
+  return catalog_build_segments(name, p->nb_segments, p->p_segment_ids, p->nb_pids, p->p_pids, p_size);
+}
+
+static uint8_t *catalog_remove_cb(const char *name, void *arg, size_t *p_size)
+{
+  (void)arg;
+  return catalog_build(CATALOG_REC_REMOVE, name, NULL, 0, p_size);
+}
+
+int dvr_catalog_set_stats(const char *location, uint64_t size, time_t time, uint32_t pkts)
+{
+  Catalog_Update_t update;
+
+  memset(&update, 0, sizeof(update));
+  update.size = size;
+  update.time = time;
+  update.pkts = pkts;
+  return catalog_append(location, catalog_stats_cb, &update);
+}
+
+int dvr_catalog_set_segments(const char *location, uint32_t nb_segments, const uint64_t *p_segment_ids,
+    uint32_t nb_pids, const DVR_StreamPid_t *p_pids)
+{
+  Catalog_Update_t update;
+
+  DVR_RETURN_IF_FALSE(nb_segments == 0 || p_segment_ids);
+  DVR_RETURN_IF_FALSE(nb_pids == 0 || p_pids);
+  if (nb_pids > DVR_MAX_RECORD_PIDS_COUNT)
+    nb_pids = DVR_MAX_RECORD_PIDS_COUNT;
+
+  memset(&update, 0, sizeof(update));
+  update.nb_segments = nb_segments;
+  update.p_segment_ids = p_segment_ids;
+  update.nb_pids = nb_pids;
+  update.p_pids = p_pids;
+  return catalog_append(location, catalog_segments_cb, &update);
+}
+
+int dvr_catalog_remove(const char *location)
+{
+  return catalog_append(location, catalog_remove_cb, NULL);
+}
+
+/* Get the synced catalog of a location and the entry of the recording.
+ * Returns with catalog_lock held on success */
+static Catalog_Entry_t *catalog_lookup(const char *location)
+{
+  char path[DVR_MAX_LOCATION_SIZE + 32];
+  const char *name;
+  Catalog_t *cat;
+  Catalog_Entry_t *p_ent = NULL;
+
+  if (!location || !catalog_is_enabled())
+    return NULL;
+  if (catalog_split(location, path, sizeof(path), &name) != DVR_SUCCESS)
+    return NULL;
+
+  pthread_mutex_lock(&catalog_lock);
+  cat = catalog_get(path);
+  if (cat && catalog_sync(cat, -1) == DVR_SUCCESS)
+    p_ent = catalog_find(cat, name, DVR_FALSE);
+  if (!p_ent)
+    pthread_mutex_unlock(&catalog_lock);
+  return p_ent;
+}
+
+int dvr_catalog_get(const char *location, DVR_CatalogEntry_t *p_entry)
+{
+  Catalog_Entry_t *p_ent;
+
+  DVR_RETURN_IF_FALSE(p_entry);
+
+  p_ent = catalog_lookup(location);
+  if (!p_ent)
+    return DVR_FAILURE;
+  *p_entry = p_ent->entry;
+  pthread_mutex_unlock(&catalog_lock);
+  return DVR_SUCCESS;
+}
+
+int dvr_catalog_get_segments(const char *location, uint32_t *p_segment_nb, uint64_t **pp_segment_ids)
+{
+  Catalog_Entry_t *p_ent;
+  uint64_t *ids = NULL;
+  uint32_t n;
+
+  DVR_RETURN_IF_FALSE(p_segment_nb);
+  DVR_RETURN_IF_FALSE(pp_segment_ids);
+
+  p_ent = catalog_lookup(location);
+  if (!p_ent)
+    return DVR_FAILURE;
+  n = p_ent->entry.nb_segments;
+  if (!(p_ent->entry.flags & DVR_CATALOG_HAS_SEGMENTS) || n == 0 ||
+      !(ids = (uint64_t *)malloc(n * sizeof(uint64_t)))) {
+    pthread_mutex_unlock(&catalog_lock);
+    return DVR_FAILURE;
+  }
+  memcpy(ids, p_ent->segment_ids, n * sizeof(uint64_t));
+  pthread_mutex_unlock(&catalog_lock);
+
+  *p_segment_nb = n;
+  *pp_segment_ids = ids;
+  return DVR_SUCCESS;
+}
+
+int dvr_catalog_list(const char *dir, uint32_t *p_entry_nb, DVR_CatalogEntry_t **pp_entries)
+{
+  char path[DVR_MAX_LOCATION_SIZE + 32];
+  char location[DVR_MAX_LOCATION_SIZE + 4];
+  DVR_CatalogEntry_t *entries = NULL;
+  const char *name;
+  Catalog_t *cat;
+  uint32_t i, n = 0;
+  size_t len;
+
+  DVR_RETURN_IF_FALSE(dir);
+  DVR_RETURN_IF_FALSE(p_entry_nb);
+  DVR_RETURN_IF_FALSE(pp_entries);
+  DVR_RETURN_IF_FALSE(catalog_is_enabled());
+
+  /*Build the path as for a file of the directory, so that "dir" and "dir/"
+   *share the cached catalog of the recordings there*/
+  len = strlen(dir);
+  while (len > 1 && dir[len - 1] == '/')
+    len--;
+  DVR_RETURN_IF_FALSE(len < DVR_MAX_LOCATION_SIZE);
+  if (len == 0)
+    snprintf(location, sizeof(location), "x");
+  else if (len == 1 && dir[0] == '/')
+    snprintf(location, sizeof(location), "/x");
+  else
+    snprintf(location, sizeof(location), "%.*s/x", (int)len, dir);
+  DVR_RETURN_IF_FALSE(catalog_split(location, path, sizeof(path), &name) == DVR_SUCCESS);
+
+  pthread_mutex_lock(&catalog_lock);
+  cat = catalog_get(path);
+  if (!cat || catalog_sync(cat, -1) != DVR_SUCCESS) {
+    pthread_mutex_unlock(&catalog_lock);
+    return DVR_FAILURE;
+  }
+  if (cat->nb_entries) {
+    entries = (DVR_CatalogEntry_t *)malloc(cat->nb_entries * sizeof(DVR_CatalogEntry_t));
+    if (!entries) {
+      pthread_mutex_unlock(&catalog_lock);
+      return DVR_FAILURE;
+    }
+    for (i = 0; i < cat->nb_entries; i++)
+      entries[i] = cat->entries[i].entry;
+    n = cat->nb_entries;
+  }
+  pthread_mutex_unlock(&catalog_lock);
+
+  *p_entry_nb = n;
+  *pp_entries = entries;
+  return DVR_SUCCESS;
+}
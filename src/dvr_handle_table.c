@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "dvr_handle_table.h"
+
+#define HANDLE_INDEX_MASK   ((uintptr_t)DVR_HANDLE_TABLE_MAX - 1)
+#define HANDLE_GEN_MASK     (UINTPTR_MAX >> DVR_HANDLE_TABLE_INDEX_BITS)
+
+static void *handle_make(uint32_t gen, int index)
+{
+  return (void *)(((uintptr_t)gen << DVR_HANDLE_TABLE_INDEX_BITS) | (uintptr_t)index);
+}
+
+/* Must be called with the table locked */
+static void handle_table_check_limit(DVR_HandleTable_t *table)
+{
+  int limit;
+
+  if (table->limit > 0)
+    return;
+  limit = dvr_prop_read_int(DVR_HANDLE_TABLE_PROP, DVR_HANDLE_TABLE_DEFAULT);
+  if (limit < 1 || limit > DVR_HANDLE_TABLE_MAX)
+    limit = DVR_HANDLE_TABLE_DEFAULT;
+  table->limit = limit;
+}
+
+/* Must be called with the table locked */
+static int handle_table_grow(DVR_HandleTable_t *table)
+{
+  int size;
+  void **objs;
+  uint32_t *gens;
+  int *refs;
+
+  size = table->size ? table->size * 2 : 4;
+  if (size > table->limit)
+    size = table->limit;
+  DVR_RETURN_IF_FALSE(size > table->size);
+
+  objs = realloc(table->objs, size * sizeof(void *));
+  DVR_RETURN_IF_FALSE(objs);
+  table->objs = objs;
+  gens = realloc(table->gens, size * sizeof(uint32_t));
+  DVR_RETURN_IF_FALSE(gens);
+  table->gens = gens;
+  refs = realloc(table->refs, size * sizeof(int));
+  DVR_RETURN_IF_FALSE(refs);
+  table->refs = refs;
+
+  memset(&objs[table->size], 0, (size - table->size) * sizeof(void *));
+  memset(&gens[table->size], 0, (size - table->size) * sizeof(uint32_t));
+  memset(&refs[table->size], 0, (size - table->size) * sizeof(int));
+  table->size = size;
+  return DVR_SUCCESS;
+}
+
+int dvr_handle_table_set_limit(DVR_HandleTable_t *table, int limit)
+{
+  DVR_RETURN_IF_FALSE(table);
+  DVR_RETURN_IF_FALSE(limit > 0 && limit <= DVR_HANDLE_TABLE_MAX);
+
+  pthread_mutex_lock(&table->lock);
+  table->limit = limit;
+  pthread_mutex_unlock(&table->lock);
+  return DVR_SUCCESS;
+}
+
+int dvr_handle_table_add(DVR_HandleTable_t *table, void *obj, void **p_handle, int *p_index)
+{
+  int i, n;
+
+  DVR_RETURN_IF_FALSE(table);
+  DVR_RETURN_IF_FALSE(obj);
+  DVR_RETURN_IF_FALSE(p_handle);
+
+  pthread_mutex_lock(&table->lock);
+  handle_table_check_limit(table);
+  n = (table->size < table->limit) ? table->size : table->limit;
+  /* A removed slot still referenced keeps its generation until put */
+  for (i = 0; i < n; i++) {
+    if (!table->objs[i] && !table->refs[i])
+      break;
+  }
+  if (i == n && (i >= table->limit || handle_table_grow(table) != DVR_SUCCESS)) {
+    pthread_mutex_unlock(&table->lock);
+    DVR_ERROR("%s no free slot, limit:%d", __func__, table->limit);
+    return DVR_FAILURE;
+  }
+
+  /* Generation 0 is never used, so a handle is never NULL */
+  table->gens[i] = (table->gens[i] + 1) & HANDLE_GEN_MASK;
+  if (!table->gens[i])
+    table->gens[i] = 1;
+  table->objs[i] = obj;
+  table->count++;
+  *p_handle = handle_make(table->gens[i], i);
+  if (p_index)
+    *p_index = i;
+  pthread_mutex_unlock(&table->lock);
+  return DVR_SUCCESS;
+}
+
+void *dvr_handle_table_get(DVR_HandleTable_t *table, void *handle)
+{
+  uintptr_t h = (uintptr_t)handle;
+  int i = (int)(h & HANDLE_INDEX_MASK);
+  void *obj = NULL;
+
+  if (!table || !handle)
+    return NULL;
+
+  pthread_mutex_lock(&table->lock);
+  if (i < table->size && table->gens[i] == (h >> DVR_HANDLE_TABLE_INDEX_BITS))
+    obj = table->objs[i];
+  if (obj)
+    table->refs[i]++;
+  pthread_mutex_unlock(&table->lock);
+  return obj;
+}
+
+void dvr_handle_table_put(DVR_HandleTable_t *table, void *handle)
+{
+  uintptr_t h = (uintptr_t)handle;
+  int i = (int)(h & HANDLE_INDEX_MASK);
+
+  if (!table || !handle)
+    return;
+
+  pthread_mutex_lock(&table->lock);
+  if (i < table->size && table->refs[i] > 0 && table->gens[i] == (h >> DVR_HANDLE_TABLE_INDEX_BITS)) {
+    if (--table->refs[i] == 0)
+      pthread_cond_broadcast(&table->cond);
+  }
+  pthread_mutex_unlock(&table->lock);
+}
+
+int dvr_handle_table_remove(DVR_HandleTable_t *table, void *handle)
+{
+  uintptr_t h = (uintptr_t)handle;
+  int i = (int)(h & HANDLE_INDEX_MASK);
+  int ret = DVR_FAILURE;
+
+  DVR_RETURN_IF_FALSE(table);
+
+  pthread_mutex_lock(&table->lock);
+  if (i < table->size && table->objs[i] && table->gens[i] == (h >> DVR_HANDLE_TABLE_INDEX_BITS)) {
+    table->objs[i] = NULL;
+    table->count--;
+    while (table->refs[i] > 0)
+      pthread_cond_wait(&table->cond, &table->lock);
+    ret = DVR_SUCCESS;
+  }
+  pthread_mutex_unlock(&table->lock);
+  return ret;
+}
+
+void *dvr_handle_table_at(DVR_HandleTable_t *table, int index)
+{
+  void *obj = NULL;
+
+  if (!table || index < 0)
+    return NULL;
+
+  pthread_mutex_lock(&table->lock);
+  if (index < table->size)
+    obj = table->objs[index];
+  if (obj)
+    table->refs[index]++;
+  pthread_mutex_unlock(&table->lock);
+  return obj;
+}
+
+int dvr_handle_table_size(DVR_HandleTable_t *table)
+{
+  int size;
+
+  if (!table)
+    return 0;
+
+  pthread_mutex_lock(&table->lock);
+  size = table->size;
+  pthread_mutex_unlock(&table->lock);
+  return size;
+}
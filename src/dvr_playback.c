@@ -43,6 +43,9 @@
 //#define FOR_OTT_49490
 
 #define FFFB_SLEEP_TIME    (1000)//500ms
+//I-frame trick play step, no decoder restart so it can be short
+#define FFFB_IFRAME_TIME   (200)
+#define FFFB_IFRAME_MAX_SIZE (4*1024*1024)
 #define FB_DEFAULT_LEFT_TIME    (3000)
 //if tsplayer delay time < 200 and no data can read, we will pause
 #define MIN_TSPLAYER_DELAY_TIME (200)
@@ -317,6 +320,45 @@ static uint32_t _dvr_time_getClock(void)
   return ms;
 }
 
+//get sys time us
+static uint64_t _dvr_time_getClockUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//add a sample to a statistics histogram
+static void _dvr_playback_stats_add(DVR_Playback_t *player, DVR_PlaybackHistogram_t *p_hist, uint64_t value)
+{
+  int bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+  if (bucket >= DVR_PLAYBACK_STATS_BUCKETS)
+    bucket = DVR_PLAYBACK_STATS_BUCKETS - 1;
+
+  pthread_mutex_lock(&player->stats_lock);
+  p_hist->count++;
+  p_hist->total += value;
+  if (value > p_hist->max)
+    p_hist->max = (value > UINT32_MAX) ? UINT32_MAX : (uint32_t)value;
+  p_hist->buckets[bucket]++;
+  pthread_mutex_unlock(&player->stats_lock);
+}
+
+//time a playback thread stage started at start_us
+static void _dvr_playback_stats_stage(DVR_Playback_t *player, DVR_PlaybackStage_t stage, uint64_t start_us)
+{
+  _dvr_playback_stats_add(player, &player->stats.stages[stage], _dvr_time_getClockUs() - start_us);
+}
+
+//count an event of the playback thread
+#define _dvr_playback_stats_inc(_player, _field)\
+  do {\
+    pthread_mutex_lock(&(_player)->stats_lock);\
+    (_player)->stats._field++;\
+    pthread_mutex_unlock(&(_player)->stats_lock);\
+  } while (0)
+
 //timeout wait signal
 static int _dvr_playback_timeoutwait(DVR_PlaybackHandle_t handle , int ms)
 {
@@ -660,6 +702,7 @@ retry:
     DVR_PB_INFO("close segment");
     segment_close(player->segment_handle);
     player->segment_handle = NULL;
+    player->segment_gen++;
   }
 
   memset((void*)&params,0,sizeof(params));
@@ -768,6 +811,7 @@ static int _dvr_open_segment(DVR_PlaybackHandle_t handle, uint64_t segment_id)
   if (player->segment_handle != NULL) {
     segment_close(player->segment_handle);
     player->segment_handle = NULL;
+    player->segment_gen++;
   }
   ret = segment_open(&params, &(player->segment_handle));
   if (ret == DVR_FAILURE) {
@@ -946,6 +990,33 @@ static DVR_Bool_t _dvr_pauselive_decode_success(DVR_PlaybackHandle_t handle) {
     return DVR_FALSE;
   }
 }
+/* Read the next TS data of the current segment. When nothing is pending in
+ * buf and the data is sent as is, try to get a mapped view of the segment
+ * instead of copying it; *p_view is set in that case. The data is copied
+ * to buf only if a whole block is required and the view is shorter. The
+ * view is unmapped when the segment is closed, it is only valid while
+ * player->segment_gen is unchanged. */
+static int _dvr_playback_read_segment(DVR_Playback_t *player, uint8_t *buf,
+    int real_read, int buf_len, DVR_Bool_t whole_block, uint8_t **p_view)
+{
+  void *view = NULL;
+  int read;
+
+  *p_view = NULL;
+  if (real_read == 0 && !player->dec_func && !player->cryptor) {
+    read = segment_read_view(player->segment_handle, &view, buf_len);
+    if (read > 0 && read < buf_len && whole_block) {
+      memcpy(buf, view, read);
+      return read;
+    }
+    if (read >= 0) {
+      *p_view = view;
+      return read;
+    }
+  }
+  return segment_read(player->segment_handle, buf + real_read, buf_len - real_read);
+}
+
 static void* _dvr_playback_thread(void *arg)
 {
   DVR_Playback_t *player = (DVR_Playback_t *) arg;
@@ -965,6 +1036,9 @@ static void* _dvr_playback_thread(void *arg)
   int real_read = 0;
   DVR_Bool_t goto_rewrite = DVR_FALSE;
   int read = 0;
+  uint8_t *view = NULL;
+  uint32_t view_gen = 0;
+  uint64_t stage_start;
 
   prctl(PR_SET_NAME,"DvrPlayback");
 
@@ -978,7 +1052,8 @@ static void* _dvr_playback_thread(void *arg)
     }
   }
 
-  uint8_t *buf = malloc(buf_len);
+  /* The buffers are kept by the session until it is closed */
+  uint8_t *buf = dvr_block_pool_reserve(&player->thread_buf, buf_len);
   if (!buf) {
     DVR_PB_INFO("Malloc buffer failed");
     return NULL;
@@ -986,10 +1061,9 @@ static void* _dvr_playback_thread(void *arg)
   input_buffer.buf_type = TS_INPUT_BUFFER_TYPE_NORMAL;
   input_buffer.buf_size = 0;
 
-  dec_bufs.buf_data = malloc(dec_buf_size);
+  dec_bufs.buf_data = dvr_block_pool_reserve(&player->dec_buf, dec_buf_size);
   if (!dec_bufs.buf_data) {
     DVR_PB_INFO("Malloc dec buffer failed");
-    free(buf);
     return NULL;
   }
   dec_bufs.buf_type = TS_INPUT_BUFFER_TYPE_NORMAL;
@@ -1000,10 +1074,6 @@ static void* _dvr_playback_thread(void *arg)
   }
 
   if (ret != DVR_SUCCESS) {
-    if (buf != NULL) {
-      free(buf);
-    }
-    free(dec_bufs.buf_data);
     DVR_PB_INFO("get segment error");
     return NULL;
   }
@@ -1138,7 +1208,9 @@ static void* _dvr_playback_thread(void *arg)
               //used timeout wait need lock first,so we unlock and lock
               //dvr_mutex_unlock(&player->lock);
               //dvr_mutex_lock(&player->lock);
-              AmTsPlayer_pauseVideoDecoding(player->handle);
+              //I-frame trick play writes one frame per step, nothing to hold back
+              if (!player->iframe_trick)
+                AmTsPlayer_pauseVideoDecoding(player->handle);
               _dvr_playback_timeoutwait((DVR_PlaybackHandle_t)player, timeout);
               DVR_PB_DEBUG("unlock---");
               dvr_mutex_unlock(&player->lock);
@@ -1210,6 +1282,19 @@ static void* _dvr_playback_thread(void *arg)
       }
     }
 
+    if (player->iframe_trick) {
+      if (__IS_SPEED() && player->state != DVR_PLAYBACK_STATE_PAUSE) {
+        //I-frame trick play feeds the decoder in _dvr_playback_fffb only
+        _dvr_playback_timeoutwait((DVR_PlaybackHandle_t)player, FFFB_IFRAME_TIME);
+        dvr_mutex_unlock(&player->lock);
+        continue;
+      } else if (!__IS_SPEED()) {
+        DVR_PB_INFO("leave I-frame trick play");
+        player->iframe_trick = DVR_FALSE;
+        AmTsPlayer_setTrickMode(player->handle, AV_VIDEO_TRICK_MODE_NONE);
+      }
+    }
+
     if (player->state == DVR_PLAYBACK_STATE_PAUSE
         && player->seek_pause == DVR_FALSE) {
       //check is need send time send end
@@ -1243,13 +1328,19 @@ static void* _dvr_playback_thread(void *arg)
     dvr_mutex_lock(&player->lock);
     pthread_mutex_lock(&player->segment_lock);
     //DVR_PB_INFO("start read");
-    read = segment_read(player->segment_handle, buf + real_read, buf_len - real_read);
+    stage_start = _dvr_time_getClockUs();
+    read = _dvr_playback_read_segment(player, buf, real_read, buf_len,
+        b_writed_whole_block && player->has_video, &view);
+    view_gen = player->segment_gen;
+    _dvr_playback_stats_stage(player, DVR_PLAYBACK_STAGE_READ, stage_start);
     real_read = real_read + read;
     player->ts_cache_len = real_read;
     //DVR_PB_INFO("start read end [%d]", read);
     pthread_mutex_unlock(&player->segment_lock);
     //DVR_PB_DEBUG("unlock---");
     dvr_mutex_unlock(&player->lock);
+    if (read < 0)
+      _dvr_playback_stats_inc(player, read_errors);
     if (read < 0 && errno == EIO) {
       //EIO ERROR, EXIT THRAD
       DVR_PB_INFO("read error.EIO error, exit thread");
@@ -1335,6 +1426,7 @@ static void* _dvr_playback_thread(void *arg)
         continue;
       } else if (ret != DVR_SUCCESS) {
         DVR_PB_INFO("delay:%d pauselive:%d", delay, _dvr_pauselive_decode_success((DVR_PlaybackHandle_t)player));
+        _dvr_playback_stats_inc(player, end_waits);
         dvr_mutex_lock(&player->lock);
         _dvr_playback_timeoutwait((DVR_PlaybackHandle_t)player, timeout);
         dvr_mutex_unlock(&player->lock);
@@ -1360,7 +1452,11 @@ static void* _dvr_playback_thread(void *arg)
       _dvr_replay_changed_pid((DVR_PlaybackHandle_t)player);
       _dvr_check_cur_segment_flag((DVR_PlaybackHandle_t)player);
       pthread_mutex_lock(&player->segment_lock);
-      read = segment_read(player->segment_handle, buf + real_read, buf_len - real_read);
+      stage_start = _dvr_time_getClockUs();
+      read = _dvr_playback_read_segment(player, buf, real_read, buf_len,
+          b_writed_whole_block && player->has_video, &view);
+      view_gen = player->segment_gen;
+      _dvr_playback_stats_stage(player, DVR_PLAYBACK_STAGE_READ, stage_start);
       real_read = real_read + read;
       player->ts_cache_len = real_read;
       pthread_mutex_unlock(&player->segment_lock);
@@ -1406,7 +1502,7 @@ static void* _dvr_playback_thread(void *arg)
     reach_end_timeout = 0;
     //real_read = real_read + read;
     input_buffer.buf_size = real_read;
-    input_buffer.buf_data = buf;
+    input_buffer.buf_data = view ? view : buf;
 
     //check read data len,if len < 0, we need continue
     if (input_buffer.buf_size <= 0 || input_buffer.buf_data == NULL) {
@@ -1424,6 +1520,7 @@ static void* _dvr_playback_thread(void *arg)
       if (real_read < buf_len) {
         //continue to read data from file
         DVR_PB_INFO("read buf len[%d] is < block size [%d]", real_read, buf_len);
+        _dvr_playback_stats_inc(player, block_waits);
         dvr_mutex_lock(&player->lock);
         _dvr_playback_timeoutwait((DVR_PlaybackHandle_t)player, timeout);
         dvr_mutex_unlock(&player->lock);
@@ -1434,6 +1531,7 @@ static void* _dvr_playback_thread(void *arg)
       }
     }
 
+    stage_start = _dvr_time_getClockUs();
     if (player->dec_func) {
       DVR_CryptoParams_t crypto_params;
 
@@ -1478,6 +1576,8 @@ static void* _dvr_playback_thread(void *arg)
       input_buffer.buf_type = TS_INPUT_BUFFER_TYPE_NORMAL;
       input_buffer.buf_size = len;
     }
+    if (player->dec_func || player->cryptor)
+      _dvr_playback_stats_stage(player, DVR_PLAYBACK_STAGE_DECRYPT, stage_start);
 rewrite:
     if (player->drop_ts == DVR_TRUE) {
       //need drop ts data when seek occur.we need read next loop,drop this ts data
@@ -1492,6 +1592,16 @@ rewrite:
     }
 
     pthread_mutex_lock(&player->segment_lock);
+    if (view && input_buffer.buf_data == view && view_gen != player->segment_gen) {
+      /*the segment was closed since the view was read, its mapping is gone.
+        the data belongs to the segment left by seek or segment change, drop it*/
+      DVR_PB_INFO("segment closed, drop mapped ts data");
+      player->ts_cache_len = 0;
+      pthread_mutex_unlock(&player->segment_lock);
+      real_read = 0;
+      view = NULL;
+      continue;
+    }
     player->ts_cache_len = real_read;
     //used for printf first write data time.
     //to check change channel kpi.
@@ -1500,12 +1610,17 @@ rewrite:
       DVR_PB_INFO("----first write ts data");
     }
 
+    stage_start = _dvr_time_getClockUs();
     ret = AmTsPlayer_writeData(player->handle, &input_buffer, write_timeout_ms);
+    _dvr_playback_stats_stage(player, DVR_PLAYBACK_STAGE_WRITE, stage_start);
     if (ret == AM_TSPLAYER_OK) {
       player->ts_cache_len = 0;
       pthread_mutex_unlock(&player->segment_lock);
       real_read = 0;
       write_success++;
+      pthread_mutex_lock(&player->stats_lock);
+      player->stats.bytes += input_buffer.buf_size;
+      pthread_mutex_unlock(&player->stats_lock);
       if (player->control_speed_enable == 1) {
 check0:
             if (!player->is_running) {
@@ -1522,10 +1637,17 @@ check0:
       }
       //DVR_PB_INFO("write  write_success:%d input_buffer.buf_size:%d", write_success, input_buffer.buf_size);
     } else {
+      if (input_buffer.buf_data == view && view) {
+        /*the view is gone once the segment changes, keep a private copy to rewrite*/
+        memcpy(buf, view, input_buffer.buf_size);
+        input_buffer.buf_data = buf;
+      }
+      view = NULL;
       pthread_mutex_unlock(&player->segment_lock);
       DVR_PB_DEBUG("write time out write_success:%d buf_size:%d systime:%u",
           write_success, input_buffer.buf_size, _dvr_time_getClock());
       write_success = 0;
+      _dvr_playback_stats_inc(player, write_timeouts);
       if (player->control_speed_enable == 1) {
 check1:
         if (!player->is_running) {
@@ -1553,8 +1675,6 @@ check1:
   }
 end:
   DVR_PB_INFO("playback thread is end");
-  free(buf);
-  free(dec_bufs.buf_data);
   return NULL;
 }
 
@@ -1598,6 +1718,7 @@ static int _stop_playback_thread(DVR_PlaybackHandle_t handle)
   if (player->segment_handle) {
     segment_close(player->segment_handle);
     player->segment_handle = NULL;
+    player->segment_gen++;
   }
   DVR_PB_INFO(":end");
   return 0;
@@ -1643,6 +1764,7 @@ int dvr_playback_open(DVR_PlaybackHandle_t *p_handle, DVR_PlaybackOpenParams_t *
 
   dvr_mutex_init(&player->lock);
   pthread_mutex_init(&player->segment_lock, NULL);
+  pthread_mutex_init(&player->stats_lock, NULL);
   pthread_condattr_init(&cattr);
   pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
   pthread_cond_init(&player->cond, &cattr);
@@ -1724,6 +1846,10 @@ int dvr_playback_open(DVR_PlaybackHandle_t *p_handle, DVR_PlaybackOpenParams_t *
   player->drop_ts = DVR_FALSE;
 
   player->fffb_play = DVR_FALSE;
+  player->iframe_trick = DVR_FALSE;
+  memset(&player->iframe_buf, 0, sizeof(player->iframe_buf));
+  memset(&player->thread_buf, 0, sizeof(player->thread_buf));
+  memset(&player->dec_buf, 0, sizeof(player->dec_buf));
 
   player->last_send_time_id = UINT64_MAX;
   player->last_cur_time = 0;
@@ -1781,9 +1907,13 @@ int dvr_playback_close(DVR_PlaybackHandle_t handle) {
   DVR_PB_INFO(":into");
   dvr_mutex_destroy(&player->lock);
   pthread_mutex_destroy(&player->segment_lock);
+  pthread_mutex_destroy(&player->stats_lock);
   pthread_cond_destroy(&player->cond);
 
   if (player) {
+    dvr_block_pool_release(&player->iframe_buf);
+    dvr_block_pool_release(&player->thread_buf);
+    dvr_block_pool_release(&player->dec_buf);
     free(player);
   }
   DVR_PB_INFO(":end");
@@ -3483,6 +3613,7 @@ static int _dvr_playback_fffb_replay(DVR_PlaybackHandle_t handle) {
     return DVR_FAILURE;
   }
 
+  player->iframe_trick = DVR_FALSE;
   //stop
   if (player->has_video) {
     DVR_PB_INFO("fffb stop video");
@@ -3541,8 +3672,81 @@ static int _dvr_playback_fffb_replay(DVR_PlaybackHandle_t handle) {
   return 0;
 }
 
+/* I-frame trick play step. Show the I-frame at the position found by
+ * _dvr_playback_calculate_seekpos, only the bytes of that frame are read.
+ * The decoder is restarted in I-frame only mode when trick play starts,
+ * not on every step. Return DVR_FAILURE to fall back to the replay based
+ * FF/FB, e.g. if the segment has no I-frame index */
+static int _dvr_playback_iframe_step(DVR_PlaybackHandle_t handle) {
+  DVR_Playback_t *player = (DVR_Playback_t *) handle;
+  am_tsplayer_input_buffer input_buffer;
+  Segment_IFrame_t frame;
+  ssize_t len;
+  size_t size;
+  loff_t pos;
+  int ret;
+
+  //the index has clear offsets, encrypted data is played the old way
+  if (player->dec_func || player->cryptor || player->is_secure_mode)
+    return DVR_FAILURE;
+
+  pthread_mutex_lock(&player->segment_lock);
+  if (player->segment_handle == NULL) {
+    pthread_mutex_unlock(&player->segment_lock);
+    return DVR_FAILURE;
+  }
+  pos = segment_tell_position(player->segment_handle);
+  ret = segment_find_iframe(player->segment_handle, pos, IS_FB(player->speed) ? -1 : 1, &frame);
+  if (ret != DVR_SUCCESS) {
+    pthread_mutex_unlock(&player->segment_lock);
+    return DVR_FAILURE;
+  }
+  if (player->iframe_trick && player->iframe_last_id == player->cur_segment_id
+      && player->iframe_last.offset == frame.offset) {
+    //target time has not reached the next I-frame yet
+    pthread_mutex_unlock(&player->segment_lock);
+    return DVR_SUCCESS;
+  }
+
+  size = frame.size > 0 ? frame.size : (player->openParams.block_size > 0 ? player->openParams.block_size : 256 * 1024);
+  if (size > FFFB_IFRAME_MAX_SIZE)
+    size = FFFB_IFRAME_MAX_SIZE;
+  size = size - size % 188;
+  if (size == 0)
+    size = 188;
+  if (!dvr_block_pool_reserve(&player->iframe_buf, size)) {
+    pthread_mutex_unlock(&player->segment_lock);
+    return DVR_FAILURE;
+  }
+  len = segment_pread(player->segment_handle, player->iframe_buf.block, size, frame.offset);
+  pthread_mutex_unlock(&player->segment_lock);
+  if (len <= 0) {
+    DVR_PB_INFO("read I-frame at %lld failed", frame.offset);
+    return DVR_FAILURE;
+  }
+
+  if (!player->iframe_trick) {
+    if (_dvr_playback_fffb_replay(handle) != 0)
+      return DVR_FAILURE;
+    DVR_PB_INFO("enter I-frame trick play speed[%f]", player->speed);
+    AmTsPlayer_setTrickMode(player->handle, AV_VIDEO_TRICK_MODE_IONLY);
+    player->iframe_trick = DVR_TRUE;
+  }
+
+  input_buffer.buf_type = TS_INPUT_BUFFER_TYPE_NORMAL;
+  input_buffer.buf_data = player->iframe_buf.block;
+  input_buffer.buf_size = len;
+  ret = AmTsPlayer_writeData(player->handle, &input_buffer, FFFB_IFRAME_TIME);
+  if (ret != AM_TSPLAYER_OK)
+    DVR_PB_INFO("write I-frame at %lld failed", frame.offset);
+  player->iframe_last = frame;
+  player->iframe_last_id = player->cur_segment_id;
+  return DVR_SUCCESS;
+}
+
 static int _dvr_playback_fffb(DVR_PlaybackHandle_t handle) {
   DVR_Playback_t *player = (DVR_Playback_t *) handle;
+  DVR_Bool_t iframe = DVR_TRUE;
   if (player == NULL) {
     DVR_PB_INFO("player is NULL");
     return DVR_FAILURE;
@@ -3601,10 +3805,19 @@ static int _dvr_playback_fffb(DVR_PlaybackHandle_t handle) {
       }
       return DVR_SUCCESS;
     }
+    //FF reached the end, let the thread read to the end and send the event
+    if (ret != DVR_SUCCESS)
+      iframe = DVR_FALSE;
     _dvr_playback_sent_transition_ok(handle, DVR_FALSE);
     _dvr_init_fffb_time(handle);
     DVR_PB_INFO("*******************send trans ok event  speed [%f]", player->speed);
   }
+  if (iframe && _dvr_playback_iframe_step(handle) == DVR_SUCCESS) {
+    player->next_fffb_time =_dvr_time_getClock() + FFFB_IFRAME_TIME;
+    dvr_mutex_unlock(&player->lock);
+    DVR_PB_DEBUG("unlock");
+    return DVR_SUCCESS;
+  }
   player->next_fffb_time =_dvr_time_getClock() + FFFB_SLEEP_TIME;
   _dvr_playback_fffb_replay(handle);
 
@@ -3624,6 +3837,7 @@ static int _dvr_playback_replay(DVR_PlaybackHandle_t handle, DVR_Bool_t trick) {
     return DVR_FAILURE;
   }
 
+  player->iframe_trick = DVR_FALSE;
   //stop
   if (player->has_video) {
     player->has_video = DVR_FALSE;
@@ -4015,6 +4229,19 @@ int dvr_playback_get_status(DVR_PlaybackHandle_t handle,
   return DVR_SUCCESS;
 }
 
+int dvr_playback_get_stats(DVR_PlaybackHandle_t handle, DVR_PlaybackStats_t *p_stats)
+{
+  DVR_Playback_t *player = (DVR_Playback_t *) handle;
+
+  DVR_RETURN_IF_FALSE(player);
+  DVR_RETURN_IF_FALSE(p_stats);
+
+  pthread_mutex_lock(&player->stats_lock);
+  memcpy(p_stats, &player->stats, sizeof(*p_stats));
+  pthread_mutex_unlock(&player->stats_lock);
+  return DVR_SUCCESS;
+}
+
 void _dvr_dump_segment(DVR_PlaybackSegmentInfo_t *segment) {
   if (segment != NULL) {
     DVR_PB_INFO("segment id: %lld", segment->segment_id);
@@ -4120,23 +4347,15 @@ static int get_effective_tsplayer_delay_time(DVR_Playback_t* play, int *time)
   // is introduced to insure such error condition is handled properly.
   DVR_RETURN_IF_FALSE((delay >= 0) && (delay <= 900*1000));
 
-  if (play->delay_is_effective) {
-    *time = (int)delay;
-    return DVR_SUCCESS;
-  } else if (delay > 0) {
-    *time = (int)delay;
-    play->delay_is_effective=DVR_TRUE;
-    return DVR_SUCCESS;
+  if (!play->delay_is_effective && delay <= 0) {
+    AmTsPlayer_getPts(play->handle, TS_STREAM_AUDIO, &pts_a);
+    AmTsPlayer_getPts(play->handle, TS_STREAM_VIDEO, &pts_v);
+    DVR_RETURN_IF_FALSE((int64_t)pts_a > 0 || (int64_t)pts_v > 0);
   }
 
-  AmTsPlayer_getPts(play->handle, TS_STREAM_AUDIO, &pts_a);
-  AmTsPlayer_getPts(play->handle, TS_STREAM_VIDEO, &pts_v);
-  if ((int64_t)pts_a > 0 || (int64_t)pts_v > 0) {
-    *time = (int)delay;
-    play->delay_is_effective=DVR_TRUE;
-    return DVR_SUCCESS;
-  }
-
-  return DVR_FAILURE;
+  *time = (int)delay;
+  play->delay_is_effective=DVR_TRUE;
+  _dvr_playback_stats_add(play, &play->stats.cache, (uint64_t)delay);
+  return DVR_SUCCESS;
 }
 
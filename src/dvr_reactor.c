@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "dvr_handle_table.h"
+#include "dvr_reactor.h"
+
+/**\brief Reactor source*/
+typedef struct {
+  int                     fd;           /**< Listened fd*/
+  DVR_ReactorFunction_t   fn;           /**< Function called when fd is readable*/
+  void                   *userdata;     /**< Userdata of fn*/
+  DVR_ReactorHandle_t     handle;       /**< Handle of the source, the epoll data of fd*/
+  DVR_Bool_t              busy;         /**< fn is running*/
+  DVR_Bool_t              kicked;       /**< fn must be called again*/
+  DVR_Bool_t              armed;        /**< fd is listened, cleared when fn fails or the source is removed*/
+} DVR_ReactorSource_t;
+
+/* Sources are looked up by handle with reactor_lock held, so an event
+ * received for a removed source is dropped. A source is referenced while
+ * it is dispatched, dvr_reactor_remove waits for it before freeing the
+ * source. The epoll data 0 is the eventfd waking a worker for kicked
+ * sources. */
+static pthread_mutex_t reactor_lock = PTHREAD_MUTEX_INITIALIZER;
+static DVR_HandleTable_t reactor_table = DVR_HANDLE_TABLE_INITIALIZER;
+static int reactor_epfd = -1;
+static int reactor_evtfd = -1;
+static int reactor_workers = -1;
+
+static int reactor_arm(int fd, DVR_ReactorHandle_t handle, int op)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.u64 = (uint64_t)(uintptr_t)handle;
+  if (epoll_ctl(reactor_epfd, op, fd, &ev) == -1) {
+    DVR_ERROR("%s fd:%d op:%d failed, reason:%s", __func__, fd, op, strerror(errno));
+    return DVR_FAILURE;
+  }
+  return DVR_SUCCESS;
+}
+
+/* Run the function of a source until it is not kicked anymore, then listen
+ * to its fd again. Must be called with reactor_lock held, which is released
+ * while the function runs */
+static void reactor_dispatch(DVR_ReactorSource_t *src)
+{
+  int ret;
+
+  src->busy = DVR_TRUE;
+  do {
+    src->kicked = DVR_FALSE;
+    pthread_mutex_unlock(&reactor_lock);
+    ret = src->fn(src->userdata);
+    pthread_mutex_lock(&reactor_lock);
+  } while (ret == DVR_SUCCESS && src->kicked && src->armed);
+  src->busy = DVR_FALSE;
+
+  if (ret != DVR_SUCCESS)
+    src->armed = DVR_FALSE;
+  if (src->armed)
+    reactor_arm(src->fd, src->handle, EPOLL_CTL_MOD);
+}
+
+static void *reactor_worker(void *arg)
+{
+  struct epoll_event ev;
+  DVR_ReactorSource_t *src;
+  uint64_t cnt;
+  int i, n;
+
+  (void)arg;
+  prctl(PR_SET_NAME, "DvrReactor");
+
+  for (;;) {
+    n = epoll_wait(reactor_epfd, &ev, 1, -1);
+    if (n <= 0)
+      continue;
+
+    pthread_mutex_lock(&reactor_lock);
+    if (ev.data.u64 == 0) {
+      read(reactor_evtfd, &cnt, sizeof(cnt));
+      reactor_arm(reactor_evtfd, NULL, EPOLL_CTL_MOD);
+      n = dvr_handle_table_size(&reactor_table);
+      for (i = 0; i < n; i++) {
+        src = (DVR_ReactorSource_t *)dvr_handle_table_at(&reactor_table, i);
+        if (!src)
+          continue;
+        if (src->kicked && src->armed && !src->busy)
+          reactor_dispatch(src);
+        dvr_handle_table_put(&reactor_table, src->handle);
+      }
+    } else {
+      src = (DVR_ReactorSource_t *)dvr_handle_table_get(&reactor_table, (void *)(uintptr_t)ev.data.u64);
+      if (src) {
+        if (src->busy)
+          src->kicked = DVR_TRUE;
+        else if (src->armed)
+          reactor_dispatch(src);
+        dvr_handle_table_put(&reactor_table, src->handle);
+      }
+    }
+    pthread_mutex_unlock(&reactor_lock);
+  }
+  return NULL;
+}
+
+/* Start the workers on first use, they run for the life of the process.
+ * Must be called with reactor_lock held */
+static int reactor_init_locked(void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  int i, n;
+
+  if (reactor_workers >= 0)
+    return reactor_workers;
+
+  reactor_workers = 0;
+  n = dvr_prop_read_int(DVR_REACTOR_PROP, 0);
+  if (n <= 0)
+    return 0;
+  if (n > DVR_REACTOR_MAX_WORKERS)
+    n = DVR_REACTOR_MAX_WORKERS;
+
+  reactor_epfd = epoll_create1(EPOLL_CLOEXEC);
+  reactor_evtfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (reactor_epfd == -1 || reactor_evtfd == -1 ||
+      reactor_arm(reactor_evtfd, NULL, EPOLL_CTL_ADD) != DVR_SUCCESS) {
+    DVR_ERROR("%s create epoll failed, reason:%s", __func__, strerror(errno));
+    goto error;
+  }
+  dvr_handle_table_set_limit(&reactor_table, DVR_HANDLE_TABLE_MAX);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 0; i < n; i++) {
+    if (pthread_create(&thread, &attr, reactor_worker, NULL) != 0)
+      break;
+  }
+  pthread_attr_destroy(&attr);
+  if (i == 0)
+    goto error;
+
+  reactor_workers = i;
+  DVR_INFO("%s reactor started, workers:%d", __func__, reactor_workers);
+  return reactor_workers;
+
+error:
+  if (reactor_epfd != -1)
+    close(reactor_epfd);
+  if (reactor_evtfd != -1)
+    close(reactor_evtfd);
+  reactor_epfd = reactor_evtfd = -1;
+  return 0;
+}
+
+int dvr_reactor_get_workers(void)
+{
+  int n;
+
+  pthread_mutex_lock(&reactor_lock);
+  n = reactor_init_locked();
+  pthread_mutex_unlock(&reactor_lock);
+  return n;
+}
+
+int dvr_reactor_add(int fd, DVR_ReactorFunction_t fn, void *userdata, DVR_ReactorHandle_t *p_handle)
+{
+  DVR_ReactorSource_t *src;
+
+  DVR_RETURN_IF_FALSE(fd != -1);
+  DVR_RETURN_IF_FALSE(fn);
+  DVR_RETURN_IF_FALSE(p_handle);
+
+  src = (DVR_ReactorSource_t *)calloc(1, sizeof(DVR_ReactorSource_t));
+  DVR_RETURN_IF_FALSE(src);
+  src->fd = fd;
+  src->fn = fn;
+  src->userdata = userdata;
+  src->armed = DVR_TRUE;
+
+  pthread_mutex_lock(&reactor_lock);
+  if (reactor_init_locked() <= 0 ||
+      dvr_handle_table_add(&reactor_table, src, &src->handle, NULL) != DVR_SUCCESS) {
+    pthread_mutex_unlock(&reactor_lock);
+    free(src);
+    return DVR_FAILURE;
+  }
+  if (reactor_arm(fd, src->handle, EPOLL_CTL_ADD) != DVR_SUCCESS) {
+    dvr_handle_table_remove(&reactor_table, src->handle);
+    pthread_mutex_unlock(&reactor_lock);
+    free(src);
+    return DVR_FAILURE;
+  }
+  *p_handle = src->handle;
+  pthread_mutex_unlock(&reactor_lock);
+  return DVR_SUCCESS;
+}
+
+int dvr_reactor_kick(DVR_ReactorHandle_t handle)
+{
+  DVR_ReactorSource_t *src;
+  uint64_t cnt = 1;
+
+  pthread_mutex_lock(&reactor_lock);
+  src = (DVR_ReactorSource_t *)dvr_handle_table_get(&reactor_table, handle);
+  if (!src) {
+    pthread_mutex_unlock(&reactor_lock);
+    return DVR_FAILURE;
+  }
+  src->kicked = DVR_TRUE;
+  if (!src->busy)
+    write(reactor_evtfd, &cnt, sizeof(cnt));
+  dvr_handle_table_put(&reactor_table, handle);
+  pthread_mutex_unlock(&reactor_lock);
+  return DVR_SUCCESS;
+}
+
+int dvr_reactor_remove(DVR_ReactorHandle_t handle)
+{
+  DVR_ReactorSource_t *src;
+
+  pthread_mutex_lock(&reactor_lock);
+  src = (DVR_ReactorSource_t *)dvr_handle_table_get(&reactor_table, handle);
+  if (!src) {
+    pthread_mutex_unlock(&reactor_lock);
+    return DVR_FAILURE;
+  }
+  epoll_ctl(reactor_epfd, EPOLL_CTL_DEL, src->fd, NULL);
+  src->armed = DVR_FALSE;
+  dvr_handle_table_put(&reactor_table, handle);
+  pthread_mutex_unlock(&reactor_lock);
+
+  /* Wait for a running dispatch without reactor_lock, which the dispatch
+   * takes to return. Only the caller removing the handle frees the source */
+  DVR_RETURN_IF_FALSE(dvr_handle_table_remove(&reactor_table, handle) == DVR_SUCCESS);
+  free(src);
+  return DVR_SUCCESS;
+}
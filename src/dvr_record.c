@@ -1,26 +1,42 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include "dvr_types.h"
+#include "dvr_utils.h"
 #include "dvr_record.h"
 #include "dvr_crypto.h"
 #include "dvb_utils.h"
 #include "record_device.h"
 #include <sys/time.h>
+#include <time.h>
 #include <sys/prctl.h>
 #include "am_crypt.h"
 
 #include "segment.h"
 #include "segment_dataout.h"
+#include "ts_pid_set.h"
+#include "ts_indexer.h"
+#include "dvr_handle_table.h"
+#include "dvr_block_pool.h"
+#include "dvr_reactor.h"
 
 #define CHECK_PTS_MAX_COUNT  (20)
 
 //#define DEBUG_PERFORMANCE
-#define MAX_DVR_RECORD_SESSION_COUNT 4
 #define RECORD_BLOCK_SIZE (256 * 1024)
 #define NEW_DEVICE_RECORD_BLOCK_SIZE (1024 * 188)
+#define RECORD_SPLICE_PROP "vendor.tv.libdvr.splice"
+#define RECORD_SPLICE_WINDOW (64 * 1024)
+#define RECORD_PCR_HITS_MAX (64)
+#define RECORD_PID_FILTER_PROP "vendor.tv.libdvr.pidfilter"
+#define DVR_STORE_INFO_TIME (400)
+#define RECORD_SECURE_WAIT_MAX (40)
 
 /**\brief DVR index file type*/
 typedef enum {
@@ -51,6 +67,48 @@ typedef struct {
   uint32_t data_end;                                                         /**< Secure mode record buffer length*/
 } DVR_NewDmxSecureBuffer_t;
 
+/**\brief PCR found by the packet scan*/
+typedef struct {
+  loff_t pos;                                                           /**< Packet position in the segment*/
+  uint64_t pcr;                                                         /**< PCR base, 90KHz*/
+} DVR_RecordPcrHit_t;
+
+/**\brief DVR record zero-copy pipes*/
+typedef struct {
+  int data[2];                                                          /**< Pipe moving data from the device to the segment*/
+  int copy[2];                                                          /**< Pipe holding the tee'd copy used for indexing*/
+  size_t size;                                                          /**< Max length moved at once*/
+  size_t len;                                                           /**< Data length in the data pipe, not written yet*/
+  size_t index_len;                                                     /**< Data length copied to user space for indexing*/
+  DVR_Bool_t failed;                                                    /**< Splice is not supported, fall back to read and write*/
+} DVR_RecordSplice_t;
+
+/**\brief DVR record loop state, kept between two blocks*/
+typedef struct {
+  DVR_Bool_t                      started;                              /**< The loop is set up*/
+  uint8_t                         *buf;                                 /**< Input buffer*/
+  uint8_t                         *buf_out;                             /**< Output buffer*/
+  struct timespec                 start_ts;                             /**< Start of the local clock time index*/
+  struct timespec                 start_no_pcr_ts;                      /**< Time of the last block with a PCR*/
+  int                             pcr_rec_len;                          /**< Duration indexed by PCR before the local clock is used*/
+  time_t                          pre_time;                             /**< Duration when the segment info was last stored*/
+  DVR_SecureBuffer_t              secure_buf;                           /**< Secure buffer of the last block*/
+  DVR_NewDmxSecureBuffer_t        new_dmx_secure_buf;                   /**< New dmx secure buffer of the last block*/
+  DVR_Bool_t                      first_read;                           /**< The first block was recorded*/
+  DVR_RecordSplice_t              splice;                               /**< Zero-copy pipes*/
+  DVR_Bool_t                      zero_copy;                            /**< Splice is used*/
+  struct timespec                 secure_ts;                            /**< Time of the last secure demux read*/
+  int                             secure_wait;                          /**< Wait before the next secure demux read in ms*/
+} DVR_RecordLoop_t;
+
+/**\brief Result of one record loop step*/
+typedef enum {
+  RECORD_STEP_DATA,                                                     /**< A block was recorded*/
+  RECORD_STEP_NO_DATA,                                                  /**< Nothing was read, the read waited for the timeout*/
+  RECORD_STEP_IDLE,                                                     /**< The block was dropped, e.g. when paused*/
+  RECORD_STEP_END                                                       /**< The record ended on a write error*/
+} DVR_RecordStep_t;
+
 /**\brief DVR record context*/
 typedef struct {
   pthread_t                       thread;                               /**< DVR thread handle*/
@@ -80,8 +138,39 @@ typedef struct {
   int                             notification_time;                    /**< DVR record notification time*/
   time_t                          last_send_time;                       /**< Last send notify segment duration */
   loff_t                          guarded_segment_size;                 /**< Guarded segment size in bytes. Libdvr will be forcely stopped to write anymore if current segment reaches this size*/
+  loff_t                          segment_size;                         /**< Expected segment size in bytes, passed to segment as preallocation hint*/
+  DVR_Bool_t                      direct_io;                            /**< Write segment TS files with O_DIRECT*/
+  loff_t                          ring_size;                            /**< Ring file size in bytes, 0 to use one TS file per segment*/
+  DVR_Bool_t                      zero_copy;                            /**< Splice clear data from the device to the segment*/
+  TS_PidSet_t                     pid_set;                              /**< Pids of segment_info*/
+  DVR_Bool_t                      pid_filter;                           /**< Drop packets of other pids before recording them*/
+  DVR_Bool_t                      whole_ts;                             /**< TS_PID_ALL is recorded, so no packet is dropped*/
+  DVR_RecordPcrHit_t              *pcr_hits;                            /**< PCRs found in the last block*/
+  int                             pcr_hit_nb;                           /**< Number of pcr_hits*/
+  int                             pcr_hit_cap;                          /**< Allocated number of pcr_hits*/
+  DVR_RecordHandle_t              handle;                               /**< Handle of the session*/
+  DVR_BlockReserve_t              buf_in;                               /**< Record thread input buffer*/
+  DVR_BlockReserve_t              buf_out;                              /**< Record thread output buffer*/
+  pthread_mutex_t                 stats_lock;                           /**< Protects stats*/
+  DVR_RecordStats_t               stats;                                /**< Record loop statistics*/
+  DVR_Bool_t                      accurate;                             /**< Build the I-frame index of clear data, DVR_RECORD_FLAG_ACCURATE*/
+  TS_Indexer_t                    ts_indexer;                           /**< TS indexer of the current segment, used if accurate*/
+  Segment_IFrame_t                iframe;                               /**< Last I-frame found, saved when its size is known*/
+  DVR_Bool_t                      iframe_pending;                       /**< iframe is not saved yet*/
   size_t                          secbuf_size;                          /**< DVR record secure buffer length*/
+  DVR_Bool_t                      secure_batch;                         /**< Pace the secure demux reads on the data rate, RECORD_DEVICE_SECURE_BATCH_PROP*/
   DVR_Bool_t                      discard_coming_data;                  /**< Whether to discard subsequent recording data due to exceeding total size limit too much.*/
+  pthread_mutex_t                 rollover_lock;                        /**< Protects the segment rollover fields below*/
+  pthread_cond_t                  rollover_cond;                        /**< Signaled when the record thread switched segment or exited*/
+  DVR_Bool_t                      rollover_pending;                     /**< A pre-opened next segment is waiting for the record thread*/
+  DVR_Bool_t                      thread_running;                       /**< Record thread, or reactor source, is running*/
+  DVR_RecordLoop_t                loop;                                 /**< Record loop state*/
+  DVR_ReactorHandle_t             reactor;                              /**< Reactor source running the loop, NULL if a thread runs it*/
+  Segment_Handle_t                next_segment_handle;                  /**< Pre-opened next segment*/
+  DVR_RecordSegmentStartParams_t  next_segment_params;                  /**< Start parameters of the next segment*/
+  DVR_RecordSegmentInfo_t         next_segment_info;                    /**< Initial info of the next segment*/
+  Segment_Handle_t                prev_segment_handle;                  /**< Segment switched away from, closed by dvr_record_next_segment*/
+  DVR_RecordSegmentInfo_t         prev_segment_info;                    /**< Final info of prev_segment_handle*/
   Segment_Ops_t                   segment_ops;
   struct list_head                segment_ctrls;
 } DVR_RecordContext_t;
@@ -109,14 +198,18 @@ typedef struct {
 
 extern ssize_t record_device_read_ext(Record_DeviceHandle_t handle, size_t *buf, size_t *len);
 
-static DVR_RecordContext_t record_ctx[MAX_DVR_RECORD_SESSION_COUNT] = {
-  {
-    .state = DVR_RECORD_STATE_CLOSED
-  },
-  {
-    .state = DVR_RECORD_STATE_CLOSED
-  }
-};
+static DVR_HandleTable_t record_table = DVR_HANDLE_TABLE_INITIALIZER;
+
+/* Get a record context, it is not freed until it is put back */
+static inline DVR_RecordContext_t *record_get_ctx(DVR_RecordHandle_t handle)
+{
+  return (DVR_RecordContext_t *)dvr_handle_table_get(&record_table, handle);
+}
+
+static inline void record_put_ctx(DVR_RecordContext_t *p_ctx)
+{
+  dvr_handle_table_put(&record_table, p_ctx->handle);
+}
 
 
 static int record_set_segment_ops(DVR_RecordContext_t *p_ctx, int flags)
@@ -147,8 +240,11 @@ static int record_set_segment_ops(DVR_RecordContext_t *p_ctx, int flags)
     _SET(close);
     _SET(read);
     _SET(write);
+    _SET(splice);
     _SET(update_pts);
     _SET(update_pts_force);
+    _SET(update_iframe);
+    _SET(find_iframe);
     _SET(seek);
     _SET(tell_position);
     _SET(tell_position_time);
@@ -162,166 +258,585 @@ static int record_set_segment_ops(DVR_RecordContext_t *p_ctx, int flags)
     _SET(ongoing);
     _SET(get_cur_segment_size);
     _SET(get_cur_segment_id);
+    _SET(get_write_stats);
     #undef _SET
   }
   return DVR_SUCCESS;
 }
 
-static int record_is_valid_pid(DVR_RecordContext_t *p_ctx, int pid)
+static void record_update_pid_set(DVR_RecordContext_t *p_ctx)
 {
   int i;
 
+  ts_pid_set_init(&p_ctx->pid_set);
+  p_ctx->whole_ts = DVR_FALSE;
   for (i = 0; i < p_ctx->segment_info.nb_pids; i++) {
-    if (pid == p_ctx->segment_info.pids[i].pid)
-      return 1;
+    if (p_ctx->segment_info.pids[i].pid == TS_PID_ALL)
+      p_ctx->whole_ts = DVR_TRUE;
+    else
+      ts_pid_set_add(&p_ctx->pid_set, p_ctx->segment_info.pids[i].pid, i);
   }
-  return 0;
 }
 
-static int record_save_pcr(DVR_RecordContext_t *p_ctx, uint8_t *buf, loff_t pos)
+/* Save the pending I-frame, its data ends at end */
+static void record_save_iframe(DVR_RecordContext_t *p_ctx, loff_t end)
 {
-  uint8_t *p = buf;
-  int len;
-  uint8_t afc;
-  uint64_t pcr = 0;
-  int has_pcr = 0;
-  int pid;
-  int adp_field_len;
-
   SEG_CALL_INIT(&p_ctx->segment_ops);
 
-  pid = ((p[1] & 0x1f) << 8) | p[2];
-  if (pid == 0x1fff || !record_is_valid_pid(p_ctx, pid))
-    return has_pcr;
-
-  //scramble = p[3] >> 6;
-  //cc = p[3] & 0x0f;
-  afc = (p[3] >> 4) & 0x03;
-
-  p += 4;
-  len = 184;
-
-  if (afc & 2) {
-    adp_field_len = p[0];
-    /* Skip adaptation len */
-    p++;
-    len--;
-    /* Parse pcr field, see 13818 spec table I-2-6,adaptation_field */
-    if (p[0] & 0x10 && len >= 6 && adp_field_len >= 6) {
-    /* get pcr value,pcr is 33bit value */
-    pcr = (((uint64_t)(p[1])) << 25)
-        | (((uint64_t)p[2]) << 17)
-        | (((uint64_t)(p[3])) << 9)
-        | (((uint64_t)p[4]) << 1)
-        | ((((uint64_t)p[5]) & 0x80) >> 7);
-      has_pcr = 1;
+  if (!p_ctx->iframe_pending)
+    return;
+  p_ctx->iframe_pending = DVR_FALSE;
+  if (end > p_ctx->iframe.offset && end - p_ctx->iframe.offset <= UINT32_MAX)
+    p_ctx->iframe.size = end - p_ctx->iframe.offset;
+  SEG_CALL(update_iframe, (p_ctx->segment_handle, p_ctx->iframe.pts, p_ctx->iframe.offset, p_ctx->iframe.size));
+}
+
+static void record_ts_indexer_cb(TS_Indexer_t *ts_indexer, TS_Indexer_Event_t *event)
+{
+  DVR_RecordContext_t *p_ctx;
+
+  p_ctx = (DVR_RecordContext_t *)((uint8_t *)ts_indexer - offsetof(DVR_RecordContext_t, ts_indexer));
+
+  switch (event->type) {
+    case TS_INDEXER_EVENT_TYPE_START_INDICATOR:
+      /* The next video PES ends the I-frame */
+      if (p_ctx->iframe_pending && event->pid == ts_indexer->video_parser.pid
+          && (loff_t)event->offset > p_ctx->iframe.offset)
+        record_save_iframe(p_ctx, event->offset);
+      break;
+    case TS_INDEXER_EVENT_TYPE_MPEG2_I_FRAME:
+    case TS_INDEXER_EVENT_TYPE_AVC_I_SLICE:
+    case TS_INDEXER_EVENT_TYPE_HEVC_BLA_W_LP:
+    case TS_INDEXER_EVENT_TYPE_HEVC_BLA_W_RADL:
+    case TS_INDEXER_EVENT_TYPE_HEVC_BLA_N_LP:
+    case TS_INDEXER_EVENT_TYPE_HEVC_IDR_W_RADL:
+    case TS_INDEXER_EVENT_TYPE_HEVC_IDR_N_LP:
+    case TS_INDEXER_EVENT_TYPE_HEVC_TRAIL_CRA:
+      /* Every slice of a frame reports the same PES offset */
+      if (p_ctx->iframe_pending && (loff_t)event->offset == p_ctx->iframe.offset)
+        break;
+      record_save_iframe(p_ctx, 0);
+      memset(&p_ctx->iframe, 0, sizeof(p_ctx->iframe));
+      p_ctx->iframe.pts = event->pts;
+      p_ctx->iframe.offset = event->offset;
+      p_ctx->iframe_pending = DVR_TRUE;
+      break;
+    default:
+      break;
+  }
+}
+
+/* Restart the TS indexer on the video pid of segment_info, the offsets of
+ * its events are relative to the current segment */
+static void record_reset_indexer(DVR_RecordContext_t *p_ctx)
+{
+  TS_Indexer_StreamFormat_t format;
+  int i, type;
+
+  if (!p_ctx->accurate)
+    return;
+
+  p_ctx->iframe_pending = DVR_FALSE;
+  ts_indexer_init(&p_ctx->ts_indexer);
+  ts_indexer_set_event_callback(&p_ctx->ts_indexer, record_ts_indexer_cb);
+  for (i = 0; i < p_ctx->segment_info.nb_pids; i++) {
+    type = (p_ctx->segment_info.pids[i].type >> 24) & 0x0f;
+    if (type != DVR_STREAM_TYPE_VIDEO)
+      continue;
+
+    switch (p_ctx->segment_info.pids[i].type & 0xffffff) {
+      case DVR_VIDEO_FORMAT_MPEG1:
+      case DVR_VIDEO_FORMAT_MPEG2:
+        format = TS_INDEXER_VIDEO_FORMAT_MPEG2;
+        break;
+      case DVR_VIDEO_FORMAT_H264:
+        format = TS_INDEXER_VIDEO_FORMAT_H264;
+        break;
+      case DVR_VIDEO_FORMAT_HEVC:
+        format = TS_INDEXER_VIDEO_FORMAT_HEVC;
+        break;
+      default:
+        DVR_INFO("%s video format of pid %d can not be indexed", __func__,
+            p_ctx->segment_info.pids[i].pid);
+        return;
     }
+    ts_indexer_set_video_format(&p_ctx->ts_indexer, format);
+    ts_indexer_set_video_pid(&p_ctx->ts_indexer, p_ctx->segment_info.pids[i].pid);
+    return;
+  }
+}
 
-    len -= adp_field_len;
+/* Run the TS indexer on a block just written at segment position pos */
+static void record_do_iframe_index(DVR_RecordContext_t *p_ctx, uint8_t *buf, int len, loff_t pos)
+{
+  /* Follow the segment position, so a block which is not packet aligned
+   * does not shift the offsets of later frames */
+  p_ctx->ts_indexer.offset = pos;
+  ts_indexer_parse(&p_ctx->ts_indexer, buf, len);
+}
 
-    if (len < 0) {
-      DVR_INFO("parser pcr: illegal adaptation field length");
-      return 0;
+/* Drop the packets of pids which are not recorded, in place. Data out of
+ * sync is kept as it is. Return the new length */
+static int record_drop_pids(DVR_RecordContext_t *p_ctx, uint8_t *buf, int len)
+{
+  uint8_t *p = buf, *end = buf + len, *out = buf, *q;
+  size_t n;
+
+  while (end - p >= 188) {
+    if (p[0] != 0x47) {
+      q = memchr(p, 0x47, end - p - 187);
+      n = q ? (size_t)(q - p) : (size_t)(end - p - 187);
+    } else if (ts_pid_set_has(&p_ctx->pid_set, TS_PKT_PID(p))) {
+      n = 188;
+    } else {
+      p += 188;
+      continue;
     }
+    if (out != p)
+      memmove(out, p, n);
+    out += n;
+    p += n;
   }
+  if (p < end) {
+    if (out != p)
+      memmove(out, p, end - p);
+    out += end - p;
+  }
+  return out - buf;
+}
+
+/* Make room for one more PCR hit, the array grows when a block carries
+ * more PCRs than it holds */
+static DVR_RecordPcrHit_t *record_pcr_hit_slot(DVR_RecordContext_t *p_ctx, int nb)
+{
+  DVR_RecordPcrHit_t *hits;
+  int cap;
+
+  if (nb < p_ctx->pcr_hit_cap)
+    return &p_ctx->pcr_hits[nb];
+
+  cap = p_ctx->pcr_hit_cap ? p_ctx->pcr_hit_cap * 2 : RECORD_PCR_HITS_MAX;
+  hits = (DVR_RecordPcrHit_t *)realloc(p_ctx->pcr_hits, cap * sizeof(DVR_RecordPcrHit_t));
+  if (!hits)
+    return NULL;
+  if (p_ctx->pcr_hit_cap)
+    DVR_INFO("%s more than %d PCRs in a block, grow to %d", __func__, p_ctx->pcr_hit_cap, cap);
+  p_ctx->pcr_hits = hits;
+  p_ctx->pcr_hit_cap = cap;
+  return &p_ctx->pcr_hits[nb];
+}
+
+/* Scan a block for PCRs of the recorded pids, the hits are stored in
+ * p_ctx->pcr_hits. Packets are walked at a 188-byte stride, only their
+ * header and adaptation flags are looked at. Lost sync is recovered with
+ * memchr, which is vectorized by the C library */
+static int record_scan_pcr(DVR_RecordContext_t *p_ctx, uint8_t *buf, int len, loff_t pos)
+{
+  uint8_t *p = buf, *end = buf + len, *q;
+  DVR_RecordPcrHit_t *hit;
+  int pid, nb = 0;
+
+  while (end - p >= 188) {
+    if (p[0] != 0x47) {
+      q = memchr(p, 0x47, end - p - 187);
+      if (!q)
+        break;
+      pos += q - p;
+      p = q;
+      continue;
+    }
+
+    /* Adaptation field present, long enough for a PCR and carrying the
+     * PCR flag, see 13818 spec table I-2-6, adaptation_field */
+    if ((p[3] & 0x20) && p[4] >= 6 && p[4] <= 183 && (p[5] & 0x10)) {
+      pid = TS_PKT_PID(p);
+      if (ts_pid_set_has(&p_ctx->pid_set, pid)) {
+        hit = record_pcr_hit_slot(p_ctx, nb);
+        if (!hit) {
+          /* Out of memory, the newest PCR replaces the last one */
+          DVR_WARN("%s can not grow the PCR hits, replace the last one at %lld", __func__, pos);
+          if (nb == 0)
+            break;
+          hit = &p_ctx->pcr_hits[nb - 1];
+        } else {
+          nb++;
+        }
+        /* get pcr value,pcr is 33bit value */
+        hit->pcr = (((uint64_t)(p[6])) << 25)
+            | (((uint64_t)p[7]) << 17)
+            | (((uint64_t)(p[8])) << 9)
+            | (((uint64_t)p[9]) << 1)
+            | ((((uint64_t)p[10]) & 0x80) >> 7);
+        hit->pos = pos;
+      }
+    }
+    p += 188;
+    pos += 188;
+  }
+  p_ctx->pcr_hit_nb = nb;
+  return nb;
+}
+
+/* Save the PCRs found by the last record_scan_pcr to the time index */
+static void record_save_pcr_hits(DVR_RecordContext_t *p_ctx)
+{
+  uint64_t pts;
+  int i;
 
-  if (has_pcr && p_ctx->index_type == DVR_INDEX_TYPE_PCR) {
+  SEG_CALL_INIT(&p_ctx->segment_ops);
+
+  if (p_ctx->index_type != DVR_INDEX_TYPE_PCR)
+    return;
+
+  for (i = 0; i < p_ctx->pcr_hit_nb; i++) {
+    pts = p_ctx->pcr_hits[i].pcr/90;
     //save newest pcr
-    if (p_ctx->pts == pcr/90 &&
+    if (p_ctx->pts == pts &&
       p_ctx->check_pts_count < CHECK_PTS_MAX_COUNT) {
       p_ctx->check_pts_count ++;
     }
-    p_ctx->pts = pcr/90;
+    p_ctx->pts = pts;
 
-    SEG_CALL(update_pts, (p_ctx->segment_handle, pcr/90, pos));
+    SEG_CALL(update_pts, (p_ctx->segment_handle, pts, p_ctx->pcr_hits[i].pos));
   }
-  return has_pcr;
 }
 
-static int record_do_pcr_index(DVR_RecordContext_t *p_ctx, uint8_t *buf, int len)
+/* Index the PCRs in the first len bytes of the last written block of
+ * block_len bytes */
+static int record_do_pcr_index(DVR_RecordContext_t *p_ctx, uint8_t *buf, int len, int block_len)
 {
-  uint8_t *p = buf;
-  int left = len;
   loff_t pos;
-  int has_pcr = 0;
 
   SEG_CALL_INIT(&p_ctx->segment_ops);
 
+  p_ctx->pcr_hit_nb = 0;
   SEG_CALL_RET_VALID(tell_position, (p_ctx->segment_handle), pos, -1);
 
   if (pos == -1)
-      return has_pcr;
+      return 0;
 
-  if (pos >= len) {
-    pos = pos - len;
+  if (pos >= block_len) {
+    pos = pos - block_len;
   }
-  while (left >= 188) {
-    if (*p == 0x47) {
-      has_pcr |= record_save_pcr(p_ctx, p, pos);
-      p += 188;
-      left -= 188;
-      pos += 188;
-    } else {
-      p++;
-      left --;
-      pos++;
+  if (record_scan_pcr(p_ctx, buf, len, pos) == 0)
+    return 0;
+  record_save_pcr_hits(p_ctx);
+  return 1;
+}
+
+static int get_diff_time(struct timespec start_ts, struct timespec end_ts)
+{
+  return end_ts.tv_sec * 1000 + end_ts.tv_nsec / 1000000 - start_ts.tv_sec * 1000 - start_ts.tv_nsec / 1000000;
+}
+
+/* Copy the write-behind statistics of the current segment, called by the
+ * record loop which owns the segment handle */
+static void record_update_write_stats(DVR_RecordContext_t *p_ctx)
+{
+  Segment_WriteStats_t ws;
+
+  SEG_CALL_INIT(&p_ctx->segment_ops);
+
+  if (!SEG_CALL_IS_VALID(get_write_stats))
+    return;
+  memset(&ws, 0, sizeof(ws));
+  SEG_CALL(get_write_stats, (p_ctx->segment_handle, &ws));
+
+  pthread_mutex_lock(&p_ctx->stats_lock);
+  p_ctx->stats.write.queue_size = ws.queue_size;
+  p_ctx->stats.write.high_water = ws.high_water;
+  p_ctx->stats.write.full_count = ws.full_count;
+  p_ctx->stats.write.max_write_ms = ws.max_write_ms;
+  p_ctx->stats.write.pending = ws.pending;
+  pthread_mutex_unlock(&p_ctx->stats_lock);
+}
+
+/* Add a sample to a stage histogram, must be called with stats_lock held */
+static void record_stats_add(DVR_RecordStageStats_t *p_stage, const struct timespec *start, const struct timespec *end)
+{
+  int64_t us;
+  int bucket;
+
+  us = (int64_t)(end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+  if (us < 0)
+    us = 0;
+  bucket = us ? 64 - __builtin_clzll((uint64_t)us) : 0;
+  if (bucket >= DVR_RECORD_STATS_BUCKETS)
+    bucket = DVR_RECORD_STATS_BUCKETS - 1;
+
+  p_stage->count++;
+  p_stage->total_us += us;
+  if (us > p_stage->max_us)
+    p_stage->max_us = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+  p_stage->buckets[bucket]++;
+}
+
+static ssize_t record_pipe_read(int fd, uint8_t *buf, size_t len)
+{
+  size_t done = 0;
+  ssize_t ret;
+
+  while (done < len) {
+    ret = read(fd, buf + done, len - done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    done += ret;
+  }
+  return done;
+}
+
+static void record_splice_close(DVR_RecordSplice_t *sp)
+{
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (sp->data[i] != -1)
+      close(sp->data[i]);
+    if (sp->copy[i] != -1)
+      close(sp->copy[i]);
+    sp->data[i] = sp->copy[i] = -1;
+  }
+}
+
+static int record_splice_open(DVR_RecordSplice_t *sp, size_t size)
+{
+  int data_size, copy_size;
+
+  memset(sp, 0, sizeof(*sp));
+  sp->data[0] = sp->data[1] = sp->copy[0] = sp->copy[1] = -1;
+  if (pipe2(sp->data, O_CLOEXEC) == -1 || pipe2(sp->copy, O_CLOEXEC) == -1) {
+    DVR_ERROR("%s pipe failed, reason:%s", __func__, strerror(errno));
+    record_splice_close(sp);
+    return DVR_FAILURE;
+  }
+  /* Both pipes must hold a whole block, so tee never returns short */
+  data_size = fcntl(sp->data[1], F_SETPIPE_SZ, size);
+  copy_size = fcntl(sp->copy[1], F_SETPIPE_SZ, size);
+  if (data_size <= 0 || copy_size <= 0) {
+    data_size = fcntl(sp->data[1], F_GETPIPE_SZ);
+    copy_size = fcntl(sp->copy[1], F_GETPIPE_SZ);
+  }
+  sp->size = size;
+  if (data_size > 0 && (size_t)data_size < sp->size)
+    sp->size = data_size;
+  if (copy_size > 0 && (size_t)copy_size < sp->size)
+    sp->size = copy_size;
+  DVR_INFO("%s zero copy record, block:%zu", __func__, sp->size);
+  return DVR_SUCCESS;
+}
+
+/* Move one block from the device into the data pipe, and read the first
+ * window bytes of its tee'd copy into buf for indexing, sp->index_len is
+ * set to the length read. If the copy is short, the whole block is read
+ * from the pipe instead and sp->len is 0 */
+static ssize_t record_splice_in(DVR_RecordContext_t *p_ctx, DVR_RecordSplice_t *sp, uint8_t *buf,
+    size_t window, int timeout)
+{
+  ssize_t len, copied;
+
+  errno = 0;
+  len = record_device_splice(p_ctx->dev_handle, sp->data[1], sp->size, timeout);
+  if (len == DVR_FAILURE) {
+    if (errno == EINVAL) {
+      DVR_WARN("%s device can not splice, use read", __func__);
+      sp->failed = DVR_TRUE;
     }
+    return DVR_FAILURE;
   }
-  return has_pcr;
+
+  if (window > (size_t)len)
+    window = len;
+  copied = tee(sp->data[0], sp->copy[1], window, 0);
+  if (copied == (ssize_t)window) {
+    sp->len = len;
+    sp->index_len = record_pipe_read(sp->copy[0], buf, window);
+    return len;
+  }
+  if (copied > 0)
+    record_pipe_read(sp->copy[0], buf, copied);
+  sp->len = 0;
+  len = record_pipe_read(sp->data[0], buf, len);
+  sp->index_len = len;
+  return len;
 }
 
-static int get_diff_time(struct timeval start_tv, struct timeval end_tv)
+/* Write the block in the data pipe to the segment. What could not be
+ * spliced is read from the pipe into buf and written */
+static ssize_t record_splice_out(DVR_RecordContext_t *p_ctx, DVR_RecordSplice_t *sp,
+    uint8_t *buf, size_t len)
 {
-  return end_tv.tv_sec * 1000 + end_tv.tv_usec / 1000 - start_tv.tv_sec * 1000 - start_tv.tv_usec / 1000;
+  ssize_t moved = 0, ret = 0;
+
+  SEG_CALL_INIT(&p_ctx->segment_ops);
+
+  if (sp->len > 0) {
+    SEG_CALL_RET(splice, (p_ctx->segment_handle, sp->data[0], sp->len), moved);
+    if (moved < 0) {
+      if (errno == ENOTSUP) {
+        DVR_WARN("%s segment can not splice, use write", __func__);
+        sp->failed = DVR_TRUE;
+      }
+      moved = 0;
+    }
+    if ((size_t)moved < sp->len)
+      len = moved + record_pipe_read(sp->data[0], buf + moved, sp->len - moved);
+    sp->len = 0;
+  }
+  if ((size_t)moved < len)
+    SEG_CALL_RET(write, (p_ctx->segment_handle, buf + moved, len - moved), ret);
+  return (ret < 0) ? ret : (ssize_t)len;
 }
 
-void *record_thread(void *arg)
+/* Drop a block left in the data pipe, e.g. when it is not recorded */
+static void record_splice_drain(DVR_RecordSplice_t *sp, uint8_t *scratch)
 {
-  DVR_RecordContext_t *p_ctx = (DVR_RecordContext_t *)arg;
-  ssize_t len;
-  uint8_t *buf, *buf_out;
-  uint32_t block_size = p_ctx->block_size;
-  loff_t pos = 0;
+  if (sp->len > 0) {
+    record_pipe_read(sp->data[0], scratch, sp->len);
+    sp->len = 0;
+  }
+}
+
+/* Flush the index and information of the current segment before it is
+ * closed, the final segment info is returned in p_info */
+static int record_finish_segment(DVR_RecordContext_t *p_ctx, DVR_RecordSegmentInfo_t *p_info)
+{
+  loff_t pos;
   int ret = DVR_SUCCESS;
-  struct timespec start_ts, end_ts, start_no_pcr_ts, end_no_pcr_ts;
-  DVR_RecordStatus_t record_status;
-  int has_pcr;
-  int pcr_rec_len = 0;
-  DVR_Bool_t guarded_size_exceeded = DVR_FALSE;
 
-  time_t pre_time = 0;
-  #define DVR_STORE_INFO_TIME (400)
-  DVR_SecureBuffer_t secure_buf = {0,0};
-  DVR_NewDmxSecureBuffer_t new_dmx_secure_buf;
-  int first_read = 0;
+  SEG_CALL_INIT(&p_ctx->segment_ops);
+
+  //add index file store
+  if (SEG_CALL_IS_VALID(update_pts_force)) {
+    SEG_CALL_RET_VALID(tell_position, (p_ctx->segment_handle), pos, -1);
+    if (pos != -1) {
+      SEG_CALL(update_pts_force, (p_ctx->segment_handle, p_ctx->segment_info.duration, pos));
+      record_save_iframe(p_ctx, pos);
+    }
+  }
+
+  SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_ctx->segment_info.duration);
+
+  /*Update segment info*/
+  memcpy(p_info, &p_ctx->segment_info, sizeof(p_ctx->segment_info));
+
+  SEG_CALL_RET(store_info, (p_ctx->segment_handle, p_info), ret);
+  DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
+
+  SEG_CALL(store_allInfo, (p_ctx->segment_handle, p_info));
+  return DVR_SUCCESS;
+}
 
+/* Switch to the pre-opened next segment between two reads, so the device
+ * is drained without a gap. Must be called with rollover_lock held, either
+ * by the record thread or after it exited */
+static DVR_Bool_t record_switch_segment_locked(DVR_RecordContext_t *p_ctx)
+{
   SEG_CALL_INIT(&p_ctx->segment_ops);
 
-  prctl(PR_SET_NAME,"DvrRecording");
+  if (!p_ctx->rollover_pending)
+    return DVR_FALSE;
+
+  if (record_finish_segment(p_ctx, &p_ctx->prev_segment_info) != DVR_SUCCESS)
+    DVR_WARN("%s store info of segment %lld failed", __func__, p_ctx->segment_info.id);
+  p_ctx->prev_segment_handle = p_ctx->segment_handle;
+
+  p_ctx->segment_handle = p_ctx->next_segment_handle;
+  memcpy(&p_ctx->segment_params, &p_ctx->next_segment_params, sizeof(p_ctx->segment_params));
+  memcpy(&p_ctx->segment_info, &p_ctx->next_segment_info, sizeof(p_ctx->segment_info));
+  record_update_pid_set(p_ctx);
+  record_reset_indexer(p_ctx);
+  p_ctx->next_segment_handle = NULL;
+  p_ctx->last_send_size = 0;
+  p_ctx->last_send_time = 0;
+
+  if (p_ctx->pts != ULLONG_MAX) {
+    SEG_CALL(update_pts, (p_ctx->segment_handle, p_ctx->pts, 0));
+  }
+
+  p_ctx->rollover_pending = DVR_FALSE;
+  pthread_cond_broadcast(&p_ctx->rollover_cond);
+  return DVR_TRUE;
+}
+
+static DVR_Bool_t record_switch_segment(DVR_RecordContext_t *p_ctx)
+{
+  DVR_Bool_t switched;
+
+  pthread_mutex_lock(&p_ctx->rollover_lock);
+  switched = record_switch_segment_locked(p_ctx);
+  pthread_mutex_unlock(&p_ctx->rollover_lock);
+  return switched;
+}
+
+/* Compute the wait before the next secure demux read, so that it returns
+ * about a quarter of the secure buffer at the rate seen by the last reads.
+ * The reads are not delayed when the buffer is more than half full */
+static void record_secure_update_wait(DVR_RecordContext_t *p_ctx, ssize_t len)
+{
+  DVR_RecordLoop_t *p_loop = &p_ctx->loop;
+  struct timespec now;
+  int64_t elapsed, wait;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (int64_t)(now.tv_sec - p_loop->secure_ts.tv_sec) * 1000 +
+      (now.tv_nsec - p_loop->secure_ts.tv_nsec) / 1000000;
+  p_loop->secure_ts = now;
+
+  if (len <= 0)
+    wait = p_loop->secure_wait ? p_loop->secure_wait * 2 : 1;
+  else if ((size_t)len > p_ctx->secbuf_size / 2)
+    wait = 0;
+  else
+    wait = elapsed * (int64_t)(p_ctx->secbuf_size / 4) / len;
+  if (wait > RECORD_SECURE_WAIT_MAX)
+    wait = RECORD_SECURE_WAIT_MAX;
+  p_loop->secure_wait = (int)wait;
+}
+
+/* Set up the record loop before its first block, in the thread or worker
+ * running it */
+static int record_loop_init(DVR_RecordContext_t *p_ctx)
+{
+  DVR_RecordLoop_t *p_loop = &p_ctx->loop;
+  DVR_RecordStatus_t record_status;
+  uint32_t block_size = p_ctx->block_size;
 
+  SEG_CALL_INIT(&p_ctx->segment_ops);
+
+  memset(p_loop, 0, sizeof(*p_loop));
   // Force to use LOCAL_CLOCK as index type if force_sysclock is on. Please
   // refer to SWPL-75327
   if (p_ctx->force_sysclock)
     p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
   else
     p_ctx->index_type = DVR_INDEX_TYPE_INVALID;
-  buf = (uint8_t *)malloc(block_size);
-  if (!buf) {
+  /* The buffers are kept by the session until it is closed */
+  p_loop->buf = (uint8_t *)dvr_block_pool_reserve(&p_ctx->buf_in, block_size);
+  if (!p_loop->buf) {
     DVR_INFO("%s, malloc failed", __func__);
-    return NULL;
+    return DVR_FAILURE;
   }
 
   if (p_ctx->is_secure_mode) {
-    buf_out = (uint8_t *)malloc(p_ctx->secbuf_size + 188);
+    p_loop->buf_out = (uint8_t *)dvr_block_pool_reserve(&p_ctx->buf_out, p_ctx->secbuf_size + 188);
   } else {
-    buf_out = (uint8_t *)malloc(block_size + 188);
+    p_loop->buf_out = (uint8_t *)dvr_block_pool_reserve(&p_ctx->buf_out, block_size + 188);
   }
-  if (!buf_out) {
+  if (!p_loop->buf_out) {
     DVR_INFO("%s, malloc failed", __func__);
-    free(buf);
-    return NULL;
+    return DVR_FAILURE;
   }
 
+  /* Ring segments are written in place from user space, the segment
+   * turns off its write-behind queue and O_DIRECT for spliced writes */
+  if (p_ctx->zero_copy && p_ctx->ring_size > 0)
+    DVR_INFO("%s ring recording, zero copy is not used", __func__);
+  else if (p_ctx->zero_copy && !p_ctx->is_secure_mode && !p_ctx->enc_func
+      && SEG_CALL_IS_VALID(splice) && record_splice_open(&p_loop->splice, block_size) == DVR_SUCCESS)
+    p_loop->zero_copy = DVR_TRUE;
+
   memset(&record_status, 0, sizeof(record_status));
   record_status.state = DVR_RECORD_STATE_STARTED;
   if (p_ctx->event_notify_fn) {
@@ -333,284 +848,436 @@ void *record_thread(void *arg)
   DVR_INFO("%s, --secure_mode:%d, block_size:%d, cryptor:%p",
         __func__, p_ctx->is_secure_mode,
         block_size, p_ctx->cryptor);
-  clock_gettime(CLOCK_MONOTONIC, &start_ts);
+  clock_gettime(CLOCK_MONOTONIC, &p_loop->start_ts);
+  p_loop->secure_ts = p_loop->start_ts;
   p_ctx->check_pts_count = 0;
   p_ctx->check_no_pts_count++;
   p_ctx->last_send_size = 0;
   p_ctx->last_send_time = 0;
-  struct timeval t1, t2, t3, t4, t5, t6, t7;
-  while (p_ctx->state == DVR_RECORD_STATE_STARTED ||
-    p_ctx->state == DVR_RECORD_STATE_PAUSE) {
+  p_loop->started = DVR_TRUE;
+  return DVR_SUCCESS;
+}
 
-    gettimeofday(&t1, NULL);
+/* Release the record loop and wake up a waiting segment rollover, may be
+ * called again after the loop ended on a write error */
+static void record_loop_fini(DVR_RecordContext_t *p_ctx)
+{
+  DVR_RecordLoop_t *p_loop = &p_ctx->loop;
 
-    /* data from dmx, normal dvr case */
-    if (p_ctx->is_secure_mode) {
-      if (p_ctx->is_new_dmx) {
-        /* We resolve the below invoke for dvbcore to be under safety status */
-        memset(&new_dmx_secure_buf, 0, sizeof(new_dmx_secure_buf));
-        len = record_device_read(p_ctx->dev_handle, &new_dmx_secure_buf,
-            sizeof(new_dmx_secure_buf), 10);
-
-        /* Read data from secure demux TA */
-        len = record_device_read_ext(p_ctx->dev_handle, &secure_buf.addr,
-            &secure_buf.len);
-      } else {
-          memset(&secure_buf, 0, sizeof(secure_buf));
-          len = record_device_read(p_ctx->dev_handle, &secure_buf,
-              sizeof(secure_buf), 1000);
-      }
-    } else {
-      len = record_device_read(p_ctx->dev_handle, buf, block_size, 1000);
+  if (p_loop->zero_copy) {
+    record_splice_close(&p_loop->splice);
+    p_loop->zero_copy = DVR_FALSE;
+  }
+  p_loop->started = DVR_FALSE;
+  pthread_mutex_lock(&p_ctx->rollover_lock);
+  p_ctx->thread_running = DVR_FALSE;
+  pthread_cond_broadcast(&p_ctx->rollover_cond);
+  pthread_mutex_unlock(&p_ctx->rollover_lock);
+}
+
+/* Read and record one block, waiting at most timeout ms for it */
+static DVR_RecordStep_t record_loop_step(DVR_RecordContext_t *p_ctx, int timeout)
+{
+  DVR_RecordLoop_t *p_loop = &p_ctx->loop;
+  ssize_t len;
+  uint8_t *buf = p_loop->buf, *buf_out = p_loop->buf_out;
+  uint32_t block_size = p_ctx->block_size;
+  loff_t pos = 0;
+  int ret = DVR_SUCCESS;
+  struct timespec end_ts, end_no_pcr_ts;
+  DVR_RecordStatus_t record_status;
+  int has_pcr;
+  DVR_Bool_t guarded_size_exceeded = DVR_FALSE;
+  struct timespec t1, t2, t3, t4, t5, t6, t7;
+
+  SEG_CALL_INIT(&p_ctx->segment_ops);
+
+  /* Segment rollover, restart the time index as a new thread would */
+  if (p_ctx->rollover_pending && record_switch_segment(p_ctx)) {
+    if (p_ctx->force_sysclock)
+      p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
+    else
+      p_ctx->index_type = DVR_INDEX_TYPE_INVALID;
+    p_loop->pre_time = 0;
+    p_loop->pcr_rec_len = 0;
+    clock_gettime(CLOCK_MONOTONIC, &p_loop->start_ts);
+    p_ctx->check_pts_count = 0;
+    p_ctx->check_no_pts_count++;
+    if (p_ctx->event_notify_fn) {
+      memset(&record_status, 0, sizeof(record_status));
+      record_status.state = DVR_RECORD_STATE_STARTED;
+      record_status.info.id = p_ctx->segment_info.id;
+      p_ctx->event_notify_fn(DVR_RECORD_EVENT_STATUS, &record_status, p_ctx->event_userdata);
+      DVR_INFO("%s line %d notify record status, state:%d id=%lld",
+            __func__,__LINE__, record_status.state, p_ctx->segment_info.id);
     }
-    if (len == DVR_FAILURE) {
-      //usleep(10*1000);
-      //DVR_INFO("%s, start_read error", __func__);
-      continue;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  /* data from dmx, normal dvr case */
+  if (p_ctx->is_secure_mode) {
+    if (p_ctx->is_new_dmx) {
+      /* Let the data come in, instead of a TA round trip per iteration */
+      if (p_ctx->secure_batch && p_loop->secure_wait > 0)
+        usleep(p_loop->secure_wait * 1000);
+      /* We resolve the below invoke for dvbcore to be under safety status.
+       * In batch mode the wait above is the pacing, so the read does not wait */
+      memset(&p_loop->new_dmx_secure_buf, 0, sizeof(p_loop->new_dmx_secure_buf));
+      len = record_device_read(p_ctx->dev_handle, &p_loop->new_dmx_secure_buf,
+          sizeof(p_loop->new_dmx_secure_buf), p_ctx->secure_batch ? 0 : 10);
+
+      /* Read data from secure demux TA */
+      len = record_device_read_ext(p_ctx->dev_handle, &p_loop->secure_buf.addr,
+          &p_loop->secure_buf.len);
+      if (p_ctx->secure_batch)
+        record_secure_update_wait(p_ctx, len);
+    } else {
+        memset(&p_loop->secure_buf, 0, sizeof(p_loop->secure_buf));
+        len = record_device_read(p_ctx->dev_handle, &p_loop->secure_buf,
+            sizeof(p_loop->secure_buf), timeout);
     }
-    if (p_ctx->state == DVR_RECORD_STATE_PAUSE) {
-      //wait resume record
-      usleep(20*1000);
-      continue;
+  } else if (p_loop->zero_copy) {
+    /* Only the start of the block is copied for the PCR index, once it is
+     * in use. The I-frame index and the index type detection need it all */
+    size_t window = (p_ctx->accurate || p_ctx->index_type != DVR_INDEX_TYPE_PCR)
+      ? block_size : RECORD_SPLICE_WINDOW;
+    len = record_splice_in(p_ctx, &p_loop->splice, buf, window, timeout);
+  } else {
+    len = record_device_read(p_ctx->dev_handle, buf, block_size, timeout);
+    if (len > 0 && p_ctx->pid_filter && !p_ctx->whole_ts) {
+      len = record_drop_pids(p_ctx, buf, len);
+      if (len == 0)
+        return RECORD_STEP_NO_DATA;
     }
-    gettimeofday(&t2, NULL);
+  }
+  if (p_loop->zero_copy && p_loop->splice.failed) {
+    record_splice_drain(&p_loop->splice, buf_out);
+    record_splice_close(&p_loop->splice);
+    p_loop->zero_copy = DVR_FALSE;
+  }
+  if (len == DVR_FAILURE) {
+    //DVR_INFO("%s, start_read error", __func__);
+    return RECORD_STEP_NO_DATA;
+  }
+  if (p_ctx->state == DVR_RECORD_STATE_PAUSE) {
+    if (p_loop->zero_copy)
+      record_splice_drain(&p_loop->splice, buf_out);
+    //wait resume record
+    return RECORD_STEP_IDLE;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  t3 = t2;
 
-    guarded_size_exceeded = DVR_FALSE;
-    if ( p_ctx->guarded_segment_size > 0 &&
-        p_ctx->segment_info.size+len >= p_ctx->guarded_segment_size) {
-      guarded_size_exceeded = DVR_TRUE;
-    }
-    /* Got data from device, record it */
+  guarded_size_exceeded = DVR_FALSE;
+  if ( p_ctx->guarded_segment_size > 0 &&
+      p_ctx->segment_info.size+len >= p_ctx->guarded_segment_size) {
+    guarded_size_exceeded = DVR_TRUE;
+  }
+  /* Got data from device, record it */
+  ret = 0;
+  if (guarded_size_exceeded) {
+    len = 0;
     ret = 0;
-    if (guarded_size_exceeded) {
-      len = 0;
-      ret = 0;
-      DVR_ERROR("Skip segment_write due to current segment size %u exceeding"
-        " guarded segment size", p_ctx->segment_info.size);
-    } else if (p_ctx->discard_coming_data) {
-      len = 0;
-      ret = 0;
-      DVR_ERROR("Skip segment_write due to total size exceeding max size too much");
-    } else if (p_ctx->enc_func) {
-      /* Encrypt record data */
-      DVR_CryptoParams_t crypto_params;
-
-      memset(&crypto_params, 0, sizeof(crypto_params));
-      crypto_params.type = DVR_CRYPTO_TYPE_ENCRYPT;
-      memcpy(crypto_params.location, p_ctx->location, sizeof(p_ctx->location));
-      crypto_params.segment_id = p_ctx->segment_info.id;
-      crypto_params.offset = p_ctx->segment_info.size;
-
-      if (p_ctx->is_secure_mode) {
-        crypto_params.input_buffer.type = DVR_BUFFER_TYPE_SECURE;
-        crypto_params.input_buffer.addr = secure_buf.addr;
-        crypto_params.input_buffer.size = secure_buf.len;
-        crypto_params.output_buffer.size = p_ctx->secbuf_size + 188;
-      } else {
-        crypto_params.input_buffer.type = DVR_BUFFER_TYPE_NORMAL;
-        crypto_params.input_buffer.addr = (size_t)buf;
-        crypto_params.input_buffer.size = len;
-        crypto_params.output_buffer.size = block_size + 188;
-      }
+    DVR_ERROR("Skip segment_write due to current segment size %u exceeding"
+      " guarded segment size", p_ctx->segment_info.size);
+  } else if (p_ctx->discard_coming_data) {
+    len = 0;
+    ret = 0;
+    DVR_ERROR("Skip segment_write due to total size exceeding max size too much");
+  } else if (p_ctx->enc_func) {
+    /* Encrypt record data */
+    DVR_CryptoParams_t crypto_params;
 
-      crypto_params.output_buffer.type = DVR_BUFFER_TYPE_NORMAL;
-      crypto_params.output_buffer.addr = (size_t)buf_out;
+    memset(&crypto_params, 0, sizeof(crypto_params));
+    crypto_params.type = DVR_CRYPTO_TYPE_ENCRYPT;
+    memcpy(crypto_params.location, p_ctx->location, sizeof(p_ctx->location));
+    crypto_params.segment_id = p_ctx->segment_info.id;
+    crypto_params.offset = p_ctx->segment_info.size;
 
-      p_ctx->enc_func(&crypto_params, p_ctx->enc_userdata);
-      gettimeofday(&t3, NULL);
-      /* Out buffer length may not equal in buffer length */
-      if (crypto_params.output_size > 0) {
-        SEG_CALL_RET(write, (p_ctx->segment_handle, buf_out, crypto_params.output_size), ret);
-        len = crypto_params.output_size;
-      } else {
-        len = 0;
-      }
-    } else if (p_ctx->cryptor) {
-      /* Encrypt with clear key */
-      int crypt_len = len;
-      am_crypt_des_crypt(p_ctx->cryptor, buf_out, buf, &crypt_len, 0);
-      len = crypt_len;
-      gettimeofday(&t3, NULL);
-      SEG_CALL_RET(write, (p_ctx->segment_handle, buf_out, len), ret);
+    if (p_ctx->is_secure_mode) {
+      crypto_params.input_buffer.type = DVR_BUFFER_TYPE_SECURE;
+      crypto_params.input_buffer.addr = p_loop->secure_buf.addr;
+      crypto_params.input_buffer.size = p_loop->secure_buf.len;
+      crypto_params.output_buffer.size = p_ctx->secbuf_size + 188;
     } else {
-      if (first_read == 0) {
-        first_read = 1;
-        DVR_INFO("%s：%d,first read ts", __func__,__LINE__);
-      }
-      gettimeofday(&t3, NULL);
-      SEG_CALL_RET(write, (p_ctx->segment_handle, buf, len), ret);
+      crypto_params.input_buffer.type = DVR_BUFFER_TYPE_NORMAL;
+      crypto_params.input_buffer.addr = (size_t)buf;
+      crypto_params.input_buffer.size = len;
+      crypto_params.output_buffer.size = block_size + 188;
     }
-    gettimeofday(&t4, NULL);
-    //add DVR_RECORD_EVENT_WRITE_ERROR event if write error
-    if (ret == -1 && len > 0 && p_ctx->event_notify_fn) {
-      //send write event
-       if (p_ctx->event_notify_fn) {
-         memset(&record_status, 0, sizeof(record_status));
-         DVR_INFO("%s:%d,send event write error", __func__,__LINE__);
-         record_status.info.id = p_ctx->segment_info.id;
-         p_ctx->event_notify_fn(DVR_RECORD_EVENT_WRITE_ERROR, &record_status, p_ctx->event_userdata);
-        }
-        DVR_INFO("%s,write error %d", __func__,__LINE__);
-      goto end;
+
+    crypto_params.output_buffer.type = DVR_BUFFER_TYPE_NORMAL;
+    crypto_params.output_buffer.addr = (size_t)buf_out;
+
+    p_ctx->enc_func(&crypto_params, p_ctx->enc_userdata);
+    clock_gettime(CLOCK_MONOTONIC, &t3);
+    /* Out buffer length may not equal in buffer length */
+    if (crypto_params.output_size > 0) {
+      SEG_CALL_RET(write, (p_ctx->segment_handle, buf_out, crypto_params.output_size), ret);
+      len = crypto_params.output_size;
+    } else {
+      len = 0;
+    }
+  } else if (p_ctx->cryptor) {
+    /* Encrypt with clear key */
+    int crypt_len = len;
+    am_crypt_des_crypt(p_ctx->cryptor, buf_out, buf, &crypt_len, 0);
+    len = crypt_len;
+    clock_gettime(CLOCK_MONOTONIC, &t3);
+    SEG_CALL_RET(write, (p_ctx->segment_handle, buf_out, len), ret);
+  } else {
+    if (p_loop->first_read == 0) {
+      p_loop->first_read = 1;
+      DVR_INFO("%s：%d,first read ts", __func__,__LINE__);
     }
+    clock_gettime(CLOCK_MONOTONIC, &t3);
+    if (p_loop->zero_copy)
+      ret = record_splice_out(p_ctx, &p_loop->splice, buf, len);
+    else
+      SEG_CALL_RET(write, (p_ctx->segment_handle, buf, len), ret);
+  }
+  if (p_loop->zero_copy)
+    record_splice_drain(&p_loop->splice, buf_out);
+  clock_gettime(CLOCK_MONOTONIC, &t4);
+  //add DVR_RECORD_EVENT_WRITE_ERROR event if write error
+  if (ret == -1 && len > 0 && p_ctx->event_notify_fn) {
+    //send write event
+     if (p_ctx->event_notify_fn) {
+       memset(&record_status, 0, sizeof(record_status));
+       DVR_INFO("%s:%d,send event write error", __func__,__LINE__);
+       record_status.info.id = p_ctx->segment_info.id;
+       p_ctx->event_notify_fn(DVR_RECORD_EVENT_WRITE_ERROR, &record_status, p_ctx->event_userdata);
+      }
+      DVR_INFO("%s,write error %d", __func__,__LINE__);
+    return RECORD_STEP_END;
+  }
 
-    if (len > 0 && SEG_CALL_IS_VALID(tell_position)) {
-      /* Do time index */
-      uint8_t *index_buf = (p_ctx->enc_func || p_ctx->cryptor)? buf_out : buf;
-      SEG_CALL_RET(tell_position, (p_ctx->segment_handle), pos);
-      has_pcr = record_do_pcr_index(p_ctx, index_buf, len);
-      if (has_pcr == 0 && p_ctx->index_type == DVR_INDEX_TYPE_INVALID) {
-        clock_gettime(CLOCK_MONOTONIC, &end_ts);
-        if ((end_ts.tv_sec*1000 + end_ts.tv_nsec/1000000) -
-            (start_ts.tv_sec*1000 + start_ts.tv_nsec/1000000) > 40) {
-          /* PCR interval threshold > 40 ms*/
-          DVR_INFO("%s use local clock time index", __func__);
-          p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
-        }
-      } else if (has_pcr && p_ctx->index_type == DVR_INDEX_TYPE_INVALID){
-        DVR_INFO("%s use pcr time index", __func__);
-        p_ctx->index_type = DVR_INDEX_TYPE_PCR;
-        record_do_pcr_index(p_ctx, index_buf, len);
+  if (len > 0 && SEG_CALL_IS_VALID(tell_position)) {
+    /* Do time index */
+    uint8_t *index_buf = (p_ctx->enc_func || p_ctx->cryptor)? buf_out : buf;
+    int index_len = p_loop->zero_copy ? (int)p_loop->splice.index_len : len;
+    SEG_CALL_RET(tell_position, (p_ctx->segment_handle), pos);
+    has_pcr = record_do_pcr_index(p_ctx, index_buf, index_len, len);
+    /* The I-frame index needs clear data, buf is the clear input of the
+     * des cryptor and has the same length as its output */
+    if (p_ctx->accurate && !p_ctx->is_secure_mode && !p_ctx->enc_func && pos >= len)
+      record_do_iframe_index(p_ctx, buf, len, pos - len);
+    if (has_pcr == 0 && p_ctx->index_type == DVR_INDEX_TYPE_INVALID) {
+      clock_gettime(CLOCK_MONOTONIC, &end_ts);
+      if ((end_ts.tv_sec*1000 + end_ts.tv_nsec/1000000) -
+          (p_loop->start_ts.tv_sec*1000 + p_loop->start_ts.tv_nsec/1000000) > 40) {
+        /* PCR interval threshold > 40 ms*/
+        DVR_INFO("%s use local clock time index", __func__);
+        p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
       }
-      gettimeofday(&t5, NULL);
-      if (p_ctx->index_type == DVR_INDEX_TYPE_PCR) {
-        if (has_pcr == 0) {
-          if (p_ctx->check_no_pts_count < 2 * CHECK_PTS_MAX_COUNT) {
-            if (p_ctx->check_no_pts_count == 0) {
-              clock_gettime(CLOCK_MONOTONIC, &start_no_pcr_ts);
-              clock_gettime(CLOCK_MONOTONIC, &start_ts);
-            }
-            p_ctx->check_no_pts_count++;
+    } else if (has_pcr && p_ctx->index_type == DVR_INDEX_TYPE_INVALID){
+      DVR_INFO("%s use pcr time index", __func__);
+      p_ctx->index_type = DVR_INDEX_TYPE_PCR;
+      record_save_pcr_hits(p_ctx);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t5);
+    if (p_ctx->index_type == DVR_INDEX_TYPE_PCR) {
+      if (has_pcr == 0) {
+        if (p_ctx->check_no_pts_count < 2 * CHECK_PTS_MAX_COUNT) {
+          if (p_ctx->check_no_pts_count == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &p_loop->start_no_pcr_ts);
+            clock_gettime(CLOCK_MONOTONIC, &p_loop->start_ts);
           }
-        } else {
-          clock_gettime(CLOCK_MONOTONIC, &start_no_pcr_ts);
-          p_ctx->check_no_pts_count = 0;
+          p_ctx->check_no_pts_count++;
         }
-      }
-      /* Update segment i nfo */
-      p_ctx->segment_info.size += len;
-
-      /*Duration need use pcr to calculate, todo...*/
-      if (p_ctx->index_type == DVR_INDEX_TYPE_PCR) {
-        SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_ctx->segment_info.duration);
-        if (pre_time == 0)
-          pre_time = p_ctx->segment_info.duration;
-      } else if (p_ctx->index_type == DVR_INDEX_TYPE_LOCAL_CLOCK) {
-        clock_gettime(CLOCK_MONOTONIC, &end_ts);
-        p_ctx->segment_info.duration = (end_ts.tv_sec*1000 + end_ts.tv_nsec/1000000) -
-          (start_ts.tv_sec*1000 + start_ts.tv_nsec/1000000) + pcr_rec_len;
-        if (pre_time == 0)
-          pre_time = p_ctx->segment_info.duration;
-        SEG_CALL(update_pts, (p_ctx->segment_handle, p_ctx->segment_info.duration, pos));
       } else {
-        DVR_INFO("%s can NOT do time index", __func__);
+        clock_gettime(CLOCK_MONOTONIC, &p_loop->start_no_pcr_ts);
+        p_ctx->check_no_pts_count = 0;
       }
-      if (p_ctx->index_type == DVR_INDEX_TYPE_PCR &&
-          p_ctx->check_pts_count == CHECK_PTS_MAX_COUNT) {
-        DVR_INFO("%s change time from pcr to local time", __func__);
-        if (pcr_rec_len == 0) {
-          SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), pcr_rec_len);
-        }
-        p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
-        if (pcr_rec_len == 0) {
-          SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), pcr_rec_len);
-        }
-        clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    }
+    /* Update segment i nfo */
+    p_ctx->segment_info.size += len;
+
+    /*Duration need use pcr to calculate, todo...*/
+    if (p_ctx->index_type == DVR_INDEX_TYPE_PCR) {
+      SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_ctx->segment_info.duration);
+      if (p_loop->pre_time == 0)
+        p_loop->pre_time = p_ctx->segment_info.duration;
+    } else if (p_ctx->index_type == DVR_INDEX_TYPE_LOCAL_CLOCK) {
+      clock_gettime(CLOCK_MONOTONIC, &end_ts);
+      p_ctx->segment_info.duration = (end_ts.tv_sec*1000 + end_ts.tv_nsec/1000000) -
+        (p_loop->start_ts.tv_sec*1000 + p_loop->start_ts.tv_nsec/1000000) + p_loop->pcr_rec_len;
+      if (p_loop->pre_time == 0)
+        p_loop->pre_time = p_ctx->segment_info.duration;
+      SEG_CALL(update_pts, (p_ctx->segment_handle, p_ctx->segment_info.duration, pos));
+    } else {
+      DVR_INFO("%s can NOT do time index", __func__);
+    }
+    if (p_ctx->index_type == DVR_INDEX_TYPE_PCR &&
+        p_ctx->check_pts_count == CHECK_PTS_MAX_COUNT) {
+      DVR_INFO("%s change time from pcr to local time", __func__);
+      if (p_loop->pcr_rec_len == 0) {
+        SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_loop->pcr_rec_len);
       }
-
-      if (p_ctx->index_type == DVR_INDEX_TYPE_PCR ) {
-         clock_gettime(CLOCK_MONOTONIC, &end_no_pcr_ts);
-         int diff = (int)(end_no_pcr_ts.tv_sec*1000 + end_no_pcr_ts.tv_nsec/1000000) -
-          (int)(start_no_pcr_ts.tv_sec*1000 + start_no_pcr_ts.tv_nsec/1000000);
-         if (diff > 3000) {
-            DVR_INFO("%s no pcr change time from pcr to local time diff[%d]", __func__, diff);
-            if (pcr_rec_len == 0) {
-              SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), pcr_rec_len);
-            }
-            p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
-         }
+      p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
+      if (p_loop->pcr_rec_len == 0) {
+        SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_loop->pcr_rec_len);
       }
-      p_ctx->segment_info.nb_packets = p_ctx->segment_info.size/188;
+      clock_gettime(CLOCK_MONOTONIC, &p_loop->start_ts);
+    }
 
-      if (p_ctx->segment_info.duration - pre_time > DVR_STORE_INFO_TIME) {
-        pre_time = p_ctx->segment_info.duration + DVR_STORE_INFO_TIME;
-        time_t duration = p_ctx->segment_info.duration;
-        if (p_ctx->index_type == DVR_INDEX_TYPE_LOCAL_CLOCK) {
-          SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_ctx->segment_info.duration);
-        }
-        SEG_CALL(store_info, (p_ctx->segment_handle, &p_ctx->segment_info));
-        p_ctx->segment_info.duration = duration;
-      }
-    } else {
-      gettimeofday(&t5, NULL);
+    if (p_ctx->index_type == DVR_INDEX_TYPE_PCR ) {
+       clock_gettime(CLOCK_MONOTONIC, &end_no_pcr_ts);
+       int diff = (int)(end_no_pcr_ts.tv_sec*1000 + end_no_pcr_ts.tv_nsec/1000000) -
+        (int)(p_loop->start_no_pcr_ts.tv_sec*1000 + p_loop->start_no_pcr_ts.tv_nsec/1000000);
+       if (diff > 3000) {
+          DVR_INFO("%s no pcr change time from pcr to local time diff[%d]", __func__, diff);
+          if (p_loop->pcr_rec_len == 0) {
+            SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_loop->pcr_rec_len);
+          }
+          p_ctx->index_type = DVR_INDEX_TYPE_LOCAL_CLOCK;
+       }
     }
-    gettimeofday(&t6, NULL);
-     /*Event notification*/
-    DVR_Bool_t condA1 = (p_ctx->notification_size > 0);
-    DVR_Bool_t condA2 = ((p_ctx->segment_info.size-p_ctx->last_send_size) >= p_ctx->notification_size);
-    DVR_Bool_t condA3 = (p_ctx->notification_time > 0);
-    DVR_Bool_t condA4 = ((p_ctx->segment_info.duration-p_ctx->last_send_time) >= p_ctx->notification_time);
-    DVR_Bool_t condA5 = (guarded_size_exceeded);
-    DVR_Bool_t condA6 = (p_ctx->discard_coming_data);
-    DVR_Bool_t condB = (p_ctx->event_notify_fn != NULL);
-    DVR_Bool_t condC = (p_ctx->segment_info.duration > 0);
-    DVR_Bool_t condD = (p_ctx->state == DVR_RECORD_STATE_STARTED);
-    if (((condA1 && condA2) || (condA3 && condA4) || condA5 || condA6)
-      && condB && condC && condD) {
-      memset(&record_status, 0, sizeof(record_status));
-      //clock_gettime(CLOCK_MONOTONIC, &end_ts);
-      p_ctx->last_send_size = p_ctx->segment_info.size;
-      p_ctx->last_send_time = p_ctx->segment_info.duration;
-      record_status.state = p_ctx->state;
-      record_status.info.id = p_ctx->segment_info.id;
+    p_ctx->segment_info.nb_packets = p_ctx->segment_info.size/188;
+
+    if (p_ctx->segment_info.duration - p_loop->pre_time > DVR_STORE_INFO_TIME) {
+      p_loop->pre_time = p_ctx->segment_info.duration + DVR_STORE_INFO_TIME;
+      time_t duration = p_ctx->segment_info.duration;
       if (p_ctx->index_type == DVR_INDEX_TYPE_LOCAL_CLOCK) {
-        SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), record_status.info.duration);
-      } else
-        record_status.info.duration = p_ctx->segment_info.duration;
-      record_status.info.size = p_ctx->segment_info.size;
-      record_status.info.nb_packets = p_ctx->segment_info.size/188;
-      p_ctx->event_notify_fn(DVR_RECORD_EVENT_STATUS, &record_status, p_ctx->event_userdata);
-      DVR_INFO("%s notify record status, state:%d, id:%lld, duration:%ld ms, size:%zu loc[%s]",
-          __func__, record_status.state,
-          record_status.info.id, record_status.info.duration,
-          record_status.info.size, p_ctx->location);
+        SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_ctx->segment_info.duration);
+      }
+      SEG_CALL(store_info, (p_ctx->segment_handle, &p_ctx->segment_info));
+      p_ctx->segment_info.duration = duration;
+      record_update_write_stats(p_ctx);
     }
-    gettimeofday(&t7, NULL);
+  } else {
+    clock_gettime(CLOCK_MONOTONIC, &t5);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t6);
+   /*Event notification*/
+  DVR_Bool_t condA1 = (p_ctx->notification_size > 0);
+  DVR_Bool_t condA2 = ((p_ctx->segment_info.size-p_ctx->last_send_size) >= p_ctx->notification_size);
+  DVR_Bool_t condA3 = (p_ctx->notification_time > 0);
+  DVR_Bool_t condA4 = ((p_ctx->segment_info.duration-p_ctx->last_send_time) >= p_ctx->notification_time);
+  DVR_Bool_t condA5 = (guarded_size_exceeded);
+  DVR_Bool_t condA6 = (p_ctx->discard_coming_data);
+  DVR_Bool_t condB = (p_ctx->event_notify_fn != NULL);
+  DVR_Bool_t condC = (p_ctx->segment_info.duration > 0);
+  DVR_Bool_t condD = (p_ctx->state == DVR_RECORD_STATE_STARTED);
+  if (((condA1 && condA2) || (condA3 && condA4) || condA5 || condA6)
+    && condB && condC && condD) {
+    memset(&record_status, 0, sizeof(record_status));
+    //clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    p_ctx->last_send_size = p_ctx->segment_info.size;
+    p_ctx->last_send_time = p_ctx->segment_info.duration;
+    record_status.state = p_ctx->state;
+    record_status.info.id = p_ctx->segment_info.id;
+    if (p_ctx->index_type == DVR_INDEX_TYPE_LOCAL_CLOCK) {
+      SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), record_status.info.duration);
+    } else
+      record_status.info.duration = p_ctx->segment_info.duration;
+    record_status.info.size = p_ctx->segment_info.size;
+    record_status.info.nb_packets = p_ctx->segment_info.size/188;
+    p_ctx->event_notify_fn(DVR_RECORD_EVENT_STATUS, &record_status, p_ctx->event_userdata);
+    DVR_INFO("%s notify record status, state:%d, id:%lld, duration:%ld ms, size:%zu loc[%s]",
+        __func__, record_status.state,
+        record_status.info.id, record_status.info.duration,
+        record_status.info.size, p_ctx->location);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t7);
+
+  pthread_mutex_lock(&p_ctx->stats_lock);
+  record_stats_add(&p_ctx->stats.stages[DVR_RECORD_STAGE_READ], &t1, &t2);
+  if (p_ctx->enc_func || p_ctx->cryptor)
+    record_stats_add(&p_ctx->stats.stages[DVR_RECORD_STAGE_ENCRYPT], &t2, &t3);
+  record_stats_add(&p_ctx->stats.stages[DVR_RECORD_STAGE_WRITE], &t3, &t4);
+  record_stats_add(&p_ctx->stats.stages[DVR_RECORD_STAGE_INDEX], &t4, &t5);
+  record_stats_add(&p_ctx->stats.stages[DVR_RECORD_STAGE_STORE], &t5, &t6);
+  record_stats_add(&p_ctx->stats.stages[DVR_RECORD_STAGE_NOTIFY], &t6, &t7);
+  if (len > 0)
+    p_ctx->stats.bytes += len;
+  pthread_mutex_unlock(&p_ctx->stats_lock);
 #ifdef DEBUG_PERFORMANCE
-    DVR_INFO("record count, read:%dms, encrypt:%dms, write:%dms, index:%dms, store:%dms, notify:%dms total:%dms read len:%zd notify [%d]diff[%d]",
-        get_diff_time(t1, t2), get_diff_time(t2, t3), get_diff_time(t3, t4), get_diff_time(t4, t5),
-        get_diff_time(t5, t6), get_diff_time(t6, t7), get_diff_time(t1, t5), len,
-        p_ctx->notification_time,p_ctx->segment_info.duration -p_ctx->last_send_time);
+  DVR_INFO("record count, read:%dms, encrypt:%dms, write:%dms, index:%dms, store:%dms, notify:%dms total:%dms read len:%zd notify [%d]diff[%d]",
+      get_diff_time(t1, t2), get_diff_time(t2, t3), get_diff_time(t3, t4), get_diff_time(t4, t5),
+      get_diff_time(t5, t6), get_diff_time(t6, t7), get_diff_time(t1, t5), len,
+      p_ctx->notification_time,p_ctx->segment_info.duration -p_ctx->last_send_time);
 #endif
-    if (len == 0) {
+  return (len == 0) ? RECORD_STEP_IDLE : RECORD_STEP_DATA;
+}
+
+void *record_thread(void *arg)
+{
+  DVR_RecordContext_t *p_ctx = (DVR_RecordContext_t *)arg;
+
+  prctl(PR_SET_NAME,"DvrRecording");
+
+  if (record_loop_init(p_ctx) != DVR_SUCCESS) {
+    record_loop_fini(p_ctx);
+    return NULL;
+  }
+  while (p_ctx->state == DVR_RECORD_STATE_STARTED ||
+    p_ctx->state == DVR_RECORD_STATE_PAUSE) {
+    DVR_RecordStep_t step = record_loop_step(p_ctx, 1000);
+
+    if (step == RECORD_STEP_END)
+      break;
+    if (step == RECORD_STEP_IDLE)
       usleep(20*1000);
-    }
   }
-end:
-  free((void *)buf);
-  free((void *)buf_out);
+  record_loop_fini(p_ctx);
   DVR_INFO("exit %s", __func__);
   return NULL;
 }
 
+/* Reactor function of a session, called when the device is readable or
+ * kicked. Paused sessions drain the device here instead of sleeping */
+static int record_reactor_cb(void *userdata)
+{
+  DVR_RecordContext_t *p_ctx = (DVR_RecordContext_t *)userdata;
+
+  if (p_ctx->state != DVR_RECORD_STATE_STARTED &&
+      p_ctx->state != DVR_RECORD_STATE_PAUSE)
+    return DVR_FAILURE;
+  if (!p_ctx->loop.started && record_loop_init(p_ctx) != DVR_SUCCESS) {
+    record_loop_fini(p_ctx);
+    return DVR_FAILURE;
+  }
+  if (record_loop_step(p_ctx, 0) == RECORD_STEP_END) {
+    record_loop_fini(p_ctx);
+    return DVR_FAILURE;
+  }
+  return DVR_SUCCESS;
+}
+
+/* Hand a clear recording over to the shared reactor instead of starting a
+ * thread for it. The first call of record_reactor_cb sets the loop up */
+static int record_reactor_start(DVR_RecordContext_t *p_ctx)
+{
+  int fd;
+
+  if (p_ctx->is_secure_mode || dvr_reactor_get_workers() <= 0)
+    return DVR_FAILURE;
+  fd = record_device_get_fd(p_ctx->dev_handle);
+  if (fd == -1)
+    return DVR_FAILURE;
+  DVR_RETURN_IF_FALSE(dvr_reactor_add(fd, record_reactor_cb, p_ctx, &p_ctx->reactor) == DVR_SUCCESS);
+  dvr_reactor_kick(p_ctx->reactor);
+  return DVR_SUCCESS;
+}
+
 int dvr_record_open(DVR_RecordHandle_t *p_handle, DVR_RecordOpenParams_t *params)
 {
   DVR_RecordContext_t *p_ctx;
   Record_DeviceOpenParams_t dev_open_params;
   int ret = DVR_SUCCESS;
-  uint32_t i;
 
   DVR_RETURN_IF_FALSE(p_handle);
   DVR_RETURN_IF_FALSE(params);
 
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (record_ctx[i].state == DVR_RECORD_STATE_CLOSED) {
-      break;
-    }
+  p_ctx = (DVR_RecordContext_t *)calloc(1, sizeof(DVR_RecordContext_t));
+  DVR_RETURN_IF_FALSE(p_ctx);
+  p_ctx->state = DVR_RECORD_STATE_CLOSED;
+  if (dvr_handle_table_add(&record_table, p_ctx, &p_ctx->handle, NULL) != DVR_SUCCESS) {
+    free(p_ctx);
+    return DVR_FAILURE;
   }
-  DVR_RETURN_IF_FALSE(i < MAX_DVR_RECORD_SESSION_COUNT);
-  DVR_RETURN_IF_FALSE(record_ctx[i].state == DVR_RECORD_STATE_CLOSED);
-  p_ctx = &record_ctx[i];
   DVR_INFO("%s , current state:%d, dmx_id:%d, notification_size:%zu, flags:%d, keylen:%d ",
         __func__, p_ctx->state, params->dmx_dev_id,
     params->notification_size,
@@ -655,6 +1322,10 @@ int dvr_record_open(DVR_RecordHandle_t *p_handle, DVR_RecordOpenParams_t *params
     ret = record_device_open(&p_ctx->dev_handle, &dev_open_params);
     if (ret != DVR_SUCCESS) {
       DVR_INFO("%s, open record devices failed", __func__);
+      if (p_ctx->cryptor)
+        am_crypt_des_close(p_ctx->cryptor);
+      dvr_handle_table_remove(&record_table, p_ctx->handle);
+      free(p_ctx);
       return DVR_FAILURE;
     }
   }
@@ -667,6 +1338,13 @@ int dvr_record_open(DVR_RecordHandle_t *p_handle, DVR_RecordOpenParams_t *params
   p_ctx->state = DVR_RECORD_STATE_OPENED;
   p_ctx->force_sysclock = params->force_sysclock;
   p_ctx->guarded_segment_size = params->guarded_segment_size;
+  p_ctx->segment_size = params->segment_size;
+  p_ctx->ring_size = params->ring_size;
+  p_ctx->direct_io = (params->flags & DVR_RECORD_FLAG_DIRECTIO) ? DVR_TRUE : DVR_FALSE;
+  p_ctx->accurate = ((params->flags & DVR_RECORD_FLAG_ACCURATE) && !(params->flags & DVR_RECORD_FLAG_DATAOUT)) ? DVR_TRUE : DVR_FALSE;
+  p_ctx->pid_filter = (dvr_prop_read_int(RECORD_PID_FILTER_PROP, 0) > 0) ? DVR_TRUE : DVR_FALSE;
+  p_ctx->zero_copy = (!p_ctx->pid_filter && !p_ctx->is_vod && !p_ctx->cryptor && !(params->flags & DVR_RECORD_FLAG_DATAOUT)
+      && dvr_prop_read_int(RECORD_SPLICE_PROP, 0) > 0) ? DVR_TRUE : DVR_FALSE;
   if (p_ctx->guarded_segment_size <= 0) {
     DVR_WARN("Odd guarded_segment_size value %lld is given. Change it to"
         " 0 to disable segment guarding mechanism.", p_ctx->guarded_segment_size);
@@ -677,8 +1355,12 @@ int dvr_record_open(DVR_RecordHandle_t *p_handle, DVR_RecordOpenParams_t *params
 
   record_set_segment_ops(p_ctx, params->flags);
   INIT_LIST_HEAD(&p_ctx->segment_ctrls);
+  pthread_mutex_init(&p_ctx->rollover_lock, NULL);
+  pthread_cond_init(&p_ctx->rollover_cond, NULL);
+  pthread_mutex_init(&p_ctx->stats_lock, NULL);
+  memset(&p_ctx->stats, 0, sizeof(p_ctx->stats));
 
-  *p_handle = p_ctx;
+  *p_handle = p_ctx->handle;
   return DVR_SUCCESS;
 }
 
@@ -686,17 +1368,16 @@ int dvr_record_close(DVR_RecordHandle_t handle)
 {
   DVR_RecordContext_t *p_ctx;
   int ret = DVR_SUCCESS;
-  uint32_t i;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  record_put_ctx(p_ctx);
+
+  /* Only the caller removing the handle goes on, once the calls still
+   * using the context have returned */
+  DVR_RETURN_IF_FALSE(dvr_handle_table_remove(&record_table, handle) == DVR_SUCCESS);
 
   DVR_INFO("%s , current state:%d", __func__, p_ctx->state);
-  DVR_RETURN_IF_FALSE(p_ctx->state != DVR_RECORD_STATE_CLOSED);
   if (p_ctx->cryptor) {
     am_crypt_des_close(p_ctx->cryptor);
     p_ctx->cryptor = NULL;
@@ -720,23 +1401,20 @@ int dvr_record_close(DVR_RecordHandle_t handle)
     }
   }
 
-  memset(p_ctx, 0, sizeof(DVR_RecordContext_t));
-  p_ctx->state = DVR_RECORD_STATE_CLOSED;
+  pthread_mutex_destroy(&p_ctx->rollover_lock);
+  pthread_cond_destroy(&p_ctx->rollover_cond);
+  pthread_mutex_destroy(&p_ctx->stats_lock);
+  dvr_block_pool_release(&p_ctx->buf_in);
+  dvr_block_pool_release(&p_ctx->buf_out);
+  if (p_ctx->pcr_hits)
+    free(p_ctx->pcr_hits);
+  free(p_ctx);
   return ret;
 }
 
-int dvr_record_pause(DVR_RecordHandle_t handle)
+static int record_pause(DVR_RecordContext_t *p_ctx)
 {
-  DVR_RecordContext_t *p_ctx;
   int ret = DVR_SUCCESS;
-  uint32_t i;
-
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
 
   DVR_INFO("%s , current state:%d", __func__, p_ctx->state);
   DVR_RETURN_IF_FALSE(p_ctx->state != DVR_RECORD_STATE_CLOSED);
@@ -749,18 +1427,21 @@ int dvr_record_pause(DVR_RecordHandle_t handle)
   return ret;
 }
 
-int dvr_record_resume(DVR_RecordHandle_t handle)
+int dvr_record_pause(DVR_RecordHandle_t handle)
 {
   DVR_RecordContext_t *p_ctx;
-  int ret = DVR_SUCCESS;
-  uint32_t i;
+  int ret;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_pause(p_ctx);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_resume(DVR_RecordContext_t *p_ctx)
+{
+  int ret = DVR_SUCCESS;
 
   DVR_INFO("%s , current state:%d", __func__, p_ctx->state);
   DVR_RETURN_IF_FALSE(p_ctx->state != DVR_RECORD_STATE_CLOSED);
@@ -773,6 +1454,18 @@ int dvr_record_resume(DVR_RecordHandle_t handle)
   return ret;
 }
 
+int dvr_record_resume(DVR_RecordHandle_t handle)
+{
+  DVR_RecordContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_resume(p_ctx);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
 #if 0
 int dvr_record_register_encryption(DVR_RecordHandle_t handle,
     DVR_CryptoFunction_t cb,
@@ -783,20 +1476,12 @@ int dvr_record_register_encryption(DVR_RecordHandle_t handle,
 }
 #endif
 
-int dvr_record_start_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t *params)
+static int record_start_segment(DVR_RecordContext_t *p_ctx, DVR_RecordStartParams_t *params)
 {
-  DVR_RecordContext_t *p_ctx;
   Segment_OpenParams_t open_params;
   int ret = DVR_SUCCESS;
   uint32_t i;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
-
   SEG_CALL_INIT(&p_ctx->segment_ops);
 
   DVR_INFO("%s , current state:%d pids:%d params->location:%s", __func__, p_ctx->state, params->segment.nb_pids, params->location);
@@ -812,6 +1497,10 @@ int dvr_record_start_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t
     open_params.segment_id = params->segment.segment_id;
     open_params.mode = SEGMENT_MODE_WRITE;
     open_params.force_sysclock = p_ctx->force_sysclock;
+    open_params.size_hint = p_ctx->segment_size;
+    open_params.direct_io = p_ctx->direct_io;
+    open_params.ring_size = p_ctx->ring_size;
+    open_params.zero_copy = p_ctx->zero_copy;
 
     SEG_CALL_RET(open, (&open_params, &p_ctx->segment_handle), ret);
     DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
@@ -835,6 +1524,8 @@ int dvr_record_start_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t
     p_ctx->segment_info.id = params->segment.segment_id;
     p_ctx->segment_info.nb_pids = params->segment.nb_pids;
     memcpy(p_ctx->segment_info.pids, params->segment.pids, params->segment.nb_pids*sizeof(DVR_StreamPid_t));
+    record_update_pid_set(p_ctx);
+    record_reset_indexer(p_ctx);
   }
 
   if (!p_ctx->is_vod) {
@@ -851,26 +1542,36 @@ int dvr_record_start_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t
   DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
 
   p_ctx->state = DVR_RECORD_STATE_STARTED;
-  if (!p_ctx->is_vod)
-    pthread_create(&p_ctx->thread, NULL, record_thread, p_ctx);
+  if (!p_ctx->is_vod) {
+    p_ctx->thread_running = DVR_TRUE;
+    p_ctx->reactor = NULL;
+    if (record_reactor_start(p_ctx) != DVR_SUCCESS &&
+        pthread_create(&p_ctx->thread, NULL, record_thread, p_ctx) != 0)
+      p_ctx->thread_running = DVR_FALSE;
+  }
 
   return DVR_SUCCESS;
 }
 
-int dvr_record_next_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t *params, DVR_RecordSegmentInfo_t *p_info)
+int dvr_record_start_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t *params)
 {
   DVR_RecordContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_start_segment(p_ctx, params);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_next_segment(DVR_RecordContext_t *p_ctx, DVR_RecordStartParams_t *params, DVR_RecordSegmentInfo_t *p_info)
+{
   Segment_OpenParams_t open_params;
+  Segment_Handle_t next_handle = NULL;
+  DVR_RecordSegmentInfo_t next_info;
   int ret = DVR_SUCCESS;
   uint32_t i;
-  loff_t pos;
-
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
 
   DVR_INFO("%s , current state:%d p_ctx->location:%s", __func__, p_ctx->state, p_ctx->location);
   DVR_RETURN_IF_FALSE(p_ctx->state == DVR_RECORD_STATE_STARTED);
@@ -881,115 +1582,113 @@ int dvr_record_next_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t *
 
   SEG_CALL_INIT(&p_ctx->segment_ops);
 
-  /*Stop the on going record segment*/
-  //ret = record_device_stop(p_ctx->dev_handle);
-  //DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
-  p_ctx->state = DVR_RECORD_STATE_STOPPED;
-  pthread_join(p_ctx->thread, NULL);
-
-  //add index file store
-  if (SEG_CALL_IS_VALID(update_pts_force)) {
-    SEG_CALL_RET_VALID(tell_position, (p_ctx->segment_handle), pos, -1);
-    if (pos != -1) {
-      SEG_CALL(update_pts_force, (p_ctx->segment_handle, p_ctx->segment_info.duration, pos));
-    }
-  }
-
-  SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_ctx->segment_info.duration);
-
-  /*Update segment info*/
-  memcpy(p_info, &p_ctx->segment_info, sizeof(p_ctx->segment_info));
-
-  SEG_CALL_RET(store_info, (p_ctx->segment_handle, p_info), ret);
-  DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
-
-  SEG_CALL(store_allInfo, (p_ctx->segment_handle, p_info));
-
-  DVR_INFO("%s dump segment info, id:%lld, nb_pids:%d, duration:%ld ms, size:%zu, nb_packets:%d params->segment.nb_pids:%d",
-      __func__, p_info->id, p_info->nb_pids, p_info->duration, p_info->size, p_info->nb_packets, params->segment.nb_pids);
-
-  /*Close current segment*/
-  SEG_CALL_RET(close, (p_ctx->segment_handle), ret);
-  DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
-
-  p_ctx->last_send_size = 0;
-  p_ctx->last_send_time = 0;
-
-  /*Open the new record segment*/
+  /*Open the new record segment while the current one is still recorded*/
   if (SEG_CALL_IS_VALID(open)) {
     memset(&open_params, 0, sizeof(open_params));
     memcpy(open_params.location, p_ctx->location, sizeof(p_ctx->location));
     open_params.segment_id = params->segment.segment_id;
     open_params.mode = SEGMENT_MODE_WRITE;
     open_params.force_sysclock = p_ctx->force_sysclock;
+    open_params.size_hint = p_ctx->segment_size;
+    open_params.direct_io = p_ctx->direct_io;
+    open_params.ring_size = p_ctx->ring_size;
+    open_params.zero_copy = p_ctx->zero_copy;
     DVR_INFO("%s: p_ctx->location:%s  params->location:%s", __func__, p_ctx->location,params->location);
-    SEG_CALL_RET(open, (&open_params, &p_ctx->segment_handle), ret);
+    SEG_CALL_RET(open, (&open_params, &next_handle), ret);
     DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
   }
 
   /*process params*/
-  {
-    //need all params??
-    memcpy(&p_ctx->segment_params, &params->segment, sizeof(params->segment));
-    /*save current segment info*/
-    memset(&p_ctx->segment_info, 0, sizeof(p_ctx->segment_info));
-    p_ctx->segment_info.id = params->segment.segment_id;
-    memcpy(p_ctx->segment_info.pids, params->segment.pids, params->segment.nb_pids*sizeof(DVR_StreamPid_t));
-  }
+  memset(&next_info, 0, sizeof(next_info));
+  next_info.id = params->segment.segment_id;
 
-  p_ctx->segment_info.nb_pids = 0;
+  /*New pids are added before the switch, so the new segment gets all their packets*/
   for (i = 0; i < params->segment.nb_pids; i++) {
     switch (params->segment.pid_action[i]) {
       case DVR_RECORD_PID_CREATE:
         DVR_INFO("%s create pid:%d", __func__, params->segment.pids[i].pid);
         ret = record_device_add_pid(p_ctx->dev_handle, params->segment.pids[i].pid);
-        p_ctx->segment_info.nb_pids++;
-        DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
+        next_info.pids[next_info.nb_pids++] = params->segment.pids[i];
+        if (ret != DVR_SUCCESS)
+          goto error;
         break;
       case DVR_RECORD_PID_KEEP:
         DVR_INFO("%s keep pid:%d", __func__, params->segment.pids[i].pid);
-        p_ctx->segment_info.nb_pids++;
+        next_info.pids[next_info.nb_pids++] = params->segment.pids[i];
         break;
       case DVR_RECORD_PID_CLOSE:
-        DVR_INFO("%s close pid:%d", __func__, params->segment.pids[i].pid);
-        ret = record_device_remove_pid(p_ctx->dev_handle, params->segment.pids[i].pid);
-        DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
         break;
       default:
         DVR_INFO("%s wrong action pid:%d", __func__, params->segment.pids[i].pid);
-        return DVR_FAILURE;
+        ret = DVR_FAILURE;
+        goto error;
     }
   }
 
-  //ret = record_device_start(p_ctx->dev_handle);
-  //DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
-
   /*Update segment info*/
-  SEG_CALL_RET(store_info, (p_ctx->segment_handle, &p_ctx->segment_info), ret);
+  SEG_CALL_RET(store_info, (next_handle, &next_info), ret);
+  if (ret != DVR_SUCCESS)
+    goto error;
+
+  /*Hand the new segment over to the record thread and wait for the switch*/
+  pthread_mutex_lock(&p_ctx->rollover_lock);
+  p_ctx->next_segment_handle = next_handle;
+  memcpy(&p_ctx->next_segment_params, &params->segment, sizeof(params->segment));
+  memcpy(&p_ctx->next_segment_info, &next_info, sizeof(next_info));
+  p_ctx->rollover_pending = DVR_TRUE;
+  /*A reactor source is only called when data comes, so wake it up*/
+  if (p_ctx->reactor)
+    dvr_reactor_kick(p_ctx->reactor);
+  while (p_ctx->rollover_pending && p_ctx->thread_running)
+    pthread_cond_wait(&p_ctx->rollover_cond, &p_ctx->rollover_lock);
+  if (p_ctx->rollover_pending) {
+    DVR_WARN("%s record thread is not running, switch segment directly", __func__);
+    record_switch_segment_locked(p_ctx);
+  }
+  memcpy(p_info, &p_ctx->prev_segment_info, sizeof(p_ctx->prev_segment_info));
+  next_handle = p_ctx->prev_segment_handle;
+  p_ctx->prev_segment_handle = NULL;
+  pthread_mutex_unlock(&p_ctx->rollover_lock);
+
+  DVR_INFO("%s dump segment info, id:%lld, nb_pids:%d, duration:%ld ms, size:%zu, nb_packets:%d params->segment.nb_pids:%d",
+      __func__, p_info->id, p_info->nb_pids, p_info->duration, p_info->size, p_info->nb_packets, params->segment.nb_pids);
+
+  /*Close the previous segment, out of the record thread*/
+  SEG_CALL_RET(close, (next_handle), ret);
   DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
 
-  if (p_ctx->pts != ULLONG_MAX) {
-    SEG_CALL(update_pts, (p_ctx->segment_handle, p_ctx->pts, 0));
+  /*Closed pids are removed after the switch, so the previous segment keeps them to its end*/
+  for (i = 0; i < params->segment.nb_pids; i++) {
+    if (params->segment.pid_action[i] == DVR_RECORD_PID_CLOSE) {
+      DVR_INFO("%s close pid:%d", __func__, params->segment.pids[i].pid);
+      ret = record_device_remove_pid(p_ctx->dev_handle, params->segment.pids[i].pid);
+      DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
+    }
   }
 
-  p_ctx->state = DVR_RECORD_STATE_STARTED;
-  pthread_create(&p_ctx->thread, NULL, record_thread, p_ctx);
   return DVR_SUCCESS;
+
+error:
+  if (next_handle)
+    SEG_CALL(close, (next_handle));
+  return DVR_FAILURE;
 }
 
-int dvr_record_stop_segment(DVR_RecordHandle_t handle, DVR_RecordSegmentInfo_t *p_info)
+int dvr_record_next_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t *params, DVR_RecordSegmentInfo_t *p_info)
 {
   DVR_RecordContext_t *p_ctx;
-  int ret = DVR_SUCCESS;
-  uint32_t i;
-  loff_t pos = 0;
+  int ret;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_next_segment(p_ctx, params, p_info);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_stop_segment(DVR_RecordContext_t *p_ctx, DVR_RecordSegmentInfo_t *p_info)
+{
+  int ret = DVR_SUCCESS;
 
   if (p_ctx->segment_handle == NULL) {
     // It seems this stop function has been called twice on the same recording,
@@ -1008,7 +1707,13 @@ int dvr_record_stop_segment(DVR_RecordHandle_t handle, DVR_RecordSegmentInfo_t *
   if (p_ctx->is_vod) {
     p_ctx->segment_info.duration = 10*1000; //debug, should delete it
   } else {
-    pthread_join(p_ctx->thread, NULL);
+    if (p_ctx->reactor) {
+      dvr_reactor_remove(p_ctx->reactor);
+      p_ctx->reactor = NULL;
+      record_loop_fini(p_ctx);
+    } else {
+      pthread_join(p_ctx->thread, NULL);
+    }
     ret = record_device_stop(p_ctx->dev_handle);
     //DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
     if (ret != DVR_SUCCESS)
@@ -1016,25 +1721,10 @@ int dvr_record_stop_segment(DVR_RecordHandle_t handle, DVR_RecordSegmentInfo_t *
     //p_ctx->state = DVR_RECORD_STATE_STOPPED;
   }
 
-  //add index file store
-  if (SEG_CALL_IS_VALID(update_pts_force)) {
-    SEG_CALL_RET_VALID(tell_position, (p_ctx->segment_handle), pos, -1);
-    if (pos != -1) {
-      SEG_CALL(update_pts_force, (p_ctx->segment_handle, p_ctx->segment_info.duration, pos));
-    }
-  }
-
-  SEG_CALL_RET(tell_total_time, (p_ctx->segment_handle), p_ctx->segment_info.duration);
-
-  /*Update segment info*/
-  memcpy(p_info, &p_ctx->segment_info, sizeof(p_ctx->segment_info));
-
-  SEG_CALL_RET(store_info, (p_ctx->segment_handle, p_info), ret);
+  ret = record_finish_segment(p_ctx, p_info);
   if (ret != DVR_SUCCESS)
     goto end;
 
-  SEG_CALL(store_allInfo, (p_ctx->segment_handle, p_info));
-
   DVR_INFO("%s dump segment info, id:%lld, nb_pids:%d, duration:%ld ms, size:%zu, nb_packets:%d",
       __func__, p_info->id, p_info->nb_pids, p_info->duration, p_info->size, p_info->nb_packets);
 
@@ -1046,23 +1736,27 @@ end:
   return DVR_SUCCESS;
 }
 
-int dvr_record_resume_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t *params, uint64_t *p_resume_size)
+int dvr_record_stop_segment(DVR_RecordHandle_t handle, DVR_RecordSegmentInfo_t *p_info)
 {
   DVR_RecordContext_t *p_ctx;
-  uint32_t i;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_stop_segment(p_ctx, p_info);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_resume_segment(DVR_RecordContext_t *p_ctx, DVR_RecordStartParams_t *params, uint64_t *p_resume_size)
+{
   int ret = DVR_SUCCESS;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
   DVR_RETURN_IF_FALSE(params);
   DVR_RETURN_IF_FALSE(p_resume_size);
 
   DVR_INFO("%s , current state:%d, resume size:%lld", __func__, p_ctx->state, *p_resume_size);
-  ret = dvr_record_start_segment(handle, params);
+  ret = record_start_segment(p_ctx, params);
   DVR_RETURN_IF_FALSE(ret == DVR_SUCCESS);
 
   p_ctx->segment_info.size = *p_resume_size;
@@ -1070,17 +1764,20 @@ int dvr_record_resume_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t
   return DVR_SUCCESS;
 }
 
-int dvr_record_get_status(DVR_RecordHandle_t handle, DVR_RecordStatus_t *p_status)
+int dvr_record_resume_segment(DVR_RecordHandle_t handle, DVR_RecordStartParams_t *params, uint64_t *p_resume_size)
 {
   DVR_RecordContext_t *p_ctx;
-  int i;
+  int ret;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_resume_segment(p_ctx, params, p_resume_size);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_get_status(DVR_RecordContext_t *p_ctx, DVR_RecordStatus_t *p_status)
+{
   DVR_RETURN_IF_FALSE(p_status);
 
   //lock
@@ -1093,25 +1790,29 @@ int dvr_record_get_status(DVR_RecordHandle_t handle, DVR_RecordStatus_t *p_statu
   return DVR_SUCCESS;
 }
 
-int dvr_record_write(DVR_RecordHandle_t handle, void *buffer, uint32_t len)
+int dvr_record_get_status(DVR_RecordHandle_t handle, DVR_RecordStatus_t *p_status)
 {
   DVR_RecordContext_t *p_ctx;
-  uint32_t i;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_get_status(p_ctx, p_status);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_write(DVR_RecordContext_t *p_ctx, void *buffer, uint32_t len)
+{
   int ret = DVR_SUCCESS;
   int has_pcr;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
   DVR_RETURN_IF_FALSE(buffer);
   DVR_RETURN_IF_FALSE(len);
 
   SEG_CALL_INIT(&p_ctx->segment_ops);
 
-  has_pcr = record_do_pcr_index(p_ctx, buffer, len);
+  has_pcr = record_do_pcr_index(p_ctx, buffer, len, len);
   if (has_pcr == 0) {
     /* Pull VOD record should use PCR time index */
     DVR_INFO("%s has no pcr, can NOT do time index", __func__);
@@ -1126,17 +1827,20 @@ int dvr_record_write(DVR_RecordHandle_t handle, void *buffer, uint32_t len)
   return DVR_SUCCESS;
 }
 
-int dvr_record_set_encrypt_callback(DVR_RecordHandle_t handle, DVR_CryptoFunction_t func, void *userdata)
+int dvr_record_write(DVR_RecordHandle_t handle, void *buffer, uint32_t len)
 {
   DVR_RecordContext_t *p_ctx;
-  uint32_t i;
+  int ret;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_write(p_ctx, buffer, len);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_set_encrypt_callback(DVR_RecordContext_t *p_ctx, DVR_CryptoFunction_t func, void *userdata)
+{
   DVR_RETURN_IF_FALSE(func);
 
   DVR_INFO("%s , current state:%d", __func__, p_ctx->state);
@@ -1148,18 +1852,22 @@ int dvr_record_set_encrypt_callback(DVR_RecordHandle_t handle, DVR_CryptoFunctio
   return DVR_SUCCESS;
 }
 
-int dvr_record_set_secure_buffer(DVR_RecordHandle_t handle, uint8_t *p_secure_buf, uint32_t len)
+int dvr_record_set_encrypt_callback(DVR_RecordHandle_t handle, DVR_CryptoFunction_t func, void *userdata)
 {
   DVR_RecordContext_t *p_ctx;
-  uint32_t i;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_set_encrypt_callback(p_ctx, func, userdata);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_set_secure_buffer(DVR_RecordContext_t *p_ctx, uint8_t *p_secure_buf, uint32_t len)
+{
   int ret = DVR_SUCCESS;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
   DVR_RETURN_IF_FALSE(p_secure_buf);
   DVR_RETURN_IF_FALSE(len);
 
@@ -1172,22 +1880,25 @@ int dvr_record_set_secure_buffer(DVR_RecordHandle_t handle, uint8_t *p_secure_bu
 
   p_ctx->is_secure_mode = 1;
   p_ctx->secbuf_size = len;
+  p_ctx->secure_batch = (dvr_prop_read_int(RECORD_DEVICE_SECURE_BATCH_PROP, 0) > 0) ? DVR_TRUE : DVR_FALSE;
   return ret;
 }
 
-int dvr_record_is_secure_mode(DVR_RecordHandle_t handle)
+int dvr_record_set_secure_buffer(DVR_RecordHandle_t handle, uint8_t *p_secure_buf, uint32_t len)
 {
   DVR_RecordContext_t *p_ctx;
-  uint32_t i;
-  int ret = DVR_SUCCESS;
+  int ret;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_set_secure_buffer(p_ctx, p_secure_buf, len);
+  record_put_ctx(p_ctx);
+  return ret;
+}
 
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+static int record_is_secure_mode(DVR_RecordContext_t *p_ctx)
+{
+  int ret = DVR_SUCCESS;
 
   if (p_ctx->is_secure_mode == 1)
     ret = 1;
@@ -1196,18 +1907,20 @@ int dvr_record_is_secure_mode(DVR_RecordHandle_t handle)
   return ret;
 }
 
-int dvr_record_discard_coming_data(DVR_RecordHandle_t handle, DVR_Bool_t discard)
+int dvr_record_is_secure_mode(DVR_RecordHandle_t handle)
 {
   DVR_RecordContext_t *p_ctx;
-  int i;
+  int ret;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_is_secure_mode(p_ctx);
+  record_put_ctx(p_ctx);
+  return ret;
+}
 
+static int record_discard_coming_data(DVR_RecordContext_t *p_ctx, DVR_Bool_t discard)
+{
   if (p_ctx->discard_coming_data != discard) {
     p_ctx->discard_coming_data = discard;
     if (discard) {
@@ -1220,18 +1933,32 @@ int dvr_record_discard_coming_data(DVR_RecordHandle_t handle, DVR_Bool_t discard
   return DVR_TRUE;
 }
 
-int dvr_record_ioctl(DVR_RecordHandle_t handle, unsigned int cmd, void *data, size_t size)
+int dvr_record_discard_coming_data(DVR_RecordHandle_t handle, DVR_Bool_t discard)
 {
   DVR_RecordContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_discard_coming_data(p_ctx, discard);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_ioctl(DVR_RecordContext_t *p_ctx, unsigned int cmd, void *data, size_t size)
+{
   int ret = DVR_FAILURE;
-  int i;
 
-  p_ctx = (DVR_RecordContext_t *)handle;
-  for (i = 0; i < MAX_DVR_RECORD_SESSION_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
+  /* Record module commands, the others are passed to the segment */
+  if (cmd == DVR_RECORD_CMD_GET_STATS) {
+    DVR_RETURN_IF_FALSE(data && size >= sizeof(DVR_RecordStats_t));
+    return dvr_record_get_stats(p_ctx->handle, (DVR_RecordStats_t *)data);
+  } else if (cmd == DVR_RECORD_CMD_RESET_STATS) {
+    pthread_mutex_lock(&p_ctx->stats_lock);
+    memset(&p_ctx->stats, 0, sizeof(p_ctx->stats));
+    pthread_mutex_unlock(&p_ctx->stats_lock);
+    return DVR_SUCCESS;
   }
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
 
   SEG_CALL_INIT(&p_ctx->segment_ops);
 
@@ -1263,3 +1990,44 @@ int dvr_record_ioctl(DVR_RecordHandle_t handle, unsigned int cmd, void *data, si
 
   return ret;
 }
+
+int dvr_record_ioctl(DVR_RecordHandle_t handle, unsigned int cmd, void *data, size_t size)
+{
+  DVR_RecordContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_ioctl(p_ctx, cmd, data, size);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+static int record_get_stats(DVR_RecordContext_t *p_ctx, DVR_RecordStats_t *p_stats)
+{
+  DVR_RETURN_IF_FALSE(p_stats);
+  DVR_RETURN_IF_FALSE(p_ctx->state != DVR_RECORD_STATE_CLOSED);
+
+  pthread_mutex_lock(&p_ctx->stats_lock);
+  memcpy(p_stats, &p_ctx->stats, sizeof(*p_stats));
+  pthread_mutex_unlock(&p_ctx->stats_lock);
+  return DVR_SUCCESS;
+}
+
+int dvr_record_get_stats(DVR_RecordHandle_t handle, DVR_RecordStats_t *p_stats)
+{
+  DVR_RecordContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = record_get_stats(p_ctx, p_stats);
+  record_put_ctx(p_ctx);
+  return ret;
+}
+
+int dvr_record_set_max_sessions(int count)
+{
+  DVR_RETURN_IF_FALSE(dvr_handle_table_set_limit(&record_table, count) == DVR_SUCCESS);
+  return record_device_set_max_count(count);
+}
@@ -6,7 +6,10 @@
 #include <pthread.h>
 #include "dvr_segment.h"
 #include <segment.h>
+#include <segment_ring.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 /**\brief DVR segment file information*/
 typedef struct {
@@ -45,6 +48,11 @@ int dvr_segment_delete(const char *location, uint64_t segment_id)
   DVR_RETURN_IF_FALSE(strlen(location) < DVR_MAX_LOCATION_SIZE);
   DVR_INFO("In function %s, segment %s's id is %lld", __func__, location, segment_id);
 
+  /* Releasing a ring slot only rewrites its slot entry and unlinks the
+   * small index files, no need for a thread */
+  if (segment_ring_exists(location))
+    return segment_delete(location, segment_id);
+
   // Memory allocated here will be freed in segment deletion thread under normal conditions.
   // In case of thread creation failure, it will be freed right away.
   segment = (DVR_SegmentFile_t *)malloc(sizeof(DVR_SegmentFile_t));
@@ -144,96 +152,170 @@ int dvr_segment_del_by_location(const char *location)
   return DVR_SUCCESS;
 }
 
-int dvr_segment_get_list(const char *location, uint32_t *p_segment_nb, uint64_t **pp_segment_ids)
+/* Add an entry to a growable segment array */
+static int segment_enum_add(DVR_SegmentEntry_t **pp_entries, uint32_t *p_nb, uint32_t *p_cap, uint64_t id)
+{
+  DVR_SegmentEntry_t *p;
+  uint32_t cap;
+
+  if (*p_nb == *p_cap) {
+    cap = *p_cap ? *p_cap * 2 : 64;
+    p = realloc(*pp_entries, cap * sizeof(DVR_SegmentEntry_t));
+    DVR_RETURN_IF_FALSE(p);
+    *pp_entries = p;
+    *p_cap = cap;
+  }
+  (*pp_entries)[*p_nb].id = id;
+  (*pp_entries)[*p_nb].size = 0;
+  (*p_nb)++;
+  return DVR_SUCCESS;
+}
+
+static int segment_enum_cmp(const void *a, const void *b)
+{
+  uint64_t ia = ((const DVR_SegmentEntry_t *)a)->id;
+  uint64_t ib = ((const DVR_SegmentEntry_t *)b)->id;
+
+  return (ia < ib) ? -1 : (ia > ib);
+}
+
+/* Get the id of a "<fname>-<id>.ts" directory entry */
+static int segment_enum_parse(const char *name, const char *fname, size_t fname_len, uint64_t *p_id)
+{
+  const char *p;
+  char *end;
+
+  if (strncmp(name, fname, fname_len) != 0 || name[fname_len] != '-')
+    return DVR_FAILURE;
+  p = name + fname_len + 1;
+  if (*p < '0' || *p > '9')
+    return DVR_FAILURE;
+  *p_id = strtoull(p, &end, 10);
+  if (strcmp(end, ".ts") != 0)
+    return DVR_FAILURE;
+  return DVR_SUCCESS;
+}
+
+/* Read the ids of the list file in one pass */
+static int segment_enum_list(FILE *fp, DVR_SegmentEntry_t **pp_entries, uint32_t *p_nb)
 {
-  FILE *fp;
-  char fpath[DVR_MAX_LOCATION_SIZE];
-  uint32_t i = 0, j = 0, n = 0;
   char buf[DVR_MAX_LOCATION_SIZE + 10];
-  uint64_t *p = NULL;
-  char cmd[DVR_MAX_LOCATION_SIZE + 64];
+  uint32_t cap = 0;
+
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    if (segment_enum_add(pp_entries, p_nb, &cap, strtoull(buf, NULL, 10)) != DVR_SUCCESS)
+      return DVR_FAILURE;
+  }
+  return DVR_SUCCESS;
+}
+
+/* Scan the directory of the record for its TS files, and sort their ids.
+ * readdir fetches many entries per getdents64 call */
+static int segment_enum_dir(DIR *dir, const char *fname, DVR_SegmentEntry_t **pp_entries, uint32_t *p_nb)
+{
+  struct dirent *entry;
+  size_t fname_len = strlen(fname);
+  uint32_t cap = 0;
+  uint64_t id;
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+      continue;
+    if (segment_enum_parse(entry->d_name, fname, fname_len, &id) != DVR_SUCCESS)
+      continue;
+    if (segment_enum_add(pp_entries, p_nb, &cap, id) != DVR_SUCCESS)
+      return DVR_FAILURE;
+  }
+  if (*p_nb > 1)
+    qsort(*pp_entries, *p_nb, sizeof(DVR_SegmentEntry_t), segment_enum_cmp);
+  return DVR_SUCCESS;
+}
+
+int dvr_segment_enum(const char *location, int flags, uint32_t *p_segment_nb, DVR_SegmentEntry_t **pp_entries)
+{
+  FILE *fp;
+  DIR *dir = NULL;
+  char fpath[DVR_MAX_LOCATION_SIZE + 32];
+  char dname[DVR_MAX_LOCATION_SIZE];
+  const char *fname;
+  DVR_SegmentEntry_t *p = NULL;
+  uint32_t i, n = 0;
+  struct stat st;
+  int ret;
 
   DVR_RETURN_IF_FALSE(location);
   DVR_RETURN_IF_FALSE(p_segment_nb);
-  DVR_RETURN_IF_FALSE(pp_segment_ids);
+  DVR_RETURN_IF_FALSE(pp_entries);
+  DVR_RETURN_IF_FALSE(strlen(location) < DVR_MAX_LOCATION_SIZE);
 
-  memset(fpath, 0, sizeof(fpath));
-  sprintf(fpath, "%s.list", location);
+  /*split the location into its directory and file name*/
+  fname = strrchr(location, '/');
+  if (fname) {
+    fname++;
+    memcpy(dname, location, fname - location);
+    dname[fname - location] = '\0';
+  } else {
+    fname = location;
+    strcpy(dname, ".");
+  }
+  DVR_RETURN_IF_FALSE(fname[0] != '\0');
 
+  /*the directory is only opened to scan it or to get the sizes*/
+  snprintf(fpath, sizeof(fpath), "%s.list", location);
   fp = fopen(fpath, "r");
   if (fp != NULL) { /*the list file exists*/
-    /*get segment numbers*/
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-      i++;
-    }
-    *p_segment_nb = i;
-    rewind(fp);
-    /*malloc*/
-    p = malloc(i * sizeof(uint64_t));
-    i = 0;
-    /*set value*/
-    memset(buf, 0, sizeof(buf));
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-      p[i++] = strtoull(buf, NULL, 10);
-      memset(buf, 0, sizeof(buf));
-    }
-    *pp_segment_ids = p;
+    ret = segment_enum_list(fp, &p, &n);
     fclose(fp);
-    DVR_INFO("%s location:%s segments:%d",  __func__, location, i);
   } else { /*the list file does not exist*/
-    uint32_t id = 0;
-    memset(cmd, 0, sizeof(cmd));
-    sprintf(cmd, "ls -l \"%s\"-*.ts | wc -l", location);
-    fp = popen(cmd, "r");
-    DVR_RETURN_IF_FALSE(fp);
-    memset(buf, 0, sizeof(buf));
-    if (fgets(buf, sizeof(buf), fp) != NULL) {
-      i = strtoul(buf, NULL, 10);
-      pclose(fp);
-      DVR_RETURN_IF_FALSE(i>0);
-    } else {
-      pclose(fp);
-      DVR_ERROR("%s location:%s get null",  __func__, location);
-      return DVR_FAILURE;
+    dir = opendir(dname);
+    DVR_RETURN_IF_FALSE(dir);
+    ret = segment_enum_dir(dir, fname, &p, &n);
+    if (ret == DVR_SUCCESS && n == 0) {
+      DVR_ERROR("%s location:%s no segment found", __func__, location);
+      ret = DVR_FAILURE;
     }
-    n = i;
+  }
 
-    /*try to get the 1st segment id*/
-    memset(cmd, 0, sizeof(cmd));
-    sprintf(cmd, "ls \"%s\"-*.ts", location);
-    fp = popen(cmd, "r");
-    DVR_RETURN_IF_FALSE(fp);
-    memset(buf, 0, sizeof(buf));
-    j = 0;
-    snprintf(fpath, sizeof(fpath), "%s-%%d.ts", location);
-
-    // Tainted data issue originating from fgets seem false positive, so we
-    // just suppress it here.
-    // coverity[tainted_data]
-    p = malloc(n * sizeof(uint64_t));
-    if (p == NULL) {
-      DVR_ERROR("%s, Failed to allocate memory with errno:%d (%s)",
-          __func__,errno,strerror(errno));
-      pclose(fp);
-      return DVR_FAILURE;
+  if (ret == DVR_SUCCESS && (flags & DVR_SEGMENT_ENUM_SIZE)) {
+    if (!dir)
+      dir = opendir(dname);
+    for (i = 0; dir && i < n; i++) {
+      snprintf(fpath, sizeof(fpath), "%s-%04llu.ts", fname, (unsigned long long)p[i].id);
+      if (fstatat(dirfd(dir), fpath, &st, 0) == 0)
+        p[i].size = st.st_size;
     }
+  }
+  if (dir)
+    closedir(dir);
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-      if (sscanf(buf, fpath, &id) != 1) {
-        DVR_INFO("%s location:%s  buf:%s not get id", __func__, location, buf);
-        id = 0;
-        n = n -1;
-      } else {
-        p[j++] = id;
-      }
-      memset(buf, 0, sizeof(buf));
-    }
-    DVR_DEBUG("%s location:%s  n=%d j=%d end", __func__, location, n, j);
-    pclose(fp);
-    *p_segment_nb = n;
-    *pp_segment_ids = p;
+  if (ret != DVR_SUCCESS) {
+    free(p);
+    return DVR_FAILURE;
   }
+  DVR_INFO("%s location:%s segments:%d", __func__, location, n);
+  *p_segment_nb = n;
+  *pp_entries = p;
+  return DVR_SUCCESS;
+}
+
+int dvr_segment_get_list(const char *location, uint32_t *p_segment_nb, uint64_t **pp_segment_ids)
+{
+  DVR_SegmentEntry_t *entries = NULL;
+  uint64_t *p;
+  uint32_t i, n = 0;
+
+  DVR_RETURN_IF_FALSE(location);
+  DVR_RETURN_IF_FALSE(p_segment_nb);
+  DVR_RETURN_IF_FALSE(pp_segment_ids);
+
+  DVR_RETURN_IF_FALSE(dvr_segment_enum(location, 0, &n, &entries) == DVR_SUCCESS);
 
+  /*the ids are moved in place to the start of the entries*/
+  p = (uint64_t *)entries;
+  for (i = 0; i < n; i++)
+    p[i] = entries[i].id;
+  *p_segment_nb = n;
+  *pp_segment_ids = p;
   return DVR_SUCCESS;
 }
 
@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -14,7 +15,9 @@
 #include "dvr_crypto.h"
 #include "dvr_playback.h"
 #include "dvr_segment.h"
+#include "dvr_catalog.h"
 #include "dvr_utils.h"
+#include "dvr_handle_table.h"
 
 #include "AmTsPlayer.h"
 
@@ -33,6 +36,8 @@
 #define TIMESHIFT_DATA_DURATION_TO_RESUME (600)
 /*a tolerant gap*/
 #define DVR_PLAYBACK_END_GAP              (1000)
+#define TIMESHIFT_RING_FILE_PROP          "vendor.tv.libdvr.ringfile"
+#define CATALOG_STATS_INTERVAL_MS         (1000) /**< Min interval of the catalog totals of a started recording*/
 
 int g_dvr_log_level = LOG_LV_DEFAULT;
 
@@ -144,6 +149,9 @@ typedef struct {
   /*rec or play*/
   int                           type;
 
+  /*index in the context list, in the low bits of sn*/
+  int                           slot;
+
   /*valid if (sn != 0)*/
   unsigned long                 sn;
   unsigned long                 sn_linked;
@@ -166,6 +174,8 @@ typedef struct {
       uint64_t                        next_segment_id;
 
       DVR_WrapperInfo_t               obsolete;             /**<data obsolete due to the max limit*/
+      struct timespec                 catalog_time;         /**<last time the totals were put in the catalog*/
+      DVR_Bool_t                      catalog_pending;      /**<totals not put in the catalog yet*/
     } record;
 
     struct {
@@ -233,36 +243,31 @@ typedef struct {
 static unsigned long sn = 1;
 static pthread_mutex_t sn_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static inline unsigned long get_sn()
+#define DVR_WRAPPER_SLOT_BITS DVR_HANDLE_TABLE_INDEX_BITS
+#define DVR_WRAPPER_SN_MASK (ULONG_MAX >> DVR_WRAPPER_SLOT_BITS)
+
+/* the slot of the ctx is kept in the low bits, so a ctx is found without a search */
+static inline unsigned long get_sn(int slot)
 {
   unsigned long no = 0;
 
   pthread_mutex_lock(&sn_lock);
-  no = sn++;
+  no = sn++ & DVR_WRAPPER_SN_MASK;
   if (!no)
-    no = sn++;
+    no = sn++ & DVR_WRAPPER_SN_MASK;
   pthread_mutex_unlock(&sn_lock);
-  return no;
+  return (no << DVR_WRAPPER_SLOT_BITS) | (unsigned long)slot;
 }
 
-/* entity ctx */
-#define DVR_WRAPPER_MAX 10
+/* entity ctx, allocated on first use and kept once allocated */
+#define DVR_WRAPPER_MAX DVR_HANDLE_TABLE_MAX
 
-static DVR_WrapperCtx_t record_list[DVR_WRAPPER_MAX] =
-{
-  [0 ... (DVR_WRAPPER_MAX - 1)] =
-  {
-    .type = W_REC,
-  }
-};
+static DVR_WrapperCtx_t *record_list[DVR_WRAPPER_MAX];
+static DVR_WrapperCtx_t *playback_list[DVR_WRAPPER_MAX];
+static pthread_mutex_t ctx_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static DVR_WrapperCtx_t playback_list[DVR_WRAPPER_MAX] =
-{
-  [0 ... (DVR_WRAPPER_MAX - 1)] =
-  {
-    .type = W_PLAYBACK,
-  }
-};
+/* number of usable slots of each list, 0 until set */
+static int wrapper_max_sessions = 0;
 
 /* events lists */
 static struct list_head record_evt_list = LIST_HEAD_INIT(record_evt_list);
@@ -301,6 +306,8 @@ static DVR_Result_t wrapper_playback_event_handler(DVR_PlaybackEvent_t event, vo
 
 static int process_generateRecordStatus(DVR_WrapperCtx_t *ctx, DVR_WrapperRecordStatus_t *status);
 static int process_generatePlaybackStatus(DVR_WrapperCtx_t *ctx, DVR_WrapperPlaybackStatus_t *status);
+static int wrapper_saveRecordCatalog(DVR_WrapperCtx_t *ctx);
+static void wrapper_saveRecordCatalogStats(DVR_WrapperCtx_t *ctx, DVR_WrapperRecordStatus_t *p_status);
 
 static int get_timespec_timeout(int timeout, struct timespec *ts)
 {
@@ -373,7 +380,7 @@ static inline void ctx_freeEvent(DVR_WrapperEventCtx_t *evt)
 /*useless*/
 static void ctx_cleanOutdatedEvents(struct list_head *evt_list,
     pthread_mutex_t *evt_list_lock,
-    DVR_WrapperCtx_t *list)
+    DVR_WrapperCtx_t **list)
 {
   DVR_WrapperEventCtx_t *p_evt, *p_evt_tmp;
   unsigned long sns[DVR_WRAPPER_MAX];
@@ -383,7 +390,9 @@ static void ctx_cleanOutdatedEvents(struct list_head *evt_list,
 
   /*copy all valid sns*/
   for (i = 0; i < DVR_WRAPPER_MAX; i++) {
-    sns[cnt] = list[i].sn;
+    if (!list[i])
+      continue;
+    sns[cnt] = list[i]->sn;
     if (!sns[cnt])
       cnt++;
   }
@@ -424,7 +433,9 @@ static inline int ctx_isPlay_recording(char *play_location)
   DVR_WrapperCtx_t *cnt;
 
   for (i = 0; i < DVR_WRAPPER_MAX; i++) {
-    cnt = &record_list[i];
+    cnt = record_list[i];
+    if (!cnt)
+      continue;
     //DVR_WRAPPER_INFO("[%d]sn[%d]R:[%s]P:[%s] ...\n", i, cnt->sn, cnt->record.param_open.location, play_location);
     if (!strcmp(cnt->record.param_open.location, play_location)) {
       DVR_WRAPPER_INFO("[%d]sn[%d]R:[%s]P:[%s] .found..\n", i, cnt->sn, cnt->record.param_open.location, play_location);
@@ -442,7 +453,9 @@ static inline int ctx_isRecord_playing(char *rec_location)
     int i;
     DVR_WrapperCtx_t *cnt;
     for (i = 0; i < DVR_WRAPPER_MAX; i++) {
-      cnt = &playback_list[i];
+      cnt = playback_list[i];
+      if (!cnt)
+        continue;
       //DVR_WRAPPER_INFO("[%d]sn[%d]P[%s]R[%s] ...\n", i, cnt->sn, cnt->playback.param_open.location, rec_location);
       if (!strcmp(cnt->playback.param_open.location, rec_location)) {
         DVR_WRAPPER_DEBUG("[%d]sn[%d]P[%s]R[%s] ..found.",
@@ -453,15 +466,62 @@ static inline int ctx_isRecord_playing(char *rec_location)
     return 0;
 }
 
-static inline DVR_WrapperCtx_t *ctx_get(unsigned long sn, DVR_WrapperCtx_t *list)
+static inline int ctx_maxSessions(void)
 {
-  int i;
-  for (i = 0; i < DVR_WRAPPER_MAX; i++) {
-    if (list[i].sn == sn) {
-      wrapper_mutex_init(&list[i].wrapper_lock);
-      return &list[i];
+  if (!wrapper_max_sessions) {
+    int max = dvr_prop_read_int(DVR_HANDLE_TABLE_PROP, DVR_HANDLE_TABLE_DEFAULT);
+    wrapper_max_sessions = (max > 0 && max <= DVR_WRAPPER_MAX) ? max : DVR_HANDLE_TABLE_DEFAULT;
+  }
+  return wrapper_max_sessions;
+}
+
+/* get a free ctx, allocate one if all the allocated ones are used */
+static DVR_WrapperCtx_t *ctx_getFree(DVR_WrapperCtx_t **list, int type)
+{
+  DVR_WrapperCtx_t *ctx = NULL;
+  int i, max;
+
+  pthread_mutex_lock(&ctx_list_lock);
+  max = ctx_maxSessions();
+  for (i = 0; i < max; i++) {
+    if (list[i] && !list[i]->sn) {
+      ctx = list[i];
+      break;
+    }
+  }
+  if (!ctx) {
+    for (i = 0; i < max; i++) {
+      if (!list[i])
+        break;
+    }
+    if (i < max) {
+      ctx = calloc(1, sizeof(DVR_WrapperCtx_t));
+      if (ctx) {
+        ctx->type = type;
+        ctx->slot = i;
+        list[i] = ctx;
+      }
     }
   }
+  if (ctx)
+    wrapper_mutex_init(&ctx->wrapper_lock);
+  pthread_mutex_unlock(&ctx_list_lock);
+
+  if (!ctx)
+    DVR_WRAPPER_ERROR("no free %s ctx, max sessions:%d", (type == W_REC) ? "record" : "playback", max);
+  return ctx;
+}
+
+static inline DVR_WrapperCtx_t *ctx_get(unsigned long sn, DVR_WrapperCtx_t **list, int type)
+{
+  DVR_WrapperCtx_t *ctx;
+
+  if (!sn)
+    return ctx_getFree(list, type);
+
+  ctx = list[sn & (DVR_WRAPPER_MAX - 1)];
+  if (ctx && ctx->sn == sn)
+    return ctx;
   return NULL;
 }
 
@@ -479,12 +539,12 @@ static inline int ctx_valid(DVR_WrapperCtx_t *ctx)
 
 static inline DVR_WrapperCtx_t *ctx_getRecord(unsigned long sn)
 {
-  return ctx_get(sn, record_list);
+  return ctx_get(sn, record_list, W_REC);
 }
 
 static inline DVR_WrapperCtx_t *ctx_getPlayback(unsigned long sn)
 {
-  return ctx_get(sn, playback_list);
+  return ctx_get(sn, playback_list, W_PLAYBACK);
 }
 
 static int wrapper_requestThread(DVR_WrapperThreadCtx_t *ctx, void *(thread_fn)(void *))
@@ -1066,6 +1126,18 @@ static int wrapper_removeRecordSegment(DVR_WrapperCtx_t *ctx, DVR_WrapperRecordS
   return error;
 }
 
+int dvr_wrapper_set_max_sessions (int count)
+{
+  DVR_RETURN_IF_FALSE(count > 0 && count <= DVR_WRAPPER_MAX);
+
+  pthread_mutex_lock(&ctx_list_lock);
+  wrapper_max_sessions = count;
+  pthread_mutex_unlock(&ctx_list_lock);
+
+  DVR_WRAPPER_INFO("set max sessions:%d", count);
+  return dvr_record_set_max_sessions(count);
+}
+
 int dvr_wrapper_open_record (DVR_WrapperRecord_t *rec, DVR_WrapperRecordOpenParams_t *params)
 {
   int error;
@@ -1091,7 +1163,7 @@ int dvr_wrapper_open_record (DVR_WrapperRecord_t *rec, DVR_WrapperRecordOpenPara
   ctx->record.event_userdata = params->event_userdata;
 
   INIT_LIST_HEAD(&ctx->segments);
-  ctx->sn = get_sn();
+  ctx->sn = get_sn(ctx->slot);
 
   wrapper_requestThreadFor(ctx);
 
@@ -1117,6 +1189,13 @@ int dvr_wrapper_open_record (DVR_WrapperRecord_t *rec, DVR_WrapperRecordOpenPara
   }
   open_param.force_sysclock = params->force_sysclock;
   open_param.guarded_segment_size = params->segment_size/2*3;
+  open_param.segment_size = params->segment_size;
+  /* Timeshift keeps at most max_size plus half a segment, see the
+   * discard logic in process_handleRecordEvent */
+  if (params->is_timeshift && params->max_size > 0 && params->segment_size > 0
+      && dvr_prop_read_int(TIMESHIFT_RING_FILE_PROP, 0) > 0) {
+    open_param.ring_size = params->max_size + params->segment_size;
+  }
 
   error = dvr_record_open(&ctx->record.recorder, &open_param);
   if (error) {
@@ -1211,8 +1290,10 @@ int dvr_wrapper_start_record (DVR_WrapperRecord_t rec, DVR_WrapperRecordStartPar
     start_param->segment.pid_action[i] = DVR_RECORD_PID_CREATE;
   }
 
-  if (params->save_rec_file == 0)//default is not save
+  if (params->save_rec_file == 0) {//default is not save
+    dvr_catalog_remove(start_param->location);
     dvr_segment_del_by_location(start_param->location);
+  }
 
   //wait for the file status to stabilize before set the new segment id
   uint64_t new_segment_id = 0;
@@ -1253,6 +1334,7 @@ int dvr_wrapper_start_record (DVR_WrapperRecord_t rec, DVR_WrapperRecordStartPar
       { .id = start_param->segment.segment_id, };
     wrapper_addRecordSegment(ctx, &new_seg_info);
   }
+  wrapper_saveRecordCatalog(ctx);
 
   DVR_WRAPPER_INFO("record(sn:%ld) started = (%d)\n", ctx->sn, error);
 
@@ -1280,6 +1362,16 @@ int dvr_wrapper_stop_record (DVR_WrapperRecord_t rec)
   error = dvr_record_stop_segment(ctx->record.recorder, &seg_info);
   wrapper_updateRecordSegment(ctx, &seg_info, U_ALL);
 
+  /*flush the totals held back by the catalog rate limit*/
+  if (ctx->record.catalog_pending && !ctx->record.param_open.is_timeshift) {
+    DVR_WrapperRecordStatus_t status;
+
+    memset(&status, 0, sizeof(status));
+    process_generateRecordStatus(ctx, &status);
+    status.state = DVR_RECORD_STATE_STOPPED;
+    wrapper_saveRecordCatalogStats(ctx, &status);
+  }
+
   ctx_freeSegments(ctx);
 
   DVR_WRAPPER_INFO("record(sn:%ld) stopped = (%d)\n", ctx->sn, error);
@@ -1463,6 +1555,7 @@ int dvr_wrapper_update_record_pids (DVR_WrapperRecord_t rec, DVR_WrapperUpdatePi
     wrapper_updateRecordSegment(ctx, &seg_info, U_PIDS);
     wrapper_addRecordSegment(ctx, &new_seg_info);
   }
+  wrapper_saveRecordCatalog(ctx);
 
   DVR_WRAPPER_INFO("record(sn:%ld) updated = (%d)\n", ctx->sn, error);
   wrapper_mutex_unlock(&ctx->wrapper_lock);
@@ -1581,7 +1674,7 @@ int dvr_wrapper_open_playback (DVR_WrapperPlayback_t *playback, DVR_WrapperPlayb
   ctx->playback.event_userdata = params->event_userdata;
   ctx->current_segment_id = 0;
   INIT_LIST_HEAD(&ctx->segments);
-  ctx->sn = get_sn();
+  ctx->sn = get_sn(ctx->slot);
 
   wrapper_requestThreadFor(ctx);
 
@@ -2489,6 +2582,28 @@ int dvr_wrapper_get_playback_status(DVR_WrapperPlayback_t playback, DVR_WrapperP
   return error;
 }
 
+int dvr_wrapper_get_playback_stats(DVR_WrapperPlayback_t playback, DVR_PlaybackStats_t *stats)
+{
+  DVR_WrapperCtx_t *ctx;
+  int error;
+
+  DVR_RETURN_IF_FALSE(playback);
+  DVR_RETURN_IF_FALSE(stats);
+
+  ctx = ctx_getPlayback((unsigned long)playback);
+  DVR_RETURN_IF_FALSE(ctx);
+
+  wrapper_mutex_lock(&ctx->wrapper_lock);
+
+  WRAPPER_RETURN_IF_FALSE_WITH_UNLOCK(ctx_valid(ctx), &ctx->wrapper_lock);
+
+  error = dvr_playback_get_stats(ctx->playback.player, stats);
+
+  wrapper_mutex_unlock(&ctx->wrapper_lock);
+
+  return error;
+}
+
 int dvr_wrapper_set_playback_secure_buffer (DVR_WrapperPlayback_t playback,  uint8_t *p_secure_buf, uint32_t len)
 {
   DVR_WrapperCtx_t *ctx;
@@ -2532,6 +2647,7 @@ int dvr_wrapper_segment_del_by_location (const char *location)
   /*del the stats file*/
   sprintf(fpath, "%s.stats", location);
   unlink(fpath);
+  dvr_catalog_remove(location);
 
   return dvr_segment_del_by_location(location);
 }
@@ -2547,6 +2663,19 @@ int dvr_wrapper_segment_get_info_by_location (const char *location, DVR_WrapperI
   if (p_info)
     memset(p_info, 0, sizeof(p_info[0]));
 
+  /*catalog of the directory, no file of the recording is opened*/
+  {
+    DVR_CatalogEntry_t entry;
+
+    if (dvr_catalog_get(location, &entry) == DVR_SUCCESS
+      && (entry.flags & DVR_CATALOG_HAS_STATS)) {
+      p_info->size = entry.size;
+      p_info->time = entry.time;
+      p_info->pkts = entry.pkts;
+      return DVR_SUCCESS;
+    }
+  }
+
   memset(fpath, 0, sizeof(fpath));
   sprintf(fpath, "%s.stats", location);
 
@@ -2725,14 +2854,46 @@ static inline int process_notifyRecord(DVR_WrapperCtx_t *ctx, DVR_RecordEvent_t
   return 0;
 }
 
-static int wrapper_saveRecordStatistics(const char *location, DVR_WrapperRecordStatus_t *p_status)
+/*put the totals of the recording in the catalog of its directory.
+  while started, a status comes with every block written, so the totals
+  are appended at most once per CATALOG_STATS_INTERVAL_MS, the last ones
+  are flushed when the recording stops*/
+static void wrapper_saveRecordCatalogStats(DVR_WrapperCtx_t *ctx, DVR_WrapperRecordStatus_t *p_status)
+{
+  struct timespec now;
+  long diff;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (p_status->state == DVR_RECORD_STATE_STARTED
+      && (ctx->record.catalog_time.tv_sec || ctx->record.catalog_time.tv_nsec)) {
+    diff = (now.tv_sec - ctx->record.catalog_time.tv_sec) * 1000
+      + (now.tv_nsec - ctx->record.catalog_time.tv_nsec) / 1000000;
+    if (diff >= 0 && diff < CATALOG_STATS_INTERVAL_MS) {
+      ctx->record.catalog_pending = DVR_TRUE;
+      return;
+    }
+  }
+
+  dvr_catalog_set_stats(ctx->record.param_open.location,
+      p_status->info.size - p_status->info_obsolete.size,
+      p_status->info.time - p_status->info_obsolete.time,
+      p_status->info.pkts - p_status->info_obsolete.pkts);
+  ctx->record.catalog_time = now;
+  ctx->record.catalog_pending = DVR_FALSE;
+}
+
+static int wrapper_saveRecordStatistics(DVR_WrapperCtx_t *ctx, DVR_WrapperRecordStatus_t *p_status)
 {
   FILE *fp;
   char fpath[DVR_MAX_LOCATION_SIZE];
+  const char *location = ctx->record.param_open.location;
 
-  DVR_RETURN_IF_FALSE(location);
   DVR_RETURN_IF_FALSE(p_status);
 
+  /*timeshift files are deleted without the wrapper, keep them out of the catalog*/
+  if (!ctx->record.param_open.is_timeshift)
+    wrapper_saveRecordCatalogStats(ctx, p_status);
+
   sprintf(fpath, "%s.stats", location);
 
   /*stats file*/
@@ -2752,6 +2913,35 @@ static int wrapper_saveRecordStatistics(const char *location, DVR_WrapperRecordS
   return DVR_FAILURE;
 }
 
+/*save the segments and pids of the recording in the catalog of its directory*/
+static int wrapper_saveRecordCatalog(DVR_WrapperCtx_t *ctx)
+{
+  DVR_WrapperRecordSegmentInfo_t *p_seg;
+  uint64_t *p_ids;
+  uint32_t n = 0;
+  int error;
+
+  if (ctx->record.param_open.is_timeshift)
+    return DVR_SUCCESS;
+
+  // coverity[self_assign]
+  list_for_each_entry(p_seg, &ctx->segments, head)
+    n++;
+  p_ids = (uint64_t *)malloc((n ? n : 1) * sizeof(uint64_t));
+  DVR_RETURN_IF_FALSE(p_ids);
+
+  /*the list head is the newest segment*/
+  n = 0;
+  // coverity[self_assign]
+  list_for_each_entry_reverse(p_seg, &ctx->segments, head)
+    p_ids[n++] = p_seg->info.id;
+
+  error = dvr_catalog_set_segments(ctx->record.param_open.location, n, p_ids,
+      ctx->record.param_update.segment.nb_pids, ctx->record.param_update.segment.pids);
+  free(p_ids);
+  return error;
+}
+
 
 static inline int record_startNextSegment(DVR_WrapperCtx_t *ctx)
 {
@@ -2777,6 +2967,7 @@ static inline int record_startNextSegment(DVR_WrapperCtx_t *ctx)
     wrapper_updateRecordSegment(ctx, &seg_info, U_ALL);
     wrapper_addRecordSegment(ctx, &new_seg_info);
   }
+  wrapper_saveRecordCatalog(ctx);
 
   DVR_WRAPPER_INFO("record next segment(%llu)=(%d)\n", ctx->record.param_update.segment.segment_id, error);
   return error;
@@ -2784,7 +2975,10 @@ static inline int record_startNextSegment(DVR_WrapperCtx_t *ctx)
 
 static inline int record_removeSegment(DVR_WrapperCtx_t *ctx, DVR_WrapperRecordSegmentInfo_t *p_seg)
 {
-  return wrapper_removeRecordSegment(ctx, p_seg);
+  int error = wrapper_removeRecordSegment(ctx, p_seg);
+
+  wrapper_saveRecordCatalog(ctx);
+  return error;
 }
 
 /*should run periodically to update the current status*/
@@ -2856,7 +3050,7 @@ static int process_handleRecordEvent(DVR_WrapperEventCtx_t *evt, DVR_WrapperCtx_
 
           status.state = evt->record.status.state;
           process_notifyRecord(ctx, evt->record.event, &status);
-          wrapper_saveRecordStatistics(ctx->record.param_open.location, &status);
+          wrapper_saveRecordStatistics(ctx, &status);
         } break;
         case DVR_RECORD_STATE_STARTED:
         {
@@ -2864,7 +3058,7 @@ static int process_handleRecordEvent(DVR_WrapperEventCtx_t *evt, DVR_WrapperCtx_
 
           process_generateRecordStatus(ctx, &status);
           process_notifyRecord(ctx, evt->record.event, &status);
-          wrapper_saveRecordStatistics(ctx->record.param_open.location, &status);
+          wrapper_saveRecordStatistics(ctx, &status);
 
           /*restart to next segment*/
           if (ctx->record.param_open.segment_size
@@ -2880,7 +3074,7 @@ static int process_handleRecordEvent(DVR_WrapperEventCtx_t *evt, DVR_WrapperCtx_
                 ctx->sn, error);
               status.state = DVR_RECORD_STATE_CLOSED;
               process_notifyRecord(ctx, DVR_RECORD_EVENT_WRITE_ERROR, &status);
-              wrapper_saveRecordStatistics(ctx->record.param_open.location, &status);
+              wrapper_saveRecordStatistics(ctx, &status);
             }
           }
 
@@ -2905,7 +3099,7 @@ static int process_handleRecordEvent(DVR_WrapperEventCtx_t *evt, DVR_WrapperCtx_
 
               process_generateRecordStatus(ctx, &status);
               process_notifyRecord(ctx, evt->record.event, &status);
-              wrapper_saveRecordStatistics(ctx->record.param_open.location, &status);
+              wrapper_saveRecordStatistics(ctx, &status);
             }
           }
 
@@ -2929,7 +3123,7 @@ static int process_handleRecordEvent(DVR_WrapperEventCtx_t *evt, DVR_WrapperCtx_
 
                 process_generateRecordStatus(ctx, &status);
                 process_notifyRecord(ctx, evt->record.event, &status);
-                wrapper_saveRecordStatistics(ctx->record.param_open.location, &status);
+                wrapper_saveRecordStatistics(ctx, &status);
               }
               if (actual_size >= max_size + segment_size/2) {
                 dvr_record_discard_coming_data(ctx->record.recorder,DVR_TRUE);
@@ -2945,7 +3139,7 @@ static int process_handleRecordEvent(DVR_WrapperEventCtx_t *evt, DVR_WrapperCtx_
 
           process_generateRecordStatus(ctx, &status);
           process_notifyRecord(ctx, evt->record.event, &status);
-          wrapper_saveRecordStatistics(ctx->record.param_open.location, &status);
+          wrapper_saveRecordStatistics(ctx, &status);
         } break;
         default:
         break;
@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -9,6 +11,7 @@
 #include <errno.h>
 #include <poll.h>
 #include <dlfcn.h>
+#include <stdatomic.h>
 
 #include <dmx.h>
 /*add for config define for linux dvb *.h*/
@@ -16,8 +19,9 @@
 #include "dvr_types.h"
 #include "dvr_utils.h"
 #include "dvb_utils.h"
+#include "ts_pid_set.h"
+#include "dvr_handle_table.h"
 
-#define MAX_RECORD_DEVICE_COUNT 8
 #define MAX_DEMUX_DEVICE_COUNT 8
 #define MAX_FEND_DEVICE_COUNT 2
 
@@ -41,30 +45,85 @@ typedef struct {
   int                           fd;                                    /**< DVR device file descriptor*/
   int                           stream_cnt;                            /**< Stream counts*/
   Record_Stream_t               streams[DVR_MAX_RECORD_PIDS_COUNT];    /**< Record stream list*/
-  Record_DeviceState_t          state;                                 /**< Record device state*/
+  TS_PidSet_t                   pid_set;                               /**< Pids of streams, the slot is the stream index*/
+  _Atomic Record_DeviceState_t  state;                                 /**< Record device state, changed locked, read lock free*/
   int                           fend_dev_id;                           /**< Frontend device id*/
   uint32_t                      dmx_dev_id;                            /**< Record source*/
   size_t                        dvr_buf;
   size_t                        output_handle;                         /**< Secure demux output*/
   pthread_mutex_t               lock;                                  /**< Record device lock*/
-  int                           evtfd;                                 /**< eventfd for poll's exit*/
+  int                           evtfd;                                 /**< eventfd waking up the poll of read on stop*/
+  Record_DeviceHandle_t         handle;                                /**< Handle of the device*/
+  int                           dev_no;                                /**< Async fifo number, the slot of the device*/
+  const Record_DeviceBackend_t *backend;                               /**< Backend of the device, NULL for the demux*/
+  void                         *priv;                                  /**< Backend context*/
+  DVR_Bool_t                    secure_batch;                          /**< Share the secure demux processing with the other devices of the sid*/
 } Record_DeviceContext_t;
 
+/**\brief Secure demux data processed last on a sid*/
+typedef struct {
+  DVR_Bool_t                    valid;                                 /**< wp and ts are set*/
+  uint32_t                      wp;                                    /**< Write pointer processed*/
+} Record_SecdmxState_t;
+
 /*  each sid need one mutex */
 static pthread_mutex_t secdmx_lock[MAX_DEMUX_DEVICE_COUNT] = PTHREAD_MUTEX_INITIALIZER;
+/*  shared secure DVR buffers are looked up and allocated or freed under this mutex */
+static pthread_mutex_t dvr_buf_lock = PTHREAD_MUTEX_INITIALIZER;
+static Record_SecdmxState_t secdmx_state[MAX_DEMUX_DEVICE_COUNT];
 
-static Record_DeviceContext_t record_ctx[MAX_RECORD_DEVICE_COUNT] = {
-  {
-    .state = RECORD_DEVICE_STATE_CLOSED,
-    .fend_dev_id = -1,
-    .lock = PTHREAD_MUTEX_INITIALIZER
-  },
-  {
-    .state = RECORD_DEVICE_STATE_CLOSED,
-    .fend_dev_id = -1,
-    .lock = PTHREAD_MUTEX_INITIALIZER
+static DVR_HandleTable_t record_table = DVR_HANDLE_TABLE_INITIALIZER;
+
+static const Record_DeviceBackend_t *record_backend = NULL;
+
+/* Get a device context, it is not freed until it is put back */
+static inline Record_DeviceContext_t *record_device_get_ctx(Record_DeviceHandle_t handle)
+{
+  return (Record_DeviceContext_t *)dvr_handle_table_get(&record_table, handle);
+}
+
+static inline void record_device_put_ctx(Record_DeviceContext_t *p_ctx)
+{
+  dvr_handle_table_put(&record_table, p_ctx->handle);
+}
+
+/* Get the secure DVR buffer of another device sharing the demux, or the
+ * frontend, of a device. 0 if there is none, must be called with
+ * dvr_buf_lock held */
+static size_t record_device_find_dvr_buf(Record_DeviceContext_t *p_ctx, DVR_Bool_t same_dmx)
+{
+  Record_DeviceContext_t *p_other;
+  size_t dvr_buf = 0;
+  int i, n;
+
+  n = dvr_handle_table_size(&record_table);
+  for (i = 0; i < n && !dvr_buf; i++) {
+    p_other = (Record_DeviceContext_t *)dvr_handle_table_at(&record_table, i);
+    if (!p_other)
+      continue;
+    if (p_other != p_ctx && p_other->state != RECORD_DEVICE_STATE_CLOSED && p_other->dvr_buf != 0 &&
+        (same_dmx ? p_other->dmx_dev_id == p_ctx->dmx_dev_id : p_other->fend_dev_id == p_ctx->fend_dev_id)) {
+      DVR_INFO("%s found [%d] ", __func__, i);
+      dvr_buf = p_other->dvr_buf;
+    }
+    dvr_handle_table_put(&record_table, p_other->handle);
   }
-};
+  return dvr_buf;
+}
+
+/* The state is changed with the device locked, and published to the read
+ * path, which does not lock: read checks the state after its poll, and stop
+ * changes the state before waking the poll, so a read never starts on a
+ * stopped device. fd and evtfd do not change between open and close. */
+static inline Record_DeviceState_t record_device_get_state(Record_DeviceContext_t *p_ctx)
+{
+  return atomic_load_explicit(&p_ctx->state, memory_order_acquire);
+}
+
+static inline void record_device_set_state(Record_DeviceContext_t *p_ctx, Record_DeviceState_t state)
+{
+  atomic_store_explicit(&p_ctx->state, state, memory_order_release);
+}
 /*define sec dmx function api ptr*/
 static void* secdmx_handle = NULL;
 int (*SECDMX_Init_Ptr)(int ts_clone_enabled);
@@ -152,6 +211,43 @@ int get_sid(Record_DeviceContext_t *p_ctx)
   }
 }
 
+/* In batch mode, the secure demux processing is skipped if another device
+ * of the sid already processed the same write pointer, the data up to it is
+ * in the output buffers of all the devices of the sid. A moved write
+ * pointer is always processed. Must be called with secdmx_lock[sid] held */
+static DVR_Bool_t secdmx_batch_skip(int sid, uint32_t wp)
+{
+  Record_SecdmxState_t *st = &secdmx_state[sid];
+
+  return (st->valid && st->wp == wp) ? DVR_TRUE : DVR_FALSE;
+}
+
+static const Record_DeviceBackend_t *record_device_get_backend(void)
+{
+  char path[256];
+
+  if (record_backend)
+    return record_backend;
+  memset(path, 0, sizeof(path));
+  if (dvr_prop_read(RECORD_DEVICE_REPLAY_PROP, path, sizeof(path)) == DVR_SUCCESS && path[0])
+    return &record_device_replay_backend;
+  return NULL;
+}
+
+/* Remove a device from the table and free it once the calls using it have
+ * returned, the lock and no reference must be held */
+static void record_device_free(Record_DeviceContext_t *p_ctx)
+{
+  if (p_ctx->handle)
+    dvr_handle_table_remove(&record_table, p_ctx->handle);
+  if (p_ctx->fd != -1)
+    close(p_ctx->fd);
+  if (p_ctx->evtfd != -1)
+    close(p_ctx->evtfd);
+  pthread_mutex_destroy(&p_ctx->lock);
+  free(p_ctx);
+}
+
 int record_device_open(Record_DeviceHandle_t *p_handle, Record_DeviceOpenParams_t *params)
 {
   int i;
@@ -166,13 +262,34 @@ int record_device_open(Record_DeviceHandle_t *p_handle, Record_DeviceOpenParams_
   DVR_RETURN_IF_FALSE(params);
   DVR_RETURN_IF_FALSE(params->dmx_dev_id < MAX_DEMUX_DEVICE_COUNT);
 
-  for (dev_no = 0; dev_no <  MAX_RECORD_DEVICE_COUNT; dev_no++) {
-    if (record_ctx[dev_no].state == RECORD_DEVICE_STATE_CLOSED)
-      break;
+  p_ctx = (Record_DeviceContext_t *)calloc(1, sizeof(Record_DeviceContext_t));
+  DVR_RETURN_IF_FALSE(p_ctx);
+  record_device_set_state(p_ctx, RECORD_DEVICE_STATE_CLOSED);
+  p_ctx->fend_dev_id = -1;
+  p_ctx->fd = -1;
+  p_ctx->evtfd = -1;
+  pthread_mutex_init(&p_ctx->lock, NULL);
+  /*The slot index selects the async fifo*/
+  if (dvr_handle_table_add(&record_table, p_ctx, &p_ctx->handle, &dev_no) != DVR_SUCCESS) {
+    record_device_free(p_ctx);
+    return DVR_FAILURE;
+  }
+  p_ctx->dev_no = dev_no;
+
+  p_ctx->backend = record_device_get_backend();
+  if (p_ctx->backend) {
+    if (p_ctx->backend->open(&p_ctx->priv, params) != DVR_SUCCESS) {
+      DVR_ERROR("%s backend %s open failed", __func__, p_ctx->backend->name);
+      record_device_free(p_ctx);
+      return DVR_FAILURE;
+    }
+    DVR_INFO("%s use backend %s", __func__, p_ctx->backend->name);
+    p_ctx->fend_dev_id = params->fend_dev_id;
+    p_ctx->dmx_dev_id = params->dmx_dev_id;
+    record_device_set_state(p_ctx, RECORD_DEVICE_STATE_OPENED);
+    *p_handle = p_ctx->handle;
+    return DVR_SUCCESS;
   }
-  DVR_RETURN_IF_FALSE(dev_no < MAX_RECORD_DEVICE_COUNT);
-  DVR_RETURN_IF_FALSE(record_ctx[dev_no].state == RECORD_DEVICE_STATE_CLOSED);
-  p_ctx = &record_ctx[dev_no];
 
   pthread_mutex_lock(&p_ctx->lock);
   for (i = 0; i < DVR_MAX_RECORD_PIDS_COUNT; i++) {
@@ -180,6 +297,7 @@ int record_device_open(Record_DeviceHandle_t *p_handle, Record_DeviceOpenParams_
     p_ctx->streams[i].pid = DVR_INVALID_PID;
     p_ctx->streams[i].fid = -1;
   }
+  ts_pid_set_init(&p_ctx->pid_set);
   /*Open dvr device*/
   memset(dev_name, 0, sizeof(dev_name));
   snprintf(dev_name, sizeof(dev_name), "/dev/dvb0.dvr%d", params->dmx_dev_id);
@@ -188,16 +306,19 @@ int record_device_open(Record_DeviceHandle_t *p_handle, Record_DeviceOpenParams_
   {
     DVR_INFO("%s cannot open \"%s\" (%s)", __func__, dev_name, strerror(errno));
     pthread_mutex_unlock(&p_ctx->lock);
+    record_device_free(p_ctx);
     return DVR_FAILURE;
   }
   if (fcntl(p_ctx->fd, F_SETFL, fcntl(p_ctx->fd, F_GETFL, 0) | O_NONBLOCK, 0) < 0) {
     DVR_ERROR("%s setting non-block flag fails with errno:%d(%s)",
         __func__,errno,strerror(errno));
     pthread_mutex_unlock(&p_ctx->lock);
+    record_device_free(p_ctx);
     return DVR_FAILURE;
   }
 
-  p_ctx->evtfd = eventfd(0, 0);
+  p_ctx->evtfd = eventfd(0, EFD_NONBLOCK);
+  p_ctx->secure_batch = (dvr_prop_read_int(RECORD_DEVICE_SECURE_BATCH_PROP, 0) > 0) ? DVR_TRUE : DVR_FALSE;
   DVR_INFO("%s, %d fd: %d %p %d %p", __func__, __LINE__, p_ctx->fd, &(p_ctx->fd), p_ctx->evtfd, &(p_ctx->evtfd));
   load_secdmx_api();
   /*Configure flush size*/
@@ -261,8 +382,8 @@ int record_device_open(Record_DeviceHandle_t *p_handle, Record_DeviceOpenParams_
   }
   p_ctx->output_handle = (size_t)NULL;
   p_ctx->dvr_buf = (size_t)NULL;
-  p_ctx->state = RECORD_DEVICE_STATE_OPENED;
-  *p_handle = p_ctx;
+  record_device_set_state(p_ctx, RECORD_DEVICE_STATE_OPENED);
+  *p_handle = p_ctx->handle;
   pthread_mutex_unlock(&p_ctx->lock);
   return DVR_SUCCESS;
 }
@@ -270,22 +391,20 @@ int record_device_open(Record_DeviceHandle_t *p_handle, Record_DeviceOpenParams_
 int record_device_close(Record_DeviceHandle_t handle)
 {
   Record_DeviceContext_t *p_ctx;
-  int i;
 
-  p_ctx = (Record_DeviceContext_t *)handle;
+  p_ctx = record_device_get_ctx(handle);
   DVR_RETURN_IF_FALSE(p_ctx);
-  for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(i < MAX_RECORD_DEVICE_COUNT);
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
 
   pthread_mutex_lock(&p_ctx->lock);
-  DVR_RETURN_IF_FALSE_WITH_UNLOCK(p_ctx->state != RECORD_DEVICE_STATE_CLOSED, &p_ctx->lock);
-  close(p_ctx->fd);
-  close(p_ctx->evtfd);
-  if (dvr_check_dmx_isNew()) {
+  if (p_ctx->state == RECORD_DEVICE_STATE_CLOSED) {
+    pthread_mutex_unlock(&p_ctx->lock);
+    record_device_put_ctx(p_ctx);
+    return DVR_FAILURE;
+  }
+  if (p_ctx->backend) {
+    p_ctx->backend->close(p_ctx->priv);
+    p_ctx->priv = NULL;
+  } else if (dvr_check_dmx_isNew()) {
     if (p_ctx->output_handle) {
       if (SECDMX_RemoveOutputBuffer_Ptr != NULL)
         SECDMX_RemoveOutputBuffer_Ptr(p_ctx->output_handle);
@@ -293,48 +412,58 @@ int record_device_close(Record_DeviceHandle_t handle)
     }
     if (p_ctx->dvr_buf) {
       if (SECDMX_FreeDVRBuffer_Ptr != NULL) {
-    for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-      if (&record_ctx[i] != p_ctx &&
-          record_ctx[i].fend_dev_id == p_ctx->fend_dev_id &&
-          record_ctx[i].dvr_buf == p_ctx->dvr_buf) {
-        break;
-      }
-    }
-    if (i >= MAX_RECORD_DEVICE_COUNT) {
+    pthread_mutex_lock(&dvr_buf_lock);
+    if (record_device_find_dvr_buf(p_ctx, DVR_FALSE) != p_ctx->dvr_buf) {
           SECDMX_FreeDVRBuffer_Ptr(p_ctx->fend_dev_id);
     }
     p_ctx->dvr_buf = (size_t)NULL;
+    pthread_mutex_unlock(&dvr_buf_lock);
       }
     }
   }
   p_ctx->fend_dev_id = -1;
-  p_ctx->state = RECORD_DEVICE_STATE_CLOSED;
+  record_device_set_state(p_ctx, RECORD_DEVICE_STATE_CLOSED);
   pthread_mutex_unlock(&p_ctx->lock);
 
+  /* Removing the device waits for the calls still using it */
+  record_device_put_ctx(p_ctx);
+  record_device_free(p_ctx);
   return DVR_SUCCESS;
 }
 
-int record_device_add_pid(Record_DeviceHandle_t handle, int pid)
+/* Find the stream of a pid. The null packet pid and 0x2000, which records
+ * the whole TS, are not in the pid set, their stream is searched for */
+static int record_device_find_stream(Record_DeviceContext_t *p_ctx, int pid)
+{
+  int i;
+
+  i = ts_pid_set_slot(&p_ctx->pid_set, pid);
+  if (i >= 0 && i < DVR_MAX_RECORD_PIDS_COUNT && p_ctx->streams[i].pid == pid)
+    return i;
+  for (i = 0; i < DVR_MAX_RECORD_PIDS_COUNT; i++) {
+    if (p_ctx->streams[i].pid == pid)
+      return i;
+  }
+  return -1;
+}
+
+static int device_add_pid(Record_DeviceContext_t *p_ctx, int pid)
 {
   int i;
   int fd;
   int ret;
-  Record_DeviceContext_t *p_ctx;
   char dev_name[32];
   struct dmx_pes_filter_params params;
 
-  p_ctx = (Record_DeviceContext_t *)handle;
-  DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(pid != DVR_INVALID_PID);
-  for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(i < MAX_RECORD_DEVICE_COUNT);
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
 
   pthread_mutex_lock(&p_ctx->lock);
   DVR_RETURN_IF_FALSE_WITH_UNLOCK(p_ctx->state != RECORD_DEVICE_STATE_CLOSED, &p_ctx->lock);
+  if (p_ctx->backend) {
+    ret = p_ctx->backend->add_pid(p_ctx->priv, pid);
+    pthread_mutex_unlock(&p_ctx->lock);
+    return ret;
+  }
   for (i = 0; i < DVR_MAX_RECORD_PIDS_COUNT; i++) {
     if (p_ctx->streams[i].pid == DVR_INVALID_PID)
       break;
@@ -343,6 +472,8 @@ int record_device_add_pid(Record_DeviceHandle_t handle, int pid)
   DVR_RETURN_IF_FALSE_WITH_UNLOCK(p_ctx->streams[i].pid == DVR_INVALID_PID, &p_ctx->lock);
 
   p_ctx->streams[i].pid = pid;
+  if (!ts_pid_set_has(&p_ctx->pid_set, pid) && ts_pid_set_add(&p_ctx->pid_set, pid, i) != 0)
+    DVR_INFO("%s pid:%#x is not in the pid set", __func__, pid);
   DVR_INFO("%s add pid:%#x", __func__, pid);
     snprintf(dev_name, sizeof(dev_name), "/dev/dvb0.demux%d", p_ctx->dmx_dev_id);
   fd = open(dev_name, O_RDWR);
@@ -387,31 +518,35 @@ int record_device_add_pid(Record_DeviceHandle_t handle, int pid)
   return DVR_SUCCESS;
 }
 
-int record_device_remove_pid(Record_DeviceHandle_t handle, int pid)
+int record_device_add_pid(Record_DeviceHandle_t handle, int pid)
 {
   Record_DeviceContext_t *p_ctx;
-  int fd;
   int ret;
-  int i;
 
-  p_ctx = (Record_DeviceContext_t *)handle;
+  p_ctx = record_device_get_ctx(handle);
   DVR_RETURN_IF_FALSE(p_ctx);
+  ret = device_add_pid(p_ctx, pid);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+static int device_remove_pid(Record_DeviceContext_t *p_ctx, int pid)
+{
+  int fd;
+  int ret;
+  int i, j;
+
   DVR_RETURN_IF_FALSE(pid != DVR_INVALID_PID);
-  for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(i < MAX_RECORD_DEVICE_COUNT);
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
 
   pthread_mutex_lock(&p_ctx->lock);
   DVR_RETURN_IF_FALSE_WITH_UNLOCK(p_ctx->state != RECORD_DEVICE_STATE_CLOSED, &p_ctx->lock);
-  for (i = 0; i < DVR_MAX_RECORD_PIDS_COUNT; i++) {
-    if (p_ctx->streams[i].pid == pid)
-      break;
+  if (p_ctx->backend) {
+    ret = p_ctx->backend->remove_pid(p_ctx->priv, pid);
+    pthread_mutex_unlock(&p_ctx->lock);
+    return ret;
   }
-  DVR_RETURN_IF_FALSE_WITH_UNLOCK(i < DVR_MAX_RECORD_PIDS_COUNT, &p_ctx->lock);
-  DVR_RETURN_IF_FALSE_WITH_UNLOCK(p_ctx->streams[i].pid == pid, &p_ctx->lock);
+  i = record_device_find_stream(p_ctx, pid);
+  DVR_RETURN_IF_FALSE_WITH_UNLOCK(i >= 0, &p_ctx->lock);
 
   fd = p_ctx->streams[i].fid;
   DVR_RETURN_IF_FALSE_WITH_UNLOCK(fd != -1, &p_ctx->lock);
@@ -426,6 +561,11 @@ int record_device_remove_pid(Record_DeviceHandle_t handle, int pid)
   }
 
   p_ctx->streams[i].pid = DVR_INVALID_PID;
+  ts_pid_set_remove(&p_ctx->pid_set, pid);
+  /* The pid may have been added twice, point it to the remaining stream */
+  j = record_device_find_stream(p_ctx, pid);
+  if (j >= 0)
+    ts_pid_set_add(&p_ctx->pid_set, pid, j);
   //DVR_RETURN_IF_FALSE_WITH_UNLOCK(DVR_SUCCESS == add_dvr_pids(p_ctx), &p_ctx->lock);
   add_dvr_pids(p_ctx);
   //DVR_INFO("%s libdvrFilterTrace close1-1. pid: 0x%x, fd: 0x%x ", __func__,pid, fd);
@@ -436,23 +576,25 @@ int record_device_remove_pid(Record_DeviceHandle_t handle, int pid)
   return DVR_SUCCESS;
 }
 
-int record_device_start(Record_DeviceHandle_t handle)
+int record_device_remove_pid(Record_DeviceHandle_t handle, int pid)
 {
   Record_DeviceContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_device_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = device_remove_pid(p_ctx, pid);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+static int device_start(Record_DeviceContext_t *p_ctx)
+{
   int fd;
   int ret;
   int i;
   struct dmx_pes_filter_params params;
 
-  p_ctx = (Record_DeviceContext_t *)handle;
-  DVR_RETURN_IF_FALSE(p_ctx);
-  for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(i < MAX_RECORD_DEVICE_COUNT);
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
-
   pthread_mutex_lock(&p_ctx->lock);
   if (p_ctx->state != RECORD_DEVICE_STATE_OPENED &&
       p_ctx->state != RECORD_DEVICE_STATE_STOPPED) {
@@ -461,8 +603,21 @@ int record_device_start(Record_DeviceHandle_t handle)
     return DVR_FAILURE;
   }
 
+  if (p_ctx->backend) {
+    ret = p_ctx->backend->start(p_ctx->priv);
+    if (ret == DVR_SUCCESS)
+      record_device_set_state(p_ctx, RECORD_DEVICE_STATE_STARTED);
+    pthread_mutex_unlock(&p_ctx->lock);
+    return ret;
+  }
+
   //DVR_RETURN_IF_FALSE_WITH_UNLOCK(DVR_SUCCESS == add_dvr_pids(p_ctx), &p_ctx->lock);
   add_dvr_pids(p_ctx);
+  {
+    /*Drop the wakeup left by the last stop*/
+    int64_t pad;
+    read(p_ctx->evtfd, &pad, sizeof(pad));
+  }
 
   for (i = 0; i < DVR_MAX_RECORD_PIDS_COUNT; i++) {
     if (p_ctx->streams[i].fid != -1 &&
@@ -496,26 +651,28 @@ int record_device_start(Record_DeviceHandle_t handle)
       p_ctx->streams[i].is_start = DVR_TRUE;
     }
   }
-  p_ctx->state = RECORD_DEVICE_STATE_STARTED;
+  record_device_set_state(p_ctx, RECORD_DEVICE_STATE_STARTED);
   pthread_mutex_unlock(&p_ctx->lock);
   return DVR_SUCCESS;
 }
 
-int record_device_stop(Record_DeviceHandle_t handle)
+int record_device_start(Record_DeviceHandle_t handle)
 {
   Record_DeviceContext_t *p_ctx;
-  int fd;
   int ret;
-  int i;
 
-  p_ctx = (Record_DeviceContext_t *)handle;
+  p_ctx = record_device_get_ctx(handle);
   DVR_RETURN_IF_FALSE(p_ctx);
-  for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(i < MAX_RECORD_DEVICE_COUNT);
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
+  ret = device_start(p_ctx);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+static int device_stop(Record_DeviceContext_t *p_ctx)
+{
+  int fd;
+  int ret;
+  int i;
 
   pthread_mutex_lock(&p_ctx->lock);
   if (p_ctx->state != RECORD_DEVICE_STATE_STARTED) {
@@ -524,6 +681,13 @@ int record_device_stop(Record_DeviceHandle_t handle)
     return DVR_FAILURE;
   }
 
+  if (p_ctx->backend) {
+    ret = p_ctx->backend->stop(p_ctx->priv);
+    record_device_set_state(p_ctx, RECORD_DEVICE_STATE_STOPPED);
+    pthread_mutex_unlock(&p_ctx->lock);
+    return ret;
+  }
+
   for (i = 0; i < DVR_MAX_RECORD_PIDS_COUNT; i++) {
     if (p_ctx->streams[i].fid != -1 &&
         p_ctx->streams[i].pid != DVR_INVALID_PID &&
@@ -544,7 +708,7 @@ int record_device_stop(Record_DeviceHandle_t handle)
       p_ctx->streams[i].is_start = DVR_FALSE;
     }
   }
-  p_ctx->state = RECORD_DEVICE_STATE_STOPPED;
+  record_device_set_state(p_ctx, RECORD_DEVICE_STATE_STOPPED);
   {
     /*wakeup the poll*/
     int64_t pad = 1;
@@ -554,24 +718,37 @@ int record_device_stop(Record_DeviceHandle_t handle)
   return DVR_SUCCESS;
 }
 
-int record_device_read(Record_DeviceHandle_t handle, void *buf, size_t len, int timeout)
+int record_device_stop(Record_DeviceHandle_t handle)
 {
   Record_DeviceContext_t *p_ctx;
-  struct pollfd fds[2];
   int ret;
 
-  p_ctx = (Record_DeviceContext_t *)handle;
+  p_ctx = record_device_get_ctx(handle);
   DVR_RETURN_IF_FALSE(p_ctx);
-  DVR_RETURN_IF_FALSE(p_ctx->fd != -1);
+  ret = device_stop(p_ctx);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+static int device_read(Record_DeviceContext_t *p_ctx, void *buf, size_t len, int timeout)
+{
+  struct pollfd fds[2];
+  int ret;
+
   DVR_RETURN_IF_FALSE(buf);
   DVR_RETURN_IF_FALSE(len);
 
-  memset(fds, 0, sizeof(fds));
+  /*Not locked, so pid changes and stop do not wait for the read*/
+  if (p_ctx->backend) {
+    if (record_device_get_state(p_ctx) != RECORD_DEVICE_STATE_STARTED)
+      return DVR_FAILURE;
+    return p_ctx->backend->read(p_ctx->priv, buf, len, timeout);
+  }
+  DVR_RETURN_IF_FALSE(p_ctx->fd != -1);
 
-  pthread_mutex_lock(&p_ctx->lock);
+  memset(fds, 0, sizeof(fds));
   fds[0].fd = p_ctx->fd;
   fds[1].fd = p_ctx->evtfd;
-  pthread_mutex_unlock(&p_ctx->lock);
 
   fds[0].events = fds[1].events = POLLIN | POLLERR;
   ret = poll(fds, 2, timeout);
@@ -584,37 +761,114 @@ int record_device_read(Record_DeviceHandle_t handle, void *buf, size_t len, int
   if (!(fds[0].revents & POLLIN))
     return DVR_FAILURE;
 
-  pthread_mutex_lock(&p_ctx->lock);
-  if (p_ctx->state == RECORD_DEVICE_STATE_STARTED) {
-    ret = read(fds[0].fd, buf, len);
-    if (ret <= 0) {
-      DVR_INFO("%s, %d failed: %s", __func__, __LINE__, strerror(errno));
-      pthread_mutex_unlock(&p_ctx->lock);
+  if (record_device_get_state(p_ctx) != RECORD_DEVICE_STATE_STARTED)
+    return DVR_FAILURE;
+  ret = read(fds[0].fd, buf, len);
+  if (ret <= 0) {
+    DVR_INFO("%s, %d failed: %s", __func__, __LINE__, strerror(errno));
+    return DVR_FAILURE;
+  }
+  return ret;
+}
+
+int record_device_read(Record_DeviceHandle_t handle, void *buf, size_t len, int timeout)
+{
+  Record_DeviceContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_device_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = device_read(p_ctx, buf, len, timeout);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+static int device_splice(Record_DeviceContext_t *p_ctx, int pipe_fd, size_t len, int timeout)
+{
+  struct pollfd fds[2];
+  int ret;
+
+  DVR_RETURN_IF_FALSE(pipe_fd != -1);
+  DVR_RETURN_IF_FALSE(len);
+
+  if (p_ctx->backend) {
+    if (!p_ctx->backend->splice) {
+      errno = EINVAL;
       return DVR_FAILURE;
     }
-  } else {
-      ret = DVR_FAILURE;
+    if (record_device_get_state(p_ctx) != RECORD_DEVICE_STATE_STARTED)
+      return DVR_FAILURE;
+    return p_ctx->backend->splice(p_ctx->priv, pipe_fd, len, timeout);
+  }
+  DVR_RETURN_IF_FALSE(p_ctx->fd != -1);
+
+  memset(fds, 0, sizeof(fds));
+  fds[0].fd = p_ctx->fd;
+  fds[1].fd = p_ctx->evtfd;
+
+  fds[0].events = fds[1].events = POLLIN | POLLERR;
+  ret = poll(fds, 2, timeout);
+  if (ret < 0) {
+    DVR_INFO("%s, %d failed: %s fd %d event fd %d", __func__, __LINE__,
+        strerror(errno), p_ctx->fd, p_ctx->evtfd);
+    return DVR_FAILURE;
+  }
+
+  if (!(fds[0].revents & POLLIN))
+    return DVR_FAILURE;
+
+  if (record_device_get_state(p_ctx) != RECORD_DEVICE_STATE_STARTED)
+    return DVR_FAILURE;
+  ret = splice(fds[0].fd, NULL, pipe_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (ret <= 0) {
+    DVR_INFO("%s, %d failed: %s", __func__, __LINE__, strerror(errno));
+    return DVR_FAILURE;
   }
-  pthread_mutex_unlock(&p_ctx->lock);
   return ret;
 }
 
-ssize_t record_device_read_ext(Record_DeviceHandle_t handle, size_t *buf, size_t *len)
+int record_device_splice(Record_DeviceHandle_t handle, int pipe_fd, size_t len, int timeout)
 {
   Record_DeviceContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_device_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = device_splice(p_ctx, pipe_fd, len, timeout);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+int record_device_get_fd(Record_DeviceHandle_t handle)
+{
+  Record_DeviceContext_t *p_ctx;
+
+  int fd = -1;
+
+  p_ctx = record_device_get_ctx(handle);
+  if (!p_ctx)
+    return -1;
+  if (!p_ctx->backend)
+    fd = p_ctx->fd;
+  record_device_put_ctx(p_ctx);
+  return fd;
+}
+
+static ssize_t device_read_ext(Record_DeviceContext_t *p_ctx, size_t *buf, size_t *len)
+{
   int result;
   int sid;
   struct dvr_mem_info info;
 
-  p_ctx = (Record_DeviceContext_t *)handle;
-  DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(buf);
   DVR_RETURN_IF_FALSE(len);
+  DVR_RETURN_IF_FALSE(!p_ctx->backend);
   DVR_RETURN_IF_FALSE(p_ctx->dvr_buf);
   DVR_RETURN_IF_FALSE(p_ctx->output_handle);
 
+  /* The secure buffer is only changed while the device is not started,
+   * so the device is not locked, only the shared write pointer is */
   sid = get_sid(p_ctx);
-  pthread_mutex_lock(&p_ctx->lock);
 
   /* wp_offset is hw write pointer shared by multiple recordings under one sid,
    * must use mutex for thread safe
@@ -623,7 +877,13 @@ ssize_t record_device_read_ext(Record_DeviceHandle_t handle, size_t *buf, size_t
   memset(&info, 0, sizeof(info));
   result = ioctl(p_ctx->fd, DMX_GET_DVR_MEM, &info);
   //DVR_INFO("sid[%d] fd[%d] wp:%#x\n", sid, p_ctx->fd, info.wp_offset);
-  if (result == DVR_SUCCESS) {
+  if (result == DVR_SUCCESS && p_ctx->secure_batch) {
+    if (!secdmx_batch_skip(sid, info.wp_offset) && SECDMX_ProcessData_Ptr != NULL) {
+      result = SECDMX_ProcessData_Ptr(sid, info.wp_offset);
+      secdmx_state[sid].valid = (result == DVR_SUCCESS) ? DVR_TRUE : DVR_FALSE;
+      secdmx_state[sid].wp = info.wp_offset;
+    }
+  } else if (result == DVR_SUCCESS) {
     if (SECDMX_ProcessData_Ptr != NULL)
       result = SECDMX_ProcessData_Ptr(sid, info.wp_offset);
   }
@@ -632,34 +892,36 @@ ssize_t record_device_read_ext(Record_DeviceHandle_t handle, size_t *buf, size_t
   }
   pthread_mutex_unlock(&secdmx_lock[sid]);
 
-  DVR_RETURN_IF_FALSE_WITH_UNLOCK(result == DVR_SUCCESS, &p_ctx->lock);
+  DVR_RETURN_IF_FALSE(result == DVR_SUCCESS);
   if (SECDMX_GetOutputBufferStatus_Ptr != NULL)
     result = SECDMX_GetOutputBufferStatus_Ptr(p_ctx->output_handle, buf, len);
   //DVR_INFO("addr:%#x, len:%#x\n", *buf, *len);
-  DVR_RETURN_IF_FALSE_WITH_UNLOCK(result == DVR_SUCCESS, &p_ctx->lock);
+  DVR_RETURN_IF_FALSE(result == DVR_SUCCESS);
 
-  pthread_mutex_unlock(&p_ctx->lock);
   return *len;
 }
 
-int record_device_set_secure_buffer(Record_DeviceHandle_t handle, uint8_t *sec_buf, uint32_t len)
+ssize_t record_device_read_ext(Record_DeviceHandle_t handle, size_t *buf, size_t *len)
 {
   Record_DeviceContext_t *p_ctx;
-  int i;
+  ssize_t ret;
+
+  p_ctx = record_device_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = device_read_ext(p_ctx, buf, len);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+static int device_set_secure_buffer(Record_DeviceContext_t *p_ctx, uint8_t *sec_buf, uint32_t len)
+{
   char buf[64];
   char cmd[32];
 
-  p_ctx = (Record_DeviceContext_t *)handle;
-  DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(sec_buf);
   DVR_RETURN_IF_FALSE(len);
+  DVR_RETURN_IF_FALSE(!p_ctx->backend);
 
-  for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-    if (p_ctx == &record_ctx[i])
-      break;
-  }
-  DVR_RETURN_IF_FALSE(i < MAX_RECORD_DEVICE_COUNT);
-  DVR_RETURN_IF_FALSE(p_ctx == &record_ctx[i]);
 
   pthread_mutex_lock(&p_ctx->lock);
   if (p_ctx->state != RECORD_DEVICE_STATE_OPENED &&
@@ -698,40 +960,21 @@ int record_device_set_secure_buffer(Record_DeviceHandle_t handle, uint8_t *sec_b
     DVR_INFO("%s dvr_ts_clone_enable is [%d] ", __func__, dvr_ts_clone_enable());
 
     if (SECDMX_AllocateDVRBuffer_Ptr != NULL) {
-        if (dvr_ts_clone_enable()) {
-            for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-              if (record_ctx[i].state != RECORD_DEVICE_STATE_CLOSED &&
-                  &record_ctx[i] != p_ctx &&
-                  record_ctx[i].dmx_dev_id == p_ctx->dmx_dev_id &&
-                  record_ctx[i].dvr_buf != 0) {
-                DVR_INFO("%s dvr_ts_clone_enable found [%d] ", __func__, i);
-                break;
-              }
-            }
-        } else {
-        for (i = 0; i < MAX_RECORD_DEVICE_COUNT; i++) {
-          if (record_ctx[i].state != RECORD_DEVICE_STATE_CLOSED &&
-              &record_ctx[i] != p_ctx &&
-              record_ctx[i].fend_dev_id == p_ctx->fend_dev_id &&
-              record_ctx[i].dvr_buf != 0) {
-            DVR_INFO("%s Non-dvr_ts_clone_enable found [%d] ", __func__, i);
-            break;
-          }
-        }
-      }
-
-    if (i >= MAX_RECORD_DEVICE_COUNT) {
+    /* With ts clone, the devices of a demux share the buffer, else the
+     * devices of a frontend */
+    pthread_mutex_lock(&dvr_buf_lock);
+    dvr_buf = record_device_find_dvr_buf(p_ctx, dvr_ts_clone_enable() ? DVR_TRUE : DVR_FALSE);
+    if (!dvr_buf) {
       result = SECDMX_AllocateDVRBuffer_Ptr(sid, &len, &dvr_buf);
       if (result != DVR_SUCCESS) {
       //DVR_INFO("%s libdvrFilterTrace close2-1. fd: 0x%x ", __func__, fd);
          close(fd);
       }
-      DVR_RETURN_IF_FALSE_WITH_UNLOCK(result == DVR_SUCCESS, &p_ctx->lock);
-    } else {
-      dvr_buf = record_ctx[i].dvr_buf;
     }
-
-    p_ctx->dvr_buf = dvr_buf;
+    if (result == DVR_SUCCESS)
+      p_ctx->dvr_buf = dvr_buf;
+    pthread_mutex_unlock(&dvr_buf_lock);
+    DVR_RETURN_IF_FALSE_WITH_UNLOCK(result == DVR_SUCCESS, &p_ctx->lock);
     } else {
     p_ctx->dvr_buf = (size_t)sec_buf;
     }
@@ -753,16 +996,16 @@ int record_device_set_secure_buffer(Record_DeviceHandle_t handle, uint8_t *sec_b
   }
 
   memset(buf, 0, sizeof(buf));
-  snprintf(buf, sizeof(buf), "/sys/class/stb/asyncfifo%d_secure_enable", i);
+  snprintf(buf, sizeof(buf), "/sys/class/stb/asyncfifo%d_secure_enable", p_ctx->dev_no);
   dvr_file_echo(buf, "1");
 
   memset(buf, 0, sizeof(buf));
-  snprintf(buf, sizeof(buf), "/sys/class/stb/asyncfifo%d_secure_addr", i);
+  snprintf(buf, sizeof(buf), "/sys/class/stb/asyncfifo%d_secure_addr", p_ctx->dev_no);
   snprintf(cmd, sizeof(cmd), "%llu", (uint64_t)sec_buf);
   dvr_file_echo(buf, cmd);
 
   memset(buf, 0, sizeof(buf));
-  snprintf(buf, sizeof(buf), "/sys/class/stb/asyncfifo%d_secure_addr_size", i);
+  snprintf(buf, sizeof(buf), "/sys/class/stb/asyncfifo%d_secure_addr_size", p_ctx->dev_no);
   snprintf(cmd, sizeof(cmd), "%d", len);
   dvr_file_echo(buf, cmd);
 
@@ -770,3 +1013,30 @@ int record_device_set_secure_buffer(Record_DeviceHandle_t handle, uint8_t *sec_b
   return DVR_SUCCESS;
 }
 
+int record_device_set_secure_buffer(Record_DeviceHandle_t handle, uint8_t *sec_buf, uint32_t len)
+{
+  Record_DeviceContext_t *p_ctx;
+  int ret;
+
+  p_ctx = record_device_get_ctx(handle);
+  DVR_RETURN_IF_FALSE(p_ctx);
+  ret = device_set_secure_buffer(p_ctx, sec_buf, len);
+  record_device_put_ctx(p_ctx);
+  return ret;
+}
+
+int record_device_set_backend(const Record_DeviceBackend_t *backend)
+{
+  if (backend) {
+    DVR_RETURN_IF_FALSE(backend->open && backend->close && backend->read);
+    DVR_RETURN_IF_FALSE(backend->add_pid && backend->remove_pid);
+    DVR_RETURN_IF_FALSE(backend->start && backend->stop);
+  }
+  record_backend = backend;
+  return DVR_SUCCESS;
+}
+
+int record_device_set_max_count(int count)
+{
+  return dvr_handle_table_set_limit(&record_table, count);
+}
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "ts_pid_set.h"
+#include "record_device.h"
+
+#define REPLAY_TS_PKT_SIZE    188
+#define REPLAY_PCR_HZ         90000
+/*PCR steps larger than this are discontinuities, the pace restarts from them*/
+#define REPLAY_PCR_MAX_STEP   (REPLAY_PCR_HZ * 2)
+
+/**\brief Replay source context*/
+typedef struct {
+  int             fd;             /**< Source file or pipe*/
+  int             evtfd;          /**< eventfd waking up a waiting read on stop*/
+  DVR_Bool_t      seekable;       /**< Source is a regular file*/
+  DVR_Bool_t      pace;           /**< Deliver at the PCR derived bitrate*/
+  DVR_Bool_t      loop;           /**< Rewind the file at its end*/
+  DVR_Bool_t      eof;            /**< End of the source reached*/
+  volatile int    started;        /**< Source started*/
+  pthread_mutex_t lock;           /**< Protects the PID set*/
+  TS_PidSet_t     pid_set;        /**< PIDs to deliver*/
+  DVR_Bool_t      whole_ts;       /**< TS_PID_ALL is added, all the packets are delivered*/
+  uint8_t         part[REPLAY_TS_PKT_SIZE];  /**< Partial packet of the last read*/
+  int             part_len;       /**< Bytes in part*/
+  int             pcr_pid;        /**< PID the pace follows, DVR_INVALID_PID until a PCR is found*/
+  DVR_Bool_t      pcr_valid;      /**< pcr_base and time_base are set*/
+  uint64_t        pcr_base;       /**< PCR at time_base, 90KHz*/
+  uint64_t        pcr_last;       /**< Last PCR, 90KHz*/
+  uint64_t        time_base;      /**< Monotonic time of pcr_base, unit on us*/
+} Replay_Source_t;
+
+static uint64_t replay_time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Wait until stopped or timeout, return DVR_FALSE if stopped */
+static DVR_Bool_t replay_wait(Replay_Source_t *src, int timeout)
+{
+  struct pollfd pfd;
+
+  if (!src->started)
+    return DVR_FALSE;
+  pfd.fd = src->evtfd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, timeout) > 0)
+    return DVR_FALSE;
+  return src->started ? DVR_TRUE : DVR_FALSE;
+}
+
+/* Get the PCR of a packet, 90KHz */
+static DVR_Bool_t replay_get_pcr(const uint8_t *p, uint64_t *pcr)
+{
+  if (!(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10))
+    return DVR_FALSE;
+  *pcr = ((uint64_t)p[6] << 25) | ((uint64_t)p[7] << 17) |
+    ((uint64_t)p[8] << 9) | ((uint64_t)p[9] << 1) | (p[10] >> 7);
+  return DVR_TRUE;
+}
+
+/* Hold a packet back until its PCR is due */
+static DVR_Bool_t replay_pace(Replay_Source_t *src, uint64_t pcr)
+{
+  uint64_t now, due;
+
+  now = replay_time_us();
+  if (!src->pcr_valid || pcr < src->pcr_last || pcr - src->pcr_last > REPLAY_PCR_MAX_STEP) {
+    src->pcr_base = pcr;
+    src->pcr_last = pcr;
+    src->time_base = now;
+    src->pcr_valid = DVR_TRUE;
+    return DVR_TRUE;
+  }
+  src->pcr_last = pcr;
+  due = src->time_base + (pcr - src->pcr_base) * 1000000 / REPLAY_PCR_HZ;
+  if (due > now + 1000)
+    return replay_wait(src, (int)((due - now) / 1000));
+  return src->started ? DVR_TRUE : DVR_FALSE;
+}
+
+static int replay_open(void **p_priv, Record_DeviceOpenParams_t *params)
+{
+  Replay_Source_t *src;
+  char path[256];
+  struct stat st;
+
+  DVR_RETURN_IF_FALSE(p_priv);
+  DVR_RETURN_IF_FALSE(params);
+
+  memset(path, 0, sizeof(path));
+  if (dvr_prop_read(RECORD_DEVICE_REPLAY_PROP, path, sizeof(path)) != DVR_SUCCESS || !path[0]) {
+    DVR_ERROR("%s no source, set %s", __func__, RECORD_DEVICE_REPLAY_PROP);
+    return DVR_FAILURE;
+  }
+
+  src = (Replay_Source_t *)calloc(1, sizeof(Replay_Source_t));
+  DVR_RETURN_IF_FALSE(src);
+  src->evtfd = -1;
+  /*Do not block on a pipe without a writer*/
+  src->fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (src->fd == -1) {
+    DVR_ERROR("%s cannot open \"%s\" (%s)", __func__, path, strerror(errno));
+    free(src);
+    return DVR_FAILURE;
+  }
+  src->evtfd = eventfd(0, EFD_NONBLOCK);
+  if (src->evtfd == -1) {
+    DVR_ERROR("%s eventfd failed (%s)", __func__, strerror(errno));
+    close(src->fd);
+    free(src);
+    return DVR_FAILURE;
+  }
+  src->seekable = (fstat(src->fd, &st) == 0 && S_ISREG(st.st_mode)) ? DVR_TRUE : DVR_FALSE;
+  src->pace = dvr_prop_read_int(RECORD_DEVICE_REPLAY_PACE_PROP, 1) ? DVR_TRUE : DVR_FALSE;
+  src->loop = dvr_prop_read_int(RECORD_DEVICE_REPLAY_LOOP_PROP, 0) ? DVR_TRUE : DVR_FALSE;
+  src->pcr_pid = DVR_INVALID_PID;
+  pthread_mutex_init(&src->lock, NULL);
+  ts_pid_set_init(&src->pid_set);
+
+  DVR_INFO("%s \"%s\" pace:%d loop:%d", __func__, path, src->pace, src->loop);
+  *p_priv = src;
+  return DVR_SUCCESS;
+}
+
+static int replay_close(void *priv)
+{
+  Replay_Source_t *src = (Replay_Source_t *)priv;
+
+  DVR_RETURN_IF_FALSE(src);
+  close(src->fd);
+  close(src->evtfd);
+  pthread_mutex_destroy(&src->lock);
+  free(src);
+  return DVR_SUCCESS;
+}
+
+static int replay_add_pid(void *priv, int pid)
+{
+  Replay_Source_t *src = (Replay_Source_t *)priv;
+  int ret;
+
+  DVR_RETURN_IF_FALSE(src);
+  pthread_mutex_lock(&src->lock);
+  if (pid == TS_PID_ALL) {
+    src->whole_ts = DVR_TRUE;
+    ret = 0;
+  } else {
+    ret = ts_pid_set_add(&src->pid_set, pid, 0);
+  }
+  pthread_mutex_unlock(&src->lock);
+  return (ret == 0) ? DVR_SUCCESS : DVR_FAILURE;
+}
+
+static int replay_remove_pid(void *priv, int pid)
+{
+  Replay_Source_t *src = (Replay_Source_t *)priv;
+
+  DVR_RETURN_IF_FALSE(src);
+  pthread_mutex_lock(&src->lock);
+  if (pid == TS_PID_ALL)
+    src->whole_ts = DVR_FALSE;
+  else
+    ts_pid_set_remove(&src->pid_set, pid);
+  pthread_mutex_unlock(&src->lock);
+  return DVR_SUCCESS;
+}
+
+static int replay_start(void *priv)
+{
+  Replay_Source_t *src = (Replay_Source_t *)priv;
+  uint64_t pad;
+
+  DVR_RETURN_IF_FALSE(src);
+  /*Drop a wakeup left by the last stop*/
+  read(src->evtfd, &pad, sizeof(pad));
+  src->pcr_valid = DVR_FALSE;
+  src->started = 1;
+  return DVR_SUCCESS;
+}
+
+static int replay_stop(void *priv)
+{
+  Replay_Source_t *src = (Replay_Source_t *)priv;
+  uint64_t pad = 1;
+
+  DVR_RETURN_IF_FALSE(src);
+  src->started = 0;
+  /*wakeup the poll*/
+  write(src->evtfd, &pad, sizeof(pad));
+  return DVR_SUCCESS;
+}
+
+/* Read the next bytes of the source after the partial packet, return 0 at the end */
+static int replay_fill(Replay_Source_t *src, uint8_t *buf, size_t len, int timeout)
+{
+  struct pollfd fds[2];
+  ssize_t ret;
+
+  if (src->eof) {
+    replay_wait(src, timeout);
+    return DVR_FAILURE;
+  }
+
+  memset(fds, 0, sizeof(fds));
+  fds[0].fd = src->fd;
+  fds[1].fd = src->evtfd;
+  fds[0].events = fds[1].events = POLLIN;
+  if (poll(fds, 2, timeout) <= 0 || !src->started)
+    return DVR_FAILURE;
+  if (!(fds[0].revents & (POLLIN | POLLHUP)))
+    return DVR_FAILURE;
+
+  ret = read(src->fd, buf, len);
+  if (ret < 0) {
+    if (errno != EAGAIN)
+      DVR_ERROR("%s read failed (%s)", __func__, strerror(errno));
+    return DVR_FAILURE;
+  }
+  if (ret == 0) {
+    if (!src->seekable) {
+      /*No writer on the pipe, wait for the next one*/
+      replay_wait(src, timeout);
+    } else if (src->loop && lseek(src->fd, 0, SEEK_SET) == 0) {
+      DVR_INFO("%s rewind", __func__);
+      src->part_len = 0;
+      src->pcr_valid = DVR_FALSE;
+    } else {
+      DVR_INFO("%s end of source", __func__);
+      src->eof = DVR_TRUE;
+    }
+  }
+  return (int)ret;
+}
+
+static int replay_read(void *priv, void *buf, size_t len, int timeout)
+{
+  Replay_Source_t *src = (Replay_Source_t *)priv;
+  uint8_t *p = (uint8_t *)buf;
+  size_t total, pos, out = 0;
+  uint64_t pcr;
+  int pid, ret, keep;
+
+  DVR_RETURN_IF_FALSE(src);
+  DVR_RETURN_IF_FALSE(len >= REPLAY_TS_PKT_SIZE);
+
+  len -= len % REPLAY_TS_PKT_SIZE;
+  memcpy(p, src->part, src->part_len);
+  ret = replay_fill(src, p + src->part_len, len - src->part_len, timeout);
+  if (ret <= 0)
+    return DVR_FAILURE;
+  total = src->part_len + ret;
+
+  pos = 0;
+  while (pos + REPLAY_TS_PKT_SIZE <= total) {
+    /*Resync on the next sync byte*/
+    if (p[pos] != 0x47) {
+      pos++;
+      continue;
+    }
+    pid = TS_PKT_PID(p + pos);
+    if (src->pace && (src->pcr_pid == DVR_INVALID_PID || src->pcr_pid == pid) &&
+        replay_get_pcr(p + pos, &pcr)) {
+      src->pcr_pid = pid;
+      if (!replay_pace(src, pcr)) {
+        pos = total;
+        break;
+      }
+    }
+    /*Not locked while pacing, so adding a PID does not wait for the pace*/
+    pthread_mutex_lock(&src->lock);
+    keep = src->whole_ts || ts_pid_set_has(&src->pid_set, pid);
+    pthread_mutex_unlock(&src->lock);
+    if (keep) {
+      if (out != pos)
+        memmove(p + out, p + pos, REPLAY_TS_PKT_SIZE);
+      out += REPLAY_TS_PKT_SIZE;
+    }
+    pos += REPLAY_TS_PKT_SIZE;
+  }
+
+  /*Keep the partial packet for the next read*/
+  src->part_len = (int)(total - pos);
+  memmove(src->part, p + pos, src->part_len);
+
+  return out ? (int)out : DVR_FAILURE;
+}
+
+/**\brief Replay a TS file or pipe, see RECORD_DEVICE_REPLAY_PROP*/
+const Record_DeviceBackend_t record_device_replay_backend = {
+  .name       = "replay",
+  .open       = replay_open,
+  .close      = replay_close,
+  .add_pid    = replay_add_pid,
+  .remove_pid = replay_remove_pid,
+  .start      = replay_start,
+  .stop       = replay_stop,
+  .read       = replay_read,
+  .splice     = NULL,
+};
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -6,8 +7,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include "dvr_types.h"
+#include "dvr_utils.h"
 #include "segment.h"
+#include "segment_ring.h"
 
 #define MAX_SEGMENT_FD_COUNT (128)
 #define MAX_SEGMENT_PATH_SIZE (DVR_MAX_LOCATION_SIZE + 32)
@@ -20,6 +28,51 @@
 #define IDX_FILE_SYNC_TIME    (10)//10*PCR_RECORD_INTERVAL_MS
 #define TS_FILE_SYNC_TIME     (9)//9*PCR_RECORD_INTERVAL_MS
 
+#define SEGMENT_INDEX_MAGIC       (0x58444944)  /* "DIDX" */
+#define SEGMENT_INDEX_VERSION     (1)
+#define SEGMENT_INDEX_BINARY_PROP "vendor.tv.libdvr.binidx"
+#define SEGMENT_INDEX_CACHE_INIT  (256)
+#define SEGMENT_INDEX_NOTIFY_PROP "vendor.tv.libdvr.idxnotify"
+#define SEGMENT_IFRAME_MAGIC      (0x52464944)  /* "DIFR" */
+#define SEGMENT_IFRAME_VERSION    (1)
+#define SEGMENT_MMAP_PROP         "vendor.tv.libdvr.mmap"
+#define SEGMENT_MMAP_WINDOW       (4*1024*1024)
+#define SEGMENT_WB_QUEUE_PROP     "vendor.tv.libdvr.wbqueue"
+#define SEGMENT_WB_QUEUE_DEFAULT  (0)
+#define SEGMENT_PREALLOC_PROP     "vendor.tv.libdvr.prealloc"
+#define SEGMENT_DIO_PROP          "vendor.tv.libdvr.directio"
+#define SEGMENT_DIO_ALIGN         (4096)
+#define SEGMENT_DIO_BUF_SIZE      (512*1024)
+#define SEGMENT_DROP_BEHIND_PROP  "vendor.tv.libdvr.dropbehind"
+#define SEGMENT_READ_AHEAD_PROP   "vendor.tv.libdvr.readahead"
+
+/**\brief Index file format*/
+typedef enum {
+  SEGMENT_INDEX_FORMAT_UNKNOWN,               /**< Not probed yet, e.g. ongoing index is still empty*/
+  SEGMENT_INDEX_FORMAT_TEXT,                  /**< Legacy "{time=%llu, offset=%lld}" lines*/
+  SEGMENT_INDEX_FORMAT_BINARY,                /**< Header followed by fixed-width records*/
+} Segment_IndexFormat_t;
+
+/**\brief Binary index file header, stored in host byte order*/
+typedef struct {
+  uint32_t        magic;                              /**< SEGMENT_INDEX_MAGIC*/
+  uint16_t        version;                            /**< SEGMENT_INDEX_VERSION*/
+  uint16_t        entry_size;                         /**< Size of one index record*/
+  uint64_t        reserved;
+} Segment_IndexHeader_t;
+
+/**\brief Binary index record*/
+typedef struct {
+  uint64_t        time;                               /**< Time from segment start, unit on ms*/
+  int64_t         offset;                             /**< Offset in the TS file*/
+} Segment_IndexEntry_t;
+
+/**\brief Write-behind queue block*/
+typedef struct {
+  uint8_t         *data;                              /**< Block buffer, kept for reuse*/
+  size_t          size;                               /**< Allocated size of data*/
+  size_t          len;                                /**< Valid data length*/
+} Segment_WriteBlock_t;
 
 /**\brief Segment context*/
 typedef struct {
@@ -40,6 +93,55 @@ typedef struct {
   float           avg_rate;
   int             time;
   DVR_Bool_t      force_sysclock;                     /**< If ture, force to use system clock as PVR index time source. If false, libdvr can determine index time source based on actual situation*/
+  Segment_IndexFormat_t index_format;                 /**< Index file format*/
+  uint32_t        index_nb;                           /**< Number of index entries written, use for write mode*/
+  Segment_OpenMode_t mode;                            /**< Segment open mode*/
+  Segment_IndexEntry_t *index_cache;                  /**< In-memory index points, sorted by time and offset*/
+  uint32_t        index_cache_nb;                     /**< Number of cached index points*/
+  uint32_t        index_cache_cap;                    /**< Capacity of index_cache*/
+  long            index_cache_pos;                    /**< Index file position parsed into the cache, use for read mode*/
+  DVR_Bool_t      index_cache_stale;                  /**< A point could not be cached in write mode, the cache is parsed from the file*/
+  DVR_Bool_t      index_complete;                     /**< Index file will not grow any more, use for read mode*/
+  int             index_notify_fd;                    /**< inotify fd watching an ongoing index file, -1 if not used*/
+  DVR_Bool_t      mmap_read;                          /**< Read TS and index files through mmap, use for read mode*/
+  uint8_t         *ts_map;                            /**< Mapped window of the TS file*/
+  loff_t          ts_map_offset;                      /**< File offset of the mapped window*/
+  size_t          ts_map_len;                         /**< Length of the mapped window*/
+  pthread_t       wb_thread;                          /**< Write-behind thread, use for write mode*/
+  pthread_mutex_t wb_lock;                            /**< Write-behind queue lock*/
+  pthread_cond_t  wb_cond;                            /**< Signaled when a block is queued or written*/
+  Segment_WriteBlock_t *wb_blocks;                    /**< Write-behind block pool, used as a ring*/
+  int             wb_count;                           /**< Number of blocks in the pool, 0 if write-behind is off*/
+  int             wb_head;                            /**< First queued block*/
+  int             wb_nb;                              /**< Number of queued blocks*/
+  DVR_Bool_t      wb_running;                         /**< Write-behind thread is running*/
+  int             wb_error;                           /**< errno of the first failed write*/
+  loff_t          wb_pos;                             /**< Bytes accepted by segment_write*/
+  loff_t          wb_done;                            /**< Bytes written to the TS file by the write-behind thread*/
+  Segment_IndexEntry_t *wb_index;                     /**< Index points waiting for their data to be in the TS file*/
+  uint32_t        wb_index_nb;                        /**< Number of entries in wb_index*/
+  uint32_t        wb_index_cap;                       /**< Capacity of wb_index*/
+  int             wb_high_water;                      /**< Max number of queued blocks*/
+  uint32_t        wb_full_count;                      /**< Times segment_write waited for a free block*/
+  uint32_t        wb_max_write_ms;                    /**< Max write() latency in ms*/
+  loff_t          prealloc_size;                      /**< Size preallocated beyond EOF, trimmed on close*/
+  int             dio_fd;                             /**< O_DIRECT fd of the TS file, -1 if direct write is not used*/
+  uint8_t         *dio_buf;                           /**< Aligned staging buffer, NULL if direct write mode is off*/
+  size_t          dio_len;                            /**< Data length in dio_buf, not written yet*/
+  loff_t          dio_off;                            /**< File offset of dio_buf*/
+  loff_t          ts_written;                         /**< Bytes written to the TS file through the page cache*/
+  loff_t          drop_window;                        /**< Drop written data from page cache in this window size, 0 if off*/
+  loff_t          drop_flushed;                       /**< TS file is flushed up to this offset*/
+  loff_t          drop_done;                          /**< TS file is dropped from page cache up to this offset*/
+  loff_t          ra_window;                          /**< Read ahead window size, 0 if off*/
+  loff_t          ra_end;                             /**< TS file is advised to read up to this offset*/
+  Segment_Ring_t  *ring;                              /**< Ring file holding the TS data, NULL if the TS file is used*/
+  loff_t          ring_pos;                           /**< Current position in the ring segment*/
+  FILE            *iframe_fp;                         /**< I-frame index file fd, opened on first use*/
+  Segment_IFrame_t *iframe_cache;                     /**< In-memory I-frames, sorted by offset*/
+  uint32_t        iframe_nb;                          /**< Number of cached I-frames*/
+  uint32_t        iframe_cap;                         /**< Capacity of iframe_cache*/
+  long            iframe_pos;                         /**< I-frame index file position parsed into the cache, use for read mode*/
  } Segment_Context_t;
 
 /**\brief Segment file type*/
@@ -49,6 +151,7 @@ typedef enum {
   SEGMENT_FILE_TYPE_DAT,                      /**< Used for store information data, such as duration etc*/
   SEGMENT_FILE_TYPE_ONGOING,                  /**< Used for store information data, such as duration etc*/
   SEGMENT_FILE_TYPE_ALL_DATA,                  /**< Used for store all information data*/
+  SEGMENT_FILE_TYPE_IFRAME,                   /**< Used for store I-frame index data*/
 } Segment_FileType_t;
 
 static void segment_get_fname(char fname[MAX_SEGMENT_PATH_SIZE],
@@ -81,6 +184,8 @@ static void segment_get_fname(char fname[MAX_SEGMENT_PATH_SIZE],
     strncpy(fname + offset, ".going", 7);
   else if (type == SEGMENT_FILE_TYPE_ALL_DATA)
     strncpy(fname + offset, ".dat", 5);
+  else if (type == SEGMENT_FILE_TYPE_IFRAME)
+    strncpy(fname + offset, ".ifr", 5);
 
 }
 
@@ -101,6 +206,796 @@ static void segment_get_dirname(char dir_name[MAX_SEGMENT_PATH_SIZE],
     memcpy(dir_name, location, p - location);
 }
 
+/* Detect the index format by its magic number. An empty index (ongoing
+ * segment not written yet) is left unknown and probed again on next rewind. */
+static void segment_index_probe(Segment_Context_t *p_ctx)
+{
+  Segment_IndexHeader_t hdr;
+  size_t n;
+
+  if (fseek(p_ctx->index_fp, 0, SEEK_SET) == -1)
+    return;
+
+  memset(&hdr, 0, sizeof(hdr));
+  n = fread(&hdr, 1, sizeof(hdr), p_ctx->index_fp);
+  if (n >= sizeof(hdr.magic) && hdr.magic == SEGMENT_INDEX_MAGIC) {
+    if (n < sizeof(hdr))
+      return;
+    if (hdr.version != SEGMENT_INDEX_VERSION || hdr.entry_size != sizeof(Segment_IndexEntry_t)) {
+      DVR_ERROR("%s unsupported index version:%d entry_size:%d", __func__,
+          hdr.version, hdr.entry_size);
+      return;
+    }
+    p_ctx->index_format = SEGMENT_INDEX_FORMAT_BINARY;
+  } else if (n > 0) {
+    p_ctx->index_format = SEGMENT_INDEX_FORMAT_TEXT;
+  }
+}
+
+static int segment_index_write_header(Segment_Context_t *p_ctx)
+{
+  Segment_IndexHeader_t hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = SEGMENT_INDEX_MAGIC;
+  hdr.version = SEGMENT_INDEX_VERSION;
+  hdr.entry_size = sizeof(Segment_IndexEntry_t);
+  DVR_RETURN_IF_FALSE(fwrite(&hdr, sizeof(hdr), 1, p_ctx->index_fp) == 1);
+  fflush(p_ctx->index_fp);
+  return DVR_SUCCESS;
+}
+
+static int segment_index_cache_add(Segment_Context_t *p_ctx, uint64_t time, loff_t offset)
+{
+  if (p_ctx->index_cache_nb == p_ctx->index_cache_cap) {
+    uint32_t cap = p_ctx->index_cache_cap ? p_ctx->index_cache_cap * 2 : SEGMENT_INDEX_CACHE_INIT;
+    Segment_IndexEntry_t *p;
+
+    p = realloc(p_ctx->index_cache, cap * sizeof(Segment_IndexEntry_t));
+    DVR_RETURN_IF_FALSE(p);
+    p_ctx->index_cache = p;
+    p_ctx->index_cache_cap = cap;
+  }
+  p_ctx->index_cache[p_ctx->index_cache_nb].time = time;
+  p_ctx->index_cache[p_ctx->index_cache_nb].offset = offset;
+  p_ctx->index_cache_nb++;
+  return DVR_SUCCESS;
+}
+
+/* Write one {time, offset} point to the index file */
+static int segment_index_write(Segment_Context_t *p_ctx, uint64_t time, loff_t offset)
+{
+  if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_BINARY) {
+    Segment_IndexEntry_t entry;
+
+    entry.time = time;
+    entry.offset = offset;
+    DVR_RETURN_IF_FALSE(fwrite(&entry, sizeof(entry), 1, p_ctx->index_fp) == 1);
+  } else {
+    fprintf(p_ctx->index_fp, "%s{time=%llu, offset=%lld}",
+        (p_ctx->index_nb > 0) ? "\n" : "", time, offset);
+  }
+  fflush(p_ctx->index_fp);
+  p_ctx->index_nb++;
+  return DVR_SUCCESS;
+}
+
+/* Write the index points held back by write-behind whose data is now in
+ * the TS file */
+static void segment_index_flush(Segment_Context_t *p_ctx, loff_t done)
+{
+  uint32_t i;
+
+  for (i = 0; i < p_ctx->wb_index_nb && p_ctx->wb_index[i].offset <= done; i++)
+    segment_index_write(p_ctx, p_ctx->wb_index[i].time, p_ctx->wb_index[i].offset);
+  if (i == 0)
+    return;
+  p_ctx->wb_index_nb -= i;
+  memmove(p_ctx->wb_index, p_ctx->wb_index + i, p_ctx->wb_index_nb * sizeof(Segment_IndexEntry_t));
+}
+
+/* Get the length of the TS file as readers see it. Queued data and the
+ * unaligned tail of the O_DIRECT buffer are not in the file yet */
+static loff_t segment_wb_done(Segment_Context_t *p_ctx)
+{
+  loff_t done;
+
+  if (p_ctx->wb_count == 0)
+    return p_ctx->dio_off;
+  pthread_mutex_lock(&p_ctx->wb_lock);
+  done = p_ctx->wb_done;
+  pthread_mutex_unlock(&p_ctx->wb_lock);
+  return done;
+}
+
+/* Append one {time, offset} point to the index file. With write-behind or
+ * O_DIRECT, a point is held back until its data is written, so that a
+ * timeshift reader never finds an offset beyond the end of the TS file */
+static int segment_index_append(Segment_Context_t *p_ctx, uint64_t time, loff_t offset)
+{
+  if (!p_ctx->index_cache_stale && segment_index_cache_add(p_ctx, time, offset) != DVR_SUCCESS) {
+    /*Drop the cache, lookups parse it from the file as in read mode*/
+    DVR_WARN("%s segment %llu can not cache index point, reload from file", __func__, p_ctx->segment_id);
+    p_ctx->index_cache_nb = 0;
+    p_ctx->index_cache_pos = 0;
+    p_ctx->index_cache_stale = DVR_TRUE;
+  }
+
+  if (p_ctx->wb_count > 0 || p_ctx->dio_buf) {
+    segment_index_flush(p_ctx, segment_wb_done(p_ctx));
+    if (p_ctx->wb_index_nb > 0 || offset > segment_wb_done(p_ctx)) {
+      if (p_ctx->wb_index_nb == p_ctx->wb_index_cap) {
+        uint32_t cap = p_ctx->wb_index_cap ? p_ctx->wb_index_cap * 2 : 16;
+        Segment_IndexEntry_t *p;
+
+        p = realloc(p_ctx->wb_index, cap * sizeof(Segment_IndexEntry_t));
+        DVR_RETURN_IF_FALSE(p);
+        p_ctx->wb_index = p;
+        p_ctx->wb_index_cap = cap;
+      }
+      p_ctx->wb_index[p_ctx->wb_index_nb].time = time;
+      p_ctx->wb_index[p_ctx->wb_index_nb].offset = offset;
+      p_ctx->wb_index_nb++;
+      return DVR_SUCCESS;
+    }
+  }
+  return segment_index_write(p_ctx, time, offset);
+}
+
+/* Parse a legacy text index line, return 1 if both fields are found */
+static int segment_index_parse_line(const char *buf, uint64_t *p_time, loff_t *p_offset)
+{
+  const char *p;
+
+  p = strstr(buf, "time=");
+  if (!p)
+    return 0;
+  *p_time = strtoull(p + 5, NULL, 10);
+
+  p = strstr(buf, "offset=");
+  if (!p)
+    return 0;
+  *p_offset = strtoll(p + 7, NULL, 10);
+  return 1;
+}
+
+/* Move the index file position to the first entry */
+static int segment_index_rewind(Segment_Context_t *p_ctx)
+{
+  if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_UNKNOWN)
+    segment_index_probe(p_ctx);
+
+  if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_BINARY)
+    return fseek(p_ctx->index_fp, sizeof(Segment_IndexHeader_t), SEEK_SET);
+  return fseek(p_ctx->index_fp, 0, SEEK_SET);
+}
+
+/* Read the next index entry, return 1 on success and 0 at the end */
+static int segment_index_next(Segment_Context_t *p_ctx, uint64_t *p_time, loff_t *p_offset)
+{
+  char buf[256];
+
+  if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_BINARY) {
+    Segment_IndexEntry_t entry;
+
+    if (fread(&entry, sizeof(entry), 1, p_ctx->index_fp) != 1)
+      return 0;
+    *p_time = entry.time;
+    *p_offset = entry.offset;
+    return 1;
+  }
+
+  if (p_ctx->index_format != SEGMENT_INDEX_FORMAT_TEXT)
+    return 0;
+
+  while (fgets(buf, sizeof(buf), p_ctx->index_fp) != NULL) {
+    if (segment_index_parse_line(buf, p_time, p_offset))
+      return 1;
+  }
+  return 0;
+}
+
+/* Same as segment_index_cache_parse(), but walk the new entries straight
+ * from a mapping of the index file instead of going through stdio. Only
+ * the part from the parsed position to EOF is mapped */
+static int segment_index_cache_parse_map(Segment_Context_t *p_ctx, off_t size)
+{
+  uint8_t *map;
+  uint64_t time;
+  loff_t offset;
+  long pos = p_ctx->index_cache_pos;
+  off_t map_off;
+  size_t map_len;
+  int ret = DVR_SUCCESS;
+
+  map_off = pos & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+  map_len = size - map_off;
+  map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fileno(p_ctx->index_fp), map_off);
+  DVR_RETURN_IF_FALSE(map != MAP_FAILED);
+
+  if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_BINARY) {
+    Segment_IndexEntry_t entry;
+
+    while (pos + (long)sizeof(entry) <= size) {
+      memcpy(&entry, map + (pos - map_off), sizeof(entry));
+      if (segment_index_cache_add(p_ctx, entry.time, entry.offset) != DVR_SUCCESS) {
+        ret = DVR_FAILURE;
+        break;
+      }
+      pos += sizeof(entry);
+    }
+  } else {
+    char buf[256];
+    uint8_t *end;
+    size_t len;
+
+    while (pos < size) {
+      end = memchr(map + (pos - map_off) + 1, '\n', size - pos - 1);
+      len = end ? (size_t)(end - (map + (pos - map_off))) : (size_t)(size - pos);
+      if (len >= sizeof(buf))
+        len = sizeof(buf) - 1;
+      memcpy(buf, map + (pos - map_off), len);
+      buf[len] = 0;
+      /* Last line without '}' is still being written */
+      if (!end && strchr(buf, '}') == NULL)
+        break;
+      if (segment_index_parse_line(buf, &time, &offset) &&
+          segment_index_cache_add(p_ctx, time, offset) != DVR_SUCCESS) {
+        ret = DVR_FAILURE;
+        break;
+      }
+      pos = end ? end - map + map_off : size;
+    }
+  }
+
+  munmap(map, map_len);
+  p_ctx->index_cache_pos = pos;
+  return ret;
+}
+
+/* Parse the index entries appended since the last call into the cache.
+ * Only complete entries are consumed, a partially written tail is parsed
+ * again on next call. */
+static int segment_index_cache_parse(Segment_Context_t *p_ctx)
+{
+  struct stat st;
+  uint64_t time;
+  loff_t offset;
+
+  if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_UNKNOWN) {
+    segment_index_probe(p_ctx);
+    if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_UNKNOWN)
+      return DVR_SUCCESS;
+  }
+  if (p_ctx->index_cache_pos == 0 && p_ctx->index_format == SEGMENT_INDEX_FORMAT_BINARY)
+    p_ctx->index_cache_pos = sizeof(Segment_IndexHeader_t);
+
+  DVR_RETURN_IF_FALSE(fstat(fileno(p_ctx->index_fp), &st) != -1);
+  if (st.st_size <= p_ctx->index_cache_pos)
+    return DVR_SUCCESS;
+
+  if (p_ctx->mmap_read)
+    return segment_index_cache_parse_map(p_ctx, st.st_size);
+
+  clearerr(p_ctx->index_fp);
+  DVR_RETURN_IF_FALSE(fseek(p_ctx->index_fp, p_ctx->index_cache_pos, SEEK_SET) != -1);
+
+  if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_BINARY) {
+    Segment_IndexEntry_t entry;
+
+    while (fread(&entry, sizeof(entry), 1, p_ctx->index_fp) == 1) {
+      DVR_RETURN_IF_FALSE(segment_index_cache_add(p_ctx, entry.time, entry.offset) == DVR_SUCCESS);
+      p_ctx->index_cache_pos += sizeof(entry);
+    }
+  } else {
+    char buf[256];
+    size_t len;
+
+    while (fgets(buf, sizeof(buf), p_ctx->index_fp) != NULL) {
+      len = strlen(buf);
+      if (len == 0 || (strchr(buf, '}') == NULL && buf[len - 1] != '\n'))
+        break;
+      if (segment_index_parse_line(buf, &time, &offset))
+        DVR_RETURN_IF_FALSE(segment_index_cache_add(p_ctx, time, offset) == DVR_SUCCESS);
+      p_ctx->index_cache_pos += len;
+    }
+  }
+  return DVR_SUCCESS;
+}
+
+/* Bring the cache up to date before a lookup. In write mode the cache is
+ * filled by segment_index_append() and the file is only read back after a
+ * point could not be cached. A finished index is parsed once. While the index is ongoing, it is only
+ * parsed again when inotify reports a change, or on every call if inotify
+ * is not available. */
+static int segment_index_cache_update(Segment_Context_t *p_ctx)
+{
+  int ret;
+
+  if (p_ctx->mode == SEGMENT_MODE_WRITE) {
+    if (!p_ctx->index_cache_stale)
+      return DVR_SUCCESS;
+    /*Held back points are not in the file yet, they are parsed once written.
+     *Go back to the end, so the next write does not follow a read*/
+    ret = segment_index_cache_parse(p_ctx);
+    fseek(p_ctx->index_fp, 0, SEEK_END);
+    return ret;
+  }
+  if (p_ctx->index_complete)
+    return DVR_SUCCESS;
+
+  if (p_ctx->index_notify_fd != -1) {
+    char buf[sizeof(struct inotify_event) * 16];
+    struct inotify_event *event;
+    ssize_t len, i;
+    int changed = 0, closed = 0;
+
+    while ((len = read(p_ctx->index_notify_fd, buf, sizeof(buf))) > 0) {
+      for (i = 0; i < len; i += sizeof(struct inotify_event) + event->len) {
+        event = (struct inotify_event *)(buf + i);
+        changed = 1;
+        if (event->mask & IN_CLOSE_WRITE)
+          closed = 1;
+      }
+    }
+    if (!changed)
+      return DVR_SUCCESS;
+
+    ret = segment_index_cache_parse(p_ctx);
+    if (closed && p_ctx->index_format != SEGMENT_INDEX_FORMAT_UNKNOWN) {
+      DVR_INFO("%s index of segment %llu is closed by writer", __func__, p_ctx->segment_id);
+      close(p_ctx->index_notify_fd);
+      p_ctx->index_notify_fd = -1;
+      p_ctx->index_complete = DVR_TRUE;
+    }
+    return ret;
+  }
+
+  return segment_index_cache_parse(p_ctx);
+}
+
+/* Return the first cached entry whose time is not less than time */
+static uint32_t segment_index_cache_find_time(Segment_Context_t *p_ctx, uint64_t time)
+{
+  uint32_t lo = 0, hi = p_ctx->index_cache_nb, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (p_ctx->index_cache[mid].time < time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Return the first cached entry whose offset is not less than offset */
+static uint32_t segment_index_cache_find_offset(Segment_Context_t *p_ctx, loff_t offset)
+{
+  uint32_t lo = 0, hi = p_ctx->index_cache_nb, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (p_ctx->index_cache[mid].offset < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Open the I-frame index on first use, segments recorded without accurate
+ * indexing have no I-frame index file */
+static int segment_iframe_open(Segment_Context_t *p_ctx)
+{
+  char fname[MAX_SEGMENT_PATH_SIZE];
+  Segment_IndexHeader_t hdr;
+
+  if (p_ctx->iframe_fp)
+    return DVR_SUCCESS;
+
+  segment_get_fname(fname, p_ctx->location, p_ctx->segment_id, SEGMENT_FILE_TYPE_IFRAME);
+  if (p_ctx->mode == SEGMENT_MODE_WRITE) {
+    p_ctx->iframe_fp = fopen(fname, "w+");
+    DVR_RETURN_IF_FALSE(p_ctx->iframe_fp);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SEGMENT_IFRAME_MAGIC;
+    hdr.version = SEGMENT_IFRAME_VERSION;
+    hdr.entry_size = sizeof(Segment_IFrame_t);
+    DVR_RETURN_IF_FALSE(fwrite(&hdr, sizeof(hdr), 1, p_ctx->iframe_fp) == 1);
+    fflush(p_ctx->iframe_fp);
+    return DVR_SUCCESS;
+  }
+
+  p_ctx->iframe_fp = fopen(fname, "r");
+  if (!p_ctx->iframe_fp)
+    return DVR_FAILURE;
+  if (fread(&hdr, sizeof(hdr), 1, p_ctx->iframe_fp) != 1 ||
+      hdr.magic != SEGMENT_IFRAME_MAGIC ||
+      hdr.entry_size != sizeof(Segment_IFrame_t)) {
+    /* Header of an ongoing index may be not written yet, try again later */
+    fclose(p_ctx->iframe_fp);
+    p_ctx->iframe_fp = NULL;
+    return DVR_FAILURE;
+  }
+  p_ctx->iframe_pos = sizeof(hdr);
+  return DVR_SUCCESS;
+}
+
+static int segment_iframe_cache_add(Segment_Context_t *p_ctx, const Segment_IFrame_t *frame)
+{
+  if (p_ctx->iframe_nb == p_ctx->iframe_cap) {
+    uint32_t cap = p_ctx->iframe_cap ? p_ctx->iframe_cap * 2 : SEGMENT_INDEX_CACHE_INIT;
+    Segment_IFrame_t *p;
+
+    p = realloc(p_ctx->iframe_cache, cap * sizeof(Segment_IFrame_t));
+    DVR_RETURN_IF_FALSE(p);
+    p_ctx->iframe_cache = p;
+    p_ctx->iframe_cap = cap;
+  }
+  p_ctx->iframe_cache[p_ctx->iframe_nb++] = *frame;
+  return DVR_SUCCESS;
+}
+
+/* Load the I-frames appended since the last call, the index of an ongoing
+ * segment keeps growing */
+static int segment_iframe_cache_update(Segment_Context_t *p_ctx)
+{
+  Segment_IFrame_t frame;
+
+  if (segment_iframe_open(p_ctx) != DVR_SUCCESS)
+    return DVR_FAILURE;
+  if (p_ctx->mode == SEGMENT_MODE_WRITE)
+    return DVR_SUCCESS;
+
+  clearerr(p_ctx->iframe_fp);
+  DVR_RETURN_IF_FALSE(fseek(p_ctx->iframe_fp, p_ctx->iframe_pos, SEEK_SET) != -1);
+  while (fread(&frame, sizeof(frame), 1, p_ctx->iframe_fp) == 1) {
+    if (segment_iframe_cache_add(p_ctx, &frame) != DVR_SUCCESS)
+      break;
+    p_ctx->iframe_pos += sizeof(frame);
+  }
+  return DVR_SUCCESS;
+}
+
+/* Reserve the expected size of the TS file without changing its size, so
+ * that the file is laid out sequentially and readers never see the
+ * reserved space. File systems without KEEP_SIZE support are left as is. */
+static void segment_prealloc(Segment_Context_t *p_ctx, loff_t size)
+{
+  if (size <= 0 || dvr_prop_read_int(SEGMENT_PREALLOC_PROP, 1) <= 0)
+    return;
+
+  if (fallocate(p_ctx->ts_fd, FALLOC_FL_KEEP_SIZE, 0, size) == -1) {
+    DVR_INFO("%s segment %llu preallocate %lld failed, reason:%s", __func__,
+        p_ctx->segment_id, size, strerror(errno));
+    return;
+  }
+  p_ctx->prealloc_size = size;
+}
+
+/* Release the preallocated space which was not written */
+static void segment_prealloc_trim(Segment_Context_t *p_ctx)
+{
+  struct stat st;
+
+  if (p_ctx->prealloc_size <= 0)
+    return;
+
+  if (fstat(p_ctx->ts_fd, &st) == -1 || ftruncate(p_ctx->ts_fd, st.st_size) == -1) {
+    DVR_WARN("%s segment %llu trim failed, reason:%s", __func__,
+        p_ctx->segment_id, strerror(errno));
+  }
+  p_ctx->prealloc_size = 0;
+}
+
+static int segment_dio_open(Segment_Context_t *p_ctx, const char *ts_fname)
+{
+  if (posix_memalign((void **)&p_ctx->dio_buf, SEGMENT_DIO_ALIGN, SEGMENT_DIO_BUF_SIZE) != 0) {
+    p_ctx->dio_buf = NULL;
+    return DVR_FAILURE;
+  }
+  p_ctx->dio_fd = open(ts_fname, O_WRONLY | O_DIRECT);
+  if (p_ctx->dio_fd == -1) {
+    DVR_WARN("%s %s does not support direct write, reason:%s", __func__,
+        ts_fname, strerror(errno));
+    free(p_ctx->dio_buf);
+    p_ctx->dio_buf = NULL;
+    return DVR_FAILURE;
+  }
+  return DVR_SUCCESS;
+}
+
+/* Write len bytes from the start of dio_buf and keep the rest as tail */
+static int segment_dio_flush(Segment_Context_t *p_ctx, size_t len)
+{
+  size_t done = 0;
+  ssize_t ret;
+
+  while (done < len) {
+    if (p_ctx->dio_fd != -1)
+      ret = pwrite(p_ctx->dio_fd, p_ctx->dio_buf + done, len - done, p_ctx->dio_off + done);
+    else
+      ret = pwrite(p_ctx->ts_fd, p_ctx->dio_buf + done, len - done, p_ctx->dio_off + done);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EINVAL && p_ctx->dio_fd != -1) {
+        /* Alignment not accepted by this file system, go on buffered */
+        DVR_WARN("%s segment %llu direct write rejected, use buffered write", __func__, p_ctx->segment_id);
+        close(p_ctx->dio_fd);
+        p_ctx->dio_fd = -1;
+        continue;
+      }
+      DVR_ERROR("%s write failed, reason:%s", __func__, strerror(errno));
+      return DVR_FAILURE;
+    }
+    done += ret;
+  }
+
+  p_ctx->dio_off += len;
+  p_ctx->dio_len -= len;
+  if (p_ctx->dio_len > 0)
+    memmove(p_ctx->dio_buf, p_ctx->dio_buf + len, p_ctx->dio_len);
+  return DVR_SUCCESS;
+}
+
+/* Stage data in the aligned buffer and write out whole aligned blocks.
+ * The unaligned tail is carried to the next call. */
+static ssize_t segment_dio_write(Segment_Context_t *p_ctx, const uint8_t *buf, size_t count)
+{
+  size_t done = 0, len, aligned;
+
+  while (done < count) {
+    len = SEGMENT_DIO_BUF_SIZE - p_ctx->dio_len;
+    if (len > count - done)
+      len = count - done;
+    memcpy(p_ctx->dio_buf + p_ctx->dio_len, buf + done, len);
+    p_ctx->dio_len += len;
+    done += len;
+
+    aligned = p_ctx->dio_len & ~((size_t)SEGMENT_DIO_ALIGN - 1);
+    if (aligned > 0 && segment_dio_flush(p_ctx, aligned) != DVR_SUCCESS)
+      return DVR_FAILURE;
+  }
+  return count;
+}
+
+/* Write the carried tail through the buffered fd and leave direct mode */
+static void segment_dio_close(Segment_Context_t *p_ctx)
+{
+  if (!p_ctx->dio_buf)
+    return;
+
+  if (p_ctx->dio_fd != -1) {
+    close(p_ctx->dio_fd);
+    p_ctx->dio_fd = -1;
+  }
+  if (p_ctx->dio_len > 0)
+    segment_dio_flush(p_ctx, p_ctx->dio_len);
+  lseek(p_ctx->ts_fd, p_ctx->dio_off, SEEK_SET);
+  free(p_ctx->dio_buf);
+  p_ctx->dio_buf = NULL;
+  segment_index_flush(p_ctx, p_ctx->dio_off);
+}
+
+/* Start writeback of the data written in the last window, and drop the
+ * window before it from page cache. Dirty pages can not be dropped, so
+ * the drop lags one window behind the flush. */
+static void segment_drop_behind(Segment_Context_t *p_ctx)
+{
+  if (p_ctx->drop_window <= 0 || p_ctx->ts_written - p_ctx->drop_flushed < p_ctx->drop_window)
+    return;
+
+  sync_file_range(p_ctx->ts_fd, p_ctx->drop_flushed, p_ctx->ts_written - p_ctx->drop_flushed,
+      SYNC_FILE_RANGE_WRITE);
+  if (p_ctx->drop_flushed > p_ctx->drop_done) {
+    posix_fadvise(p_ctx->ts_fd, p_ctx->drop_done, p_ctx->drop_flushed - p_ctx->drop_done,
+        POSIX_FADV_DONTNEED);
+    p_ctx->drop_done = p_ctx->drop_flushed;
+  }
+  p_ctx->drop_flushed = p_ctx->ts_written;
+}
+
+/* Advise the kernel to read the next window once half of the previous
+ * one is consumed, or after a seek */
+static void segment_read_ahead(Segment_Context_t *p_ctx, loff_t pos)
+{
+  loff_t start;
+  DVR_Bool_t in_window;
+
+  if (p_ctx->ra_window <= 0)
+    return;
+
+  in_window = (pos >= p_ctx->ra_end - p_ctx->ra_window && pos <= p_ctx->ra_end);
+  if (in_window && pos + p_ctx->ra_window / 2 < p_ctx->ra_end)
+    return;
+
+  start = in_window ? p_ctx->ra_end : pos;
+  posix_fadvise(p_ctx->ts_fd, start, pos + p_ctx->ra_window - start, POSIX_FADV_WILLNEED);
+  p_ctx->ra_end = pos + p_ctx->ra_window;
+}
+
+/* TS data position helpers, the ring has no file offset of its own */
+static loff_t segment_ts_tell(Segment_Context_t *p_ctx)
+{
+  if (p_ctx->ring)
+    return p_ctx->ring_pos;
+  return lseek(p_ctx->ts_fd, 0, SEEK_CUR);
+}
+
+static loff_t segment_ts_seek(Segment_Context_t *p_ctx, loff_t offset)
+{
+  if (p_ctx->ring) {
+    p_ctx->ring_pos = offset;
+    return offset;
+  }
+  return lseek(p_ctx->ts_fd, offset, SEEK_SET);
+}
+
+static uint32_t segment_time_diff_ms(struct timespec *start, struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Drain queued blocks to the TS file, so that a slow storage does not
+ * block the caller of segment_write */
+static void *segment_wb_thread(void *arg)
+{
+  Segment_Context_t *p_ctx = (Segment_Context_t *)arg;
+  Segment_WriteBlock_t *blk;
+  struct timespec start, end;
+  size_t done;
+  ssize_t ret;
+  uint32_t ms;
+  int error;
+
+  prctl(PR_SET_NAME, "DvrSegWriter");
+
+  pthread_mutex_lock(&p_ctx->wb_lock);
+  while (1) {
+    while (p_ctx->wb_nb == 0 && p_ctx->wb_running)
+      pthread_cond_wait(&p_ctx->wb_cond, &p_ctx->wb_lock);
+    if (p_ctx->wb_nb == 0)
+      break;
+    blk = &p_ctx->wb_blocks[p_ctx->wb_head];
+    /*After a failure, the queued blocks are dropped, not written at a wrong offset*/
+    error = p_ctx->wb_error;
+    pthread_mutex_unlock(&p_ctx->wb_lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    done = 0;
+    if (!error && p_ctx->dio_buf) {
+      if (segment_dio_write(p_ctx, blk->data, blk->len) < 0)
+        error = errno;
+      done = blk->len;
+    }
+    while (!error && done < blk->len) {
+      ret = write(p_ctx->ts_fd, blk->data + done, blk->len - done);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        DVR_ERROR("%s write failed, reason:%s", __func__, strerror(errno));
+        error = errno;
+        break;
+      }
+      done += ret;
+      p_ctx->ts_written += ret;
+    }
+    segment_drop_behind(p_ctx);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms = segment_time_diff_ms(&start, &end);
+
+    pthread_mutex_lock(&p_ctx->wb_lock);
+    if (ms > p_ctx->wb_max_write_ms)
+      p_ctx->wb_max_write_ms = ms;
+    /*wb_done never passes a failed block, so no index point is published
+     *beyond the data really written. dio_off is only changed by this thread*/
+    if (error)
+      p_ctx->wb_error = error;
+    else
+      p_ctx->wb_done = p_ctx->dio_buf ? p_ctx->dio_off : p_ctx->wb_done + blk->len;
+    p_ctx->wb_head = (p_ctx->wb_head + 1) % p_ctx->wb_count;
+    p_ctx->wb_nb--;
+    pthread_cond_broadcast(&p_ctx->wb_cond);
+  }
+  pthread_mutex_unlock(&p_ctx->wb_lock);
+  return NULL;
+}
+
+static int segment_wb_start(Segment_Context_t *p_ctx, int count)
+{
+  p_ctx->wb_blocks = calloc(count, sizeof(Segment_WriteBlock_t));
+  DVR_RETURN_IF_FALSE(p_ctx->wb_blocks);
+  pthread_mutex_init(&p_ctx->wb_lock, NULL);
+  pthread_cond_init(&p_ctx->wb_cond, NULL);
+  p_ctx->wb_count = count;
+  p_ctx->wb_running = DVR_TRUE;
+  if (pthread_create(&p_ctx->wb_thread, NULL, segment_wb_thread, p_ctx) != 0) {
+    DVR_ERROR("%s create thread failed, use sync write", __func__);
+    pthread_cond_destroy(&p_ctx->wb_cond);
+    pthread_mutex_destroy(&p_ctx->wb_lock);
+    free(p_ctx->wb_blocks);
+    p_ctx->wb_blocks = NULL;
+    p_ctx->wb_count = 0;
+    return DVR_FAILURE;
+  }
+  return DVR_SUCCESS;
+}
+
+/* Flush all queued blocks and stop the write-behind thread */
+static void segment_wb_stop(Segment_Context_t *p_ctx)
+{
+  int i;
+
+  if (p_ctx->wb_count == 0)
+    return;
+
+  pthread_mutex_lock(&p_ctx->wb_lock);
+  p_ctx->wb_running = DVR_FALSE;
+  pthread_cond_broadcast(&p_ctx->wb_cond);
+  pthread_mutex_unlock(&p_ctx->wb_lock);
+  pthread_join(p_ctx->wb_thread, NULL);
+
+  /*Publish the points of the written data, the O_DIRECT tail is written
+   *by segment_dio_close*/
+  segment_index_flush(p_ctx, p_ctx->wb_done);
+
+  DVR_INFO("%s segment %llu write-behind high water:%d/%d, full:%u, max write:%ums",
+      __func__, p_ctx->segment_id, p_ctx->wb_high_water, p_ctx->wb_count,
+      p_ctx->wb_full_count, p_ctx->wb_max_write_ms);
+
+  for (i = 0; i < p_ctx->wb_count; i++) {
+    if (p_ctx->wb_blocks[i].data)
+      free(p_ctx->wb_blocks[i].data);
+  }
+  free(p_ctx->wb_blocks);
+  p_ctx->wb_blocks = NULL;
+  p_ctx->wb_count = 0;
+  pthread_cond_destroy(&p_ctx->wb_cond);
+  pthread_mutex_destroy(&p_ctx->wb_lock);
+}
+
+/* Queue data for the write-behind thread. Wait for a free block if the
+ * queue is full, which throttles the caller to the storage speed */
+static ssize_t segment_wb_write(Segment_Context_t *p_ctx, void *buf, size_t count)
+{
+  Segment_WriteBlock_t *blk;
+
+  pthread_mutex_lock(&p_ctx->wb_lock);
+  if (p_ctx->wb_nb == p_ctx->wb_count)
+    p_ctx->wb_full_count++;
+  while (p_ctx->wb_nb == p_ctx->wb_count && !p_ctx->wb_error)
+    pthread_cond_wait(&p_ctx->wb_cond, &p_ctx->wb_lock);
+  if (p_ctx->wb_error) {
+    errno = p_ctx->wb_error;
+    pthread_mutex_unlock(&p_ctx->wb_lock);
+    return DVR_FAILURE;
+  }
+  /* A free block is only touched by the single writer of the segment */
+  blk = &p_ctx->wb_blocks[(p_ctx->wb_head + p_ctx->wb_nb) % p_ctx->wb_count];
+  pthread_mutex_unlock(&p_ctx->wb_lock);
+
+  if (blk->size < count) {
+    uint8_t *data = realloc(blk->data, count);
+
+    DVR_RETURN_IF_FALSE(data);
+    blk->data = data;
+    blk->size = count;
+  }
+  memcpy(blk->data, buf, count);
+  blk->len = count;
+
+  pthread_mutex_lock(&p_ctx->wb_lock);
+  p_ctx->wb_nb++;
+  if (p_ctx->wb_nb > p_ctx->wb_high_water)
+    p_ctx->wb_high_water = p_ctx->wb_nb;
+  p_ctx->wb_pos += count;
+  pthread_cond_broadcast(&p_ctx->wb_cond);
+  pthread_mutex_unlock(&p_ctx->wb_lock);
+  return count;
+}
+
 int segment_open(Segment_OpenParams_t *params, Segment_Handle_t *p_handle)
 {
   Segment_Context_t *p_ctx;
@@ -153,12 +1048,28 @@ int segment_open(Segment_OpenParams_t *params, Segment_Handle_t *p_handle)
 
   if (params->mode == SEGMENT_MODE_READ) {
     p_ctx->ts_fd = open(ts_fname, O_RDONLY);
+    if (p_ctx->ts_fd == -1 && errno == ENOENT && segment_ring_exists(params->location)) {
+      if (segment_ring_attach(params->location, 0, &p_ctx->ring) == DVR_SUCCESS
+          && segment_ring_size(p_ctx->ring, params->segment_id) < 0) {
+        segment_ring_detach(p_ctx->ring);
+        p_ctx->ring = NULL;
+      }
+    }
     p_ctx->index_fp = fopen(index_fname, "r");
     p_ctx->dat_fp = fopen(dat_fname, "r");
     p_ctx->ongoing_fp = NULL;
     p_ctx->all_dat_fp = fopen(all_dat_fname, "r");
   } else if (params->mode == SEGMENT_MODE_WRITE) {
-    p_ctx->ts_fd = open(ts_fname, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (params->ring_size > 0) {
+      p_ctx->ts_fd = -1;
+      if (segment_ring_attach(params->location, params->ring_size, &p_ctx->ring) == DVR_SUCCESS
+          && segment_ring_begin(p_ctx->ring, params->segment_id) != DVR_SUCCESS) {
+        segment_ring_detach(p_ctx->ring);
+        p_ctx->ring = NULL;
+      }
+    } else {
+      p_ctx->ts_fd = open(ts_fname, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    }
     p_ctx->index_fp = fopen(index_fname, "w+");
     p_ctx->dat_fp = fopen(dat_fname, "w+");
     p_ctx->all_dat_fp = fopen(all_dat_fname, "a+");
@@ -177,11 +1088,13 @@ int segment_open(Segment_OpenParams_t *params, Segment_Handle_t *p_handle)
     p_ctx->ongoing_fp = NULL;
   }
 
-  if (p_ctx->ts_fd == -1 || !p_ctx->index_fp || !p_ctx->dat_fp) {
+  if ((p_ctx->ts_fd == -1 && !p_ctx->ring) || !p_ctx->index_fp || !p_ctx->dat_fp) {
     DVR_INFO("%s open file failed [%s, %s, %s], reason:%s", __func__,
         ts_fname, index_fname, dat_fname, strerror(errno));
     if (p_ctx->ts_fd != -1)
       close(p_ctx->ts_fd);
+    if (p_ctx->ring)
+      segment_ring_detach(p_ctx->ring);
     if (p_ctx->index_fp)
       fclose(p_ctx->index_fp);
     if (p_ctx->dat_fp)
@@ -197,6 +1110,57 @@ int segment_open(Segment_OpenParams_t *params, Segment_Handle_t *p_handle)
   p_ctx->segment_id = params->segment_id;
   strncpy(p_ctx->location, params->location, strlen(params->location)+1);
   p_ctx->force_sysclock = params->force_sysclock;
+  p_ctx->mode = params->mode;
+  p_ctx->index_notify_fd = -1;
+  p_ctx->dio_fd = -1;
+
+  if (params->mode == SEGMENT_MODE_WRITE) {
+    int wb_count = dvr_prop_read_int(SEGMENT_WB_QUEUE_PROP, SEGMENT_WB_QUEUE_DEFAULT);
+
+    /* The ring file is preallocated as a whole and written in place. Its
+     * segments must be appended in order, so the next segment can not wait
+     * for a queue of the previous one to drain */
+    if (!p_ctx->ring) {
+      p_ctx->drop_window = (loff_t)dvr_prop_read_int(SEGMENT_DROP_BEHIND_PROP, 0) * 1024;
+      segment_prealloc(p_ctx, params->size_hint);
+    }
+    if (!p_ctx->ring && !params->zero_copy) {
+      if (params->direct_io || dvr_prop_read_int(SEGMENT_DIO_PROP, 0) > 0)
+        segment_dio_open(p_ctx, ts_fname);
+      if (wb_count > 0)
+        segment_wb_start(p_ctx, wb_count);
+    }
+    if (dvr_prop_read_int(SEGMENT_INDEX_BINARY_PROP, 0) > 0) {
+      p_ctx->index_format = SEGMENT_INDEX_FORMAT_BINARY;
+      segment_index_write_header(p_ctx);
+    } else {
+      p_ctx->index_format = SEGMENT_INDEX_FORMAT_TEXT;
+    }
+  } else {
+    struct stat mstat;
+
+    if (!p_ctx->ring) {
+      p_ctx->mmap_read = (dvr_prop_read_int(SEGMENT_MMAP_PROP, 0) > 0) ? DVR_TRUE : DVR_FALSE;
+      p_ctx->ra_window = (loff_t)dvr_prop_read_int(SEGMENT_READ_AHEAD_PROP, 0) * 1024;
+    }
+    segment_index_probe(p_ctx);
+    if (stat(going_name, &mstat) != 0) {
+      p_ctx->index_complete = DVR_TRUE;
+    } else if (dvr_prop_read_int(SEGMENT_INDEX_NOTIFY_PROP, 1) > 0) {
+      /* Watch before the first parse so no append is missed */
+      p_ctx->index_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (p_ctx->index_notify_fd != -1 &&
+          inotify_add_watch(p_ctx->index_notify_fd, index_fname, IN_MODIFY | IN_CLOSE_WRITE) == -1) {
+        DVR_WARN("%s inotify watch %s failed, reason:%s", __func__, index_fname, strerror(errno));
+        close(p_ctx->index_notify_fd);
+        p_ctx->index_notify_fd = -1;
+      }
+    }
+    segment_index_cache_parse(p_ctx);
+    /* An empty index is still unknown, keep following it */
+    if (p_ctx->index_format == SEGMENT_INDEX_FORMAT_UNKNOWN)
+      p_ctx->index_complete = DVR_FALSE;
+  }
 
   //DVR_INFO("%s, open file success p_ctx->location [%s]", __func__, p_ctx->location, params->mode);
   *p_handle = (Segment_Handle_t)p_ctx;
@@ -210,10 +1174,24 @@ int segment_close(Segment_Handle_t handle)
   p_ctx = (void *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
 
+  segment_wb_stop(p_ctx);
+  segment_dio_close(p_ctx);
+  segment_prealloc_trim(p_ctx);
+  if (p_ctx->wb_index_nb > 0)
+    DVR_ERROR("%s segment %llu drop %u index points of unwritten data", __func__,
+        p_ctx->segment_id, p_ctx->wb_index_nb);
+  free(p_ctx->wb_index);
+
   if (p_ctx->ts_fd != -1) {
     close(p_ctx->ts_fd);
   }
 
+  if (p_ctx->ring) {
+    if (p_ctx->mode == SEGMENT_MODE_WRITE)
+      segment_ring_end(p_ctx->ring, p_ctx->segment_id);
+    segment_ring_detach(p_ctx->ring);
+  }
+
   if (p_ctx->index_fp) {
     fclose(p_ctx->index_fp);
   }
@@ -233,6 +1211,16 @@ int segment_close(Segment_Handle_t handle)
     unlink(going_name);
   }
 
+  if (p_ctx->index_notify_fd != -1)
+    close(p_ctx->index_notify_fd);
+  if (p_ctx->ts_map)
+    munmap(p_ctx->ts_map, p_ctx->ts_map_len);
+  if (p_ctx->index_cache)
+    free(p_ctx->index_cache);
+  if (p_ctx->iframe_fp)
+    fclose(p_ctx->iframe_fp);
+  if (p_ctx->iframe_cache)
+    free(p_ctx->iframe_cache);
   free(p_ctx);
   return 0;
 }
@@ -244,11 +1232,94 @@ ssize_t segment_read(Segment_Handle_t handle, void *buf, size_t count)
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(buf);
+  if (p_ctx->ring) {
+    len = segment_ring_read(p_ctx->ring, p_ctx->segment_id, buf, count, p_ctx->ring_pos);
+    if (len > 0)
+      p_ctx->ring_pos += len;
+    return len;
+  }
   DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
+  if (p_ctx->ra_window > 0)
+    segment_read_ahead(p_ctx, lseek(p_ctx->ts_fd, 0, SEEK_CUR));
   len = read(p_ctx->ts_fd, buf, count);
   return len;
 }
 
+ssize_t segment_read_view(Segment_Handle_t handle, void **p_buf, size_t count)
+{
+  Segment_Context_t *p_ctx;
+  struct stat st;
+  loff_t pos, map_end;
+  size_t len;
+
+  p_ctx = (Segment_Context_t *)handle;
+  DVR_RETURN_IF_FALSE(p_ctx);
+  DVR_RETURN_IF_FALSE(p_buf);
+  if (!p_ctx->mmap_read)
+    return DVR_FAILURE;
+  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
+
+  pos = lseek(p_ctx->ts_fd, 0, SEEK_CUR);
+  DVR_RETURN_IF_FALSE(pos != -1);
+  segment_read_ahead(p_ctx, pos);
+
+  map_end = p_ctx->ts_map_offset + p_ctx->ts_map_len;
+  if (!p_ctx->ts_map || pos < p_ctx->ts_map_offset || pos + (loff_t)count > map_end) {
+    loff_t map_offset;
+    size_t map_len;
+
+    DVR_RETURN_IF_FALSE(fstat(p_ctx->ts_fd, &st) != -1);
+    if (pos >= st.st_size)
+      return 0;
+    /* Keep the current window if the file has not grown past it */
+    if (!p_ctx->ts_map || pos < p_ctx->ts_map_offset
+        || (map_end < st.st_size && map_end < pos + (loff_t)count)) {
+      map_offset = pos & ~((loff_t)sysconf(_SC_PAGESIZE) - 1);
+      map_len = SEGMENT_MMAP_WINDOW;
+      if ((loff_t)map_len < pos - map_offset + (loff_t)count)
+        map_len = pos - map_offset + count;
+      if (map_offset + (loff_t)map_len > st.st_size)
+        map_len = st.st_size - map_offset;
+
+      if (p_ctx->ts_map) {
+        munmap(p_ctx->ts_map, p_ctx->ts_map_len);
+        p_ctx->ts_map = NULL;
+        p_ctx->ts_map_len = 0;
+      }
+      p_ctx->ts_map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, p_ctx->ts_fd, map_offset);
+      if (p_ctx->ts_map == MAP_FAILED) {
+        DVR_ERROR("%s mmap failed, reason:%s", __func__, strerror(errno));
+        p_ctx->ts_map = NULL;
+        return DVR_FAILURE;
+      }
+      p_ctx->ts_map_offset = map_offset;
+      p_ctx->ts_map_len = map_len;
+      map_end = map_offset + map_len;
+    }
+  }
+
+  len = count;
+  if (pos + (loff_t)len > map_end)
+    len = map_end - pos;
+  DVR_RETURN_IF_FALSE(lseek(p_ctx->ts_fd, pos + len, SEEK_SET) != -1);
+  *p_buf = p_ctx->ts_map + (pos - p_ctx->ts_map_offset);
+  return len;
+}
+
+ssize_t segment_pread(Segment_Handle_t handle, void *buf, size_t count, loff_t offset)
+{
+  Segment_Context_t *p_ctx;
+
+  p_ctx = (Segment_Context_t *)handle;
+  DVR_RETURN_IF_FALSE(p_ctx);
+  DVR_RETURN_IF_FALSE(buf);
+
+  if (p_ctx->ring)
+    return segment_ring_read(p_ctx->ring, p_ctx->segment_id, buf, count, offset);
+  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
+  return pread(p_ctx->ts_fd, buf, count, offset);
+}
+
 ssize_t segment_write(Segment_Handle_t handle, void *buf, size_t count)
 {
   Segment_Context_t *p_ctx;
@@ -256,19 +1327,70 @@ ssize_t segment_write(Segment_Handle_t handle, void *buf, size_t count)
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(buf);
-  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
+  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1 || p_ctx->ring);
+  if (p_ctx->wb_count > 0) {
+    len = segment_wb_write(p_ctx, buf, count);
+    if (p_ctx->wb_index_nb > 0)
+      segment_index_flush(p_ctx, segment_wb_done(p_ctx));
+    return len;
+  }
+  if (p_ctx->ring)
+    return segment_ring_append(p_ctx->ring, p_ctx->segment_id, buf, count);
+  if (p_ctx->dio_buf) {
+    len = segment_dio_write(p_ctx, buf, count);
+    if (p_ctx->wb_index_nb > 0)
+      segment_index_flush(p_ctx, p_ctx->dio_off);
+    return len;
+  }
   len = write(p_ctx->ts_fd, buf, count);
+  if (len > 0) {
+    p_ctx->ts_written += len;
+    segment_drop_behind(p_ctx);
+  }
   /*remove the fsync, use /proc to control the data writeback*/
   //if (p_ctx->time % TS_FILE_SYNC_TIME == 0)
   //  fsync(p_ctx->ts_fd);
   return len;
 }
 
+ssize_t segment_splice(Segment_Handle_t handle, int pipe_fd, size_t count)
+{
+  Segment_Context_t *p_ctx;
+  size_t done = 0;
+  ssize_t ret;
+
+  p_ctx = (Segment_Context_t *)handle;
+  DVR_RETURN_IF_FALSE(p_ctx);
+  DVR_RETURN_IF_FALSE(pipe_fd != -1);
+  /* Queued, O_DIRECT and ring writes need the data in user space */
+  if (p_ctx->ts_fd == -1 || p_ctx->wb_count > 0 || p_ctx->dio_buf || p_ctx->ring) {
+    errno = ENOTSUP;
+    return DVR_FAILURE;
+  }
+
+  while (done < count) {
+    ret = splice(pipe_fd, NULL, p_ctx->ts_fd, NULL, count - done, SPLICE_F_MOVE);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      DVR_ERROR("%s splice failed, reason:%s", __func__, strerror(errno));
+      break;
+    }
+    if (ret == 0)
+      break;
+    done += ret;
+  }
+  if (done > 0) {
+    p_ctx->ts_written += done;
+    segment_drop_behind(p_ctx);
+  }
+  return done ? (ssize_t)done : DVR_FAILURE;
+}
+
 int segment_update_pts_force(Segment_Handle_t handle, uint64_t pts, loff_t offset)
 {
   Segment_Context_t *p_ctx;
-  char buf[256];
-  int record_diff = 0;
+  uint64_t time;
 
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
@@ -279,10 +1401,9 @@ int segment_update_pts_force(Segment_Handle_t handle, uint64_t pts, loff_t offse
     p_ctx->first_pts = pts;
     p_ctx->first_offset = offset;
   }
-  memset(buf, 0, sizeof(buf));
   if (p_ctx->last_pts == ULLONG_MAX) {
     /*Last pts is init value*/
-    sprintf(buf, "{time=%llu, offset=%lld}", pts - p_ctx->first_pts, offset);
+    time = pts - p_ctx->first_pts;
     p_ctx->cur_time = pts - p_ctx->first_pts;
     DVR_INFO("%s force pcr:%llu -1", __func__, pts);
   } else {
@@ -292,25 +1413,21 @@ int segment_update_pts_force(Segment_Handle_t handle, uint64_t pts, loff_t offse
       /*Current pts has a transition*/
       DVR_INFO("[%s]force update Current pts has a transition, [%llu, %llu, %llu]",__func__,
           p_ctx->first_pts, p_ctx->last_pts, pts);
-      sprintf(buf, "\n{time=%llu, offset=%lld}", p_ctx->cur_time, offset);
+      time = p_ctx->cur_time;
     } else {
       /*This is a normal pts, record it*/
       //check if this pcr is transition.if true,add 200ms
       //other case normal.
       p_ctx->cur_time += diff;
       DVR_INFO("%s force pcr:%llu -1 diff [%d]", __func__, pts, diff);
-      sprintf(buf, "\n{time=%llu, offset=%lld}", p_ctx->cur_time, offset);
+      time = p_ctx->cur_time;
     }
   }
 
-  record_diff = pts - p_ctx->last_record_pts;
-  if (strlen(buf) > 0) {
-    DVR_INFO("%s force pcr:%llu buf:%s", __func__, pts, buf);
-    fputs(buf, p_ctx->index_fp);
-    fflush(p_ctx->index_fp);
-    //fsync(fileno(p_ctx->index_fp));
-    p_ctx->last_record_pts = pts;
-  }
+  DVR_INFO("%s force pcr:%llu time:%llu offset:%lld", __func__, pts, time, offset);
+  segment_index_append(p_ctx, time, offset);
+  //fsync(fileno(p_ctx->index_fp));
+  p_ctx->last_record_pts = pts;
   p_ctx->last_pts = pts;
   return DVR_SUCCESS;
 }
@@ -318,7 +1435,7 @@ int segment_update_pts_force(Segment_Handle_t handle, uint64_t pts, loff_t offse
 int segment_update_pts(Segment_Handle_t handle, uint64_t pts, loff_t offset)
 {
   Segment_Context_t *p_ctx;
-  char buf[256];
+  uint64_t time;
   int record_diff = 0;
 
   p_ctx = (Segment_Context_t *)handle;
@@ -330,10 +1447,9 @@ int segment_update_pts(Segment_Handle_t handle, uint64_t pts, loff_t offset)
     p_ctx->first_pts = pts;
     //p_ctx->cur_time = p_ctx->cur_time + PTS_HEAD_DEVIATION;
   }
-  memset(buf, 0, sizeof(buf));
   if (p_ctx->last_pts == ULLONG_MAX) {
     /*Last pts is init value*/
-    sprintf(buf, "{time=%llu, offset=%lld}", pts - p_ctx->first_pts, offset);
+    time = pts - p_ctx->first_pts;
     p_ctx->cur_time = pts - p_ctx->first_pts;
   } else {
     if (!p_ctx->force_sysclock) {
@@ -371,14 +1487,12 @@ int segment_update_pts(Segment_Handle_t handle, uint64_t pts, loff_t offset)
        * time. Please refer to SWPL-75327*/
       p_ctx->cur_time = pts - p_ctx->first_pts;
     }
-    sprintf(buf, "\n{time=%llu, offset=%lld}", p_ctx->cur_time, offset);
+    time = p_ctx->cur_time;
   }
 
   record_diff = pts - p_ctx->last_record_pts;
-  if (strlen(buf) > 0 &&
-      (record_diff > PCR_RECORD_INTERVAL_MS || p_ctx->last_record_pts == ULLONG_MAX)){
-    fputs(buf, p_ctx->index_fp);
-    fflush(p_ctx->index_fp);
+  if (record_diff > PCR_RECORD_INTERVAL_MS || p_ctx->last_record_pts == ULLONG_MAX) {
+    segment_index_append(p_ctx, time, offset);
     p_ctx->time++;
     //flush idx file 3s
     //if ((p_ctx->time > 0 && p_ctx->time % IDX_FILE_SYNC_TIME == 0))
@@ -395,74 +1509,108 @@ int segment_update_pts(Segment_Handle_t handle, uint64_t pts, loff_t offset)
   return DVR_SUCCESS;
 }
 
+int segment_update_iframe(Segment_Handle_t handle, uint64_t pts, loff_t offset, uint32_t size)
+{
+  Segment_Context_t *p_ctx;
+  Segment_IFrame_t frame;
+
+  p_ctx = (Segment_Context_t *)handle;
+  DVR_RETURN_IF_FALSE(p_ctx);
+  DVR_RETURN_IF_FALSE(p_ctx->mode == SEGMENT_MODE_WRITE);
+  DVR_RETURN_IF_FALSE(segment_iframe_open(p_ctx) == DVR_SUCCESS);
+
+  /* Every slice of a frame reports the same PES offset, keep the first */
+  if (p_ctx->iframe_nb > 0 && offset <= p_ctx->iframe_cache[p_ctx->iframe_nb - 1].offset)
+    return DVR_SUCCESS;
+
+  memset(&frame, 0, sizeof(frame));
+  frame.pts = pts;
+  frame.offset = offset;
+  frame.size = size;
+  DVR_RETURN_IF_FALSE(fwrite(&frame, sizeof(frame), 1, p_ctx->iframe_fp) == 1);
+  fflush(p_ctx->iframe_fp);
+  return segment_iframe_cache_add(p_ctx, &frame);
+}
+
+int segment_find_iframe(Segment_Handle_t handle, loff_t offset, int dir, Segment_IFrame_t *p_frame)
+{
+  Segment_Context_t *p_ctx;
+  uint32_t lo, hi, mid;
+
+  p_ctx = (Segment_Context_t *)handle;
+  DVR_RETURN_IF_FALSE(p_ctx);
+  DVR_RETURN_IF_FALSE(p_frame);
+
+  if (segment_iframe_cache_update(p_ctx) != DVR_SUCCESS)
+    return DVR_FAILURE;
+
+  /* First I-frame whose offset is not less than offset */
+  lo = 0;
+  hi = p_ctx->iframe_nb;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (p_ctx->iframe_cache[mid].offset < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (dir < 0) {
+    if (lo == 0)
+      return DVR_FAILURE;
+    lo--;
+  } else if (lo == p_ctx->iframe_nb) {
+    return DVR_FAILURE;
+  }
+  *p_frame = p_ctx->iframe_cache[lo];
+  return DVR_SUCCESS;
+}
+
 loff_t segment_seek(Segment_Handle_t handle, uint64_t time, int block_size)
 {
   Segment_Context_t *p_ctx;
-  char buf[256];
-  char value[256];
   uint64_t pts = 0L;
   loff_t offset = 0;
-  char *p1, *p2;
   int ret = 0;
+  int line = 0;
 
   DVR_INFO("into seek time=%llu, offset=%lld time--%llu\n", pts, offset, time);
 
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(p_ctx->index_fp);
-  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
+  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1 || p_ctx->ring);
 
   if (time == 0) {
     offset = 0;
     DVR_INFO("seek time=%llu, offset=%lld time--%llu\n", pts, offset, time);
-    DVR_RETURN_IF_FALSE(lseek(p_ctx->ts_fd, offset, SEEK_SET) != -1);
+    DVR_RETURN_IF_FALSE(segment_ts_seek(p_ctx, offset) != -1);
     return offset;
   }
 
-  memset(buf, 0, sizeof(buf));
-  ret = fseek(p_ctx->index_fp, 0, SEEK_SET);
-  DVR_RETURN_IF_FALSE(ret != -1);
-  int line = 0;
-  while (fgets(buf, sizeof(buf), p_ctx->index_fp) != NULL) {
-    line++;
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "time="))) {
-      p1 += 5;
-      if ((p2 = strstr(buf, ","))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      pts = strtoull(value, NULL, 10);
-    }
-
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "offset="))) {
-      p1 += 7;
-      if ((p2 = strstr(buf, "}"))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      offset = strtoull(value, NULL, 10);
-    }
-    if (0)
-    {
-      DVR_INFO("seek buf[%s]", buf);
-      DVR_INFO("seek time=%llu, offset=%lld\n", pts, offset);
-    }
-    memset(buf, 0, sizeof(buf));
-    if (time <= pts) {
-      if (block_size > 0) {
-        offset = offset - offset%block_size;
-      }
-      //DVR_INFO("seek time=%llu, offset=%lld time--%llu line %d\n", pts, offset, time, line);
-      DVR_RETURN_IF_FALSE(lseek(p_ctx->ts_fd, offset, SEEK_SET) != -1);
-      return offset;
+  ret = segment_index_cache_update(p_ctx);
+  DVR_RETURN_IF_FALSE(ret != DVR_FAILURE);
+  line = segment_index_cache_find_time(p_ctx, time);
+  if (line < p_ctx->index_cache_nb) {
+    pts = p_ctx->index_cache[line].time;
+    offset = p_ctx->index_cache[line].offset;
+    if (block_size > 0) {
+      offset = offset - offset%block_size;
     }
+    //DVR_INFO("seek time=%llu, offset=%lld time--%llu line %d\n", pts, offset, time, line);
+    DVR_RETURN_IF_FALSE(segment_ts_seek(p_ctx, offset) != -1);
+    return offset;
+  }
+  if (line > 0) {
+    pts = p_ctx->index_cache[line - 1].time;
+    offset = p_ctx->index_cache[line - 1].offset;
   }
   if (time > pts) {
     if (block_size > 0) {
       offset = offset - offset%block_size;
     }
     DVR_INFO("seek time=%llu, offset=%lld time--%llu line %d end\n", pts, offset, time, line);
-    DVR_RETURN_IF_FALSE(lseek(p_ctx->ts_fd, offset, SEEK_SET) != -1);
+    DVR_RETURN_IF_FALSE(segment_ts_seek(p_ctx, offset) != -1);
     return offset;
   }
   DVR_INFO("seek error line [%d]", line);
@@ -475,59 +1623,54 @@ loff_t segment_tell_position(Segment_Handle_t handle)
   loff_t pos;
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
-  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
-  pos = lseek(p_ctx->ts_fd, 0, SEEK_CUR);
+  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1 || p_ctx->ring);
+  /* Queued data is not in the file yet, but already has its position. The
+   * index points at such positions are held back until the data is written */
+  if (p_ctx->wb_count > 0)
+    return p_ctx->wb_pos;
+  if (p_ctx->dio_buf)
+    return p_ctx->dio_off + p_ctx->dio_len;
+  if (p_ctx->ring && p_ctx->mode == SEGMENT_MODE_WRITE)
+    return segment_ring_size(p_ctx->ring, p_ctx->segment_id);
+  pos = segment_ts_tell(p_ctx);
   return pos;
 }
 
 loff_t segment_tell_position_time(Segment_Handle_t handle, loff_t position)
 {
   Segment_Context_t *p_ctx;
-  char buf[256];
-  char value[256];
   uint64_t ret = 0L;
   uint64_t pts = 0L;
   uint64_t pts_p = 0L;
   loff_t offset = 0;
   loff_t offset_p = 0;
-  char *p1, *p2;
   int ret2 = 0;
+  uint32_t i;
 
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(p_ctx->index_fp);
   DVR_RETURN_IF_FALSE(p_ctx->ts_fd);
 
-  memset(buf, 0, sizeof(buf));
-  ret2 = fseek(p_ctx->index_fp, 0, SEEK_SET);
-  DVR_RETURN_IF_FALSE(ret2 != -1);
+  ret2 = segment_index_cache_update(p_ctx);
+  DVR_RETURN_IF_FALSE(ret2 != DVR_FAILURE);
   DVR_RETURN_IF_FALSE(position != -1);
 
-  while (fgets(buf, sizeof(buf), p_ctx->index_fp) != NULL) {
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "time="))) {
-      p1 += 5;
-      if ((p2 = strstr(buf, ","))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      pts = strtoull(value, NULL, 10);
-    }
-
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "offset="))) {
-      p1 += 7;
-      if ((p2 = strstr(buf, "}"))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      offset = strtoull(value, NULL, 10);
-    }
-
-    memset(buf, 0, sizeof(buf));
+  /* Entries before the first offset >= position can not match, so only
+   * continue the scan from there */
+  i = segment_index_cache_find_offset(p_ctx, position);
+  if (i > 0) {
+    pts_p = p_ctx->index_cache[i - 1].time;
+    offset_p = p_ctx->index_cache[i - 1].offset;
+  }
+  for (; i < p_ctx->index_cache_nb; i++) {
+    pts = p_ctx->index_cache[i].time;
+    offset = p_ctx->index_cache[i].offset;
     //DVR_INFO("tell cur time=%llu, offset=%lld, position=%lld\n", pts, offset, position);
     if (position <= offset
         &&position >= offset_p
         && offset - offset_p > 0) {
-      // Tainted data issue originating from fgets seem false positive, so we
+      // Tainted data issue originating from index file seem false positive, so we
       // just suppress it here.
       // coverity[tainted_data]
       ret = pts_p + (pts - pts_p) * (position - offset_p) / (offset - offset_p);
@@ -537,6 +1680,8 @@ loff_t segment_tell_position_time(Segment_Handle_t handle, loff_t position)
     offset_p = offset;
     pts_p = pts;
   }
+  if (p_ctx->index_cache_nb > 0)
+    pts = p_ctx->index_cache[p_ctx->index_cache_nb - 1].time;
   //DVR_INFO("tell cur time=%llu, offset=%lld, position=%lld\n", pts, offset, position);
   return pts;
 }
@@ -545,63 +1690,34 @@ loff_t segment_tell_position_time(Segment_Handle_t handle, loff_t position)
 loff_t segment_tell_current_time(Segment_Handle_t handle)
 {
   Segment_Context_t *p_ctx;
-  char buf[256];
-  char value[256];
   uint64_t pts = 0L;
-  loff_t offset = 0, position = 0;
-  char *p1, *p2;
+  loff_t position = 0;
   int ret = 0;
+  uint32_t i;
 
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(p_ctx->index_fp);
   DVR_RETURN_IF_FALSE(p_ctx->ts_fd);
 
-  memset(buf, 0, sizeof(buf));
-  ret = fseek(p_ctx->index_fp, 0, SEEK_SET);
-  DVR_RETURN_IF_FALSE(ret != -1);
-  position = lseek(p_ctx->ts_fd, 0, SEEK_CUR);
+  ret = segment_index_cache_update(p_ctx);
+  DVR_RETURN_IF_FALSE(ret != DVR_FAILURE);
+  position = segment_ts_tell(p_ctx);
   DVR_RETURN_IF_FALSE(position != -1);
 
-  while (fgets(buf, sizeof(buf), p_ctx->index_fp) != NULL) {
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "time="))) {
-      p1 += 5;
-      if ((p2 = strstr(buf, ","))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      pts = strtoull(value, NULL, 10);
-    }
-
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "offset="))) {
-      p1 += 7;
-      if ((p2 = strstr(buf, "}"))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      offset = strtoull(value, NULL, 10);
-    }
-
-    memset(buf, 0, sizeof(buf));
-    //DVR_INFO("tell cur time=%llu, offset=%lld, position=%lld\n", pts, offset, position);
-    if (position <= offset) {
-      return pts;
-    }
+  i = segment_index_cache_find_offset(p_ctx, position);
+  if (i < p_ctx->index_cache_nb) {
+    return p_ctx->index_cache[i].time;
   }
-  //DVR_INFO("tell cur time=%llu, offset=%lld, position=%lld\n", pts, offset, position);
+  if (p_ctx->index_cache_nb > 0)
+    pts = p_ctx->index_cache[p_ctx->index_cache_nb - 1].time;
   return pts;
 }
 
 loff_t segment_tell_total_time(Segment_Handle_t handle)
 {
   Segment_Context_t *p_ctx;
-  char buf[256];
-  char last_buf[256];
-  char value[256];
   uint64_t pts = ULLONG_MAX;
-  loff_t offset = 0, position = 0;
-  char *p1, *p2;
-  int line = 0;
   int ret = 0;
 
   p_ctx = (Segment_Context_t *)handle;
@@ -609,48 +1725,13 @@ loff_t segment_tell_total_time(Segment_Handle_t handle)
   DVR_RETURN_IF_FALSE(p_ctx->index_fp);
   DVR_RETURN_IF_FALSE(p_ctx->ts_fd);
 
-  memset(buf, 0, sizeof(buf));
-  memset(last_buf, 0, sizeof(last_buf));
-  position = lseek(p_ctx->ts_fd, 0, SEEK_CUR);
-  DVR_RETURN_IF_FALSE(position != -1);
+  ret = segment_index_cache_update(p_ctx);
+  DVR_RETURN_IF_FALSE(ret != DVR_FAILURE);
 
-  // if unable to seek from end, it is necessary to seek to file beginning position.
-  if (fseek(p_ctx->index_fp, -1000L, SEEK_END) == -1) {
-    ret = fseek(p_ctx->index_fp, 0L, SEEK_SET);
-    DVR_RETURN_IF_FALSE(ret != -1);
-  }
-  /* Save last line buffer */
-  while (fgets(buf, sizeof(buf), p_ctx->index_fp) != NULL) {
-    if (strlen(buf) <= 0) {
-      DVR_INFO("read index buf is len 0");
-      continue;
-    }
-    memset(last_buf, 0, sizeof(last_buf));
-    memcpy(last_buf, buf, strlen(buf));
-    memset(buf, 0, sizeof(buf));
-    line++;
-  }
+  if (p_ctx->index_cache_nb > 0)
+    pts = p_ctx->index_cache[p_ctx->index_cache_nb - 1].time;
 
-  /* Extract time value */
-  memset(value, 0, sizeof(value));
-  if ((p1 = strstr(last_buf, "time="))) {
-    p1 += 5;
-    if ((p2 = strstr(last_buf, ","))) {
-      memcpy(value, p1, p2 - p1);
-    }
-    pts = strtoull(value, NULL, 10);
-  }
-
-  memset(value, 0, sizeof(value));
-  if ((p1 = strstr(last_buf, "offset="))) {
-    p1 += 7;
-    if ((p2 = strstr(last_buf, "}"))) {
-      memcpy(value, p1, p2 - p1);
-    }
-    offset = strtoull(value, NULL, 10);
-  }
-  //if (line < 2)
-  //DVR_INFO("totle time=%llu, offset=%lld, position=%lld, line:%d\n", pts, offset, position, line);
+  //DVR_INFO("totle time=%llu\n", pts);
   return (pts == ULLONG_MAX ? DVR_FAILURE : pts);
 }
 
@@ -956,6 +2037,11 @@ int segment_delete(const char *location, uint64_t segment_id)
   memset(fname, 0, sizeof(fname));
   segment_get_fname(fname, location, segment_id, SEGMENT_FILE_TYPE_TS);
   ret = unlink(fname);
+  if (ret == -1 && errno == ENOENT && segment_ring_exists(location)) {
+    /* The slot may be already overwritten by the ring */
+    segment_ring_remove(location, segment_id);
+    ret = 0;
+  }
   DVR_ERROR("%s, [%s] return:%s", __func__, fname, strerror(errno));
   DVR_RETURN_IF_FALSE(ret == 0);
 
@@ -973,6 +2059,11 @@ int segment_delete(const char *location, uint64_t segment_id)
   DVR_ERROR("%s, [%s] return:%s", __func__, fname, strerror(errno));
   DVR_RETURN_IF_FALSE(ret == 0);
 
+  /*delete I-frame index file, only exists for accurate records*/
+  memset(fname, 0, sizeof(fname));
+  segment_get_fname(fname, location, segment_id, SEGMENT_FILE_TYPE_IFRAME);
+  unlink(fname);
+
   return DVR_SUCCESS;
 }
 
@@ -996,44 +2087,20 @@ int segment_ongoing(Segment_Handle_t handle)
 loff_t segment_dump_pts(Segment_Handle_t handle)
 {
   Segment_Context_t *p_ctx;
-  char buf[256];
-  char value[256];
   uint64_t pts = 0;
   loff_t offset = 0;
-  char *p1, *p2;
   int ret = 0;
 
   p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
   DVR_RETURN_IF_FALSE(p_ctx->index_fp);
-  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
+  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1 || p_ctx->ring);
 
-  memset(buf, 0, sizeof(buf));
-  ret = fseek(p_ctx->index_fp, 0, SEEK_SET);
+  ret = segment_index_rewind(p_ctx);
   DVR_RETURN_IF_FALSE(ret != -1);
 
   printf("start gets pts\n");
-  while (fgets(buf, sizeof(buf), p_ctx->index_fp) != NULL) {
-    printf("buf[%s]\n", buf);
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "time="))) {
-      p1 += 5;
-      if ((p2 = strstr(buf, ","))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      pts = strtoull(value, NULL, 10);
-    }
-
-    memset(value, 0, sizeof(value));
-    if ((p1 = strstr(buf, "offset="))) {
-      p1 += 7;
-      if ((p2 = strstr(buf, "}"))) {
-        memcpy(value, p1, p2 - p1);
-      }
-      offset = strtoull(value, NULL, 10);
-    }
-
-    memset(buf, 0, sizeof(buf));
+  while (segment_index_next(p_ctx, &pts, &offset)) {
     printf("pts=%llu, offset=%lld\n", pts, offset);
   }
 
@@ -1044,8 +2111,14 @@ off_t segment_get_cur_segment_size(Segment_Handle_t handle)
 {
   Segment_Context_t *p_ctx = (Segment_Context_t *)handle;
   DVR_RETURN_IF_FALSE(p_ctx);
-  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1);
+  DVR_RETURN_IF_FALSE(p_ctx->ts_fd != -1 || p_ctx->ring);
   struct stat sb;
+  if (p_ctx->wb_count > 0)
+    return p_ctx->wb_pos;
+  if (p_ctx->dio_buf)
+    return p_ctx->dio_off + p_ctx->dio_len;
+  if (p_ctx->ring)
+    return segment_ring_size(p_ctx->ring, p_ctx->segment_id);
   int ret=fstat(p_ctx->ts_fd,&sb);
   if (ret<0) {
     return -1;
@@ -1060,3 +2133,24 @@ uint64_t segment_get_cur_segment_id(Segment_Handle_t handle)
   return p_ctx->segment_id;
 }
 
+int segment_get_write_stats(Segment_Handle_t handle, Segment_WriteStats_t *p_stats)
+{
+  Segment_Context_t *p_ctx = (Segment_Context_t *)handle;
+
+  DVR_RETURN_IF_FALSE(p_ctx);
+  DVR_RETURN_IF_FALSE(p_stats);
+
+  memset(p_stats, 0, sizeof(*p_stats));
+  if (p_ctx->wb_count == 0)
+    return DVR_SUCCESS;
+
+  pthread_mutex_lock(&p_ctx->wb_lock);
+  p_stats->queue_size = p_ctx->wb_count;
+  p_stats->high_water = p_ctx->wb_high_water;
+  p_stats->full_count = p_ctx->wb_full_count;
+  p_stats->max_write_ms = p_ctx->wb_max_write_ms;
+  p_stats->pending = p_ctx->wb_pos - p_ctx->wb_done;
+  pthread_mutex_unlock(&p_ctx->wb_lock);
+  return DVR_SUCCESS;
+}
+
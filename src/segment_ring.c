@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "dvr_types.h"
+#include "segment_ring.h"
+
+#define SEGMENT_RING_MAGIC        (0x474e5244)  /* "DRNG" */
+#define SEGMENT_RING_VERSION      (1)
+#define SEGMENT_RING_MAX_SLOTS    (256)
+#define SEGMENT_RING_SLOT_OFFSET  (4096)
+#define SEGMENT_RING_DATA_OFFSET  (64*1024)
+#define SEGMENT_RING_PATH_SIZE    (DVR_MAX_LOCATION_SIZE + 32)
+
+#define SEGMENT_RING_SLOT_VALID   (1 << 0)
+#define SEGMENT_RING_SLOT_ONGOING (1 << 1)
+
+/**\brief Ring file header, stored in host byte order at offset 0*/
+typedef struct {
+  uint32_t        magic;                              /**< SEGMENT_RING_MAGIC*/
+  uint16_t        version;                            /**< SEGMENT_RING_VERSION*/
+  uint16_t        slot_nb;                            /**< Number of slots in the table*/
+  uint64_t        capacity;                           /**< Size of the data area*/
+  uint64_t        head;                               /**< Logical write pointer, never wraps*/
+} Segment_RingHeader_t;
+
+/**\brief Ring slot, maps a segment onto a logical range*/
+typedef struct {
+  uint64_t        segment_id;                         /**< Segment id*/
+  uint64_t        start;                              /**< Logical start offset*/
+  uint64_t        end;                                /**< Logical end offset*/
+  uint32_t        flags;                              /**< SEGMENT_RING_SLOT_XXX*/
+  uint32_t        reserved;
+} Segment_RingSlot_t;
+
+/**\brief Ring file context, shared by all segment handles of a location*/
+struct Segment_Ring_s {
+  struct Segment_Ring_s *next;                        /**< Next attached ring*/
+  char            location[DVR_MAX_LOCATION_SIZE];    /**< Record file location*/
+  int             fd;                                 /**< Ring file fd*/
+  int             ref;                                /**< Number of attached users*/
+  pthread_mutex_t lock;                               /**< Protects header and slots*/
+  Segment_RingHeader_t hdr;                           /**< Header*/
+  Segment_RingSlot_t slots[SEGMENT_RING_MAX_SLOTS];   /**< Slot table*/
+};
+
+static Segment_Ring_t *ring_list = NULL;
+static pthread_mutex_t ring_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void segment_ring_get_fname(char fname[SEGMENT_RING_PATH_SIZE], const char *location)
+{
+  snprintf(fname, SEGMENT_RING_PATH_SIZE, "%s.ring", location);
+}
+
+static int segment_ring_save_header(Segment_Ring_t *ring)
+{
+  DVR_RETURN_IF_FALSE(pwrite(ring->fd, &ring->hdr, sizeof(ring->hdr), 0) == sizeof(ring->hdr));
+  return DVR_SUCCESS;
+}
+
+static int segment_ring_save_slot(Segment_Ring_t *ring, int i)
+{
+  DVR_RETURN_IF_FALSE(pwrite(ring->fd, &ring->slots[i], sizeof(ring->slots[i]),
+        SEGMENT_RING_SLOT_OFFSET + i * sizeof(Segment_RingSlot_t)) == sizeof(ring->slots[i]));
+  return DVR_SUCCESS;
+}
+
+static int segment_ring_load(Segment_Ring_t *ring)
+{
+  DVR_RETURN_IF_FALSE(pread(ring->fd, &ring->hdr, sizeof(ring->hdr), 0) == sizeof(ring->hdr));
+  DVR_RETURN_IF_FALSE(ring->hdr.magic == SEGMENT_RING_MAGIC);
+  DVR_RETURN_IF_FALSE(ring->hdr.version == SEGMENT_RING_VERSION);
+  DVR_RETURN_IF_FALSE(ring->hdr.slot_nb == SEGMENT_RING_MAX_SLOTS);
+  DVR_RETURN_IF_FALSE(ring->hdr.capacity > 0);
+  DVR_RETURN_IF_FALSE(pread(ring->fd, ring->slots, sizeof(ring->slots), SEGMENT_RING_SLOT_OFFSET)
+      == sizeof(ring->slots));
+  return DVR_SUCCESS;
+}
+
+/* (Re)create the ring file with all its space allocated up front, so that
+ * wrapping never allocates or frees blocks */
+static int segment_ring_create(Segment_Ring_t *ring, loff_t capacity)
+{
+  DVR_RETURN_IF_FALSE(ftruncate(ring->fd, 0) == 0);
+  if (fallocate(ring->fd, 0, 0, SEGMENT_RING_DATA_OFFSET + capacity) == -1) {
+    DVR_WARN("%s preallocate %lld failed, reason:%s", __func__, capacity, strerror(errno));
+    DVR_RETURN_IF_FALSE(ftruncate(ring->fd, SEGMENT_RING_DATA_OFFSET + capacity) == 0);
+  }
+
+  memset(&ring->hdr, 0, sizeof(ring->hdr));
+  ring->hdr.magic = SEGMENT_RING_MAGIC;
+  ring->hdr.version = SEGMENT_RING_VERSION;
+  ring->hdr.slot_nb = SEGMENT_RING_MAX_SLOTS;
+  ring->hdr.capacity = capacity;
+  ring->hdr.head = 0;
+  memset(ring->slots, 0, sizeof(ring->slots));
+
+  DVR_RETURN_IF_FALSE(pwrite(ring->fd, ring->slots, sizeof(ring->slots), SEGMENT_RING_SLOT_OFFSET)
+      == sizeof(ring->slots));
+  return segment_ring_save_header(ring);
+}
+
+static int segment_ring_find(Segment_Ring_t *ring, uint64_t segment_id)
+{
+  int i;
+
+  for (i = 0; i < SEGMENT_RING_MAX_SLOTS; i++) {
+    if ((ring->slots[i].flags & SEGMENT_RING_SLOT_VALID) && ring->slots[i].segment_id == segment_id)
+      return i;
+  }
+  return -1;
+}
+
+/* Oldest logical offset which is not overwritten yet */
+static uint64_t segment_ring_tail(Segment_Ring_t *ring)
+{
+  return (ring->hdr.head > ring->hdr.capacity) ? ring->hdr.head - ring->hdr.capacity : 0;
+}
+
+int segment_ring_attach(const char *location, loff_t capacity, Segment_Ring_t **p_ring)
+{
+  char fname[SEGMENT_RING_PATH_SIZE];
+  Segment_Ring_t *ring;
+
+  DVR_RETURN_IF_FALSE(location);
+  DVR_RETURN_IF_FALSE(strlen(location) < DVR_MAX_LOCATION_SIZE);
+  DVR_RETURN_IF_FALSE(p_ring);
+
+  pthread_mutex_lock(&ring_list_lock);
+  for (ring = ring_list; ring; ring = ring->next) {
+    if (!strcmp(ring->location, location)) {
+      ring->ref++;
+      pthread_mutex_unlock(&ring_list_lock);
+      *p_ring = ring;
+      return DVR_SUCCESS;
+    }
+  }
+
+  ring = calloc(1, sizeof(Segment_Ring_t));
+  if (!ring) {
+    pthread_mutex_unlock(&ring_list_lock);
+    return DVR_FAILURE;
+  }
+  strncpy(ring->location, location, sizeof(ring->location) - 1);
+  segment_ring_get_fname(fname, location);
+
+  ring->fd = open(fname, (capacity > 0) ? (O_CREAT | O_RDWR) : O_RDWR, 0644);
+  if (ring->fd == -1 && capacity <= 0)
+    ring->fd = open(fname, O_RDONLY);
+  if (ring->fd == -1) {
+    if (capacity > 0)
+      DVR_ERROR("%s open %s failed, reason:%s", __func__, fname, strerror(errno));
+    goto error;
+  }
+
+  if (segment_ring_load(ring) != DVR_SUCCESS
+      || (capacity > 0 && ring->hdr.capacity != (uint64_t)capacity)) {
+    if (capacity <= 0)
+      goto error;
+    DVR_INFO("%s create %s, capacity:%lld", __func__, fname, capacity);
+    if (segment_ring_create(ring, capacity) != DVR_SUCCESS)
+      goto error;
+  }
+
+  pthread_mutex_init(&ring->lock, NULL);
+  ring->ref = 1;
+  ring->next = ring_list;
+  ring_list = ring;
+  pthread_mutex_unlock(&ring_list_lock);
+
+  *p_ring = ring;
+  return DVR_SUCCESS;
+
+error:
+  pthread_mutex_unlock(&ring_list_lock);
+  if (ring->fd != -1)
+    close(ring->fd);
+  free(ring);
+  return DVR_FAILURE;
+}
+
+int segment_ring_detach(Segment_Ring_t *ring)
+{
+  Segment_Ring_t **pp;
+
+  DVR_RETURN_IF_FALSE(ring);
+
+  pthread_mutex_lock(&ring_list_lock);
+  if (--ring->ref > 0) {
+    pthread_mutex_unlock(&ring_list_lock);
+    return DVR_SUCCESS;
+  }
+  for (pp = &ring_list; *pp; pp = &(*pp)->next) {
+    if (*pp == ring) {
+      *pp = ring->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ring_list_lock);
+
+  close(ring->fd);
+  pthread_mutex_destroy(&ring->lock);
+  free(ring);
+  return DVR_SUCCESS;
+}
+
+int segment_ring_begin(Segment_Ring_t *ring, uint64_t segment_id)
+{
+  int i, oldest = 0;
+
+  DVR_RETURN_IF_FALSE(ring);
+
+  pthread_mutex_lock(&ring->lock);
+  i = segment_ring_find(ring, segment_id);
+  if (i < 0) {
+    /* Use a free slot, or recycle the oldest one */
+    for (i = 0; i < SEGMENT_RING_MAX_SLOTS; i++) {
+      if (!(ring->slots[i].flags & SEGMENT_RING_SLOT_VALID))
+        break;
+      if (ring->slots[i].start < ring->slots[oldest].start)
+        oldest = i;
+    }
+    if (i == SEGMENT_RING_MAX_SLOTS) {
+      DVR_WARN("%s slot table full, drop segment %llu", __func__, ring->slots[oldest].segment_id);
+      i = oldest;
+    }
+  }
+  ring->slots[i].segment_id = segment_id;
+  ring->slots[i].start = ring->hdr.head;
+  ring->slots[i].end = ring->hdr.head;
+  ring->slots[i].flags = SEGMENT_RING_SLOT_VALID | SEGMENT_RING_SLOT_ONGOING;
+  segment_ring_save_slot(ring, i);
+  pthread_mutex_unlock(&ring->lock);
+  return DVR_SUCCESS;
+}
+
+int segment_ring_end(Segment_Ring_t *ring, uint64_t segment_id)
+{
+  int i;
+
+  DVR_RETURN_IF_FALSE(ring);
+
+  pthread_mutex_lock(&ring->lock);
+  i = segment_ring_find(ring, segment_id);
+  if (i >= 0) {
+    ring->slots[i].flags &= ~SEGMENT_RING_SLOT_ONGOING;
+    segment_ring_save_slot(ring, i);
+  }
+  segment_ring_save_header(ring);
+  pthread_mutex_unlock(&ring->lock);
+  return (i >= 0) ? DVR_SUCCESS : DVR_FAILURE;
+}
+
+ssize_t segment_ring_append(Segment_Ring_t *ring, uint64_t segment_id, const void *buf, size_t count)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+  uint64_t logical, tail, phys;
+  size_t done = 0, len;
+  ssize_t ret;
+  int i, j;
+
+  DVR_RETURN_IF_FALSE(ring);
+  DVR_RETURN_IF_FALSE(buf);
+
+  pthread_mutex_lock(&ring->lock);
+  i = segment_ring_find(ring, segment_id);
+  /* A segment opened while the previous one was still written starts at
+   * its first append */
+  if (i >= 0 && ring->slots[i].start == ring->slots[i].end
+      && ring->slots[i].end != ring->hdr.head) {
+    ring->slots[i].start = ring->hdr.head;
+    ring->slots[i].end = ring->hdr.head;
+    segment_ring_save_slot(ring, i);
+  }
+  if (i < 0 || ring->slots[i].end != ring->hdr.head) {
+    pthread_mutex_unlock(&ring->lock);
+    DVR_ERROR("%s segment %llu is not at the write pointer", __func__, segment_id);
+    return DVR_FAILURE;
+  }
+  /* Move the head first, so readers stop reading the area being overwritten */
+  logical = ring->hdr.head;
+  ring->hdr.head += count;
+  tail = segment_ring_tail(ring);
+  for (j = 0; j < SEGMENT_RING_MAX_SLOTS; j++) {
+    if (j != i && (ring->slots[j].flags & SEGMENT_RING_SLOT_VALID) && ring->slots[j].end <= tail) {
+      DVR_INFO("%s segment %llu is overwritten", __func__, ring->slots[j].segment_id);
+      ring->slots[j].flags = 0;
+      segment_ring_save_slot(ring, j);
+    }
+  }
+  /* Persist the head before overwriting, a reader reopening the ring after
+   * a crash must not trust the area being written */
+  segment_ring_save_header(ring);
+  pthread_mutex_unlock(&ring->lock);
+
+  while (done < count) {
+    phys = (logical + done) % ring->hdr.capacity;
+    len = count - done;
+    if (len > ring->hdr.capacity - phys)
+      len = ring->hdr.capacity - phys;
+    ret = pwrite(ring->fd, p + done, len, SEGMENT_RING_DATA_OFFSET + phys);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      DVR_ERROR("%s write failed, reason:%s", __func__, strerror(errno));
+      break;
+    }
+    done += ret;
+  }
+
+  pthread_mutex_lock(&ring->lock);
+  ring->slots[i].end = logical + done;
+  segment_ring_save_slot(ring, i);
+  if (done < count) {
+    ring->hdr.head = logical + done;
+    segment_ring_save_header(ring);
+  }
+  pthread_mutex_unlock(&ring->lock);
+
+  return (done == count) ? (ssize_t)count : DVR_FAILURE;
+}
+
+ssize_t segment_ring_read(Segment_Ring_t *ring, uint64_t segment_id, void *buf, size_t count, loff_t pos)
+{
+  uint8_t *p = (uint8_t *)buf;
+  uint64_t logical, size, phys;
+  size_t done = 0, len;
+  ssize_t ret;
+  int i;
+
+  DVR_RETURN_IF_FALSE(ring);
+  DVR_RETURN_IF_FALSE(buf);
+  DVR_RETURN_IF_FALSE(pos >= 0);
+
+  pthread_mutex_lock(&ring->lock);
+  i = segment_ring_find(ring, segment_id);
+  if (i < 0) {
+    pthread_mutex_unlock(&ring->lock);
+    errno = ENOENT;
+    return DVR_FAILURE;
+  }
+  size = ring->slots[i].end - ring->slots[i].start;
+  if ((uint64_t)pos >= size) {
+    pthread_mutex_unlock(&ring->lock);
+    return 0;
+  }
+  if (count > size - pos)
+    count = size - pos;
+  logical = ring->slots[i].start + pos;
+  if (logical < segment_ring_tail(ring)) {
+    pthread_mutex_unlock(&ring->lock);
+    DVR_WARN("%s segment %llu pos %lld is overwritten", __func__, segment_id, pos);
+    errno = ENODATA;
+    return DVR_FAILURE;
+  }
+  pthread_mutex_unlock(&ring->lock);
+
+  while (done < count) {
+    phys = (logical + done) % ring->hdr.capacity;
+    len = count - done;
+    if (len > ring->hdr.capacity - phys)
+      len = ring->hdr.capacity - phys;
+    ret = pread(ring->fd, p + done, len, SEGMENT_RING_DATA_OFFSET + phys);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return done ? (ssize_t)done : DVR_FAILURE;
+    }
+    if (ret == 0)
+      break;
+    done += ret;
+  }
+
+  /* The writer may have wrapped over the range while it was read */
+  pthread_mutex_lock(&ring->lock);
+  if (logical < segment_ring_tail(ring)) {
+    pthread_mutex_unlock(&ring->lock);
+    DVR_WARN("%s segment %llu pos %lld is overwritten while reading", __func__, segment_id, pos);
+    errno = ENODATA;
+    return DVR_FAILURE;
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return done;
+}
+
+loff_t segment_ring_size(Segment_Ring_t *ring, uint64_t segment_id)
+{
+  loff_t size = DVR_FAILURE;
+  int i;
+
+  DVR_RETURN_IF_FALSE(ring);
+
+  pthread_mutex_lock(&ring->lock);
+  i = segment_ring_find(ring, segment_id);
+  if (i >= 0)
+    size = ring->slots[i].end - ring->slots[i].start;
+  pthread_mutex_unlock(&ring->lock);
+  return size;
+}
+
+int segment_ring_remove(const char *location, uint64_t segment_id)
+{
+  Segment_Ring_t *ring;
+  int i;
+
+  DVR_RETURN_IF_FALSE(segment_ring_attach(location, 0, &ring) == DVR_SUCCESS);
+
+  pthread_mutex_lock(&ring->lock);
+  i = segment_ring_find(ring, segment_id);
+  if (i >= 0) {
+    ring->slots[i].flags = 0;
+    segment_ring_save_slot(ring, i);
+  }
+  pthread_mutex_unlock(&ring->lock);
+
+  segment_ring_detach(ring);
+  return (i >= 0) ? DVR_SUCCESS : DVR_FAILURE;
+}
+
+DVR_Bool_t segment_ring_exists(const char *location)
+{
+  char fname[SEGMENT_RING_PATH_SIZE];
+
+  DVR_RETURN_IF_FALSE(location);
+  segment_ring_get_fname(fname, location);
+  return (access(fname, F_OK) == 0) ? DVR_TRUE : DVR_FALSE;
+}
@@ -5,6 +5,9 @@
 
 #define TS_PKT_SIZE (188)
 
+#define TS_INDEXER_SLOT_VIDEO (0)
+#define TS_INDEXER_SLOT_AUDIO (1)
+
 //#define TS_INDEXER_DEBUG
 #ifdef TS_INDEXER_DEBUG
 #define INF(fmt, ...) fprintf(stdout, fmt, ##__VA_ARGS__)
@@ -26,6 +29,15 @@
 #define HEVC_NALU_SPS           33
 #define HEVC_NALU_AUD           35
 
+/*Rebuild the PID set, video wins if both use the same PID.*/
+static void
+ts_indexer_update_pids (TS_Indexer_t *ts_indexer)
+{
+  ts_pid_set_init(&ts_indexer->pid_set);
+  ts_pid_set_add(&ts_indexer->pid_set, ts_indexer->audio_parser.pid, TS_INDEXER_SLOT_AUDIO);
+  ts_pid_set_add(&ts_indexer->pid_set, ts_indexer->video_parser.pid, TS_INDEXER_SLOT_VIDEO);
+}
+
 /**
  * Initialize the TS indexer.
  * \param ts_indexer The TS indexer to be initialized.
@@ -53,6 +65,7 @@ ts_indexer_init (TS_Indexer_t *ts_indexer)
   memcpy(&ts_indexer->audio_parser, &init_parser, sizeof(TSParser));
   ts_indexer->callback     = NULL;
   ts_indexer->offset       = 0;
+  ts_indexer_update_pids(ts_indexer);
 
   return 0;
 }
@@ -106,6 +119,7 @@ ts_indexer_set_video_pid (TS_Indexer_t *ts_indexer, int pid)
   parser->PES.offset = 0;
   parser->PES.len = 0;
   parser->PES.state = TS_INDEXER_STATE_INIT;
+  ts_indexer_update_pids(ts_indexer);
 
   return 0;
 }
@@ -130,6 +144,7 @@ ts_indexer_set_audio_pid (TS_Indexer_t *ts_indexer, int pid)
   parser->PES.offset = 0;
   parser->PES.len = 0;
   parser->PES.state = TS_INDEXER_STATE_INIT;
+  ts_indexer_update_pids(ts_indexer);
 
   return 0;
 }
@@ -625,15 +640,19 @@ ts_packet(TS_Indexer_t *ts_indexer, uint8_t *data)
   int len;
   int is_start;
   TS_Indexer_Event_t event;
+  TSParser *parser;
 
   is_start = p[1] & 0x40;
-  pid = ((p[1] & 0x1f) << 8) | p[2];
-  if (pid == 0x1fff)
-    return;
-
-  if ((pid != pi->video_parser.pid) &&
-      (pid != pi->audio_parser.pid)) {
-    return;
+  pid = TS_PKT_PID(p);
+  switch (ts_pid_set_slot(&pi->pid_set, pid)) {
+    case TS_INDEXER_SLOT_VIDEO:
+      parser = &pi->video_parser;
+      break;
+    case TS_INDEXER_SLOT_AUDIO:
+      parser = &pi->audio_parser;
+      break;
+    default:
+      return;
   }
 
   if (is_start) {
@@ -645,14 +664,8 @@ ts_packet(TS_Indexer_t *ts_indexer, uint8_t *data)
       pi->callback(pi, &event);
     }
 
-    if (pid == pi->video_parser.pid) {
-      pi->video_parser.offset = pi->offset;
-      pi->video_parser.PES.state = TS_INDEXER_STATE_TS_START;
-    }
-    else if (pid == pi->audio_parser.pid) {
-      pi->audio_parser.offset = pi->offset;
-      pi->audio_parser.PES.state = TS_INDEXER_STATE_TS_START;
-    }
+    parser->offset = pi->offset;
+    parser->PES.state = TS_INDEXER_STATE_TS_START;
   }
 
   afc = (p[3] >> 4) & 0x03;
@@ -686,7 +699,7 @@ ts_packet(TS_Indexer_t *ts_indexer, uint8_t *data)
   // has payload
   if ((afc & 1) && (len > 0)) {
     // parser pes packet
-    pes_packet(pi, p, len, (pid == pi->video_parser.pid) ? &pi->video_parser : &pi->audio_parser);
+    pes_packet(pi, p, len, parser);
   }
 }
 
@@ -0,0 +1,186 @@
+/**
+ * \page dvr_block_pool_test
+ * \section Introduction
+ * test code with dvr_block_pool_xxxx APIs.
+ * It checks:
+ * \li freed blocks are reused by allocations of a close size
+ * \li blocks much larger than the request are not reused
+ * \li reservations keep their block while it is large enough
+ * \li blocks of 2MB or more are 2MB aligned
+ * \li the least recently freed blocks above the cache limit are unmapped
+ *
+ * \section Usage
+ *
+ * \code
+ *    dvr_block_pool_test
+ * \endcode
+ *
+ * \endsection
+ */
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "dvr_block_pool.h"
+#include "../dvr_test_utils.h"
+
+#define HUGE_BLOCK_SIZE (2 * 1024 * 1024)
+#define HUGE_BLOCK_MAX  (16)
+
+static size_t cache_limit(void)
+{
+  return (size_t)dvr_prop_read_int(DVR_BLOCK_POOL_CACHE_PROP, DVR_BLOCK_POOL_CACHE_DEFAULT) * 1024;
+}
+
+static int is_mapped(void *addr, size_t size)
+{
+  return msync(addr, size, MS_ASYNC) == 0;
+}
+
+static int test_reuse(void)
+{
+  void *a, *b, *c;
+  size_t page = (size_t)getpagesize();
+
+  if (cache_limit() < 256 * 1024) {
+    printf("%s skipped, cache limit %zu too small\n", __func__, cache_limit());
+    return 0;
+  }
+
+  a = dvr_block_pool_alloc(100000);
+  CHECK(a);
+  CHECK(((uintptr_t)a & (page - 1)) == 0);
+  memset(a, 0x5a, 100000);
+  dvr_block_pool_free(a);
+
+  /*same size and smaller sizes up to half the block reuse it*/
+  b = dvr_block_pool_alloc(100000);
+  CHECK(b == a);
+  dvr_block_pool_free(b);
+  b = dvr_block_pool_alloc(60000);
+  CHECK(b == a);
+
+  /*a block more than twice as large as the request is not used*/
+  dvr_block_pool_free(b);
+  c = dvr_block_pool_alloc(10000);
+  CHECK(c);
+  CHECK(c != a);
+  b = dvr_block_pool_alloc(100000);
+  CHECK(b == a);
+
+  CHECK(dvr_block_pool_alloc(0) == NULL);
+  dvr_block_pool_free(NULL);
+  dvr_block_pool_free(b);
+  dvr_block_pool_free(c);
+  return 0;
+}
+
+static int test_reserve(void)
+{
+  DVR_BlockReserve_t res;
+  void *block;
+
+  memset(&res, 0, sizeof(res));
+  block = dvr_block_pool_reserve(&res, 64 * 1024);
+  CHECK(block);
+  CHECK(res.block == block);
+  CHECK(res.size == 64 * 1024);
+
+  /*a smaller request keeps the block*/
+  CHECK(dvr_block_pool_reserve(&res, 1024) == block);
+  CHECK(res.size == 64 * 1024);
+
+  /*a larger request replaces it*/
+  CHECK(dvr_block_pool_reserve(&res, 1024 * 1024) != NULL);
+  CHECK(res.size == 1024 * 1024);
+
+  dvr_block_pool_release(&res);
+  CHECK(res.block == NULL);
+  CHECK(res.size == 0);
+  dvr_block_pool_release(&res);
+  return 0;
+}
+
+static int test_huge_align(void)
+{
+  void *block;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    block = dvr_block_pool_alloc(HUGE_BLOCK_SIZE + i * 1024 * 1024);
+    CHECK(block);
+    CHECK(((uintptr_t)block & (HUGE_BLOCK_SIZE - 1)) == 0);
+    memset(block, i, HUGE_BLOCK_SIZE + i * 1024 * 1024);
+    dvr_block_pool_free(block);
+  }
+  return 0;
+}
+
+static int test_cache_limit(void)
+{
+  void *blocks[HUGE_BLOCK_MAX];
+  size_t limit;
+  int i, n, kept;
+
+  limit = cache_limit();
+  kept = (int)(limit / HUGE_BLOCK_SIZE);
+  if (kept > HUGE_BLOCK_MAX - 2) {
+    printf("%s skipped, cache limit %zu too large\n", __func__, limit);
+    return 0;
+  }
+  n = kept + 2;
+
+  for (i = 0; i < n; i++) {
+    blocks[i] = dvr_block_pool_alloc(HUGE_BLOCK_SIZE);
+    CHECK(blocks[i]);
+  }
+  for (i = 0; i < n; i++)
+    dvr_block_pool_free(blocks[i]);
+
+  /*the first freed blocks are unmapped, the last ones are cached*/
+  for (i = 0; i < n; i++) {
+    if (i < n - kept)
+      CHECK(!is_mapped(blocks[i], HUGE_BLOCK_SIZE));
+    else
+      CHECK(is_mapped(blocks[i], HUGE_BLOCK_SIZE));
+  }
+
+  /*the cached blocks are handed out again, most recently freed first*/
+  for (i = n - 1; i >= n - kept; i--) {
+    void *block = dvr_block_pool_alloc(HUGE_BLOCK_SIZE);
+
+    CHECK(block == blocks[i]);
+  }
+  for (i = n - kept; i < n; i++)
+    dvr_block_pool_free(blocks[i]);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int ret = 0;
+
+  (void)argc;
+  (void)argv;
+
+  if (test_reuse() != 0)
+    ret = 1;
+  if (test_reserve() != 0)
+    ret = 1;
+  if (test_huge_align() != 0)
+    ret = 1;
+  if (test_cache_limit() != 0)
+    ret = 1;
+
+  printf("dvr_block_pool_test %s\n", ret ? "FAILED" : "PASSED");
+  return ret;
+}
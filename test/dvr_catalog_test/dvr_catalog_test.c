@@ -0,0 +1,303 @@
+/**
+ * \page dvr_catalog_test
+ * \section Introduction
+ * test code with dvr_catalog_xxxx APIs.
+ * It checks:
+ * \li totals, segments and pids appended are read back, updated and removed
+ * \li dvr_catalog_list returns the same entries with or without a trailing '/'
+ * \li the file is compacted when outdated records pile up
+ * \li records appended and compactions done by another process are reloaded
+ * \li records appended after garbage at the end of the file are kept
+ * \li a file which is not a catalog is never written
+ *
+ * \section Usage
+ *
+ * \li dir: work directory, see dvr_test_utils.h
+ *
+ * \code
+ *    dvr_catalog_test [dir]
+ * \endcode
+ *
+ * \endsection
+ */
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "dvr_types.h"
+#include "dvr_catalog.h"
+#include "../dvr_test_utils.h"
+
+#define UPDATE_NB   (1000)
+
+static char cat_dir[DVR_MAX_LOCATION_SIZE - 32];
+static char cat_path[DVR_MAX_LOCATION_SIZE];
+
+static const char *rec_path(const char *name)
+{
+  static char path[DVR_MAX_LOCATION_SIZE];
+
+  snprintf(path, sizeof(path), "%s/%s", cat_dir, name);
+  return path;
+}
+
+static int check_stats(const char *name, uint64_t size, time_t time, uint32_t pkts)
+{
+  DVR_CatalogEntry_t entry;
+
+  CHECK(dvr_catalog_get(rec_path(name), &entry) == DVR_SUCCESS);
+  CHECK(!strcmp(entry.name, name));
+  CHECK(entry.flags & DVR_CATALOG_HAS_STATS);
+  CHECK(entry.size == size);
+  CHECK(entry.time == time);
+  CHECK(entry.pkts == pkts);
+  return 0;
+}
+
+static off_t file_size(void)
+{
+  struct stat st;
+
+  if (stat(cat_path, &st) != 0)
+    return -1;
+  return st.st_size;
+}
+
+static int test_append(void)
+{
+  static const uint64_t ids[] = {1, 2, 10000};
+  DVR_StreamPid_t pids[2];
+  DVR_CatalogEntry_t entry, *entries = NULL;
+  uint64_t *p_ids = NULL;
+  uint32_t i, n = 0;
+  char dir[DVR_MAX_LOCATION_SIZE];
+
+  pids[0].pid = 0x100;
+  pids[0].type = DVR_STREAM_TYPE_VIDEO;
+  pids[1].pid = 0x101;
+  pids[1].type = DVR_STREAM_TYPE_AUDIO;
+
+  CHECK(dvr_catalog_get(rec_path("rec1"), &entry) == DVR_FAILURE);
+  CHECK(dvr_catalog_set_stats(rec_path("rec1"), 1000, 10, 5) == DVR_SUCCESS);
+  CHECK(dvr_catalog_set_segments(rec_path("rec1"), 3, ids, 2, pids) == DVR_SUCCESS);
+  CHECK(dvr_catalog_set_stats(rec_path("rec2"), 2000, 20, 10) == DVR_SUCCESS);
+  CHECK(dvr_catalog_set_stats(rec_path("rec1"), 3000, 30, 15) == DVR_SUCCESS);
+
+  CHECK(check_stats("rec1", 3000, 30, 15) == 0);
+  CHECK(check_stats("rec2", 2000, 20, 10) == 0);
+  CHECK(dvr_catalog_get(rec_path("rec1"), &entry) == DVR_SUCCESS);
+  CHECK(entry.flags & DVR_CATALOG_HAS_SEGMENTS);
+  CHECK(entry.nb_segments == 3);
+  CHECK(entry.nb_pids == 2);
+  CHECK(entry.pids[1].pid == 0x101);
+  CHECK(entry.pids[1].type == pids[1].type);
+
+  CHECK(dvr_catalog_get_segments(rec_path("rec1"), &n, &p_ids) == DVR_SUCCESS);
+  CHECK(n == 3);
+  for (i = 0; i < n; i++)
+    CHECK(p_ids[i] == ids[i]);
+  free(p_ids);
+  CHECK(dvr_catalog_get_segments(rec_path("rec2"), &n, &p_ids) == DVR_FAILURE);
+
+  /*the directory with and without a trailing '/'*/
+  CHECK(dvr_catalog_list(cat_dir, &n, &entries) == DVR_SUCCESS);
+  CHECK(n == 2);
+  free(entries);
+  snprintf(dir, sizeof(dir), "%s/", cat_dir);
+  CHECK(dvr_catalog_list(dir, &n, &entries) == DVR_SUCCESS);
+  CHECK(n == 2);
+  free(entries);
+
+  CHECK(dvr_catalog_remove(rec_path("rec2")) == DVR_SUCCESS);
+  CHECK(dvr_catalog_get(rec_path("rec2"), &entry) == DVR_FAILURE);
+  CHECK(dvr_catalog_list(dir, &n, &entries) == DVR_SUCCESS);
+  CHECK(n == 1);
+  CHECK(!strcmp(entries[0].name, "rec1"));
+  free(entries);
+  return 0;
+}
+
+static int test_compact(void)
+{
+  off_t size;
+  int i;
+
+  CHECK(file_size() > 0);
+  for (i = 0; i < UPDATE_NB; i++)
+    CHECK(dvr_catalog_set_stats(rec_path("rec1"), i, i, i) == DVR_SUCCESS);
+
+  /*compactions keep the file far smaller than the updates*/
+  size = file_size();
+  printf("%d updates, catalog size:%lld\n", UPDATE_NB, (long long)size);
+  CHECK(size > 0 && size < UPDATE_NB * 16);
+  CHECK(check_stats("rec1", UPDATE_NB - 1, UPDATE_NB - 1, UPDATE_NB - 1) == 0);
+  return 0;
+}
+
+/* Run fn in a child process, which has its own copy of the cached catalog */
+static int run_child(int (*fn)(void))
+{
+  pid_t pid;
+  int status;
+
+  pid = fork();
+  CHECK(pid >= 0);
+  if (pid == 0)
+    _exit(fn() ? 1 : 0);
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  return 0;
+}
+
+static int child_append(void)
+{
+  CHECK(dvr_catalog_set_stats(rec_path("rec3"), 3, 3, 3) == DVR_SUCCESS);
+  CHECK(dvr_catalog_set_stats(rec_path("rec1"), 1, 1, 1) == DVR_SUCCESS);
+  return 0;
+}
+
+static int child_compact(void)
+{
+  int i;
+
+  for (i = 0; i < UPDATE_NB; i++)
+    CHECK(dvr_catalog_set_stats(rec_path("rec3"), i, 0, 0) == DVR_SUCCESS);
+  return 0;
+}
+
+static int test_reload(void)
+{
+  DVR_CatalogEntry_t *entries = NULL;
+  uint32_t n = 0;
+
+  /*records appended by another process*/
+  CHECK(run_child(child_append) == 0);
+  CHECK(check_stats("rec3", 3, 3, 3) == 0);
+  CHECK(check_stats("rec1", 1, 1, 1) == 0);
+
+  /*file compacted by another process*/
+  CHECK(run_child(child_compact) == 0);
+  CHECK(check_stats("rec3", UPDATE_NB - 1, 0, 0) == 0);
+  CHECK(check_stats("rec1", 1, 1, 1) == 0);
+  CHECK(dvr_catalog_list(cat_dir, &n, &entries) == DVR_SUCCESS);
+  CHECK(n == 2);
+  free(entries);
+  return 0;
+}
+
+static int test_garbage(void)
+{
+  static const uint8_t garbage[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+  static const uint8_t partial[] = {1, 0, 4, 0, 24, 0, 0, 0, 'r', 'e'};
+  int fd;
+
+  /*a corrupted record, the next append compacts the file*/
+  fd = open(cat_path, O_WRONLY | O_APPEND);
+  CHECK(fd != -1);
+  CHECK(write(fd, garbage, sizeof(garbage)) == sizeof(garbage));
+  close(fd);
+  CHECK(dvr_catalog_set_stats(rec_path("rec4"), 4, 4, 4) == DVR_SUCCESS);
+  CHECK(check_stats("rec4", 4, 4, 4) == 0);
+  CHECK(check_stats("rec1", 1, 1, 1) == 0);
+
+  /*a partial record left by a writer which died*/
+  fd = open(cat_path, O_WRONLY | O_APPEND);
+  CHECK(fd != -1);
+  CHECK(write(fd, partial, sizeof(partial)) == sizeof(partial));
+  close(fd);
+  CHECK(dvr_catalog_set_stats(rec_path("rec5"), 5, 5, 5) == DVR_SUCCESS);
+  CHECK(check_stats("rec5", 5, 5, 5) == 0);
+  CHECK(check_stats("rec4", 4, 4, 4) == 0);
+  return 0;
+}
+
+/* Replace the catalog file with data of len bytes */
+static int put_file(const char *data, size_t len)
+{
+  int fd;
+
+  unlink(cat_path);
+  fd = open(cat_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK(fd != -1);
+  CHECK(write(fd, data, len) == (ssize_t)len);
+  close(fd);
+  return 0;
+}
+
+static int same_file(const char *data, size_t len)
+{
+  char buf[64];
+  int fd;
+
+  fd = open(cat_path, O_RDONLY);
+  CHECK(fd != -1);
+  CHECK(read(fd, buf, sizeof(buf)) == (ssize_t)len);
+  close(fd);
+  CHECK(!memcmp(buf, data, len));
+  return 0;
+}
+
+static int test_foreign(void)
+{
+  static const char *data[] = {"some data of the user\n", "ab"};
+  DVR_CatalogEntry_t entry, *entries = NULL;
+  uint32_t i, n = 0;
+
+  for (i = 0; i < sizeof(data) / sizeof(data[0]); i++) {
+    CHECK(put_file(data[i], strlen(data[i])) == 0);
+    CHECK(dvr_catalog_set_stats(rec_path("rec6"), 6, 6, 6) == DVR_FAILURE);
+    CHECK(dvr_catalog_remove(rec_path("rec6")) == DVR_FAILURE);
+    CHECK(dvr_catalog_get(rec_path("rec6"), &entry) == DVR_FAILURE);
+    CHECK(dvr_catalog_list(cat_dir, &n, &entries) == DVR_FAILURE);
+    CHECK(same_file(data[i], strlen(data[i])) == 0);
+  }
+
+  /*a partial magic is a catalog left by a writer which died*/
+  CHECK(put_file("DVRC", 4) == 0);
+  CHECK(dvr_catalog_set_stats(rec_path("rec6"), 6, 6, 6) == DVR_SUCCESS);
+  CHECK(check_stats("rec6", 6, 6, 6) == 0);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *dir = dvr_test_dir(argc, argv);
+  int ret = 0;
+
+  if (!dir)
+    return 1;
+  snprintf(cat_dir, sizeof(cat_dir), "%s/dvr_catalog_test", dir);
+  snprintf(cat_path, sizeof(cat_path), "%s/%s", cat_dir, DVR_CATALOG_FILE);
+  unlink(cat_path);
+  rmdir(cat_dir);
+  if (mkdir(cat_dir, 0755) != 0) {
+    printf("create %s failed\n", cat_dir);
+    dvr_test_dir_done();
+    return 1;
+  }
+
+  if (test_append() != 0)
+    ret = 1;
+  if (!ret && test_compact() != 0)
+    ret = 1;
+  if (!ret && test_reload() != 0)
+    ret = 1;
+  if (!ret && test_garbage() != 0)
+    ret = 1;
+  if (!ret && test_foreign() != 0)
+    ret = 1;
+  unlink(cat_path);
+  rmdir(cat_dir);
+  dvr_test_dir_done();
+
+  printf("dvr_catalog_test %s\n", ret ? "FAILED" : "PASSED");
+  return ret;
+}
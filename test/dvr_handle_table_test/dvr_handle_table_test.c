@@ -0,0 +1,167 @@
+/**
+ * \page dvr_handle_table_test
+ * \section Introduction
+ * test code with dvr_handle_table_xxxx APIs.
+ * It checks:
+ * \li the slot limit and the growth of the table
+ * \li handles of a reused slot differ by their generation, stale handles are rejected
+ * \li removing a context waits for its references
+ * \li a removed slot still referenced is not reused
+ *
+ * \section Usage
+ *
+ * \code
+ *    dvr_handle_table_test
+ * \endcode
+ *
+ * \endsection
+ */
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dvr_types.h"
+#include "dvr_handle_table.h"
+#include "../dvr_test_utils.h"
+
+static int objs[64];
+
+static int test_limit(void)
+{
+  static DVR_HandleTable_t table = DVR_HANDLE_TABLE_INITIALIZER;
+  void *handles[64], *handle;
+  int i, index;
+
+  CHECK(dvr_handle_table_set_limit(&table, 0) != DVR_SUCCESS);
+  CHECK(dvr_handle_table_set_limit(&table, 40) == DVR_SUCCESS);
+  for (i = 0; i < 40; i++) {
+    CHECK(dvr_handle_table_add(&table, &objs[i], &handles[i], &index) == DVR_SUCCESS);
+    CHECK(index == i);
+    CHECK(handles[i] != NULL);
+  }
+  CHECK(dvr_handle_table_add(&table, &objs[40], &handle, NULL) != DVR_SUCCESS);
+  CHECK(dvr_handle_table_size(&table) == 40);
+
+  /*handles got before the table grew are still valid*/
+  for (i = 0; i < 40; i++) {
+    CHECK(dvr_handle_table_get(&table, handles[i]) == &objs[i]);
+    dvr_handle_table_put(&table, handles[i]);
+    CHECK(dvr_handle_table_at(&table, i) == &objs[i]);
+    dvr_handle_table_put(&table, handles[i]);
+  }
+  CHECK(dvr_handle_table_at(&table, 40) == NULL);
+
+  for (i = 0; i < 40; i++)
+    CHECK(dvr_handle_table_remove(&table, handles[i]) == DVR_SUCCESS);
+  return 0;
+}
+
+static int test_generation(void)
+{
+  static DVR_HandleTable_t table = DVR_HANDLE_TABLE_INITIALIZER;
+  void *handle, *old, *other;
+  int i, index, old_index;
+
+  CHECK(dvr_handle_table_set_limit(&table, 4) == DVR_SUCCESS);
+  CHECK(dvr_handle_table_add(&table, &objs[0], &other, NULL) == DVR_SUCCESS);
+  CHECK(dvr_handle_table_add(&table, &objs[1], &old, &old_index) == DVR_SUCCESS);
+
+  for (i = 0; i < 1000; i++) {
+    CHECK(dvr_handle_table_remove(&table, old) == DVR_SUCCESS);
+    CHECK(dvr_handle_table_remove(&table, old) != DVR_SUCCESS);
+    CHECK(dvr_handle_table_get(&table, old) == NULL);
+
+    /*the slot is reused with a new generation*/
+    CHECK(dvr_handle_table_add(&table, &objs[2], &handle, &index) == DVR_SUCCESS);
+    CHECK(index == old_index);
+    CHECK(handle != old);
+    CHECK(handle != NULL);
+    CHECK(dvr_handle_table_get(&table, old) == NULL);
+    dvr_handle_table_put(&table, old);
+    CHECK(dvr_handle_table_get(&table, handle) == &objs[2]);
+    dvr_handle_table_put(&table, handle);
+    old = handle;
+  }
+
+  CHECK(dvr_handle_table_remove(&table, handle) == DVR_SUCCESS);
+  CHECK(dvr_handle_table_remove(&table, other) == DVR_SUCCESS);
+  return 0;
+}
+
+typedef struct {
+  DVR_HandleTable_t  *table;
+  void               *handle;
+  volatile int        removed;
+  int                 ret;
+} RemoveArgs_t;
+
+static void *remover(void *arg)
+{
+  RemoveArgs_t *args = (RemoveArgs_t *)arg;
+
+  args->ret = dvr_handle_table_remove(args->table, args->handle);
+  args->removed = 1;
+  return NULL;
+}
+
+static int test_remove_wait(void)
+{
+  static DVR_HandleTable_t table = DVR_HANDLE_TABLE_INITIALIZER;
+  RemoveArgs_t args;
+  pthread_t thread;
+  void *handle, *handle2;
+  int index, index2;
+
+  memset(&args, 0, sizeof(args));
+  CHECK(dvr_handle_table_set_limit(&table, 2) == DVR_SUCCESS);
+  CHECK(dvr_handle_table_add(&table, &objs[0], &handle, &index) == DVR_SUCCESS);
+  CHECK(dvr_handle_table_get(&table, handle) == &objs[0]);
+
+  args.table = &table;
+  args.handle = handle;
+  CHECK(pthread_create(&thread, NULL, remover, &args) == 0);
+  usleep(100000);
+
+  /*the remover waits for the reference, the handle is already invalid*/
+  CHECK(!args.removed);
+  CHECK(dvr_handle_table_get(&table, handle) == NULL);
+
+  /*the referenced slot is not reused*/
+  CHECK(dvr_handle_table_add(&table, &objs[1], &handle2, &index2) == DVR_SUCCESS);
+  CHECK(index2 != index);
+  CHECK(dvr_handle_table_add(&table, &objs[2], &handle2, NULL) != DVR_SUCCESS);
+
+  dvr_handle_table_put(&table, handle);
+  pthread_join(thread, NULL);
+  CHECK(args.removed);
+  CHECK(args.ret == DVR_SUCCESS);
+
+  /*the slot is free once the reference is put*/
+  CHECK(dvr_handle_table_add(&table, &objs[2], &handle2, &index2) == DVR_SUCCESS);
+  CHECK(index2 == index);
+  CHECK(handle2 != handle);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int ret = 0;
+
+  (void)argc;
+  (void)argv;
+
+  if (test_limit() != 0)
+    ret = 1;
+  if (test_generation() != 0)
+    ret = 1;
+  if (test_remove_wait() != 0)
+    ret = 1;
+
+  printf("dvr_handle_table_test %s\n", ret ? "FAILED" : "PASSED");
+  return ret;
+}
@@ -0,0 +1,226 @@
+/**
+ * \page dvr_reactor_test
+ * \section Introduction
+ * test code with dvr_reactor_xxxx APIs.
+ * It checks:
+ * \li the function of a source is called when its fd is readable
+ * \li a kicked source is called, and called again if kicked while running
+ * \li the function of a source never runs twice at the same time
+ * \li a source whose function fails is not called anymore
+ * \li removing a source waits for its running function, its handle becomes invalid
+ *
+ * \section Usage
+ *
+ * \code
+ *    dvr_reactor_test
+ * \endcode
+ *
+ * \endsection
+ */
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "dvr_reactor.h"
+#include "../dvr_test_utils.h"
+
+#define SOURCE_NB   (32)
+
+typedef struct {
+  int             fd;
+  int             sleep_ms;     /**< Time spent in the function*/
+  int             ret;          /**< Return value of the function*/
+  volatile int    calls;
+  volatile int    active;       /**< Functions running*/
+  volatile int    overlap;      /**< Set if the function ran twice at the same time*/
+  volatile int    done;         /**< Functions returned*/
+} Source_t;
+
+static int source_fn(void *userdata)
+{
+  Source_t *s = (Source_t *)userdata;
+  uint64_t cnt;
+
+  if (__sync_add_and_fetch(&s->active, 1) > 1)
+    s->overlap = 1;
+  __sync_add_and_fetch(&s->calls, 1);
+  read(s->fd, &cnt, sizeof(cnt));
+  if (s->sleep_ms)
+    usleep(s->sleep_ms * 1000);
+  __sync_sub_and_fetch(&s->active, 1);
+  __sync_add_and_fetch(&s->done, 1);
+  return s->ret;
+}
+
+static int source_init(Source_t *s)
+{
+  memset(s, 0, sizeof(*s));
+  s->fd = eventfd(0, EFD_NONBLOCK);
+  s->ret = DVR_SUCCESS;
+  return (s->fd == -1) ? -1 : 0;
+}
+
+static void source_signal(Source_t *s)
+{
+  uint64_t cnt = 1;
+
+  write(s->fd, &cnt, sizeof(cnt));
+}
+
+/* Wait until *p reaches value, return 0 on success */
+static int wait_for(volatile int *p, int value, int timeout_ms)
+{
+  while (*p < value && timeout_ms > 0) {
+    usleep(1000);
+    timeout_ms--;
+  }
+  return (*p >= value) ? 0 : -1;
+}
+
+static int test_readable(void)
+{
+  static Source_t srcs[SOURCE_NB];
+  DVR_ReactorHandle_t handles[SOURCE_NB];
+  int i;
+
+  for (i = 0; i < SOURCE_NB; i++) {
+    CHECK(source_init(&srcs[i]) == 0);
+    CHECK(dvr_reactor_add(srcs[i].fd, source_fn, &srcs[i], &handles[i]) == DVR_SUCCESS);
+  }
+  usleep(50000);
+  for (i = 0; i < SOURCE_NB; i++)
+    CHECK(srcs[i].calls == 0);
+
+  /*each readable source is called once, and again once rearmed*/
+  for (i = 0; i < SOURCE_NB; i++)
+    source_signal(&srcs[i]);
+  for (i = 0; i < SOURCE_NB; i++)
+    CHECK(wait_for(&srcs[i].done, 1, 1000) == 0);
+  for (i = 0; i < SOURCE_NB; i++)
+    source_signal(&srcs[i]);
+  for (i = 0; i < SOURCE_NB; i++)
+    CHECK(wait_for(&srcs[i].done, 2, 1000) == 0);
+  usleep(50000);
+  for (i = 0; i < SOURCE_NB; i++) {
+    CHECK(srcs[i].calls == 2);
+    CHECK(dvr_reactor_remove(handles[i]) == DVR_SUCCESS);
+    close(srcs[i].fd);
+  }
+  return 0;
+}
+
+static int test_kick(void)
+{
+  static Source_t s;
+  DVR_ReactorHandle_t handle;
+  int i;
+
+  CHECK(source_init(&s) == 0);
+  CHECK(dvr_reactor_add(s.fd, source_fn, &s, &handle) == DVR_SUCCESS);
+
+  /*the fd is not readable, a kick calls the function*/
+  CHECK(dvr_reactor_kick(handle) == DVR_SUCCESS);
+  CHECK(wait_for(&s.done, 1, 1000) == 0);
+
+  /*kicked while running, the function is called once more after it returns*/
+  s.sleep_ms = 100;
+  CHECK(dvr_reactor_kick(handle) == DVR_SUCCESS);
+  CHECK(wait_for(&s.calls, 2, 1000) == 0);
+  for (i = 0; i < 5; i++) {
+    CHECK(dvr_reactor_kick(handle) == DVR_SUCCESS);
+    source_signal(&s);
+  }
+  CHECK(wait_for(&s.done, 3, 1000) == 0);
+  s.sleep_ms = 0;
+  usleep(200000);
+  CHECK(s.calls >= 3);
+  CHECK(!s.overlap);
+
+  CHECK(dvr_reactor_remove(handle) == DVR_SUCCESS);
+  close(s.fd);
+  return 0;
+}
+
+static int test_fail(void)
+{
+  static Source_t s;
+  DVR_ReactorHandle_t handle;
+
+  CHECK(source_init(&s) == 0);
+  s.ret = DVR_FAILURE;
+  CHECK(dvr_reactor_add(s.fd, source_fn, &s, &handle) == DVR_SUCCESS);
+  source_signal(&s);
+  CHECK(wait_for(&s.done, 1, 1000) == 0);
+
+  /*a failed source is not listened nor dispatched anymore*/
+  source_signal(&s);
+  CHECK(dvr_reactor_kick(handle) == DVR_SUCCESS);
+  usleep(100000);
+  CHECK(s.calls == 1);
+
+  CHECK(dvr_reactor_remove(handle) == DVR_SUCCESS);
+  close(s.fd);
+  return 0;
+}
+
+static int test_remove(void)
+{
+  static Source_t s;
+  DVR_ReactorHandle_t handle;
+
+  CHECK(source_init(&s) == 0);
+  s.sleep_ms = 300;
+  CHECK(dvr_reactor_add(s.fd, source_fn, &s, &handle) == DVR_SUCCESS);
+  source_signal(&s);
+  CHECK(wait_for(&s.calls, 1, 1000) == 0);
+
+  /*remove returns once the running function returned*/
+  CHECK(dvr_reactor_remove(handle) == DVR_SUCCESS);
+  CHECK(s.done == 1);
+
+  /*the handle is not valid anymore and the fd is not listened*/
+  CHECK(dvr_reactor_kick(handle) == DVR_FAILURE);
+  CHECK(dvr_reactor_remove(handle) == DVR_FAILURE);
+  source_signal(&s);
+  usleep(100000);
+  CHECK(s.calls == 1);
+  close(s.fd);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int ret = 0;
+
+  (void)argc;
+  (void)argv;
+
+  /*the workers are started on first use*/
+  if (dvr_prop_read_int(DVR_REACTOR_PROP, 0) <= 0)
+    dvr_prop_write(DVR_REACTOR_PROP, "2");
+  if (dvr_reactor_get_workers() == 0) {
+    printf("reactor disabled\n");
+    printf("dvr_reactor_test FAILED\n");
+    return 1;
+  }
+
+  if (test_readable() != 0)
+    ret = 1;
+  if (test_kick() != 0)
+    ret = 1;
+  if (test_fail() != 0)
+    ret = 1;
+  if (test_remove() != 0)
+    ret = 1;
+
+  printf("dvr_reactor_test %s\n", ret ? "FAILED" : "PASSED");
+  return ret;
+}
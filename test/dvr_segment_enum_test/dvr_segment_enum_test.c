@@ -0,0 +1,243 @@
+/**
+ * \page dvr_segment_enum_test
+ * \section Introduction
+ * test code with dvr_segment_enum and dvr_segment_get_list.
+ * It creates the TS files of a record with ids past 9999 and checks:
+ * \li without a list file, the ids are found by scanning the directory and sorted numerically
+ * \li with a list file, the ids are returned in its order
+ * \li files of other records and other file types are ignored
+ * \li the sizes of the TS files are returned with DVR_SEGMENT_ENUM_SIZE
+ *
+ * \section Usage
+ *
+ * \li dir: work directory, see dvr_test_utils.h
+ *
+ * \code
+ *    dvr_segment_enum_test [dir]
+ * \endcode
+ *
+ * \endsection
+ */
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dvr_types.h"
+#include "dvr_segment.h"
+#include "../dvr_test_utils.h"
+
+#define SEGMENT_MAX     (256)
+
+static char rec_dir[DVR_MAX_LOCATION_SIZE - 16];
+static char location[DVR_MAX_LOCATION_SIZE];
+static uint64_t ids[SEGMENT_MAX];
+static int id_nb;
+
+static const char *other_files[] = {
+  "rec-0005.idx",
+  "rec-0007.dat",
+  "rec-0008.ts.tmp",
+  "rec-abc.ts",
+  "rec-.ts",
+  "recx-0003.ts",
+  "other-0004.ts",
+  "rec.stats",
+};
+
+static uint64_t segment_size(uint64_t id)
+{
+  return (id * 7) % 1000 + 1;
+}
+
+static int create_file(const char *name, uint64_t size)
+{
+  char path[DVR_MAX_LOCATION_SIZE + 64];
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "%s/%s", rec_dir, name);
+  fp = fopen(path, "w");
+  CHECK(fp);
+  CHECK(ftruncate(fileno(fp), size) == 0);
+  fclose(fp);
+  return 0;
+}
+
+static void remove_files(void)
+{
+  char path[DVR_MAX_LOCATION_SIZE + 64];
+  size_t i;
+  int j;
+
+  for (j = 0; j < id_nb; j++) {
+    snprintf(path, sizeof(path), "%s-%04llu.ts", location, (unsigned long long)ids[j]);
+    unlink(path);
+  }
+  for (i = 0; i < sizeof(other_files) / sizeof(other_files[0]); i++) {
+    snprintf(path, sizeof(path), "%s/%s", rec_dir, other_files[i]);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s-0006.ts", location);
+  rmdir(path);
+  snprintf(path, sizeof(path), "%s.list", location);
+  unlink(path);
+  rmdir(rec_dir);
+}
+
+/* Create the TS files of ids 1, 2, 9, 10, 100, 9950 to 10100, 12345 and 100000,
+ * in an order different from the sorted one */
+static int create_files(void)
+{
+  char name[DVR_MAX_LOCATION_SIZE + 16];
+  size_t i;
+  uint64_t id;
+  int j;
+
+  id_nb = 0;
+  for (id = 10100; id >= 9950; id--)
+    ids[id_nb++] = id;
+  ids[id_nb++] = 100000;
+  ids[id_nb++] = 100;
+  ids[id_nb++] = 1;
+  ids[id_nb++] = 12345;
+  ids[id_nb++] = 10;
+  ids[id_nb++] = 2;
+  ids[id_nb++] = 9;
+
+  for (j = 0; j < id_nb; j++) {
+    snprintf(name, sizeof(name), "rec-%04llu.ts", (unsigned long long)ids[j]);
+    CHECK(create_file(name, segment_size(ids[j])) == 0);
+  }
+  for (i = 0; i < sizeof(other_files) / sizeof(other_files[0]); i++)
+    CHECK(create_file(other_files[i], 10) == 0);
+  /*a directory named like a TS file*/
+  snprintf(name, sizeof(name), "%s-0006.ts", location);
+  CHECK(mkdir(name, 0755) == 0);
+  return 0;
+}
+
+static int cmp_id(const void *a, const void *b)
+{
+  uint64_t ia = *(const uint64_t *)a, ib = *(const uint64_t *)b;
+
+  return (ia < ib) ? -1 : (ia > ib);
+}
+
+static int test_scan(const char *loc)
+{
+  DVR_SegmentEntry_t *entries = NULL;
+  uint64_t sorted[SEGMENT_MAX], *list = NULL;
+  uint32_t i, n = 0;
+
+  memcpy(sorted, ids, id_nb * sizeof(uint64_t));
+  qsort(sorted, id_nb, sizeof(uint64_t), cmp_id);
+
+  CHECK(dvr_segment_enum(loc, DVR_SEGMENT_ENUM_SIZE, &n, &entries) == DVR_SUCCESS);
+  CHECK(n == (uint32_t)id_nb);
+  for (i = 0; i < n; i++) {
+    CHECK(entries[i].id == sorted[i]);
+    CHECK(entries[i].size == segment_size(sorted[i]));
+  }
+  free(entries);
+
+  /*no size asked*/
+  CHECK(dvr_segment_enum(loc, 0, &n, &entries) == DVR_SUCCESS);
+  CHECK(n == (uint32_t)id_nb);
+  for (i = 0; i < n; i++) {
+    CHECK(entries[i].id == sorted[i]);
+    CHECK(entries[i].size == 0);
+  }
+  free(entries);
+
+  CHECK(dvr_segment_get_list(loc, &n, &list) == DVR_SUCCESS);
+  CHECK(n == (uint32_t)id_nb);
+  for (i = 0; i < n; i++)
+    CHECK(list[i] == sorted[i]);
+  free(list);
+  return 0;
+}
+
+static int test_list(void)
+{
+  static const uint64_t list_ids[] = {9998, 9999, 10000, 10001, 200000, 9};
+  char path[DVR_MAX_LOCATION_SIZE + 8];
+  DVR_SegmentEntry_t *entries = NULL;
+  uint32_t i, n = 0;
+  FILE *fp;
+
+  /*the list file order is kept, even if not sorted*/
+  snprintf(path, sizeof(path), "%s.list", location);
+  fp = fopen(path, "w");
+  CHECK(fp);
+  for (i = 0; i < sizeof(list_ids) / sizeof(list_ids[0]); i++)
+    fprintf(fp, "%llu\n", (unsigned long long)list_ids[i]);
+  fclose(fp);
+
+  CHECK(dvr_segment_enum(location, DVR_SEGMENT_ENUM_SIZE, &n, &entries) == DVR_SUCCESS);
+  CHECK(n == sizeof(list_ids) / sizeof(list_ids[0]));
+  for (i = 0; i < n; i++) {
+    CHECK(entries[i].id == list_ids[i]);
+    /*200000 is listed without a TS file*/
+    CHECK(entries[i].size == ((list_ids[i] == 200000) ? 0 : segment_size(list_ids[i])));
+  }
+  free(entries);
+
+  unlink(path);
+  return 0;
+}
+
+static int test_none(void)
+{
+  char loc[DVR_MAX_LOCATION_SIZE + 8];
+  DVR_SegmentEntry_t *entries = NULL;
+  uint32_t n = 0;
+
+  snprintf(loc, sizeof(loc), "%s/none", rec_dir);
+  CHECK(dvr_segment_enum(loc, 0, &n, &entries) == DVR_FAILURE);
+  snprintf(loc, sizeof(loc), "%s/", rec_dir);
+  CHECK(dvr_segment_enum(loc, 0, &n, &entries) == DVR_FAILURE);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *dir = dvr_test_dir(argc, argv);
+  char cwd[DVR_MAX_LOCATION_SIZE];
+  int ret = 0;
+
+  if (!dir)
+    return 1;
+  snprintf(rec_dir, sizeof(rec_dir), "%s/dvr_segment_enum_test", dir);
+  snprintf(location, sizeof(location), "%s/rec", rec_dir);
+  remove_files();
+  if (mkdir(rec_dir, 0755) != 0 || create_files() != 0) {
+    printf("create %s failed\n", rec_dir);
+    remove_files();
+    dvr_test_dir_done();
+    return 1;
+  }
+
+  if (test_scan(location) != 0)
+    ret = 1;
+  /*a location without directory is in the current directory*/
+  if (getcwd(cwd, sizeof(cwd)) && chdir(rec_dir) == 0) {
+    if (test_scan("rec") != 0)
+      ret = 1;
+    if (chdir(cwd) != 0)
+      ret = 1;
+  }
+  if (test_list() != 0)
+    ret = 1;
+  if (test_none() != 0)
+    ret = 1;
+  remove_files();
+  dvr_test_dir_done();
+
+  printf("dvr_segment_enum_test %s\n", ret ? "FAILED" : "PASSED");
+  return ret;
+}
@@ -0,0 +1,76 @@
+#ifndef _DVR_TEST_UTILS_H_
+#define _DVR_TEST_UTILS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Test helpers
+ * Shared by the unit tests under test/. A test function returns 0 on
+ * success and -1 on the first failed CHECK. Tests working on files take
+ * their work directory from the first argument, else from the
+ * DVR_TEST_DIR environment variable, else a new directory is made under
+ * $TMPDIR and removed at the end.
+ */
+
+#define DVR_TEST_DIR_ENV      "DVR_TEST_DIR"          /**< Environment variable of the work directory*/
+#ifdef __ANDROID__
+#define DVR_TEST_TMP_DEFAULT  "/data/local/tmp"       /**< Used if TMPDIR is not set*/
+#else
+#define DVR_TEST_TMP_DEFAULT  "/tmp"                  /**< Used if TMPDIR is not set*/
+#endif
+
+/**\brief Return -1 from the test function if expr is false*/
+#define CHECK(expr)\
+  do {\
+    if (!(expr)) {\
+      printf("%s:%d check failed: %s\n", __func__, __LINE__, #expr);\
+      return -1;\
+    }\
+  } while (0)
+
+static char dvr_test_tmp_dir[256];
+
+/**\brief Get the work directory of a test
+ * \param[in] argc, Argument count of the test
+ * \param[in] argv, Arguments of the test, argv[1] is the directory if given
+ * \return The directory, NULL if it can not be made
+ */
+static inline const char *dvr_test_dir(int argc, char **argv)
+{
+  const char *dir = (argc > 1) ? argv[1] : getenv(DVR_TEST_DIR_ENV);
+  const char *tmp;
+
+  if (dir && *dir)
+    return dir;
+  if (!dvr_test_tmp_dir[0]) {
+    tmp = getenv("TMPDIR");
+    if (!tmp || !*tmp)
+      tmp = DVR_TEST_TMP_DEFAULT;
+    snprintf(dvr_test_tmp_dir, sizeof(dvr_test_tmp_dir), "%s/dvr_test_XXXXXX", tmp);
+    if (!mkdtemp(dvr_test_tmp_dir)) {
+      printf("create work directory under %s failed\n", tmp);
+      dvr_test_tmp_dir[0] = 0;
+      return NULL;
+    }
+  }
+  return dvr_test_tmp_dir;
+}
+
+/**\brief Remove the work directory made by dvr_test_dir, the test has emptied it*/
+static inline void dvr_test_dir_done(void)
+{
+  if (dvr_test_tmp_dir[0])
+    rmdir(dvr_test_tmp_dir);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_DVR_TEST_UTILS_H_*/
@@ -0,0 +1,278 @@
+/**
+ * \page record_device_replay_test
+ * \section Introduction
+ * test code with the record device replay backend.
+ * It replays a generated TS file and checks:
+ * \li only the packets of the added pids are delivered, in order
+ * \li all the packets are delivered once 0x2000 is added
+ * \li bytes before a sync byte are skipped
+ * \li with pace on, the file is delivered at the PCR rate
+ * \li with pace off, the file is delivered as fast as possible
+ * \li stop wakes up a waiting read
+ *
+ * \section Usage
+ *
+ * \li dir: work directory, see dvr_test_utils.h
+ *
+ * \code
+ *    record_device_replay_test [dir]
+ * \endcode
+ *
+ * \endsection
+ */
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dvr_types.h"
+#include "dvr_utils.h"
+#include "record_device.h"
+#include "ts_pid_set.h"
+#include "../dvr_test_utils.h"
+
+#define TS_PKT_SIZE     (188)
+#define PID_PCR         (0x100)
+#define PID_A           (0x101)
+#define PID_B           (0x102)
+#define PKTS_PER_PCR    (30)
+#define PCR_NB          (11)
+#define PCR_STEP        (9000)  /*100ms at 90KHz, the file lasts 1s*/
+#define JUNK_LEN        (5)
+#define PID_BIT(_pid)   (1 << ((_pid) - PID_PCR))
+
+static const Record_DeviceBackend_t *backend = &record_device_replay_backend;
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int pkt_pid(int i)
+{
+  if (i % PKTS_PER_PCR == 0)
+    return PID_PCR;
+  return (i & 1) ? PID_A : PID_B;
+}
+
+/* Write PCR_NB PCRs on PID_PCR, each followed by packets of PID_A and PID_B.
+ * The payload holds the packet number */
+static int make_ts(const char *path)
+{
+  uint8_t pkt[TS_PKT_SIZE], junk[JUNK_LEN];
+  uint64_t pcr;
+  FILE *fp;
+  int i, pid;
+
+  fp = fopen(path, "wb");
+  CHECK(fp);
+  memset(junk, 0, sizeof(junk));
+  fwrite(junk, 1, sizeof(junk), fp);
+  for (i = 0; i < PCR_NB * PKTS_PER_PCR; i++) {
+    pid = pkt_pid(i);
+    memset(pkt, 0xff, sizeof(pkt));
+    pkt[0] = 0x47;
+    pkt[1] = (pid >> 8) & 0x1f;
+    pkt[2] = pid & 0xff;
+    pkt[3] = 0x10 | (i & 0x0f);
+    if (pid == PID_PCR) {
+      pcr = 1000000 + (uint64_t)(i / PKTS_PER_PCR) * PCR_STEP;
+      pkt[3] = 0x30 | (i & 0x0f);
+      pkt[4] = 7;
+      pkt[5] = 0x10;
+      pkt[6] = (pcr >> 25) & 0xff;
+      pkt[7] = (pcr >> 17) & 0xff;
+      pkt[8] = (pcr >> 9) & 0xff;
+      pkt[9] = (pcr >> 1) & 0xff;
+      pkt[10] = ((pcr & 1) << 7) | 0x7e;
+      pkt[11] = 0;
+    }
+    memcpy(pkt + 184, &i, sizeof(i));
+    fwrite(pkt, 1, sizeof(pkt), fp);
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* Skip the packets of the pids not added */
+static int next_pkt(int next, int pid_mask)
+{
+  while (next < PCR_NB * PKTS_PER_PCR && !(pid_mask & PID_BIT(pkt_pid(next))))
+    next++;
+  return next;
+}
+
+/* Read the whole file, check the delivered packets and return the time
+ * taken up to the last one. pid_mask has the PID_BIT of the added pids */
+static int replay_all(void *priv, int pid_mask, uint64_t *p_ms)
+{
+  uint8_t buf[TS_PKT_SIZE * 16 + 100];
+  uint64_t start = now_ms(), last = start;
+  int next = 0;
+  int ret, pos, pid, n, idle = 0;
+
+  while (idle < 3) {
+    ret = backend->read(priv, buf, sizeof(buf), 200);
+    if (ret == DVR_FAILURE) {
+      idle++;
+      continue;
+    }
+    idle = 0;
+    last = now_ms();
+    CHECK(ret > 0 && ret % TS_PKT_SIZE == 0);
+    for (pos = 0; pos < ret; pos += TS_PKT_SIZE) {
+      CHECK(buf[pos] == 0x47);
+      pid = ((buf[pos + 1] & 0x1f) << 8) | buf[pos + 2];
+      memcpy(&n, buf + pos + 184, sizeof(n));
+      next = next_pkt(next, pid_mask);
+      CHECK(n == next);
+      CHECK(pid == pkt_pid(n));
+      next++;
+    }
+  }
+  CHECK(next_pkt(next, pid_mask) == PCR_NB * PKTS_PER_PCR);
+  *p_ms = last - start;
+  return 0;
+}
+
+static int test_filter_pace(int pace)
+{
+  Record_DeviceOpenParams_t params;
+  void *priv = NULL;
+  uint64_t ms;
+
+  dvr_prop_write(RECORD_DEVICE_REPLAY_PACE_PROP, pace ? "1" : "0");
+  memset(&params, 0, sizeof(params));
+  CHECK(backend->open(&priv, &params) == DVR_SUCCESS);
+  CHECK(backend->add_pid(priv, PID_PCR) == DVR_SUCCESS);
+  CHECK(backend->add_pid(priv, PID_A) == DVR_SUCCESS);
+  CHECK(backend->add_pid(priv, PID_B) == DVR_SUCCESS);
+  CHECK(backend->remove_pid(priv, PID_B) == DVR_SUCCESS);
+  CHECK(backend->start(priv) == DVR_SUCCESS);
+
+  if (replay_all(priv, PID_BIT(PID_PCR) | PID_BIT(PID_A), &ms) != 0) {
+    backend->close(priv);
+    return -1;
+  }
+  printf("pace:%d replayed in %llums\n", pace, (unsigned long long)ms);
+  backend->stop(priv);
+  CHECK(backend->close(priv) == DVR_SUCCESS);
+
+  /*the last PCR is due (PCR_NB - 1) * 100ms after the first one*/
+  if (pace)
+    CHECK(ms >= (PCR_NB - 1) * 100 - 50);
+  else
+    CHECK(ms < (PCR_NB - 1) * 100 / 2);
+  return 0;
+}
+
+static int test_whole_ts(void)
+{
+  Record_DeviceOpenParams_t params;
+  void *priv = NULL;
+  uint64_t ms;
+
+  dvr_prop_write(RECORD_DEVICE_REPLAY_PACE_PROP, "0");
+  memset(&params, 0, sizeof(params));
+  CHECK(backend->open(&priv, &params) == DVR_SUCCESS);
+  CHECK(backend->add_pid(priv, TS_PID_ALL) == DVR_SUCCESS);
+  CHECK(backend->start(priv) == DVR_SUCCESS);
+
+  if (replay_all(priv, PID_BIT(PID_PCR) | PID_BIT(PID_A) | PID_BIT(PID_B), &ms) != 0) {
+    backend->close(priv);
+    return -1;
+  }
+  backend->stop(priv);
+  CHECK(backend->remove_pid(priv, TS_PID_ALL) == DVR_SUCCESS);
+  CHECK(backend->close(priv) == DVR_SUCCESS);
+  return 0;
+}
+
+typedef struct {
+  void           *priv;
+  int             ret;
+  uint64_t        ms;
+} ReadArgs_t;
+
+static void *reader(void *arg)
+{
+  ReadArgs_t *args = (ReadArgs_t *)arg;
+  uint8_t buf[TS_PKT_SIZE * 4];
+  uint64_t start = now_ms();
+
+  args->ret = backend->read(args->priv, buf, sizeof(buf), 5000);
+  args->ms = now_ms() - start;
+  return NULL;
+}
+
+static int test_stop_wakeup(void)
+{
+  Record_DeviceOpenParams_t params;
+  ReadArgs_t args;
+  pthread_t thread;
+  uint64_t ms;
+
+  dvr_prop_write(RECORD_DEVICE_REPLAY_PACE_PROP, "0");
+  memset(&params, 0, sizeof(params));
+  memset(&args, 0, sizeof(args));
+  CHECK(backend->open(&args.priv, &params) == DVR_SUCCESS);
+  CHECK(backend->add_pid(args.priv, PID_A) == DVR_SUCCESS);
+  CHECK(backend->start(args.priv) == DVR_SUCCESS);
+
+  /*read up to the end, the next read waits*/
+  if (replay_all(args.priv, PID_BIT(PID_A), &ms) != 0) {
+    backend->close(args.priv);
+    return -1;
+  }
+  CHECK(pthread_create(&thread, NULL, reader, &args) == 0);
+  usleep(100000);
+  backend->stop(args.priv);
+  pthread_join(thread, NULL);
+  CHECK(backend->close(args.priv) == DVR_SUCCESS);
+
+  printf("read woken up after %llums\n", (unsigned long long)args.ms);
+  CHECK(args.ret == DVR_FAILURE);
+  CHECK(args.ms < 1000);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char path[256];
+  const char *dir = dvr_test_dir(argc, argv);
+  int ret = 0;
+
+  if (!dir)
+    return 1;
+  snprintf(path, sizeof(path), "%s/record_device_replay_test.ts", dir);
+  if (make_ts(path) != 0) {
+    unlink(path);
+    dvr_test_dir_done();
+    return 1;
+  }
+  dvr_prop_write(RECORD_DEVICE_REPLAY_PROP, path);
+  dvr_prop_write(RECORD_DEVICE_REPLAY_LOOP_PROP, "0");
+
+  if (test_filter_pace(0) != 0)
+    ret = 1;
+  if (test_filter_pace(1) != 0)
+    ret = 1;
+  if (test_whole_ts() != 0)
+    ret = 1;
+  if (test_stop_wakeup() != 0)
+    ret = 1;
+  unlink(path);
+  dvr_test_dir_done();
+
+  printf("record_device_replay_test %s\n", ret ? "FAILED" : "PASSED");
+  return ret;
+}
@@ -0,0 +1,236 @@
+/**
+ * \page segment_ring_test
+ * \section Introduction
+ * test code with segment_ring_xxxx APIs.
+ * It checks:
+ * \li data of a segment spanning the end of the ring file
+ * \li reads of overwritten data fail with ENODATA
+ * \li segments entirely overwritten are dropped
+ * \li header and slots are persisted across detach/attach
+ * \li reads racing with the writer at the tail never return overwritten data
+ *
+ * \section Usage
+ *
+ * \li dir: work directory, see dvr_test_utils.h
+ *
+ * \code
+ *    segment_ring_test [dir]
+ * \endcode
+ *
+ * \endsection
+ */
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dvr_types.h"
+#include "segment_ring.h"
+#include "../dvr_test_utils.h"
+
+#define RING_CAPACITY (10000)
+#define RACE_CHUNK    (1000)
+#define RACE_CHUNKS   (2000)
+
+static uint8_t pattern(uint64_t segment_id, uint64_t pos)
+{
+  return (uint8_t)(segment_id * 31 + pos * 7 + (pos >> 8));
+}
+
+static int append(Segment_Ring_t *ring, uint64_t segment_id, uint64_t pos, size_t count)
+{
+  uint8_t *buf = malloc(count);
+  size_t i;
+  ssize_t ret;
+
+  CHECK(buf);
+  for (i = 0; i < count; i++)
+    buf[i] = pattern(segment_id, pos + i);
+  ret = segment_ring_append(ring, segment_id, buf, count);
+  free(buf);
+  CHECK(ret == (ssize_t)count);
+  return 0;
+}
+
+static int verify(Segment_Ring_t *ring, uint64_t segment_id, uint64_t pos, size_t count)
+{
+  uint8_t *buf = malloc(count);
+  size_t i;
+  ssize_t ret;
+
+  CHECK(buf);
+  ret = segment_ring_read(ring, segment_id, buf, count, pos);
+  if (ret != (ssize_t)count) {
+    free(buf);
+    CHECK(ret == (ssize_t)count);
+  }
+  for (i = 0; i < count; i++) {
+    if (buf[i] != pattern(segment_id, pos + i)) {
+      printf("segment %llu pos %llu mismatch\n", (unsigned long long)segment_id,
+          (unsigned long long)(pos + i));
+      free(buf);
+      return -1;
+    }
+  }
+  free(buf);
+  return 0;
+}
+
+static int test_ring(const char *location)
+{
+  Segment_Ring_t *ring;
+  uint8_t byte;
+
+  CHECK(segment_ring_attach(location, RING_CAPACITY, &ring) == DVR_SUCCESS);
+  CHECK(segment_ring_exists(location));
+
+  /*segment 1: logical 0..6000*/
+  CHECK(segment_ring_begin(ring, 1) == DVR_SUCCESS);
+  CHECK(append(ring, 1, 0, 6000) == 0);
+  CHECK(segment_ring_end(ring, 1) == DVR_SUCCESS);
+  CHECK(segment_ring_size(ring, 1) == 6000);
+
+  /*segment 2: logical 6000..12000, wraps at the end of the ring*/
+  CHECK(segment_ring_begin(ring, 2) == DVR_SUCCESS);
+  CHECK(append(ring, 2, 0, 3000) == 0);
+  CHECK(verify(ring, 1, 0, 6000) == 0);
+  CHECK(append(ring, 2, 3000, 3000) == 0);
+  CHECK(verify(ring, 2, 0, 6000) == 0);
+
+  /*the first 2000 bytes of segment 1 are overwritten, the rest is kept*/
+  errno = 0;
+  CHECK(segment_ring_read(ring, 1, &byte, 1, 0) == DVR_FAILURE);
+  CHECK(errno == ENODATA);
+  CHECK(segment_ring_read(ring, 1, &byte, 1, 1999) == DVR_FAILURE);
+  CHECK(verify(ring, 1, 2000, 4000) == 0);
+  CHECK(segment_ring_read(ring, 1, &byte, 1, 6000) == 0);
+
+  /*segment 2 up to 16000, segment 1 is entirely overwritten and dropped*/
+  CHECK(append(ring, 2, 6000, 4000) == 0);
+  CHECK(segment_ring_size(ring, 1) == DVR_FAILURE);
+  errno = 0;
+  CHECK(segment_ring_read(ring, 1, &byte, 1, 4000) == DVR_FAILURE);
+  CHECK(errno == ENOENT);
+  CHECK(segment_ring_end(ring, 2) == DVR_SUCCESS);
+  CHECK(segment_ring_detach(ring) == DVR_SUCCESS);
+
+  /*reattach without capacity, the ring is loaded from the file*/
+  CHECK(segment_ring_attach(location, 0, &ring) == DVR_SUCCESS);
+  CHECK(segment_ring_size(ring, 1) == DVR_FAILURE);
+  CHECK(segment_ring_size(ring, 2) == 10000);
+  CHECK(verify(ring, 2, 0, 10000) == 0);
+
+  /*a segment begun after the reload continues at the persisted head*/
+  CHECK(segment_ring_begin(ring, 3) == DVR_SUCCESS);
+  CHECK(append(ring, 3, 0, 500) == 0);
+  CHECK(verify(ring, 3, 0, 500) == 0);
+  CHECK(segment_ring_size(ring, 2) == 10000);
+  CHECK(segment_ring_read(ring, 2, &byte, 1, 0) == DVR_FAILURE);
+  CHECK(verify(ring, 2, 500, 9500) == 0);
+  CHECK(segment_ring_end(ring, 3) == DVR_SUCCESS);
+  CHECK(segment_ring_detach(ring) == DVR_SUCCESS);
+
+  CHECK(segment_ring_remove(location, 2) == DVR_SUCCESS);
+  CHECK(segment_ring_remove(location, 2) == DVR_FAILURE);
+  CHECK(segment_ring_attach(location, 0, &ring) == DVR_SUCCESS);
+  CHECK(segment_ring_size(ring, 2) == DVR_FAILURE);
+  CHECK(verify(ring, 3, 0, 500) == 0);
+  CHECK(segment_ring_detach(ring) == DVR_SUCCESS);
+  return 0;
+}
+
+typedef struct {
+  Segment_Ring_t   *ring;
+  volatile int      done;
+  int               error;
+} RaceArgs_t;
+
+static void *race_writer(void *arg)
+{
+  RaceArgs_t *args = (RaceArgs_t *)arg;
+  int i;
+
+  for (i = 0; i < RACE_CHUNKS && !args->error; i++) {
+    if (append(args->ring, 4, (uint64_t)i * RACE_CHUNK, RACE_CHUNK) != 0)
+      args->error = 1;
+  }
+  args->done = 1;
+  return NULL;
+}
+
+/* Read the oldest live bytes while the writer wraps over them: a read
+ * either returns the expected data or fails with ENODATA */
+static int test_race(const char *location)
+{
+  RaceArgs_t args;
+  pthread_t thread;
+  uint8_t buf[512];
+  loff_t size, pos;
+  ssize_t ret;
+  int i, reads = 0, lost = 0;
+
+  memset(&args, 0, sizeof(args));
+  CHECK(segment_ring_attach(location, RING_CAPACITY, &args.ring) == DVR_SUCCESS);
+  CHECK(segment_ring_begin(args.ring, 4) == DVR_SUCCESS);
+  CHECK(pthread_create(&thread, NULL, race_writer, &args) == 0);
+
+  while (!args.done) {
+    size = segment_ring_size(args.ring, 4);
+    if (size < (loff_t)sizeof(buf))
+      continue;
+    pos = (size > RING_CAPACITY) ? size - RING_CAPACITY : 0;
+    errno = 0;
+    ret = segment_ring_read(args.ring, 4, buf, sizeof(buf), pos);
+    if (ret < 0) {
+      if (errno != ENODATA)
+        args.error = 1;
+      lost++;
+      continue;
+    }
+    for (i = 0; i < ret; i++) {
+      if (buf[i] != pattern(4, pos + i)) {
+        printf("pos %lld read overwritten data\n", (long long)(pos + i));
+        args.error = 1;
+        break;
+      }
+    }
+    reads++;
+  }
+
+  pthread_join(thread, NULL);
+  segment_ring_end(args.ring, 4);
+  segment_ring_detach(args.ring);
+  printf("race reads:%d lost:%d\n", reads, lost);
+  CHECK(!args.error);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char location[DVR_MAX_LOCATION_SIZE];
+  char fname[DVR_MAX_LOCATION_SIZE + 8];
+  const char *dir = dvr_test_dir(argc, argv);
+  int ret;
+
+  if (!dir)
+    return 1;
+  snprintf(location, sizeof(location), "%s/segment_ring_test", dir);
+  snprintf(fname, sizeof(fname), "%s.ring", location);
+  unlink(fname);
+
+  ret = test_ring(location);
+  unlink(fname);
+  if (!ret)
+    ret = test_race(location);
+  unlink(fname);
+  dvr_test_dir_done();
+
+  printf("segment_ring_test %s\n", ret ? "FAILED" : "PASSED");
+  return ret ? 1 : 0;
+}